@@ -0,0 +1,399 @@
+/* bench_fixed.c */
+
+/*
+ * Scan and compare throughput of the packed varlena forms of ipaddress and
+ * iprange against the fixed-length ipaddress_fixed and iprange_fixed.
+ *
+ * Packed values are laid out as in a heap tuple: a 1-byte short varlena
+ * header followed by unaligned data, each value starting on an 8-byte
+ * boundary, and every access goes through the header check and size switch
+ * that PG_DETOAST_DATUM_PACKED and ipr_unpack/ip_unpack do. Both forms use
+ * one 40-byte slot per row, so that only the cost of access differs, not
+ * the memory traffic. The data is mostly IPv4, with 20% IPv6 prefixes.
+ *
+ * "scan" counts the rows matching a predicate (a = const for addresses,
+ * r >>= const for ranges); "cmp" compares each row with the next, as a
+ * sort or merge join does. The checksum column must match between the
+ * packed and fixed rows of each test.
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ipr.h"
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+#define NROWS (1 << 20)
+#define NPASSES 20
+#define SLOT 40
+
+static unsigned char *packed;
+static unsigned char *fixed;
+
+static uint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 1-byte varlena header as stored on little-endian machines */
+
+static inline void
+set_short_varsize(unsigned char *p, int datalen)
+{
+	p[0] = (unsigned char) (((datalen + 1) << 1) | 1);
+}
+
+static inline int
+short_varsize_exhdr(const unsigned char *p)
+{
+	/* stand-in for the VARATT_IS_EXTENDED test of the detoast macro */
+	if ((p[0] & 1) == 0)
+		abort();
+	return (p[0] >> 1) - 1;
+}
+
+/*
+ * Copies of ip_unpack and ipr_unpack for short-header values
+ */
+
+static inline int
+packed_ip_unpack(const unsigned char *p, IP *out)
+{
+	switch (short_varsize_exhdr(p))
+	{
+		case sizeof(IP4):
+			memcpy(&out->ip4, p + 1, sizeof(IP4));
+			return PGSQL_AF_INET;
+		case sizeof(IP6):
+			memcpy(&out->ip6, p + 1, sizeof(IP6));
+			return PGSQL_AF_INET6;
+	}
+	abort();
+}
+
+static inline int
+packed_ipr_unpack(const unsigned char *p, IPR *out)
+{
+	const unsigned char *ptr = p + 1;
+
+	switch (short_varsize_exhdr(p))
+	{
+		case 0:
+			return 0;
+
+		case sizeof(IP4R):
+			memcpy(&out->ip4r, ptr, sizeof(IP4R));
+			return PGSQL_AF_INET;
+
+		case 1+sizeof(uint64):
+		{
+			unsigned pfxlen = *ptr++;
+			memcpy(out->ip6r.lower.bits, ptr, sizeof(uint64));
+			out->ip6r.lower.bits[1] = 0;
+			out->ip6r.upper.bits[0] = out->ip6r.lower.bits[0] | hostmask6_hi(pfxlen);
+			out->ip6r.upper.bits[1] = hostmask6_lo(pfxlen);
+			return PGSQL_AF_INET6;
+		}
+
+		case 1+sizeof(IP6):
+		{
+			unsigned pfxlen = *ptr++;
+			memcpy(&out->ip6r.lower, ptr, sizeof(IP6));
+			out->ip6r.upper.bits[0] = out->ip6r.lower.bits[0] | hostmask6_hi(pfxlen);
+			out->ip6r.upper.bits[1] = out->ip6r.lower.bits[1] | hostmask6_lo(pfxlen);
+			return PGSQL_AF_INET6;
+		}
+
+		case sizeof(IP6R):
+			memcpy(&out->ip6r, ptr, sizeof(IP6R));
+			return PGSQL_AF_INET6;
+	}
+	abort();
+}
+
+/*
+ * Data generation. IPv4 values are drawn from a few /8s so that the scan
+ * predicates match a useful number of rows.
+ */
+
+static void
+make_addrs(void)
+{
+	int i;
+
+	for (i = 0; i < NROWS; ++i)
+	{
+		unsigned char *p = packed + (size_t) i * SLOT;
+		IPF *f = (IPF *) (fixed + (size_t) i * SLOT);
+		IP ip;
+		int af;
+
+		memset(f, 0, SLOT);
+		if (rng() % 5)
+		{
+			af = PGSQL_AF_INET;
+			ip.ip4 = ((IP4) (10 + rng() % 4) << 24) | (rng() & 0xFFFFFF);
+		}
+		else
+		{
+			af = PGSQL_AF_INET6;
+			ip.ip6.bits[0] = (UINT64_C(0x20010db8) << 32) | (rng() & 0xFFFF);
+			ip.ip6.bits[1] = rng() % 4096;
+		}
+
+		set_short_varsize(p, ip_sizeof(af));
+		memcpy(p + 1, &ip, ip_sizeof(af));
+		memcpy(&f->ip, &ip, ip_sizeof(af));
+		f->af = af;
+	}
+}
+
+static void
+make_ranges(void)
+{
+	int i;
+
+	for (i = 0; i < NROWS; ++i)
+	{
+		unsigned char *p = packed + (size_t) i * SLOT;
+		IPRF *f = (IPRF *) (fixed + (size_t) i * SLOT);
+		IPR ipr;
+		int af;
+
+		memset(f, 0, SLOT);
+		if (rng() % 5)
+		{
+			unsigned len = 16 + rng() % 17;
+			IP4 ip = ((IP4) (10 + rng() % 4) << 24) | (rng() & 0xFFFFFF);
+
+			af = PGSQL_AF_INET;
+			ipr.ip4r.lower = ip & netmask(len);
+			ipr.ip4r.upper = ip | hostmask(len);
+			set_short_varsize(p, sizeof(IP4R));
+			memcpy(p + 1, &ipr.ip4r, sizeof(IP4R));
+		}
+		else
+		{
+			unsigned len = 48 + rng() % 17;
+			uint64 hi = (UINT64_C(0x20010db8) << 32) | (rng() & 0xFFFF0000);
+
+			af = PGSQL_AF_INET6;
+			ipr.ip6r.lower.bits[0] = hi & netmask6_hi(len);
+			ipr.ip6r.lower.bits[1] = 0;
+			ipr.ip6r.upper.bits[0] = hi | hostmask6_hi(len);
+			ipr.ip6r.upper.bits[1] = ~(uint64) 0;
+			set_short_varsize(p, 1 + sizeof(uint64));
+			p[1] = len;
+			memcpy(p + 2, &ipr.ip6r.lower.bits[0], sizeof(uint64));
+		}
+
+		memcpy(&f->ipr, &ipr, ipr_sizeof(af));
+		f->af = af;
+	}
+}
+
+/*
+ * The per-row operations, as done by the SQL-callable functions
+ */
+
+static inline int
+packed_ip_cmp(const unsigned char *a, const unsigned char *b)
+{
+	IP ip1, ip2;
+	int af1 = packed_ip_unpack(a, &ip1);
+	int af2 = packed_ip_unpack(b, &ip2);
+
+	if (af1 != af2)
+		return (af1 > af2) ? 1 : -1;
+	if (af1 == PGSQL_AF_INET)
+		return ip4_compare(ip1.ip4, ip2.ip4);
+	return ip6_compare(&ip1.ip6, &ip2.ip6);
+}
+
+static inline int
+fixed_ip_cmp(const IPF *a, const IPF *b)
+{
+	if (a->af != b->af)
+		return (a->af > b->af) ? 1 : -1;
+	if (a->af == PGSQL_AF_INET)
+		return ip4_compare(a->ip.ip4, b->ip.ip4);
+	return ip6_compare((IP6 *) &a->ip.ip6, (IP6 *) &b->ip.ip6);
+}
+
+static inline int
+ipr_cmp(int af1, IPR *a, int af2, IPR *b)
+{
+	if (af1 != af2)
+		return (af1 > af2) ? 1 : -1;
+	if (af1 == PGSQL_AF_INET)
+		return ip4r_lessthan(&a->ip4r, &b->ip4r) ? -1 : !ip4r_equal(&a->ip4r, &b->ip4r);
+	if (af1 == PGSQL_AF_INET6)
+		return ip6r_lessthan(&a->ip6r, &b->ip6r) ? -1 : !ip6r_equal(&a->ip6r, &b->ip6r);
+	return 0;
+}
+
+static inline bool
+ipr_contains(int af1, IPR *a, int af2, IPR *b)
+{
+	if (af1 != af2)
+		return af1 == 0;
+	if (af1 == PGSQL_AF_INET)
+		return ip4r_contains_internal(&a->ip4r, &b->ip4r, true);
+	if (af1 == PGSQL_AF_INET6)
+		return ip6r_contains_internal(&a->ip6r, &b->ip6r, true);
+	return true;
+}
+
+static inline int
+packed_ipr_cmp(const unsigned char *a, const unsigned char *b)
+{
+	IPR ipr1, ipr2;
+	int af1 = packed_ipr_unpack(a, &ipr1);
+	int af2 = packed_ipr_unpack(b, &ipr2);
+
+	return ipr_cmp(af1, &ipr1, af2, &ipr2);
+}
+
+static inline int
+fixed_ipr_cmp(IPRF *a, IPRF *b)
+{
+	return ipr_cmp(a->af, &a->ipr, b->af, &b->ipr);
+}
+
+static void
+report(const char *type, const char *op, const char *form,
+	   double t0, double t1, uint64 sum)
+{
+	printf("%s\t%s\t%s\t%.3f\t%llu\n", type, op, form,
+		   (t1 - t0) / ((double) NROWS * NPASSES),
+		   (unsigned long long) sum);
+}
+
+#define PACKED(i_) (packed + (size_t) (i_) * SLOT)
+#define FIXED(t_,i_) ((t_ *) (fixed + (size_t) (i_) * SLOT))
+
+int
+main(void)
+{
+	double t0, t1;
+	uint64 sum;
+	int pass, i;
+
+	packed = malloc((size_t) NROWS * SLOT);
+	fixed = aligned_alloc(8, (size_t) NROWS * SLOT);
+
+	printf("type\top\tform\tns_per_row\tchecksum\n");
+
+	make_addrs();
+
+	{
+		IPF *q = FIXED(IPF, 12345);
+
+		sum = 0;
+		t0 = now_ns();
+		for (pass = 0; pass < NPASSES; ++pass)
+			for (i = 0; i < NROWS; ++i)
+				sum += (packed_ip_cmp(PACKED(i), PACKED(12345)) == 0);
+		t1 = now_ns();
+		report("ipaddress", "scan", "packed", t0, t1, sum);
+
+		sum = 0;
+		t0 = now_ns();
+		for (pass = 0; pass < NPASSES; ++pass)
+			for (i = 0; i < NROWS; ++i)
+				sum += (fixed_ip_cmp(FIXED(IPF, i), q) == 0);
+		t1 = now_ns();
+		report("ipaddress", "scan", "fixed", t0, t1, sum);
+	}
+
+	sum = 0;
+	t0 = now_ns();
+	for (pass = 0; pass < NPASSES; ++pass)
+		for (i = 0; i < NROWS - 1; ++i)
+			sum += packed_ip_cmp(PACKED(i), PACKED(i + 1)) + 1;
+	t1 = now_ns();
+	report("ipaddress", "cmp", "packed", t0, t1, sum);
+
+	sum = 0;
+	t0 = now_ns();
+	for (pass = 0; pass < NPASSES; ++pass)
+		for (i = 0; i < NROWS - 1; ++i)
+			sum += fixed_ip_cmp(FIXED(IPF, i), FIXED(IPF, i + 1)) + 1;
+	t1 = now_ns();
+	report("ipaddress", "cmp", "fixed", t0, t1, sum);
+
+	make_ranges();
+
+	{
+		IPR q;
+		int qaf = PGSQL_AF_INET;
+
+		q.ip4r.lower = q.ip4r.upper = (11U << 24) | 0x123456;
+
+		sum = 0;
+		t0 = now_ns();
+		for (pass = 0; pass < NPASSES; ++pass)
+			for (i = 0; i < NROWS; ++i)
+			{
+				IPR r;
+				int af = packed_ipr_unpack(PACKED(i), &r);
+
+				sum += ipr_contains(af, &r, qaf, &q);
+			}
+		t1 = now_ns();
+		report("iprange", "scan", "packed", t0, t1, sum);
+
+		sum = 0;
+		t0 = now_ns();
+		for (pass = 0; pass < NPASSES; ++pass)
+			for (i = 0; i < NROWS; ++i)
+			{
+				IPRF *r = FIXED(IPRF, i);
+
+				sum += ipr_contains(r->af, &r->ipr, qaf, &q);
+			}
+		t1 = now_ns();
+		report("iprange", "scan", "fixed", t0, t1, sum);
+	}
+
+	sum = 0;
+	t0 = now_ns();
+	for (pass = 0; pass < NPASSES; ++pass)
+		for (i = 0; i < NROWS - 1; ++i)
+			sum += packed_ipr_cmp(PACKED(i), PACKED(i + 1)) + 1;
+	t1 = now_ns();
+	report("iprange", "cmp", "packed", t0, t1, sum);
+
+	sum = 0;
+	t0 = now_ns();
+	for (pass = 0; pass < NPASSES; ++pass)
+		for (i = 0; i < NROWS - 1; ++i)
+			sum += fixed_ipr_cmp(FIXED(IPRF, i), FIXED(IPRF, i + 1)) + 1;
+	t1 = now_ns();
+	report("iprange", "cmp", "fixed", t0, t1, sum);
+
+	free(packed);
+	free(fixed);
+	return 0;
+}
+
+/* end */
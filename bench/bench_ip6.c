@@ -0,0 +1,183 @@
+/* bench_ip6.c */
+
+/*
+ * Microbenchmark for the IP6 kernels in ip6r_funcs.h. Built twice by the
+ * Makefile, once normally and once with IP6R_NO_INT128, so that the native
+ * 128-bit integer path can be compared against the fallback. The checksum
+ * column must match between the two builds.
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ipr.h"
+#include "ip6r_funcs.h"
+
+#ifdef IP6R_USE_INT128
+#define IMPL "int128"
+#else
+#define IMPL "fallback"
+#endif
+
+#define NITEMS (1 << 16)
+#define NPASSES 200
+
+static IP6 addrs[NITEMS];
+static IP6R ranges[NITEMS];
+
+static uint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64
+rng(void)
+{
+	/* xorshift64* */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Addresses cluster in 2000::/3 with a skew towards a few /32s, as in real
+ * data. Half the ranges are CIDR blocks (mostly /48 and /64), the rest
+ * arbitrary ranges; the benchmark therefore exercises both the equal and
+ * unequal high-word paths.
+ */
+static void
+make_corpus(void)
+{
+	int i;
+
+	for (i = 0; i < NITEMS; ++i)
+	{
+		uint64 hi = (UINT64_C(0x2000) << 48) | ((rng() % 64) << 32) | (rng() & 0xFFFFFFFFU);
+		IP6 a;
+
+		a.bits[0] = hi;
+		a.bits[1] = rng();
+		addrs[i] = a;
+
+		if (i & 1)
+		{
+			static const unsigned lens[] = { 32, 48, 48, 48, 56, 64, 64, 64, 96, 128 };
+			unsigned len = lens[rng() % 10];
+
+			ip6r_from_inet(&a, len, &ranges[i]);
+		}
+		else
+		{
+			IP6 b = a;
+
+			b.bits[1] += rng() >> (rng() % 64);
+			if (rng() & 1)
+				b.bits[0] += rng() % 4;
+			if (ip6_lessthan(&b, &a))
+			{
+				ranges[i].lower = b;
+				ranges[i].upper = a;
+			}
+			else
+			{
+				ranges[i].lower = a;
+				ranges[i].upper = b;
+			}
+		}
+	}
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+report(const char *name, double start, uint64 checksum)
+{
+	double ns = (now_ns() - start) / ((double) NITEMS * NPASSES);
+
+	printf("%s\t%s\t%.3f\t%llu\n", name, IMPL, ns, (unsigned long long) checksum);
+}
+
+/* the previous penalty calculation, for comparison */
+static float
+penalty_libm(IP6R *key, IP6R *newkey)
+{
+	IP6R ud;
+	double tmp = 0.0;
+
+	if (ip6_lessthan(&newkey->lower,&key->lower))
+	{
+		ud.lower = newkey->lower;
+		ud.upper = key->lower;
+		ip6_sub_int(&ud.upper,1,&ud.upper);
+		tmp = ip6r_metric(&ud);
+	}
+	if (ip6_lessthan(&key->upper,&newkey->upper))
+	{
+		ud.lower = key->upper;
+		ud.upper = newkey->upper;
+		ip6_sub_int(&ud.upper,1,&ud.upper);
+		tmp += ip6r_metric(&ud);
+	}
+
+	return (float) pow(log(tmp+1) / log(2), 4);
+}
+
+#define BENCH(name_, body_)								\
+	do {												\
+		uint64 sum = 0;									\
+		double start = now_ns();						\
+		int pass, i;									\
+		for (pass = 0; pass < NPASSES; ++pass)			\
+			for (i = 0; i < NITEMS; ++i)				\
+			{											\
+				int j = (i + pass + 1) & (NITEMS - 1);	\
+				(void) j;								\
+				body_;									\
+			}											\
+		report(name_, start, sum);						\
+	} while (0)
+
+int
+main(void)
+{
+	make_corpus();
+
+	printf("op\timpl\tns_per_op\tchecksum\n");
+
+	BENCH("ip6_compare", sum += ip6_compare(&addrs[i], &addrs[j]) + 1);
+	BENCH("ip6_lessthan", sum += ip6_lessthan(&addrs[i], &addrs[j]));
+	BENCH("ip6_sub", {
+		IP6 d;
+		ip6_sub(&addrs[i], &addrs[j], &d);
+		sum += d.bits[0] ^ d.bits[1];
+	});
+	BENCH("ip6_sub_int", {
+		IP6 d;
+		ip6_sub_int(&addrs[i], (int) (j - NITEMS/2), &d);
+		sum += d.bits[0] ^ d.bits[1];
+	});
+	BENCH("ip6r_contains", sum += ip6r_contains_internal(&ranges[i], &ranges[j], true));
+	BENCH("ip6r_overlaps", sum += ip6r_overlaps_internal(&ranges[i], &ranges[j]));
+	BENCH("ip6_contains", sum += ip6_contains_internal(&ranges[i], &addrs[j]));
+	BENCH("masklen6", sum += masklen6(&ranges[i].lower, &ranges[i].upper));
+	BENCH("ip6r_metric", sum += (uint64) log2(ip6r_metric(&ranges[i])));
+	BENCH("ip6r_penalty", sum += (uint64) ip6r_penalty(&ranges[i], &ranges[j]));
+	BENCH("ip6r_penalty_libm", sum += (uint64) penalty_libm(&ranges[i], &ranges[j]));
+	BENCH("ip6r_union", {
+		IP6R u;
+		ip6r_union_internal(&ranges[i], &ranges[j], &u);
+		sum += u.lower.bits[1] ^ u.upper.bits[1];
+	});
+
+	return 0;
+}
+
+/* end */
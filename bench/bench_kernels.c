@@ -0,0 +1,253 @@
+/* bench_kernels.c */
+
+/*
+ * Throughput of the text I/O routines in raw_io.c and of the mask, CIDR
+ * split and metric kernels in ip4r_funcs.h and ip6r_funcs.h, without a
+ * server. raw_io.c is compiled as is against the shim headers.
+ *
+ * Each row reports the mean time per operation and the throughput in GB/s,
+ * where the bytes counted are the text consumed or produced for the I/O
+ * routines and the size of the input structs for the kernels. The corpora
+ * are generated from a fixed seed, so the checksum column is the same on
+ * every run and machine, and a change in it means a change in results.
+ *
+ * Addresses are a mix of the forms seen in real data: for IPv4, private
+ * ranges and arbitrary public addresses; for IPv6, /64 networks with small
+ * interface ids, random interface ids, link-local and v4-mapped addresses.
+ * Ranges come in two corpora, "cidr" (prefixes, mostly of common lengths)
+ * and "arbitrary" (random bounds, which split into many prefixes).
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ipr.h"
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+#define NITEMS (1 << 16)
+
+static IP4 addrs4[NITEMS];
+static IP6 addrs6[NITEMS];
+static char text4[NITEMS][IP4_STRING_MAX];
+static char text6[NITEMS][IP6_STRING_MAX];
+static double textbytes4;
+static double textbytes6;
+static IP4R cidr4[NITEMS];
+static IP4R arb4[NITEMS];
+static IP6R cidr6[NITEMS];
+static IP6R arb6[NITEMS];
+
+static uint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64
+rng(void)
+{
+	/* xorshift64* */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static IP4
+make_ip4(void)
+{
+	switch (rng() % 10)
+	{
+		case 0: case 1:
+			return (UINT32_C(10) << 24) | (rng() & 0xFFFFFF);
+		case 2:
+			return (UINT32_C(0xC0A8) << 16) | (rng() & 0xFFFF);
+		case 3:
+			return (UINT32_C(0xAC10) << 16) | (rng() & 0xFFFFF);
+		default:
+			return (IP4) (UINT32_C(0x01000000) + rng() % UINT32_C(0xDF000000));
+	}
+}
+
+static IP6
+make_ip6(void)
+{
+	IP6 a;
+
+	/* global unicast, skewed towards a few /32s */
+	a.bits[0] = (UINT64_C(0x2000) << 48) | ((rng() % 64) << 32) | (rng() & 0xFFFFFFFFU);
+
+	switch (rng() % 20)
+	{
+		case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+			a.bits[1] = rng() % 4096;
+			break;
+		case 8: case 9: case 10: case 11: case 12: case 13:
+			a.bits[1] = rng();
+			break;
+		case 14: case 15: case 16:
+			a.bits[0] = UINT64_C(0xFE80) << 48;
+			a.bits[1] = rng();
+			break;
+		default:
+			a.bits[0] = 0;
+			a.bits[1] = (UINT64_C(0xFFFF) << 32) | make_ip4();
+			break;
+	}
+	return a;
+}
+
+static void
+make_corpus(void)
+{
+	static const unsigned lens4[] = { 8, 16, 20, 22, 24, 24, 24, 28, 30, 32 };
+	static const unsigned lens6[] = { 32, 48, 48, 48, 56, 64, 64, 64, 96, 128 };
+	int i;
+
+	for (i = 0; i < NITEMS; ++i)
+	{
+		IP4 a4 = make_ip4();
+		IP6 a6 = make_ip6();
+		IP4 b4;
+		IP6 b6;
+
+		addrs4[i] = a4;
+		addrs6[i] = a6;
+		textbytes4 += ip4_raw_output(a4, text4[i], IP4_STRING_MAX);
+		textbytes6 += ip6_raw_output(a6.bits, text6[i], IP6_STRING_MAX);
+
+		ip4r_from_inet(a4, lens4[rng() % 10], &cidr4[i]);
+		ip6r_from_inet(&a6, lens6[rng() % 10], &cidr6[i]);
+
+		b4 = a4 + (IP4) (rng() >> (40 + rng() % 24));
+		if (b4 < a4)
+			b4 = ~(IP4) 0;
+		arb4[i].lower = a4;
+		arb4[i].upper = b4;
+
+		b6 = a6;
+		b6.bits[1] += rng() >> (rng() % 64);
+		if (b6.bits[1] < a6.bits[1] || (rng() & 3) == 0)
+			b6.bits[0] += 1 + rng() % 4;
+		arb6[i].lower = a6;
+		arb6[i].upper = b6;
+	}
+}
+
+static void
+report(const char *op, const char *corpus, double start, double nops,
+	   double nbytes, uint64 checksum)
+{
+	double ns = now_ns() - start;
+
+	printf("%s\t%s\t%.3f\t%.3f\t%llu\n", op, corpus, ns / nops, nbytes / ns,
+		   (unsigned long long) checksum);
+}
+
+/*
+ * Run BODY for each item, NPASSES times over the corpus. BODY adds to "sum"
+ * for the checksum; BYTES is the number of bytes handled per pass.
+ */
+#define BENCH(op_, corpus_, npasses_, bytes_, body_)	\
+	do {												\
+		uint64 sum = 0;									\
+		double start = now_ns();						\
+		int pass, i;									\
+		for (pass = 0; pass < (npasses_); ++pass)		\
+			for (i = 0; i < NITEMS; ++i)				\
+			{											\
+				body_;									\
+			}											\
+		report(op_, corpus_, start, (double) NITEMS * (npasses_), \
+			   (double) (bytes_) * (npasses_), sum);	\
+	} while (0)
+
+static inline uint64
+double_bits(double d)
+{
+	uint64 u;
+
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+int
+main(void)
+{
+	static IP4R res4[IP4R_MAX_CIDRS];
+	static IP6R res6[IP6R_MAX_CIDRS];
+
+	make_corpus();
+
+	printf("op\tcorpus\tns_per_op\tgb_per_s\tchecksum\n");
+
+	BENCH("ip4_parse", "mixed", 100, textbytes4, {
+		IP4 ip = 0;
+		sum += ip4_raw_input(text4[i], &ip) + ip;
+	});
+	BENCH("ip4_format", "mixed", 100, textbytes4, {
+		char buf[IP4_STRING_MAX];
+		int n = ip4_raw_output(addrs4[i], buf, sizeof(buf));
+		sum += n + buf[n - 1];
+	});
+	BENCH("ip6_parse", "mixed", 50, textbytes6, {
+		IP6 ip;
+		ip.bits[0] = ip.bits[1] = 0;
+		sum += ip6_raw_input(text6[i], ip.bits) + (ip.bits[0] ^ ip.bits[1]);
+	});
+	BENCH("ip6_format", "mixed", 50, textbytes6, {
+		char buf[IP6_STRING_MAX];
+		int n = ip6_raw_output(addrs6[i].bits, buf, sizeof(buf));
+		sum += n + buf[n - 1];
+	});
+
+	BENCH("masklen", "cidr", 200, NITEMS * sizeof(IP4R), {
+		sum += masklen(cidr4[i].lower, cidr4[i].upper);
+	});
+	BENCH("masklen", "arbitrary", 200, NITEMS * sizeof(IP4R), {
+		sum += masklen(arb4[i].lower, arb4[i].upper);
+	});
+	BENCH("masklen6", "cidr", 200, NITEMS * sizeof(IP6R), {
+		sum += masklen6(&cidr6[i].lower, &cidr6[i].upper);
+	});
+	BENCH("masklen6", "arbitrary", 200, NITEMS * sizeof(IP6R), {
+		sum += masklen6(&arb6[i].lower, &arb6[i].upper);
+	});
+
+	BENCH("ip4r_split_cidr", "cidr", 100, NITEMS * sizeof(IP4R), {
+		int n = ip4r_split_cidrs(&cidr4[i], res4);
+		sum += n + res4[n - 1].lower;
+	});
+	BENCH("ip4r_split_cidr", "arbitrary", 10, NITEMS * sizeof(IP4R), {
+		int n = ip4r_split_cidrs(&arb4[i], res4);
+		sum += n + res4[n - 1].lower;
+	});
+	BENCH("ip6r_split_cidr", "cidr", 100, NITEMS * sizeof(IP6R), {
+		int n = ip6r_split_cidrs(&cidr6[i], res6);
+		sum += n + res6[n - 1].lower.bits[1];
+	});
+	BENCH("ip6r_split_cidr", "arbitrary", 2, NITEMS * sizeof(IP6R), {
+		int n = ip6r_split_cidrs(&arb6[i], res6);
+		sum += n + res6[n - 1].lower.bits[1];
+	});
+
+	BENCH("ip6r_metric", "cidr", 200, NITEMS * sizeof(IP6R), {
+		sum = sum * 31 + double_bits(ip6r_metric(&cidr6[i]));
+	});
+	BENCH("ip6r_metric", "arbitrary", 200, NITEMS * sizeof(IP6R), {
+		sum = sum * 31 + double_bits(ip6r_metric(&arb6[i]));
+	});
+
+	return 0;
+}
+
+/* end */
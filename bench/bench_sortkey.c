@@ -0,0 +1,347 @@
+/* bench_sortkey.c */
+
+/*
+ * Btree build and lookup costs for iprange values compared directly (as
+ * btree_iprange_ops does) and as bytea sort keys from ipr_sortkey.h.
+ *
+ * "build" sorts all the rows, which is what dominates CREATE INDEX; "lookup"
+ * binary-searches the sorted rows for existing values, which is the
+ * comparison work of a btree descent. Values are laid out as in a tuple: a
+ * 1-byte short varlena header followed by unaligned data.
+ *
+ * The forms are: "packed", unpacking both sides for each comparison as
+ * iprange_cmp does; "sortkey", comparing keys as byteacmp does (memcmp of
+ * the common length, then length); and "abbrev", which adds the abbreviated
+ * keys that the bytea sort support uses, i.e. the first 8 key bytes as an
+ * integer, falling back to the full comparison on ties. The data is mostly
+ * IPv4, with 20% IPv6 prefixes. The checksums must match between forms.
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ipr.h"
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+#include "ipr_sortkey.h"
+
+#define NROWS (1 << 20)
+#define NLOOKUPS (1 << 22)
+#define SLOT 40
+
+static unsigned char *packed;
+static unsigned char *keys;
+
+static uint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 1-byte varlena header as stored on little-endian machines */
+
+static inline void
+set_short_varsize(unsigned char *p, int datalen)
+{
+	p[0] = (unsigned char) (((datalen + 1) << 1) | 1);
+}
+
+static inline int
+short_varsize_exhdr(const unsigned char *p)
+{
+	/* stand-in for the VARATT_IS_EXTENDED test of the detoast macro */
+	if ((p[0] & 1) == 0)
+		abort();
+	return (p[0] >> 1) - 1;
+}
+
+/* copy of ipr_unpack for short-header values */
+
+static inline int
+packed_ipr_unpack(const unsigned char *p, IPR *out)
+{
+	const unsigned char *ptr = p + 1;
+
+	switch (short_varsize_exhdr(p))
+	{
+		case 0:
+			return 0;
+
+		case sizeof(IP4R):
+			memcpy(&out->ip4r, ptr, sizeof(IP4R));
+			return PGSQL_AF_INET;
+
+		case 1+sizeof(uint64):
+		{
+			unsigned pfxlen = *ptr++;
+			memcpy(out->ip6r.lower.bits, ptr, sizeof(uint64));
+			out->ip6r.lower.bits[1] = 0;
+			out->ip6r.upper.bits[0] = out->ip6r.lower.bits[0] | hostmask6_hi(pfxlen);
+			out->ip6r.upper.bits[1] = hostmask6_lo(pfxlen);
+			return PGSQL_AF_INET6;
+		}
+
+		case 1+sizeof(IP6):
+		{
+			unsigned pfxlen = *ptr++;
+			memcpy(&out->ip6r.lower, ptr, sizeof(IP6));
+			out->ip6r.upper.bits[0] = out->ip6r.lower.bits[0] | hostmask6_hi(pfxlen);
+			out->ip6r.upper.bits[1] = out->ip6r.lower.bits[1] | hostmask6_lo(pfxlen);
+			return PGSQL_AF_INET6;
+		}
+
+		case sizeof(IP6R):
+			memcpy(&out->ip6r, ptr, sizeof(IP6R));
+			return PGSQL_AF_INET6;
+	}
+	abort();
+}
+
+static void
+make_ranges(void)
+{
+	int i;
+
+	for (i = 0; i < NROWS; ++i)
+	{
+		unsigned char *p = packed + (size_t) i * SLOT;
+		unsigned char *k = keys + (size_t) i * SLOT;
+		IPR ipr;
+		int af;
+
+		if (rng() % 5)
+		{
+			unsigned len = 16 + rng() % 17;
+			IP4 ip = ((IP4) (10 + rng() % 4) << 24) | (rng() & 0xFFFFFF);
+
+			af = PGSQL_AF_INET;
+			ipr.ip4r.lower = ip & netmask(len);
+			ipr.ip4r.upper = ip | hostmask(len);
+			set_short_varsize(p, sizeof(IP4R));
+			memcpy(p + 1, &ipr.ip4r, sizeof(IP4R));
+		}
+		else
+		{
+			unsigned len = 48 + rng() % 17;
+			uint64 hi = (UINT64_C(0x20010db8) << 32) | (rng() & 0xFFFF0000);
+
+			af = PGSQL_AF_INET6;
+			ipr.ip6r.lower.bits[0] = hi & netmask6_hi(len);
+			ipr.ip6r.lower.bits[1] = 0;
+			ipr.ip6r.upper.bits[0] = hi | hostmask6_hi(len);
+			ipr.ip6r.upper.bits[1] = ~(uint64) 0;
+			set_short_varsize(p, 1 + sizeof(uint64));
+			p[1] = len;
+			memcpy(p + 2, &ipr.ip6r.lower.bits[0], sizeof(uint64));
+		}
+
+		set_short_varsize(k, ipr_sortkey_encode(af, &ipr, k + 1));
+	}
+}
+
+/*
+ * Comparators
+ */
+
+static int
+packed_cmp(const void *pa, const void *pb)
+{
+	const unsigned char *a = *(const unsigned char *const *) pa;
+	const unsigned char *b = *(const unsigned char *const *) pb;
+	IPR ipr1, ipr2;
+	int af1 = packed_ipr_unpack(a, &ipr1);
+	int af2 = packed_ipr_unpack(b, &ipr2);
+
+	if (af1 != af2)
+		return (af1 > af2) ? 1 : -1;
+	if (af1 == PGSQL_AF_INET)
+		return ip4r_lessthan(&ipr1.ip4r, &ipr2.ip4r) ? -1 : !ip4r_equal(&ipr1.ip4r, &ipr2.ip4r);
+	if (af1 == PGSQL_AF_INET6)
+		return ip6r_lessthan(&ipr1.ip6r, &ipr2.ip6r) ? -1 : !ip6r_equal(&ipr1.ip6r, &ipr2.ip6r);
+	return 0;
+}
+
+static inline int
+key_cmp_internal(const unsigned char *a, const unsigned char *b)
+{
+	int len1 = short_varsize_exhdr(a);
+	int len2 = short_varsize_exhdr(b);
+	int cmp = memcmp(a + 1, b + 1, Min(len1, len2));
+
+	return cmp ? cmp : (len1 - len2);
+}
+
+static int
+key_cmp(const void *pa, const void *pb)
+{
+	return key_cmp_internal(*(const unsigned char *const *) pa,
+							*(const unsigned char *const *) pb);
+}
+
+typedef struct AbbrevItem
+{
+	uint64 abbrev;
+	const unsigned char *key;
+} AbbrevItem;
+
+static uint64
+key_abbrev(const unsigned char *k)
+{
+	unsigned char buf[8] = {0};
+
+	memcpy(buf, k + 1, Min(short_varsize_exhdr(k), 8));
+	return ipr_sortkey_get64(buf);
+}
+
+static int
+abbrev_cmp(const void *pa, const void *pb)
+{
+	const AbbrevItem *a = pa;
+	const AbbrevItem *b = pb;
+
+	if (a->abbrev != b->abbrev)
+		return (a->abbrev > b->abbrev) ? 1 : -1;
+	return key_cmp_internal(a->key, b->key);
+}
+
+/*
+ * Lower-bound binary search, returning the index found
+ */
+
+static size_t
+search(const void *base, size_t size, const void *probe,
+	   int (*cmp)(const void *, const void *))
+{
+	size_t lo = 0;
+	size_t hi = NROWS;
+
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+
+		if (cmp((const char *) base + mid * size, probe) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+report(const char *op, const char *form, double t0, double t1, double n, uint64 sum)
+{
+	printf("iprange\t%s\t%s\t%.3f\t%llu\n", op, form, (t1 - t0) / n,
+		   (unsigned long long) sum);
+}
+
+int
+main(void)
+{
+	const unsigned char **pv = malloc(NROWS * sizeof(*pv));
+	const unsigned char **kv = malloc(NROWS * sizeof(*kv));
+	AbbrevItem *av = malloc(NROWS * sizeof(*av));
+	int *probes = malloc(NLOOKUPS * sizeof(int));
+	double t0, t1;
+	uint64 sum;
+	int i;
+
+	packed = malloc((size_t) NROWS * SLOT);
+	keys = malloc((size_t) NROWS * SLOT);
+
+	printf("type\top\tform\tns_per_row\tchecksum\n");
+
+	make_ranges();
+
+	for (i = 0; i < NROWS; ++i)
+	{
+		pv[i] = packed + (size_t) i * SLOT;
+		kv[i] = keys + (size_t) i * SLOT;
+	}
+	for (i = 0; i < NLOOKUPS; ++i)
+		probes[i] = rng() % NROWS;
+
+	/*
+	 * build; the checksum is the sum of positions of the first 1000 rows
+	 * in the sorted order, which must agree
+	 */
+
+	t0 = now_ns();
+	qsort(pv, NROWS, sizeof(*pv), packed_cmp);
+	t1 = now_ns();
+	for (sum = 0, i = 0; i < NROWS; ++i)
+		if ((size_t) (pv[i] - packed) / SLOT < 1000)
+			sum += i;
+	report("build", "packed", t0, t1, NROWS, sum);
+
+	t0 = now_ns();
+	qsort(kv, NROWS, sizeof(*kv), key_cmp);
+	t1 = now_ns();
+	for (sum = 0, i = 0; i < NROWS; ++i)
+		if ((size_t) (kv[i] - keys) / SLOT < 1000)
+			sum += i;
+	report("build", "sortkey", t0, t1, NROWS, sum);
+
+	t0 = now_ns();
+	for (i = 0; i < NROWS; ++i)
+	{
+		av[i].key = keys + (size_t) i * SLOT;
+		av[i].abbrev = key_abbrev(av[i].key);
+	}
+	qsort(av, NROWS, sizeof(*av), abbrev_cmp);
+	t1 = now_ns();
+	for (sum = 0, i = 0; i < NROWS; ++i)
+		if ((size_t) (av[i].key - keys) / SLOT < 1000)
+			sum += i;
+	report("build", "abbrev", t0, t1, NROWS, sum);
+
+	/* lookup; the checksum is the sum of the positions found */
+
+	sum = 0;
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; ++i)
+	{
+		const unsigned char *probe = packed + (size_t) probes[i] * SLOT;
+
+		sum += search(pv, sizeof(*pv), &probe, packed_cmp);
+	}
+	t1 = now_ns();
+	report("lookup", "packed", t0, t1, NLOOKUPS, sum);
+
+	sum = 0;
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; ++i)
+	{
+		const unsigned char *probe = keys + (size_t) probes[i] * SLOT;
+
+		sum += search(kv, sizeof(*kv), &probe, key_cmp);
+	}
+	t1 = now_ns();
+	report("lookup", "sortkey", t0, t1, NLOOKUPS, sum);
+
+	free(pv);
+	free(kv);
+	free(av);
+	free(probes);
+	free(packed);
+	free(keys);
+	return 0;
+}
+
+/* end */
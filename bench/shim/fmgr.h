@@ -0,0 +1,12 @@
+/* fmgr.h - stand-in, see postgres.h */
+#ifndef IPR_BENCH_FMGR_H
+#define IPR_BENCH_FMGR_H
+
+/* enough for the prototypes in ipr_internal.h, which are never called */
+
+typedef struct FunctionCallInfoBaseData *FunctionCallInfo;
+typedef Datum (*PGFunction) (FunctionCallInfo fcinfo);
+
+#define PG_FUNCTION_ARGS FunctionCallInfo fcinfo
+
+#endif
@@ -0,0 +1,14 @@
+/* port/pg_bitutils.h - stand-in, see postgres.h */
+#ifndef IPR_BENCH_PG_BITUTILS_H
+#define IPR_BENCH_PG_BITUTILS_H
+
+static inline int
+pg_popcount64(uint64 w)
+{
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int) ((w * 0x0101010101010101ULL) >> 56);
+}
+
+#endif
@@ -0,0 +1,40 @@
+/* postgres.h - minimal stand-in for building the ip4r kernels outside the server */
+#ifndef IPR_BENCH_POSTGRES_H
+#define IPR_BENCH_POSTGRES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define PG_VERSION_NUM 150000
+
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef int64_t int64;
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+#if defined(__SIZEOF_INT128__)
+#define HAVE_INT128 1
+typedef __int128 int128;
+typedef unsigned __int128 uint128;
+#endif
+
+typedef uintptr_t Datum;
+
+#define Min(x_,y_) ((x_) < (y_) ? (x_) : (y_))
+
+#define VARHDRSZ ((int32) sizeof(int32))
+#define SET_VARSIZE(p_,len_) (*(int32 *)(p_) = (len_))
+#define VARSIZE(p_) (*(int32 *)(p_))
+#define VARDATA(p_) ((char *)(p_) + VARHDRSZ)
+#define VARSIZE_ANY_EXHDR(p_) (VARSIZE(p_) - VARHDRSZ)
+#define VARDATA_ANY(p_) VARDATA(p_)
+
+#endif
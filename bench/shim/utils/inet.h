@@ -0,0 +1,10 @@
+/* utils/inet.h - stand-in, see postgres.h */
+#ifndef IPR_BENCH_INET_H
+#define IPR_BENCH_INET_H
+
+#include <sys/socket.h>
+
+#define PGSQL_AF_INET	(AF_INET + 0)
+#define PGSQL_AF_INET6	(AF_INET + 1)
+
+#endif
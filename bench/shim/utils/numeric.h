@@ -0,0 +1,7 @@
+/* utils/numeric.h - stand-in, see postgres.h */
+#ifndef IPR_BENCH_NUMERIC_H
+#define IPR_BENCH_NUMERIC_H
+
+typedef struct NumericData *Numeric;
+
+#endif
@@ -0,0 +1,9 @@
+/* utils/palloc.h - stand-in, see postgres.h */
+#ifndef IPR_BENCH_PALLOC_H
+#define IPR_BENCH_PALLOC_H
+
+#define palloc(sz_) malloc(sz_)
+#define palloc0(sz_) calloc(1, sz_)
+#define pfree(p_) free(p_)
+
+#endif
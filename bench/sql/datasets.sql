@@ -0,0 +1,238 @@
+-- datasets.sql
+
+-- Generators and measurement functions for the SQL-level benchmarks; see
+-- run.sh. Requires pg 9.6 or later and the ip4r extension.
+--
+-- All data is derived from md5 of (seed, row, purpose), so a given seed
+-- gives the same tables on every run, machine and server version.
+--
+-- Routing tables follow the prefix-length distribution of a full BGP
+-- table. One route in 16 is a covering allocation (/11-/16 for IPv4,
+-- /20-/32 for IPv6), announced itself; most of the rest are more-specifics
+-- of a random allocation and the remainder are scattered. Log tables hold
+-- source addresses inside the routes, with a Zipfian distribution over
+-- hosts: host k (of as many hosts as log rows) appears with probability
+-- proportional to k^-s.
+
+CREATE EXTENSION IF NOT EXISTS ip4r;
+
+-- 60 uniformly distributed bits
+CREATE OR REPLACE FUNCTION ipbench_rand(seed integer, i bigint, k integer)
+  RETURNS bigint LANGUAGE sql IMMUTABLE STRICT
+  AS $f$ SELECT ('x' || substr(md5($1 || ':' || $2 || ':' || $3), 1, 15))::bit(60)::bigint $f$;
+
+-- uniform in [0,1)
+CREATE OR REPLACE FUNCTION ipbench_unif(seed integer, i bigint, k integer)
+  RETURNS float8 LANGUAGE sql IMMUTABLE STRICT
+  AS $f$ SELECT ipbench_rand($1, $2, $3) / 1152921504606846976.0::float8 $f$;
+
+-- rank in [1,n] with P(k) proportional to k^-s, by inverting the CDF of
+-- the continuous distribution
+CREATE OR REPLACE FUNCTION ipbench_zipf(u float8, n bigint, s float8)
+  RETURNS bigint LANGUAGE sql IMMUTABLE STRICT
+  AS $f$
+    SELECT least($2, greatest(1, floor(CASE WHEN $3 = 1 THEN $2::float8 ^ $1
+                                            ELSE (($2::float8 ^ (1 - $3) - 1) * $1 + 1) ^ (1 / (1 - $3))
+                                       END)::bigint))
+  $f$;
+
+-- prefix length for a route, from the share of each length in the BGP
+-- tables (lengths with negligible shares are folded into their neighbours)
+CREATE OR REPLACE FUNCTION ipbench_len(family integer, u float8)
+  RETURNS integer LANGUAGE sql IMMUTABLE STRICT
+  AS $f$
+    SELECT d.len
+      FROM unnest(CASE WHEN $1 = 4
+                       THEN ARRAY[8, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24]
+                       ELSE ARRAY[28, 29, 30, 31, 32, 33, 34, 35, 36, 38, 40, 41, 42, 44, 45, 46, 47, 48, 56, 64]
+                  END,
+                  CASE WHEN $1 = 4
+                       THEN ARRAY[0.0002, 0.0005, 0.0015, 0.004, 0.008, 0.014, 0.02, 0.034,
+                                  0.043, 0.058, 0.083, 0.123, 0.168, 0.278, 0.378, 1.0]
+                       ELSE ARRAY[0.01, 0.05, 0.055, 0.06, 0.18, 0.187, 0.194, 0.2, 0.23, 0.245,
+                                  0.305, 0.31, 0.32, 0.41, 0.425, 0.445, 0.46, 0.96, 0.97, 1.0]
+                  END) AS d(len, cum)
+     WHERE d.cum > $2
+     ORDER BY d.cum
+     LIMIT 1
+  $f$;
+
+CREATE OR REPLACE FUNCTION ipbench_make_routes4(n integer, seed integer)
+  RETURNS void LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    np integer := greatest(n / 16, 1);
+  BEGIN
+    DROP TABLE IF EXISTS ipbench_routes4;
+    CREATE TABLE ipbench_routes4 (id integer PRIMARY KEY, len integer NOT NULL, r ip4r NOT NULL);
+
+    -- allocations, anywhere in 1.0.0.0 - 222.255.255.255
+    INSERT INTO ipbench_routes4
+      SELECT i, a.len, (ip4 '1.0.0.0' + ipbench_rand(seed, i, 1) % 3724541952) / a.len
+        FROM generate_series(1, np) i
+             CROSS JOIN LATERAL
+               (SELECT (ARRAY[11, 12, 13, 14, 15, 16, 16, 16])[(1 + ipbench_rand(seed, i, 2) % 8)::integer] AS len) a;
+
+    INSERT INTO ipbench_routes4
+      SELECT i, l.len,
+             CASE WHEN ipbench_rand(seed, i, 3) % 10 < 7 AND l.len > p.len
+                  THEN (lower(p.r) + ipbench_rand(seed, i, 4) % (upper(p.r) - lower(p.r) + 1)) / l.len
+                  ELSE (ip4 '1.0.0.0' + ipbench_rand(seed, i, 4) % 3724541952) / l.len
+             END
+        FROM generate_series(np + 1, n) i
+             CROSS JOIN LATERAL (SELECT ipbench_len(4, ipbench_unif(seed, i, 5)) AS len) l
+             JOIN ipbench_routes4 p ON p.id = 1 + ipbench_rand(seed, i, 6) % np;
+  END;
+  $f$;
+
+CREATE OR REPLACE FUNCTION ipbench_make_routes6(n integer, seed integer)
+  RETURNS void LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    np integer := greatest(n / 16, 1);
+  BEGIN
+    DROP TABLE IF EXISTS ipbench_routes6;
+    CREATE TABLE ipbench_routes6 (id integer PRIMARY KEY, len integer NOT NULL, r ip6r NOT NULL);
+
+    -- allocations, anywhere in 2000::/3 (the random bits are shifted left
+    -- by 65 to fill the 125 bits below the /3)
+    INSERT INTO ipbench_routes6
+      SELECT i, a.len, (ip6 '2000::' + ipbench_rand(seed, i, 1) * 36893488147419103232::numeric) / a.len
+        FROM generate_series(1, np) i
+             CROSS JOIN LATERAL
+               (SELECT (ARRAY[20, 23, 26, 28, 29, 32, 32, 32])[(1 + ipbench_rand(seed, i, 2) % 8)::integer] AS len) a;
+
+    -- all lengths are at most 64, so only the high 64 bits are random
+    INSERT INTO ipbench_routes6
+      SELECT i, l.len,
+             CASE WHEN ipbench_rand(seed, i, 3) % 10 < 7 AND l.len > p.len
+                  THEN (lower(p.r) + (ipbench_rand(seed, i, 4) % (1::bigint << (64 - p.len)))
+                                     * 18446744073709551616::numeric) / l.len
+                  ELSE (ip6 '2000::' + ipbench_rand(seed, i, 4) * 36893488147419103232::numeric) / l.len
+             END
+        FROM generate_series(np + 1, n) i
+             CROSS JOIN LATERAL (SELECT ipbench_len(6, ipbench_unif(seed, i, 5)) AS len) l
+             JOIN ipbench_routes6 p ON p.id = 1 + ipbench_rand(seed, i, 6) % np;
+  END;
+  $f$;
+
+CREATE OR REPLACE FUNCTION ipbench_make_logs(n integer, s float8, seed integer)
+  RETURNS void LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    n4 bigint := (SELECT count(*) FROM ipbench_routes4);
+    n6 bigint := (SELECT count(*) FROM ipbench_routes6);
+  BEGIN
+    DROP TABLE IF EXISTS ipbench_log4;
+    DROP TABLE IF EXISTS ipbench_log6;
+    CREATE TABLE ipbench_log4 (id integer PRIMARY KEY, ts timestamptz NOT NULL, src ip4 NOT NULL);
+    CREATE TABLE ipbench_log6 (id integer PRIMARY KEY, ts timestamptz NOT NULL, src ip6 NOT NULL);
+
+    -- each host is a fixed address within a fixed route, both chosen by
+    -- its rank
+    INSERT INTO ipbench_log4
+      SELECT i, timestamptz '2024-01-01 00:00:00+00' + i * interval '10 ms',
+             lower(r.r) + ipbench_rand(seed, z.k, 8) % (upper(r.r) - lower(r.r) + 1)
+        FROM generate_series(1, n) i
+             CROSS JOIN LATERAL (SELECT ipbench_zipf(ipbench_unif(seed, i, 7), n, s) AS k) z
+             JOIN ipbench_routes4 r ON r.id = 1 + ipbench_rand(seed, z.k, 9) % n4;
+
+    INSERT INTO ipbench_log6
+      SELECT i, timestamptz '2024-01-01 00:00:00+00' + i * interval '10 ms',
+             lower(r.r) + ((ipbench_rand(seed, z.k, 8) % (1::bigint << least(60, 64 - r.len)))
+                           * 18446744073709551616::numeric
+                           + ipbench_rand(seed, z.k, 10))
+        FROM generate_series(1, n) i
+             CROSS JOIN LATERAL (SELECT ipbench_zipf(ipbench_unif(seed, i, 7), n, s) AS k) z
+             JOIN ipbench_routes6 r ON r.id = 1 + ipbench_rand(seed, z.k, 9) % n6;
+  END;
+  $f$;
+
+CREATE OR REPLACE FUNCTION ipbench_setup(routes4 integer, routes6 integer, logrows integer,
+                                         zipf float8 DEFAULT 1.1, seed integer DEFAULT 1)
+  RETURNS void LANGUAGE plpgsql
+  AS $f$
+  BEGIN
+    PERFORM ipbench_make_routes4(routes4, seed);
+    PERFORM ipbench_make_routes6(routes6, seed);
+    PERFORM ipbench_make_logs(logrows, zipf, seed);
+
+    -- both families in one table, in the packed and fixed-length forms
+    DROP TABLE IF EXISTS ipbench_routes;
+    CREATE TABLE ipbench_routes (id integer PRIMARY KEY, r iprange NOT NULL, rf iprange_fixed NOT NULL);
+    INSERT INTO ipbench_routes
+      SELECT id, r::iprange, r::iprange FROM ipbench_routes4
+      UNION ALL
+      SELECT routes4 + id, r::iprange, r::iprange FROM ipbench_routes6;
+
+    ANALYZE ipbench_routes4;
+    ANALYZE ipbench_routes6;
+    ANALYZE ipbench_routes;
+    ANALYZE ipbench_log4;
+    ANALYZE ipbench_log6;
+  END;
+  $f$;
+
+-- (re)build the gist index on tbl.col with the given opclass
+CREATE OR REPLACE FUNCTION ipbench_build(tbl regclass, col name, opclass name,
+                                         OUT build_ms float8, OUT index_bytes bigint)
+  LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    idx text := format('%s_%s_idx', tbl, col);
+    t0 timestamptz;
+  BEGIN
+    EXECUTE format('DROP INDEX IF EXISTS %I', idx);
+    t0 := clock_timestamp();
+    EXECUTE format('CREATE INDEX %I ON %s USING gist (%I %I)', idx, tbl, col, opclass);
+    build_ms := extract(epoch FROM clock_timestamp() - t0) * 1000;
+    index_bytes := pg_relation_size(idx::regclass);
+  END;
+  $f$;
+
+-- mean number of buffers (hit or read) used by a point lookup of a logged
+-- address, over nprobes log rows spread over the table; addr is the
+-- expression for the address in terms of the log table's src
+CREATE OR REPLACE FUNCTION ipbench_buffers(tbl regclass, col name, log regclass,
+                                           addr text, nprobes integer)
+  RETURNS float8 LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    nlog bigint;
+    lit text;
+    plan json;
+    total bigint := 0;
+  BEGIN
+    EXECUTE format('SELECT max(id) FROM %s', log) INTO nlog;
+    FOR i IN 1..nprobes LOOP
+      EXECUTE format('SELECT quote_literal(%1$s) || ''::'' || pg_typeof(%1$s) FROM %2$s WHERE id = $1',
+                     addr, log)
+        INTO lit USING 1 + (i * 104729::bigint) % nlog;
+      EXECUTE format('EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) SELECT count(*) FROM %s WHERE %I >>= %s',
+                     tbl, col, lit)
+        INTO plan;
+      total := total + coalesce((plan->0->'Plan'->>'Shared Hit Blocks')::bigint, 0)
+                     + coalesce((plan->0->'Plan'->>'Shared Read Blocks')::bigint, 0);
+    END LOOP;
+    RETURN total::float8 / nprobes;
+  END;
+  $f$;
+
+-- time of a containment join of the first nrows log rows to their routes
+CREATE OR REPLACE FUNCTION ipbench_join(tbl regclass, col name, log regclass,
+                                        addr text, nrows integer)
+  RETURNS float8 LANGUAGE plpgsql
+  AS $f$
+  DECLARE
+    t0 timestamptz := clock_timestamp();
+    n bigint;
+  BEGIN
+    EXECUTE format('SELECT count(*) FROM (SELECT %s AS a FROM %s WHERE id <= %s) l'
+                   '  JOIN %s r ON r.%I >>= l.a',
+                   addr, log, nrows, tbl, col)
+      INTO n;
+    RETURN extract(epoch FROM clock_timestamp() - t0) * 1000;
+  END;
+  $f$;
+
+-- end
@@ -0,0 +1,60 @@
+#!/bin/sh
+# run.sh - SQL-level benchmarks for the ip4r gist operator classes
+#
+# Builds synthetic routing and log tables (see datasets.sql) in the
+# database given by the usual PG* environment variables, then for each
+# operator class reports, as tab-separated values:
+#
+#   build_ms            time to build the gist index
+#   index_bytes         size of the index
+#   buffers_per_lookup  mean shared buffers hit or read by a point lookup
+#   lookups_per_s       point lookups per second, from pgbench
+#   join_ms             containment join of JOINROWS log rows to routes
+#
+# The data depends only on the settings below, so results are comparable
+# between runs. Requires pg 9.6 or later, psql and pgbench.
+
+set -e
+
+ROUTES4=${ROUTES4:-900000}
+ROUTES6=${ROUTES6:-200000}
+LOGROWS=${LOGROWS:-1000000}
+ZIPF=${ZIPF:-1.1}
+SEED=${SEED:-1}
+PROBES=${PROBES:-1000}
+JOINROWS=${JOINROWS:-10000}
+DURATION=${DURATION:-10}
+CLIENTS=${CLIENTS:-1}
+
+here=$(dirname "$0")
+psql="psql -X -q -At -v ON_ERROR_STOP=1"
+
+$psql -f "$here/datasets.sql"
+$psql -c "SELECT ipbench_setup($ROUTES4, $ROUTES6, $LOGROWS, $ZIPF, $SEED)"
+
+printf 'case\topclass\tbuild_ms\tindex_bytes\tbuffers_per_lookup\tlookups_per_s\tjoin_ms\n'
+
+built=
+while read -r name opclass tbl col log addr; do
+	if [ "$built" != "$tbl.$col" ]; then
+		build=$($psql -F '	' -c "SELECT round(build_ms::numeric, 1), index_bytes
+		                              FROM ipbench_build('$tbl', '$col', '$opclass')")
+		$psql -c "VACUUM ANALYZE $tbl"
+		built="$tbl.$col"
+	fi
+	buffers=$($psql -c "SELECT round(ipbench_buffers('$tbl', '$col', '$log', '$addr', $PROBES)::numeric, 2)")
+	tps=$(pgbench -n -f "$here/lookup.pgbench" -T "$DURATION" -c "$CLIENTS" -j "$CLIENTS" \
+	      -D tbl="$tbl" -D col="$col" -D log="$log" -D addr="$addr" -D nlog="$LOGROWS" |
+	      sed -n 's/^tps = \([0-9.]*\).*/\1/p' | tail -1)
+	join=$($psql -c "SELECT round(ipbench_join('$tbl', '$col', '$log', '$addr', $JOINROWS)::numeric, 1)")
+	printf '%s\t%s\t%s\t%s\t%s\t%s\n' "$name" "$opclass" "$build" "$buffers" "$tps" "$join"
+done <<EOF
+ip4r		gist_ip4r_ops		ipbench_routes4	r	ipbench_log4	src
+ip6r		gist_ip6r_ops		ipbench_routes6	r	ipbench_log6	src
+iprange_v4	gist_iprange_ops	ipbench_routes	r	ipbench_log4	src::ipaddress
+iprange_v6	gist_iprange_ops	ipbench_routes	r	ipbench_log6	src::ipaddress
+iprange_fixed_v4 gist_iprange_fixed_ops	ipbench_routes	rf	ipbench_log4	src::ipaddress::ipaddress_fixed
+iprange_fixed_v6 gist_iprange_fixed_ops	ipbench_routes	rf	ipbench_log6	src::ipaddress::ipaddress_fixed
+EOF
+
+# end
@@ -0,0 +1,827 @@
+/* ip4r--2.4--2.5.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION ip4r UPDATE TO '2.5'" to load this file. \quit
+
+-- ----------------------------------------------------------------------
+-- ip4set
+
+CREATE TYPE ip4set;
+
+CREATE FUNCTION ip4set_in(cstring) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_out(ip4set) RETURNS cstring AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_recv(internal) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_send(ip4set) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE ip4set (
+       INPUT = ip4set_in, OUTPUT = ip4set_out,
+       RECEIVE = ip4set_recv, SEND = ip4set_send,
+       INTERNALLENGTH = VARIABLE, ALIGNMENT = double, STORAGE = extended
+);
+
+COMMENT ON TYPE ip4set IS 'set of IPv4 addresses';
+
+CREATE FUNCTION ip4set(ip4) RETURNS ip4set AS 'MODULE_PATHNAME','ip4set_from_ip4' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set(ip4r) RETURNS ip4set AS 'MODULE_PATHNAME','ip4set_from_ip4r' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE CAST (ip4 as ip4set) WITH FUNCTION ip4set(ip4);
+CREATE CAST (ip4r as ip4set) WITH FUNCTION ip4set(ip4r);
+
+CREATE FUNCTION cardinality(ip4set) RETURNS bigint AS 'MODULE_PATHNAME','ip4set_cardinality' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ranges(ip4set) RETURNS SETOF ip4r AS 'MODULE_PATHNAME','ip4set_ranges' LANGUAGE C IMMUTABLE STRICT ROWS 100;
+
+CREATE FUNCTION ip4set_union(ip4set,ip4set) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_inter(ip4set,ip4set) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_minus(ip4set,ip4set) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR | ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_union, COMMUTATOR = '|' );
+CREATE OPERATOR & ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_inter, COMMUTATOR = '&' );
+CREATE OPERATOR - ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_minus );
+
+CREATE FUNCTION ip4set_eq(ip4set,ip4set) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_neq(ip4set,ip4set) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR = ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_eq, COMMUTATOR = '=', NEGATOR = '<>', RESTRICT = eqsel, JOIN = eqjoinsel );
+CREATE OPERATOR <> ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_neq, COMMUTATOR = '<>', NEGATOR = '=', RESTRICT = neqsel, JOIN = neqjoinsel );
+
+CREATE FUNCTION ip4set_contains(ip4set,ip4set) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_contains(ip4set,ip4r) RETURNS bool AS 'MODULE_PATHNAME','ip4set_contains_ip4r' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_contains(ip4set,ip4) RETURNS bool AS 'MODULE_PATHNAME','ip4set_contains_ip4' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_contained_by(ip4set,ip4set) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_contained_by(ip4r,ip4set) RETURNS bool AS 'MODULE_PATHNAME','ip4set_ip4r_contained_by' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_contained_by(ip4,ip4set) RETURNS bool AS 'MODULE_PATHNAME','ip4set_ip4_contained_by' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_overlaps(ip4set,ip4set) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_overlaps(ip4set,ip4r) RETURNS bool AS 'MODULE_PATHNAME','ip4set_overlaps_ip4r' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_overlaps(ip4r,ip4set) RETURNS bool AS 'MODULE_PATHNAME','ip4set_ip4r_overlaps' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR >>= ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_contains, COMMUTATOR = '<<=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR >>= ( LEFTARG = ip4set, RIGHTARG = ip4r,   PROCEDURE = ip4set_contains, COMMUTATOR = '<<=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR >>= ( LEFTARG = ip4set, RIGHTARG = ip4,    PROCEDURE = ip4set_contains, COMMUTATOR = '<<=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR <<= ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_contained_by, COMMUTATOR = '>>=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR <<= ( LEFTARG = ip4r,   RIGHTARG = ip4set, PROCEDURE = ip4set_contained_by, COMMUTATOR = '>>=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR <<= ( LEFTARG = ip4,    RIGHTARG = ip4set, PROCEDURE = ip4set_contained_by, COMMUTATOR = '>>=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR && ( LEFTARG = ip4set, RIGHTARG = ip4set, PROCEDURE = ip4set_overlaps, COMMUTATOR = '&&', RESTRICT = areasel, JOIN = areajoinsel );
+CREATE OPERATOR && ( LEFTARG = ip4set, RIGHTARG = ip4r,   PROCEDURE = ip4set_overlaps, COMMUTATOR = '&&', RESTRICT = areasel, JOIN = areajoinsel );
+CREATE OPERATOR && ( LEFTARG = ip4r,   RIGHTARG = ip4set, PROCEDURE = ip4set_overlaps, COMMUTATOR = '&&', RESTRICT = areasel, JOIN = areajoinsel );
+
+-- aggregates; the state is a buffer of pending ranges plus the set so far
+
+CREATE FUNCTION ip4set_agg_trans(internal,ip4) RETURNS internal AS 'MODULE_PATHNAME','ip4set_agg_trans_ip4' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip4set_agg_trans(internal,ip4r) RETURNS internal AS 'MODULE_PATHNAME','ip4set_agg_trans_ip4r' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip4set_agg_trans(internal,ip4set) RETURNS internal AS 'MODULE_PATHNAME','ip4set_agg_trans_ip4set' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip4set_agg_final(internal) RETURNS ip4set AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip4set_agg_combine(internal,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip4set_agg_serial(internal) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4set_agg_deserial(bytea,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+    r record;
+  BEGIN
+    FOR r IN SELECT tname
+	       FROM UNNEST(ARRAY['ip4','ip4r','ip4set']) u(tname)
+    LOOP
+      IF pg_ver >= 90600 THEN
+	EXECUTE format('CREATE AGGREGATE ip4set_agg(%I) ('
+		       '  SFUNC = ip4set_agg_trans, STYPE = internal,'
+		       '  FINALFUNC = ip4set_agg_final,'
+		       '  COMBINEFUNC = ip4set_agg_combine,'
+		       '  SERIALFUNC = ip4set_agg_serial,'
+		       '  DESERIALFUNC = ip4set_agg_deserial,'
+		       '  PARALLEL = SAFE)',
+		       r.tname);
+      ELSE
+	EXECUTE format('CREATE AGGREGATE ip4set_agg(%I) ('
+		       '  SFUNC = ip4set_agg_trans, STYPE = internal,'
+		       '  FINALFUNC = ip4set_agg_final)',
+		       r.tname);
+      END IF;
+    END LOOP;
+  END;
+$s$;
+
+-- ----------------------------------------------------------------------
+-- ipmap
+
+CREATE TYPE ipmap;
+
+CREATE FUNCTION ipmap_in(cstring) RETURNS ipmap AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipmap_out(ipmap) RETURNS cstring AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipmap_recv(internal) RETURNS ipmap AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipmap_send(ipmap) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE ipmap (
+       INPUT = ipmap_in, OUTPUT = ipmap_out,
+       RECEIVE = ipmap_recv, SEND = ipmap_send,
+       INTERNALLENGTH = VARIABLE, ALIGNMENT = double, STORAGE = extended
+);
+
+COMMENT ON TYPE ipmap IS 'map from disjoint IP ranges to bigint values';
+
+CREATE FUNCTION map_size(ipmap) RETURNS bigint AS 'MODULE_PATHNAME','ipmap_size' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION map_lookup(ipmap,ip4) RETURNS bigint AS 'MODULE_PATHNAME','ipmap_lookup_ip4' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION map_lookup(ipmap,ip6) RETURNS bigint AS 'MODULE_PATHNAME','ipmap_lookup_ip6' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION map_lookup(ipmap,ipaddress) RETURNS bigint AS 'MODULE_PATHNAME','ipmap_lookup_ipaddr' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION ipmap_agg_trans(internal,iprange,bigint) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ipmap_agg_final(internal) RETURNS ipmap AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ipmap_agg_combine(internal,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ipmap_agg_serial(internal) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipmap_agg_deserial(bytea,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      CREATE AGGREGATE ipmap_agg(iprange,bigint) (
+	SFUNC = ipmap_agg_trans, STYPE = internal,
+	FINALFUNC = ipmap_agg_final,
+	COMBINEFUNC = ipmap_agg_combine,
+	SERIALFUNC = ipmap_agg_serial,
+	DESERIALFUNC = ipmap_agg_deserial,
+	PARALLEL = SAFE);
+    ELSE
+      CREATE AGGREGATE ipmap_agg(iprange,bigint) (
+	SFUNC = ipmap_agg_trans, STYPE = internal,
+	FINALFUNC = ipmap_agg_final);
+    END IF;
+  END;
+$s$;
+
+-- cidr_split_array
+
+CREATE FUNCTION cidr_split_array(ip4r) RETURNS ip4r[] AS 'MODULE_PATHNAME','ip4r_cidr_split_array' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION cidr_split_array(ip6r) RETURNS ip6r[] AS 'MODULE_PATHNAME','ip6r_cidr_split_array' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION cidr_split_array(iprange) RETURNS iprange[] AS 'MODULE_PATHNAME','iprange_cidr_split_array' LANGUAGE C IMMUTABLE STRICT;
+
+-- range_gaps, cidr_gaps
+
+CREATE FUNCTION range_gaps(iprange,iprange[]) RETURNS SETOF iprange AS 'MODULE_PATHNAME','iprange_range_gaps' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION cidr_gaps(iprange,iprange[],integer) RETURNS SETOF iprange AS 'MODULE_PATHNAME','iprange_cidr_gaps' LANGUAGE C IMMUTABLE STRICT;
+
+-- cidr_split_agg
+
+CREATE FUNCTION iprange_cidr_agg_trans(internal,iprange) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_cidr_agg_final(internal) RETURNS iprange[] AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_cidr_agg_combine(internal,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_cidr_agg_serial(internal) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_cidr_agg_deserial(bytea,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      CREATE AGGREGATE cidr_split_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_cidr_agg_final,
+	COMBINEFUNC = iprange_cidr_agg_combine,
+	SERIALFUNC = iprange_cidr_agg_serial,
+	DESERIALFUNC = iprange_cidr_agg_deserial,
+	PARALLEL = SAFE);
+    ELSE
+      CREATE AGGREGATE cidr_split_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_cidr_agg_final);
+    END IF;
+  END;
+$s$;
+
+-- union_size_agg
+
+CREATE FUNCTION iprange_union_size_final(internal) RETURNS numeric AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      CREATE AGGREGATE union_size_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_union_size_final,
+	COMBINEFUNC = iprange_cidr_agg_combine,
+	SERIALFUNC = iprange_cidr_agg_serial,
+	DESERIALFUNC = iprange_cidr_agg_deserial,
+	PARALLEL = SAFE);
+    ELSE
+      CREATE AGGREGATE union_size_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_union_size_final);
+    END IF;
+  END;
+$s$;
+
+-- bounding_range_agg
+
+CREATE FUNCTION ip4r_bounds_trans(ip4r,ip4r) RETURNS ip4r AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4r_bounds_trans_ip4(ip4r,ip4) RETURNS ip4r AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION ip6r_bounds_trans(ip6r,ip6r) RETURNS ip6r AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6r_bounds_trans_ip6(ip6r,ip6) RETURNS ip6r AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_bounds_trans(internal,iprange) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_bounds_trans_ip(internal,ipaddress) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_bounds_final(internal) RETURNS iprange AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_bounds_combine(internal,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION iprange_bounds_serial(internal) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_bounds_deserial(bytea,internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      CREATE AGGREGATE bounding_range_agg(ip4) (
+	SFUNC = ip4r_bounds_trans_ip4, STYPE = ip4r,
+	COMBINEFUNC = ip4r_bounds_trans, PARALLEL = SAFE);
+      CREATE AGGREGATE bounding_range_agg(ip4r) (
+	SFUNC = ip4r_bounds_trans, STYPE = ip4r,
+	COMBINEFUNC = ip4r_bounds_trans, PARALLEL = SAFE);
+      CREATE AGGREGATE bounding_range_agg(ip6) (
+	SFUNC = ip6r_bounds_trans_ip6, STYPE = ip6r,
+	COMBINEFUNC = ip6r_bounds_trans, PARALLEL = SAFE);
+      CREATE AGGREGATE bounding_range_agg(ip6r) (
+	SFUNC = ip6r_bounds_trans, STYPE = ip6r,
+	COMBINEFUNC = ip6r_bounds_trans, PARALLEL = SAFE);
+      CREATE AGGREGATE bounding_range_agg(ipaddress) (
+	SFUNC = iprange_bounds_trans_ip, STYPE = internal,
+	FINALFUNC = iprange_bounds_final,
+	COMBINEFUNC = iprange_bounds_combine,
+	SERIALFUNC = iprange_bounds_serial,
+	DESERIALFUNC = iprange_bounds_deserial,
+	PARALLEL = SAFE);
+      CREATE AGGREGATE bounding_range_agg(iprange) (
+	SFUNC = iprange_bounds_trans, STYPE = internal,
+	FINALFUNC = iprange_bounds_final,
+	COMBINEFUNC = iprange_bounds_combine,
+	SERIALFUNC = iprange_bounds_serial,
+	DESERIALFUNC = iprange_bounds_deserial,
+	PARALLEL = SAFE);
+    ELSE
+      CREATE AGGREGATE bounding_range_agg(ip4) (
+	SFUNC = ip4r_bounds_trans_ip4, STYPE = ip4r);
+      CREATE AGGREGATE bounding_range_agg(ip4r) (
+	SFUNC = ip4r_bounds_trans, STYPE = ip4r);
+      CREATE AGGREGATE bounding_range_agg(ip6) (
+	SFUNC = ip6r_bounds_trans_ip6, STYPE = ip6r);
+      CREATE AGGREGATE bounding_range_agg(ip6r) (
+	SFUNC = ip6r_bounds_trans, STYPE = ip6r);
+      CREATE AGGREGATE bounding_range_agg(ipaddress) (
+	SFUNC = iprange_bounds_trans_ip, STYPE = internal,
+	FINALFUNC = iprange_bounds_final);
+      CREATE AGGREGATE bounding_range_agg(iprange) (
+	SFUNC = iprange_bounds_trans, STYPE = internal,
+	FINALFUNC = iprange_bounds_final);
+    END IF;
+  END;
+$s$;
+
+-- ----------------------------------------------------------------------
+-- ipaddress_fixed, iprange_fixed
+
+-- fixed-length variants of ipaddress and iprange, trading space for not
+-- having to detoast and unpack values. Anything not defined here works via
+-- the implicit casts to ipaddress and iprange.
+
+CREATE TYPE ipaddress_fixed;
+
+CREATE FUNCTION ipaddress_fixed_in(cstring) RETURNS ipaddress_fixed AS 'MODULE_PATHNAME','ipaddr_fixed_in' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_out(ipaddress_fixed) RETURNS cstring AS 'MODULE_PATHNAME','ipaddr_fixed_out' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_recv(internal) RETURNS ipaddress_fixed AS 'MODULE_PATHNAME','ipaddr_fixed_recv' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_send(ipaddress_fixed) RETURNS bytea AS 'MODULE_PATHNAME','ipaddr_fixed_send' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE ipaddress_fixed (
+       INPUT = ipaddress_fixed_in, OUTPUT = ipaddress_fixed_out,
+       RECEIVE = ipaddress_fixed_recv, SEND = ipaddress_fixed_send,
+       INTERNALLENGTH = 17, ALIGNMENT = double
+);
+
+COMMENT ON TYPE ipaddress_fixed IS 'IPv4 or IPv6 address, fixed-length';
+
+CREATE TYPE iprange_fixed;
+
+CREATE FUNCTION iprange_fixed_in(cstring) RETURNS iprange_fixed AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_out(iprange_fixed) RETURNS cstring AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_recv(internal) RETURNS iprange_fixed AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_send(iprange_fixed) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE iprange_fixed (
+       INPUT = iprange_fixed_in, OUTPUT = iprange_fixed_out,
+       RECEIVE = iprange_fixed_recv, SEND = iprange_fixed_send,
+       INTERNALLENGTH = 33, ALIGNMENT = double
+);
+
+COMMENT ON TYPE iprange_fixed IS 'IPv4 or IPv6 range, fixed-length';
+
+CREATE FUNCTION ipaddress_fixed(ipaddress) RETURNS ipaddress_fixed AS 'MODULE_PATHNAME','ipaddr_fixed_cast_from_ipaddr' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed(ip4) RETURNS ipaddress_fixed AS 'MODULE_PATHNAME','ipaddr_fixed_cast_from_ip4' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed(ip6) RETURNS ipaddress_fixed AS 'MODULE_PATHNAME','ipaddr_fixed_cast_from_ip6' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress(ipaddress_fixed) RETURNS ipaddress AS 'MODULE_PATHNAME','ipaddr_fixed_cast_to_ipaddr' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed(iprange) RETURNS iprange_fixed AS 'MODULE_PATHNAME','iprange_fixed_cast_from_iprange' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed(ip4r) RETURNS iprange_fixed AS 'MODULE_PATHNAME','iprange_fixed_cast_from_ip4r' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed(ip6r) RETURNS iprange_fixed AS 'MODULE_PATHNAME','iprange_fixed_cast_from_ip6r' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed(ipaddress_fixed) RETURNS iprange_fixed AS 'MODULE_PATHNAME','iprange_fixed_cast_from_ipaddr_fixed' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange(iprange_fixed) RETURNS iprange AS 'MODULE_PATHNAME','iprange_fixed_cast_to_iprange' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange(ipaddress_fixed) RETURNS iprange AS 'MODULE_PATHNAME','iprange_cast_from_ipaddr_fixed' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE CAST (ipaddress_fixed as ipaddress) WITH FUNCTION ipaddress(ipaddress_fixed) AS IMPLICIT;
+CREATE CAST (ipaddress_fixed as iprange_fixed) WITH FUNCTION iprange_fixed(ipaddress_fixed) AS IMPLICIT;
+CREATE CAST (iprange_fixed as iprange) WITH FUNCTION iprange(iprange_fixed) AS IMPLICIT;
+
+CREATE CAST (ipaddress as ipaddress_fixed) WITH FUNCTION ipaddress_fixed(ipaddress) AS ASSIGNMENT;
+CREATE CAST (ip4 as ipaddress_fixed) WITH FUNCTION ipaddress_fixed(ip4) AS ASSIGNMENT;
+CREATE CAST (ip6 as ipaddress_fixed) WITH FUNCTION ipaddress_fixed(ip6) AS ASSIGNMENT;
+CREATE CAST (iprange as iprange_fixed) WITH FUNCTION iprange_fixed(iprange) AS ASSIGNMENT;
+CREATE CAST (ip4r as iprange_fixed) WITH FUNCTION iprange_fixed(ip4r) AS ASSIGNMENT;
+CREATE CAST (ip6r as iprange_fixed) WITH FUNCTION iprange_fixed(ip6r) AS ASSIGNMENT;
+
+CREATE FUNCTION iprange_fixed_contained_by(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_contained_by_strict(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_contains(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_contains_strict(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_overlaps(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR <<= ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_contained_by,        COMMUTATOR = '>>=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR <<  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_contained_by_strict, COMMUTATOR = '>>',  RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR >>= ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_contains,            COMMUTATOR = '<<=', RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR >>  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_contains_strict,     COMMUTATOR = '<<',  RESTRICT = contsel, JOIN = contjoinsel );
+CREATE OPERATOR &&  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_overlaps,            COMMUTATOR = '&&',  RESTRICT = areasel, JOIN = areajoinsel );
+
+CREATE FUNCTION ipaddress_fixed_eq(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_eq' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_neq(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_neq' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_lt(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_lt' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_le(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_le' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_gt(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_gt' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_ge(ipaddress_fixed,ipaddress_fixed) RETURNS bool AS 'MODULE_PATHNAME','ipaddr_fixed_ge' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_cmp(ipaddress_fixed,ipaddress_fixed) RETURNS integer AS 'MODULE_PATHNAME','ipaddr_fixed_cmp' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR =  ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_eq,  COMMUTATOR = '=',  NEGATOR = '<>', RESTRICT = eqsel, JOIN = eqjoinsel, SORT1 = '<', SORT2 = '<', HASHES );
+CREATE OPERATOR <> ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_neq, COMMUTATOR = '<>', NEGATOR = '=',  RESTRICT = neqsel, JOIN = neqjoinsel );
+CREATE OPERATOR <  ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_lt,  COMMUTATOR = '>',  NEGATOR = '>=', RESTRICT = scalarltsel, JOIN = scalarltjoinsel );
+CREATE OPERATOR <= ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_le,  COMMUTATOR = '>=', NEGATOR = '>',  RESTRICT = scalarltsel, JOIN = scalarltjoinsel );
+CREATE OPERATOR >  ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_gt,  COMMUTATOR = '<',  NEGATOR = '<=', RESTRICT = scalargtsel, JOIN = scalargtjoinsel );
+CREATE OPERATOR >= ( LEFTARG = ipaddress_fixed, RIGHTARG = ipaddress_fixed, PROCEDURE = ipaddress_fixed_ge,  COMMUTATOR = '<=', NEGATOR = '<',  RESTRICT = scalargtsel, JOIN = scalargtjoinsel );
+
+CREATE FUNCTION iprange_fixed_eq(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_neq(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_lt(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_le(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_gt(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_ge(iprange_fixed,iprange_fixed) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_cmp(iprange_fixed,iprange_fixed) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR =  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_eq,  COMMUTATOR = '=',  NEGATOR = '<>', RESTRICT = eqsel, JOIN = eqjoinsel, SORT1 = '<', SORT2 = '<', HASHES );
+CREATE OPERATOR <> ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_neq, COMMUTATOR = '<>', NEGATOR = '=',  RESTRICT = neqsel, JOIN = neqjoinsel );
+CREATE OPERATOR <  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_lt,  COMMUTATOR = '>',  NEGATOR = '>=', RESTRICT = scalarltsel, JOIN = scalarltjoinsel );
+CREATE OPERATOR <= ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_le,  COMMUTATOR = '>=', NEGATOR = '>',  RESTRICT = scalarltsel, JOIN = scalarltjoinsel );
+CREATE OPERATOR >  ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_gt,  COMMUTATOR = '<',  NEGATOR = '<=', RESTRICT = scalargtsel, JOIN = scalargtjoinsel );
+CREATE OPERATOR >= ( LEFTARG = iprange_fixed, RIGHTARG = iprange_fixed, PROCEDURE = iprange_fixed_ge,  COMMUTATOR = '<=', NEGATOR = '<',  RESTRICT = scalargtsel, JOIN = scalargtjoinsel );
+
+CREATE OPERATOR CLASS btree_ipaddress_fixed_ops DEFAULT FOR TYPE ipaddress_fixed USING btree AS
+       OPERATOR	1	< ,
+       OPERATOR	2	<= ,
+       OPERATOR	3	= ,
+       OPERATOR	4	>= ,
+       OPERATOR	5	> ,
+       FUNCTION	1	ipaddress_fixed_cmp(ipaddress_fixed, ipaddress_fixed);
+
+CREATE OPERATOR CLASS btree_iprange_fixed_ops DEFAULT FOR TYPE iprange_fixed USING btree AS
+       OPERATOR	1	< ,
+       OPERATOR	2	<= ,
+       OPERATOR	3	= ,
+       OPERATOR	4	>= ,
+       OPERATOR	5	> ,
+       FUNCTION	1	iprange_fixed_cmp(iprange_fixed, iprange_fixed);
+
+-- these hash to the same values as the ipaddress and iprange hash functions
+
+CREATE FUNCTION ipaddress_fixed_hash(ipaddress_fixed) RETURNS integer AS 'MODULE_PATHNAME','ipaddr_fixed_hash' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_fixed_hash_extended(ipaddress_fixed,bigint) RETURNS bigint AS 'MODULE_PATHNAME','ipaddr_fixed_hash_extended' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_hash(iprange_fixed) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_fixed_hash_extended(iprange_fixed,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS hash_ipaddress_fixed_ops DEFAULT FOR TYPE ipaddress_fixed USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ipaddress_fixed_hash(ipaddress_fixed);
+
+CREATE OPERATOR CLASS hash_iprange_fixed_ops DEFAULT FOR TYPE iprange_fixed USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	iprange_fixed_hash(iprange_fixed);
+
+-- the index keys are stored as iprange, and most of the support functions
+-- are shared with gist_iprange_ops.
+
+CREATE FUNCTION gipr_fixed_consistent(internal,iprange_fixed,int2,oid,internal) RETURNS bool AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION gipr_fixed_compress(internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION gipr_fixed_fetch(internal) RETURNS internal AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE OPERATOR CLASS gist_iprange_fixed_ops DEFAULT FOR TYPE iprange_fixed USING gist AS
+       OPERATOR	1	>>= ,
+       OPERATOR	2	<<= ,
+       OPERATOR	3	>> ,
+       OPERATOR	4	<< ,
+       OPERATOR	5	&& ,
+       OPERATOR	6	= ,
+       FUNCTION	1	gipr_fixed_consistent (internal, iprange_fixed, int2, oid, internal),
+       FUNCTION	2	gipr_union (internal, internal),
+       FUNCTION	3	gipr_fixed_compress (internal),
+       FUNCTION	4	gipr_decompress (internal),
+       FUNCTION	5	gipr_penalty (internal, internal, internal),
+       FUNCTION	6	gipr_picksplit (internal, internal),
+       FUNCTION	7	gipr_same (iprange, iprange, internal),
+       STORAGE	iprange;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90500 THEN
+      ALTER OPERATOR FAMILY gist_iprange_fixed_ops USING gist ADD
+	     FUNCTION	9  (iprange_fixed,iprange_fixed)	gipr_fixed_fetch (internal);
+    END IF;
+    IF pg_ver >= 110000 THEN
+      ALTER OPERATOR FAMILY hash_ipaddress_fixed_ops USING hash
+        ADD FUNCTION 2 ipaddress_fixed_hash_extended(ipaddress_fixed,bigint);
+      ALTER OPERATOR FAMILY hash_iprange_fixed_ops USING hash
+        ADD FUNCTION 2 iprange_fixed_hash_extended(iprange_fixed,bigint);
+    END IF;
+  END;
+$s$;
+
+-- ----------------------------------------------------------------------
+-- sort keys
+
+-- byte-comparable encodings of ipaddress and iprange; bytea comparison of
+-- the keys matches the btree ordering of the values.
+
+CREATE FUNCTION ipaddress_sortkey(ipaddress) RETURNS bytea AS 'MODULE_PATHNAME','ipaddr_sortkey' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_from_sortkey(bytea) RETURNS ipaddress AS 'MODULE_PATHNAME','ipaddr_from_sortkey' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_sortkey(iprange) RETURNS bytea AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_from_sortkey(bytea) RETURNS iprange AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+-- ----------------------------------------------------------------------
+-- gist index statistics
+
+CREATE FUNCTION ip_gist_stats(index regclass,
+                              OUT level integer, OUT leaf boolean,
+                              OUT pages bigint, OUT tuples bigint,
+                              OUT avg_fill float8, OUT avg_key_bytes float8,
+                              OUT ip4_keys bigint, OUT ip6_keys bigint,
+                              OUT fmt0_keys bigint, OUT fmt8_keys bigint,
+                              OUT fmt9_keys bigint, OUT fmt17_keys bigint,
+                              OUT fmt32_keys bigint,
+                              OUT overlap4 float8, OUT overlap6 float8,
+                              OUT probe4 float8, OUT probe6 float8)
+  RETURNS SETOF record AS 'MODULE_PATHNAME' LANGUAGE C STRICT;
+
+-- ----------------------------------------------------------------------
+-- prefix hash opclasses
+
+-- these hash only the leading bits of the address, so that hash
+-- partitioning keeps each network in one partition. They are not default,
+-- and are created after the default hash opclasses, since the planner uses
+-- the first hash opfamily it finds for = in hash joins and aggregation.
+
+CREATE FUNCTION ip4_prefix8_hash(ip4) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4_prefix16_hash(ip4) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4_prefix24_hash(ip4) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix32_hash(ip6) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix48_hash(ip6) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix64_hash(ip6) RETURNS integer AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix16_32_hash(ipaddress) RETURNS integer AS 'MODULE_PATHNAME','ipaddr_prefix16_32_hash' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix24_48_hash(ipaddress) RETURNS integer AS 'MODULE_PATHNAME','ipaddr_prefix24_48_hash' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix24_64_hash(ipaddress) RETURNS integer AS 'MODULE_PATHNAME','ipaddr_prefix24_64_hash' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION ip4_prefix8_hash_extended(ip4,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4_prefix16_hash_extended(ip4,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip4_prefix24_hash_extended(ip4,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix32_hash_extended(ip6,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix48_hash_extended(ip6,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6_prefix64_hash_extended(ip6,bigint) RETURNS bigint AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix16_32_hash_extended(ipaddress,bigint) RETURNS bigint AS 'MODULE_PATHNAME','ipaddr_prefix16_32_hash_extended' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix24_48_hash_extended(ipaddress,bigint) RETURNS bigint AS 'MODULE_PATHNAME','ipaddr_prefix24_48_hash_extended' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ipaddress_prefix24_64_hash_extended(ipaddress,bigint) RETURNS bigint AS 'MODULE_PATHNAME','ipaddr_prefix24_64_hash_extended' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS hash_ip4_prefix8_ops FOR TYPE ip4 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip4_prefix8_hash(ip4);
+
+CREATE OPERATOR CLASS hash_ip4_prefix16_ops FOR TYPE ip4 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip4_prefix16_hash(ip4);
+
+CREATE OPERATOR CLASS hash_ip4_prefix24_ops FOR TYPE ip4 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip4_prefix24_hash(ip4);
+
+CREATE OPERATOR CLASS hash_ip6_prefix32_ops FOR TYPE ip6 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip6_prefix32_hash(ip6);
+
+CREATE OPERATOR CLASS hash_ip6_prefix48_ops FOR TYPE ip6 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip6_prefix48_hash(ip6);
+
+CREATE OPERATOR CLASS hash_ip6_prefix64_ops FOR TYPE ip6 USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ip6_prefix64_hash(ip6);
+
+CREATE OPERATOR CLASS hash_ipaddress_prefix16_32_ops FOR TYPE ipaddress USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ipaddress_prefix16_32_hash(ipaddress);
+
+CREATE OPERATOR CLASS hash_ipaddress_prefix24_48_ops FOR TYPE ipaddress USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ipaddress_prefix24_48_hash(ipaddress);
+
+CREATE OPERATOR CLASS hash_ipaddress_prefix24_64_ops FOR TYPE ipaddress USING hash AS
+       OPERATOR	1	= ,
+       FUNCTION	1	ipaddress_prefix24_64_hash(ipaddress);
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+    r record;
+  BEGIN
+    IF pg_ver >= 110000 THEN
+      FOR r IN SELECT tname, pfx
+		 FROM (VALUES ('ip4','prefix8'), ('ip4','prefix16'), ('ip4','prefix24'),
+			      ('ip6','prefix32'), ('ip6','prefix48'), ('ip6','prefix64'),
+			      ('ipaddress','prefix16_32'),
+			      ('ipaddress','prefix24_48'),
+			      ('ipaddress','prefix24_64')) v(tname, pfx)
+      LOOP
+	EXECUTE format('ALTER OPERATOR FAMILY %I USING hash'
+		       '  ADD FUNCTION 2 %I(%I,bigint)',
+		       format('hash_%s_%s_ops', r.tname, r.pfx),
+		       format('%s_%s_hash_extended', r.tname, r.pfx),
+		       r.tname);
+      END LOOP;
+    END IF;
+  END;
+$s$;
+
+-- ----------------------------------------------------------------------
+-- call statistics
+
+-- these need ip4r in shared_preload_libraries and ip4r.track_stats on
+
+CREATE FUNCTION ip4r_stat(OUT type text, OUT operation text,
+                          OUT calls bigint, OUT rows bigint,
+                          OUT timed_calls bigint, OUT timed_ms float8)
+  RETURNS SETOF record AS 'MODULE_PATHNAME' LANGUAGE C VOLATILE;
+CREATE FUNCTION ip4r_stat_reset() RETURNS void AS 'MODULE_PATHNAME' LANGUAGE C VOLATILE;
+REVOKE EXECUTE ON FUNCTION ip4r_stat_reset() FROM PUBLIC;
+
+CREATE VIEW ip4r_stat AS SELECT * FROM ip4r_stat();
+
+-- ----------------------------------------------------------------------
+-- gist scan counts
+
+-- per-session counts of gist consistent calls, kept while
+-- ip4r.track_gist_scans is on
+
+CREATE FUNCTION ip_gist_scan_stats(OUT opclass text, OUT strategy smallint,
+                                   OUT operator text, OUT leaf boolean,
+                                   OUT pages bigint, OUT calls bigint,
+                                   OUT matches bigint, OUT rechecks bigint)
+  RETURNS SETOF record AS 'MODULE_PATHNAME' LANGUAGE C VOLATILE;
+CREATE FUNCTION ip_gist_scan_stats_reset() RETURNS void AS 'MODULE_PATHNAME' LANGUAGE C VOLATILE;
+
+-- ----------------------------------------------------------------------
+-- address extraction from text
+
+CREATE FUNCTION ip_extract(text) RETURNS SETOF ipaddress AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT ROWS 2;
+CREATE FUNCTION ip_extract_array(text) RETURNS ipaddress[] AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+-- ----------------------------------------------------------------------
+-- bulk loading
+
+-- reads a server file, so like pg_read_file this is not for PUBLIC
+
+CREATE FUNCTION iprange_load(filename text, format text, merge boolean,
+                             OUT range iprange, OUT data text)
+  RETURNS SETOF record AS 'MODULE_PATHNAME' LANGUAGE C VOLATILE STRICT;
+REVOKE EXECUTE ON FUNCTION iprange_load(text, text, boolean) FROM PUBLIC;
+
+-- containment over arrays of addresses
+
+CREATE FUNCTION contained_count(ip4[], ip4r) RETURNS bigint AS 'MODULE_PATHNAME','ip4_array_contained_count' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_mask(ip4[], ip4r) RETURNS boolean[] AS 'MODULE_PATHNAME','ip4_array_contained_mask' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_filter(ip4[], ip4r) RETURNS ip4[] AS 'MODULE_PATHNAME','ip4_array_contained_filter' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_count(ip6[], ip6r) RETURNS bigint AS 'MODULE_PATHNAME','ip6_array_contained_count' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_mask(ip6[], ip6r) RETURNS boolean[] AS 'MODULE_PATHNAME','ip6_array_contained_mask' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_filter(ip6[], ip6r) RETURNS ip6[] AS 'MODULE_PATHNAME','ip6_array_contained_filter' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_count(ipaddress[], iprange) RETURNS bigint AS 'MODULE_PATHNAME','ipaddr_array_contained_count' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_mask(ipaddress[], iprange) RETURNS boolean[] AS 'MODULE_PATHNAME','ipaddr_array_contained_mask' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION contained_filter(ipaddress[], iprange) RETURNS ipaddress[] AS 'MODULE_PATHNAME','ipaddr_array_contained_filter' LANGUAGE C IMMUTABLE STRICT;
+
+-- disjoint_agg
+
+CREATE FUNCTION iprange_disjoint_final(internal) RETURNS boolean AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE;
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      CREATE AGGREGATE disjoint_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_disjoint_final,
+	COMBINEFUNC = iprange_cidr_agg_combine,
+	SERIALFUNC = iprange_cidr_agg_serial,
+	DESERIALFUNC = iprange_cidr_agg_deserial,
+	PARALLEL = SAFE);
+    ELSE
+      CREATE AGGREGATE disjoint_agg(iprange) (
+	SFUNC = iprange_cidr_agg_trans, STYPE = internal,
+	FINALFUNC = iprange_disjoint_final);
+    END IF;
+  END;
+$s$;
+
+-- longest-prefix match ordering
+
+CREATE FUNCTION ip4r_lpm_distance(ip4r,ip4r) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION ip6r_lpm_distance(ip6r,ip6r) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iprange_lpm_distance(iprange,iprange) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR <-> ( LEFTARG = ip4r,    RIGHTARG = ip4r,    PROCEDURE = ip4r_lpm_distance );
+CREATE OPERATOR <-> ( LEFTARG = ip6r,    RIGHTARG = ip6r,    PROCEDURE = ip6r_lpm_distance );
+CREATE OPERATOR <-> ( LEFTARG = iprange, RIGHTARG = iprange, PROCEDURE = iprange_lpm_distance );
+
+CREATE FUNCTION gip4r_distance(internal,ip4r,int2,oid,internal) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION gip6r_distance(internal,ip6r,int2,oid,internal) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION gipr_distance(internal,iprange,int2,oid,internal) RETURNS double precision AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT;
+
+ALTER OPERATOR FAMILY gist_ip4r_ops USING gist ADD
+       OPERATOR	7	<-> (ip4r, ip4r) FOR ORDER BY pg_catalog.float_ops,
+       FUNCTION	8	(ip4r, ip4r) gip4r_distance (internal, ip4r, int2, oid, internal);
+ALTER OPERATOR FAMILY gist_ip6r_ops USING gist ADD
+       OPERATOR	7	<-> (ip6r, ip6r) FOR ORDER BY pg_catalog.float_ops,
+       FUNCTION	8	(ip6r, ip6r) gip6r_distance (internal, ip6r, int2, oid, internal);
+ALTER OPERATOR FAMILY gist_iprange_ops USING gist ADD
+       OPERATOR	7	<-> (iprange, iprange) FOR ORDER BY pg_catalog.float_ops,
+       FUNCTION	8	(iprange, iprange) gipr_distance (internal, iprange, int2, oid, internal);
+
+DO $s$
+  DECLARE
+    pg_ver integer := current_setting('server_version_num')::integer;
+    r record;
+  BEGIN
+    IF pg_ver >= 90600 THEN
+      -- Functions are marked parallel safe only if listed here (those
+      -- from earlier versions were marked by their own scripts); anything
+      -- that depends on per-backend state, writes to shared memory or has
+      -- other side effects must be left out.
+      FOR r IN SELECT fsig
+		 FROM UNNEST(ARRAY[
+			'ip4set_in(cstring)', 'ip4set_out(ip4set)',
+			'ip4set_recv(internal)', 'ip4set_send(ip4set)',
+			'ip4set(ip4)', 'ip4set(ip4r)', 'cardinality(ip4set)',
+			'ranges(ip4set)', 'ip4set_union(ip4set,ip4set)',
+			'ip4set_inter(ip4set,ip4set)',
+			'ip4set_minus(ip4set,ip4set)',
+			'ip4set_eq(ip4set,ip4set)',
+			'ip4set_neq(ip4set,ip4set)',
+			'ip4set_contains(ip4set,ip4set)',
+			'ip4set_contains(ip4set,ip4r)',
+			'ip4set_contains(ip4set,ip4)',
+			'ip4set_contained_by(ip4set,ip4set)',
+			'ip4set_contained_by(ip4r,ip4set)',
+			'ip4set_contained_by(ip4,ip4set)',
+			'ip4set_overlaps(ip4set,ip4set)',
+			'ip4set_overlaps(ip4set,ip4r)',
+			'ip4set_overlaps(ip4r,ip4set)',
+			'ip4set_agg_trans(internal,ip4)',
+			'ip4set_agg_trans(internal,ip4r)',
+			'ip4set_agg_trans(internal,ip4set)',
+			'ip4set_agg_final(internal)',
+			'ip4set_agg_combine(internal,internal)',
+			'ip4set_agg_serial(internal)',
+			'ip4set_agg_deserial(bytea,internal)',
+			'ipmap_in(cstring)', 'ipmap_out(ipmap)',
+			'ipmap_recv(internal)', 'ipmap_send(ipmap)',
+			'map_size(ipmap)', 'map_lookup(ipmap,ip4)',
+			'map_lookup(ipmap,ip6)',
+			'map_lookup(ipmap,ipaddress)',
+			'ipmap_agg_trans(internal,iprange,bigint)',
+			'ipmap_agg_final(internal)',
+			'ipmap_agg_combine(internal,internal)',
+			'ipmap_agg_serial(internal)',
+			'ipmap_agg_deserial(bytea,internal)',
+			'cidr_split_array(ip4r)', 'cidr_split_array(ip6r)',
+			'cidr_split_array(iprange)',
+			'range_gaps(iprange,iprange[])',
+			'cidr_gaps(iprange,iprange[],integer)',
+			'iprange_cidr_agg_trans(internal,iprange)',
+			'iprange_cidr_agg_final(internal)',
+			'iprange_cidr_agg_combine(internal,internal)',
+			'iprange_cidr_agg_serial(internal)',
+			'iprange_cidr_agg_deserial(bytea,internal)',
+			'iprange_union_size_final(internal)',
+			'ip4r_bounds_trans(ip4r,ip4r)',
+			'ip4r_bounds_trans_ip4(ip4r,ip4)',
+			'ip6r_bounds_trans(ip6r,ip6r)',
+			'ip6r_bounds_trans_ip6(ip6r,ip6)',
+			'iprange_bounds_trans(internal,iprange)',
+			'iprange_bounds_trans_ip(internal,ipaddress)',
+			'iprange_bounds_final(internal)',
+			'iprange_bounds_combine(internal,internal)',
+			'iprange_bounds_serial(internal)',
+			'iprange_bounds_deserial(bytea,internal)',
+			'ipaddress_fixed_in(cstring)',
+			'ipaddress_fixed_out(ipaddress_fixed)',
+			'ipaddress_fixed_recv(internal)',
+			'ipaddress_fixed_send(ipaddress_fixed)',
+			'iprange_fixed_in(cstring)',
+			'iprange_fixed_out(iprange_fixed)',
+			'iprange_fixed_recv(internal)',
+			'iprange_fixed_send(iprange_fixed)',
+			'ipaddress_fixed(ipaddress)', 'ipaddress_fixed(ip4)',
+			'ipaddress_fixed(ip6)', 'ipaddress(ipaddress_fixed)',
+			'iprange_fixed(iprange)', 'iprange_fixed(ip4r)',
+			'iprange_fixed(ip6r)',
+			'iprange_fixed(ipaddress_fixed)',
+			'iprange(iprange_fixed)', 'iprange(ipaddress_fixed)',
+			'iprange_fixed_contained_by(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_contained_by_strict(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_contains(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_contains_strict(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_overlaps(iprange_fixed,iprange_fixed)',
+			'ipaddress_fixed_eq(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_neq(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_lt(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_le(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_gt(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_ge(ipaddress_fixed,ipaddress_fixed)',
+			'ipaddress_fixed_cmp(ipaddress_fixed,ipaddress_fixed)',
+			'iprange_fixed_eq(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_neq(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_lt(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_le(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_gt(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_ge(iprange_fixed,iprange_fixed)',
+			'iprange_fixed_cmp(iprange_fixed,iprange_fixed)',
+			'ipaddress_fixed_hash(ipaddress_fixed)',
+			'ipaddress_fixed_hash_extended(ipaddress_fixed,bigint)',
+			'iprange_fixed_hash(iprange_fixed)',
+			'iprange_fixed_hash_extended(iprange_fixed,bigint)',
+			'gipr_fixed_consistent(internal,iprange_fixed,int2,oid,internal)',
+			'gipr_fixed_compress(internal)',
+			'gipr_fixed_fetch(internal)',
+			'ipaddress_sortkey(ipaddress)',
+			'ipaddress_from_sortkey(bytea)',
+			'iprange_sortkey(iprange)',
+			'iprange_from_sortkey(bytea)',
+			'ip_gist_stats(regclass)', 'ip4_prefix8_hash(ip4)',
+			'ip4_prefix16_hash(ip4)', 'ip4_prefix24_hash(ip4)',
+			'ip6_prefix32_hash(ip6)', 'ip6_prefix48_hash(ip6)',
+			'ip6_prefix64_hash(ip6)',
+			'ipaddress_prefix16_32_hash(ipaddress)',
+			'ipaddress_prefix24_48_hash(ipaddress)',
+			'ipaddress_prefix24_64_hash(ipaddress)',
+			'ip4_prefix8_hash_extended(ip4,bigint)',
+			'ip4_prefix16_hash_extended(ip4,bigint)',
+			'ip4_prefix24_hash_extended(ip4,bigint)',
+			'ip6_prefix32_hash_extended(ip6,bigint)',
+			'ip6_prefix48_hash_extended(ip6,bigint)',
+			'ip6_prefix64_hash_extended(ip6,bigint)',
+			'ipaddress_prefix16_32_hash_extended(ipaddress,bigint)',
+			'ipaddress_prefix24_48_hash_extended(ipaddress,bigint)',
+			'ipaddress_prefix24_64_hash_extended(ipaddress,bigint)',
+			'ip_extract(text)', 'ip_extract_array(text)',
+			'contained_count(ip4[],ip4r)',
+			'contained_mask(ip4[],ip4r)',
+			'contained_filter(ip4[],ip4r)',
+			'contained_count(ip6[],ip6r)',
+			'contained_mask(ip6[],ip6r)',
+			'contained_filter(ip6[],ip6r)',
+			'contained_count(ipaddress[],iprange)',
+			'contained_mask(ipaddress[],iprange)',
+			'contained_filter(ipaddress[],iprange)',
+			'iprange_disjoint_final(internal)',
+			'ip4r_lpm_distance(ip4r,ip4r)',
+			'ip6r_lpm_distance(ip6r,ip6r)',
+			'iprange_lpm_distance(iprange,iprange)',
+			'gip4r_distance(internal,ip4r,int2,oid,internal)',
+			'gip6r_distance(internal,ip6r,int2,oid,internal)',
+			'gipr_distance(internal,iprange,int2,oid,internal)'
+		      ]::pg_catalog.regprocedure[]) u(fsig)
+      LOOP
+	EXECUTE format('ALTER FUNCTION %s PARALLEL SAFE', r.fsig);
+      END LOOP;
+      -- the call counts are batched per backend, so a worker's view of
+      -- them is incomplete; resetting writes to shared memory, so it is
+      -- left unsafe
+      ALTER FUNCTION ip4r_stat() PARALLEL RESTRICTED;
+      -- the gist scan counts are local to the session's own backend
+      ALTER FUNCTION ip_gist_scan_stats() PARALLEL RESTRICTED;
+      ALTER FUNCTION ip_gist_scan_stats_reset() PARALLEL RESTRICTED;
+      -- reads files on the server
+      ALTER FUNCTION iprange_load(text, text, boolean) PARALLEL RESTRICTED;
+    END IF;
+  END;
+$s$;
+
+-- end
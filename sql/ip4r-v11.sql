@@ -38,4 +38,16 @@ select a6,
   from ipaddrs
  where a6 is not null;
 
+-- extended hash values must agree between types for equal values
+
+select count(*) as n,
+       sum((ip4_hash_extended(a4, 42) = ipaddress_hash_extended(a, 42))::integer) as v4,
+       sum((ip6_hash_extended(a6, 42) = ipaddress_hash_extended(a, 42))::integer) as v6,
+       sum((ip4_hash_extended(a4, 42) = hashint4extended(a4::bigint::bit(32)::integer, 42))::integer) as int4
+  from ipaddrs;
+select count(*) as n,
+       sum((ip4r_hash_extended(r4, 42) = iprange_hash_extended(r, 42))::integer) as v4,
+       sum((ip6r_hash_extended(r6, 42) = iprange_hash_extended(r, 42))::integer) as v6
+  from ipranges;
+
 -- end
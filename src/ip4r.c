@@ -24,7 +24,6 @@
 /*
  * extract an IP range from text.
  */
-static
 bool ip4r_from_str(char *str, IP4R *ipr)
 {
 	char buf[IP4_STRING_MAX];
@@ -92,7 +91,6 @@ bool ip4r_from_str(char *str, IP4R *ipr)
 
 /* Output an ip range in text form
  */
-static inline
 int ip4r_to_str(IP4R *ipr, char *str, int slen)
 {
 	char buf1[IP4_STRING_MAX];
@@ -141,9 +139,7 @@ set_text_len(text *txt, int len)
 ** Input/Output routines
 */
 
-PG_FUNCTION_INFO_V1(ip4_in);
-Datum
-ip4_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4_in, IPR_STAT_PARSE, IPR_STAT_IP4, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IP4 ip;
@@ -155,9 +151,7 @@ ip4_in(PG_FUNCTION_ARGS)
 			 errmsg("invalid IP4 value: '%s'", str)));
 }
 
-PG_FUNCTION_INFO_V1(ip4_out);
-Datum
-ip4_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4_out, IPR_STAT_FORMAT, IPR_STAT_IP4, 1)
 {
 	IP4 ip = PG_GETARG_IP4(0);
 	char *out = palloc(IP4_STRING_MAX);
@@ -185,23 +179,19 @@ ip4_send(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-PG_FUNCTION_INFO_V1(ip4hash);
-Datum
-ip4hash(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4hash, IPR_STAT_HASH, IPR_STAT_IP4, 1)
 {
 	IP4 arg1 = PG_GETARG_IP4(0);
 
-	return hash_any((unsigned char *)&arg1, sizeof(IP4));
+	return hash_uint32(arg1);
 }
 
-PG_FUNCTION_INFO_V1(ip4_hash_extended);
-Datum
-ip4_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4_hash_extended, IPR_STAT_HASH, IPR_STAT_IP4, 1)
 {
 	IP4 arg1 = PG_GETARG_IP4(0);
 	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
 
-	return hash_any_extended((unsigned char *)&arg1, sizeof(IP4), seed);
+	return hash_uint32_extended(arg1, seed);
 }
 
 PG_FUNCTION_INFO_V1(ip4_cast_to_text);
@@ -468,7 +458,7 @@ ip4_net_lower(PG_FUNCTION_ARGS)
 				 errmsg("prefix length out of range")));
 	}
 
-	PG_RETURN_IP4( ip & netmask(pfxlen) );
+	PG_RETURN_IP4( ip4_net_lower_internal(ip, pfxlen) );
 }
 
 PG_FUNCTION_INFO_V1(ip4_net_upper);
@@ -485,7 +475,7 @@ ip4_net_upper(PG_FUNCTION_ARGS)
 				 errmsg("prefix length out of range")));
 	}
 
-	PG_RETURN_IP4( ip | hostmask(pfxlen) );
+	PG_RETURN_IP4( ip4_net_upper_internal(ip, pfxlen) );
 }
 
 PG_FUNCTION_INFO_V1(ip4_plus_int);
@@ -494,9 +484,9 @@ ip4_plus_int(PG_FUNCTION_ARGS)
 {
 	IP4 ip = PG_GETARG_IP4(0);
 	int addend = PG_GETARG_INT32(1);
-	IP4 result = ip + (IP4) addend;
+	IP4 result;
 
-	if ((addend < 0) != (result < ip))
+	if (!ip4_plus_int64(ip, addend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -512,17 +502,16 @@ ip4_plus_bigint(PG_FUNCTION_ARGS)
 {
 	IP4 ip = PG_GETARG_IP4(0);
 	int64 addend = PG_GETARG_INT64(1);
-	uint64 result = (uint64) ip + addend;
+	IP4 result;
 
-	if (((addend < 0) != (result < ip))
-		|| result != (uint64)(IP4)result)
+	if (!ip4_plus_int64(ip, addend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
 				 errmsg("ip address out of range")));
 	}
 
-	PG_RETURN_IP4( (IP4)(result) );
+	PG_RETURN_IP4(result);
 }
 
 PG_FUNCTION_INFO_V1(ip4_plus_numeric);
@@ -532,17 +521,16 @@ ip4_plus_numeric(PG_FUNCTION_ARGS)
 	IP4 ip = PG_GETARG_IP4(0);
 	Datum addend_num = PG_GETARG_DATUM(1);
 	int64 addend = DatumGetInt64(DirectFunctionCall1(numeric_int8,addend_num));
-	uint64 result = (uint64) ip + addend;
+	IP4 result;
 
-	if (((addend < 0) != (result < ip))
-		|| result != (uint64)(IP4)result)
+	if (!ip4_plus_int64(ip, addend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
 				 errmsg("ip address out of range")));
 	}
 
-	PG_RETURN_IP4( (IP4)(result) );
+	PG_RETURN_IP4(result);
 }
 
 PG_FUNCTION_INFO_V1(ip4_minus_int);
@@ -551,9 +539,9 @@ ip4_minus_int(PG_FUNCTION_ARGS)
 {
 	IP4 ip = PG_GETARG_IP4(0);
 	int subtrahend = PG_GETARG_INT32(1);
-	IP4 result = ip - (IP4) subtrahend;
+	IP4 result;
 
-	if ((subtrahend > 0) != (result < ip))
+	if (!ip4_minus_int64(ip, subtrahend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -569,17 +557,16 @@ ip4_minus_bigint(PG_FUNCTION_ARGS)
 {
 	IP4 ip = PG_GETARG_IP4(0);
 	int64 subtrahend = PG_GETARG_INT64(1);
-	uint64 result = (uint64) ip - subtrahend;
+	IP4 result;
 
-	if (((subtrahend > 0) != (result < ip))
-		|| result != (uint64)(IP4)result)
+	if (!ip4_minus_int64(ip, subtrahend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
 				 errmsg("ip address out of range")));
 	}
 
-	PG_RETURN_IP4( (IP4)(result) );
+	PG_RETURN_IP4(result);
 }
 
 PG_FUNCTION_INFO_V1(ip4_minus_numeric);
@@ -589,17 +576,16 @@ ip4_minus_numeric(PG_FUNCTION_ARGS)
 	IP4 ip = PG_GETARG_IP4(0);
 	Datum subtrahend_num = PG_GETARG_DATUM(1);
 	int64 subtrahend = DatumGetInt64(DirectFunctionCall1(numeric_int8,subtrahend_num));
-	uint64 result = (uint64) ip - subtrahend;
+	IP4 result;
 
-	if (((subtrahend > 0) != (result < ip))
-		|| result != (uint64)(IP4)result)
+	if (!ip4_minus_int64(ip, subtrahend, &result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
 				 errmsg("ip address out of range")));
 	}
 
-	PG_RETURN_IP4( (IP4)(result) );
+	PG_RETURN_IP4(result);
 }
 
 PG_FUNCTION_INFO_V1(ip4_minus_ip4);
@@ -655,9 +641,7 @@ ip4_not(PG_FUNCTION_ARGS)
 
 /*---- ip4r ----*/
 
-PG_FUNCTION_INFO_V1(ip4r_in);
-Datum
-ip4r_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4r_in, IPR_STAT_PARSE, IPR_STAT_IP4R, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IP4R ipr;
@@ -673,9 +657,7 @@ ip4r_in(PG_FUNCTION_ARGS)
 			 errmsg("invalid IP4R value: \"%s\"", str)));
 }
 
-PG_FUNCTION_INFO_V1(ip4r_out);
-Datum
-ip4r_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4r_out, IPR_STAT_FORMAT, IPR_STAT_IP4R, 1)
 {
 	IP4R *ipr = PG_GETARG_IP4R_P(0);
 	char *out = palloc(IP4R_STRING_MAX);
@@ -716,23 +698,19 @@ ip4r_send(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-PG_FUNCTION_INFO_V1(ip4rhash);
-Datum
-ip4rhash(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4rhash, IPR_STAT_HASH, IPR_STAT_IP4R, 1)
 {
 	IP4R *arg1 = PG_GETARG_IP4R_P(0);
 
-	return hash_any((unsigned char *)arg1, sizeof(IP4R));
+	PG_RETURN_UINT32(ipr_hash_words(arg1, 2));
 }
 
-PG_FUNCTION_INFO_V1(ip4r_hash_extended);
-Datum
-ip4r_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4r_hash_extended, IPR_STAT_HASH, IPR_STAT_IP4R, 1)
 {
 	IP4R *arg1 = PG_GETARG_IP4R_P(0);
 	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
 
-	return hash_any_extended((unsigned char *)arg1, sizeof(IP4R), seed);
+	PG_RETURN_INT64((int64) ipr_hash_words_extended(arg1, 2, seed));
 }
 
 PG_FUNCTION_INFO_V1(ip4r_cast_to_text);
@@ -1001,30 +979,32 @@ PG_FUNCTION_INFO_V1(ip4r_cidr_split);
 Datum
 ip4r_cidr_split(PG_FUNCTION_ARGS)
 {
-	FuncCallContext *funcctx;
-	IP4R *val;
-	IP4R *res;
+	IP4R *in = PG_GETARG_IP4R_P(0);
+	IP4R res[IP4R_MAX_CIDRS];
+	Datum values[IP4R_MAX_CIDRS];
+	int n = ip4r_split_cidrs(in, res);
+	int i;
 
-	if (SRF_IS_FIRSTCALL())
-	{
-		IP4R *in = PG_GETARG_IP4R_P(0);
-		funcctx = SRF_FIRSTCALL_INIT();
-		val = MemoryContextAlloc(funcctx->multi_call_memory_ctx,
-								 sizeof(IP4R));
-		*val = *in;
-		funcctx->user_fctx = val;
-	}
+	for (i = 0; i < n; ++i)
+		values[i] = IP4RPGetDatum(&res[i]);
+
+	return ipr_return_materialized(fcinfo, values, n);
+}
 
-	funcctx = SRF_PERCALL_SETUP();
-	val = funcctx->user_fctx;
-	if (!val)
-		SRF_RETURN_DONE(funcctx);
+PG_FUNCTION_INFO_V1(ip4r_cidr_split_array);
+Datum
+ip4r_cidr_split_array(PG_FUNCTION_ARGS)
+{
+	IP4R *in = PG_GETARG_IP4R_P(0);
+	IP4R res[IP4R_MAX_CIDRS];
+	Datum values[IP4R_MAX_CIDRS];
+	int n = ip4r_split_cidrs(in, res);
+	int i;
 
-	res = palloc(sizeof(IP4R));
-	if (ip4r_split_cidr(val, res))
-		funcctx->user_fctx = NULL;
+	for (i = 0; i < n; ++i)
+		values[i] = IP4RPGetDatum(&res[i]);
 
-	SRF_RETURN_NEXT(funcctx, IP4RPGetDatum(res));
+	return ipr_return_array(fcinfo, values, n);
 }
 
 /*
@@ -1197,6 +1177,63 @@ ip4r_union(PG_FUNCTION_ARGS)
 	PG_RETURN_IP4R_P(res);
 }
 
+/*
+ * bounding_range_agg support. The state is a plain ip4r, which is
+ * updated in place; the range version also serves as the combine function.
+ */
+
+PG_FUNCTION_INFO_V1(ip4r_bounds_trans);
+Datum
+ip4r_bounds_trans(PG_FUNCTION_ARGS)
+{
+	IP4R *state = PG_GETARG_IP4R_P(0);
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "bounding_range_agg called in non-aggregate context");
+
+	ip4r_union_internal(state, PG_GETARG_IP4R_P(1), state);
+
+	PG_RETURN_IP4R_P(state);
+}
+
+PG_FUNCTION_INFO_V1(ip4r_bounds_trans_ip4);
+Datum
+ip4r_bounds_trans_ip4(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	IP4R *state;
+	IP4 ip;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "bounding_range_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_IP4R_P(PG_GETARG_IP4R_P(0));
+	}
+
+	ip = PG_GETARG_IP4(1);
+
+	if (PG_ARGISNULL(0))
+	{
+		state = MemoryContextAlloc(aggcontext, sizeof(IP4R));
+		state->lower = ip;
+		state->upper = ip;
+	}
+	else
+	{
+		state = PG_GETARG_IP4R_P(0);
+		if (ip < state->lower)
+			state->lower = ip;
+		if (ip > state->upper)
+			state->upper = ip;
+	}
+
+	PG_RETURN_IP4R_P(state);
+}
+
 PG_FUNCTION_INFO_V1(ip4r_inter);
 Datum
 ip4r_inter(PG_FUNCTION_ARGS)
@@ -1218,6 +1255,24 @@ ip4r_size(PG_FUNCTION_ARGS)
 	PG_RETURN_FLOAT8(size);
 }
 
+/*
+ * The ordering operator for longest-prefix match: the size of the left
+ * range if it contains the right one, otherwise infinity, so that
+ * ORDER BY r <-> x returns the ranges containing x most specific first.
+ */
+
+PG_FUNCTION_INFO_V1(ip4r_lpm_distance);
+Datum
+ip4r_lpm_distance(PG_FUNCTION_ARGS)
+{
+	IP4R *a = PG_GETARG_IP4R_P(0);
+	IP4R *b = PG_GETARG_IP4R_P(1);
+
+	if (!ip4r_contains_internal(a, b, true))
+		PG_RETURN_FLOAT8(HUGE_VAL);
+	PG_RETURN_FLOAT8(ip4r_metric(a));
+}
+
 PG_FUNCTION_INFO_V1(ip4r_size_exact);
 Datum
 ip4r_size_exact(PG_FUNCTION_ARGS)
@@ -1242,9 +1297,7 @@ ip4r_prefixlen(PG_FUNCTION_ARGS)
  *												   Btree functions
  *****************************************************************************/
 
-PG_FUNCTION_INFO_V1(ip4r_cmp);
-Datum
-ip4r_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4r_cmp, IPR_STAT_COMPARE, IPR_STAT_IP4R, 1)
 {
 	IP4R *a = PG_GETARG_IP4R_P(0);
 	IP4R *b = PG_GETARG_IP4R_P(1);
@@ -1255,9 +1308,7 @@ ip4r_cmp(PG_FUNCTION_ARGS)
 	PG_RETURN_INT32(1);
 }
 
-PG_FUNCTION_INFO_V1(ip4_cmp);
-Datum
-ip4_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip4_cmp, IPR_STAT_COMPARE, IPR_STAT_IP4, 1)
 {
 	IP4 a = PG_GETARG_IP4(0);
 	IP4 b = PG_GETARG_IP4(1);
@@ -1361,6 +1412,7 @@ Datum gip4r_picksplit(PG_FUNCTION_ARGS);
 Datum gip4r_union(PG_FUNCTION_ARGS);
 Datum gip4r_same(PG_FUNCTION_ARGS);
 Datum gip4r_fetch(PG_FUNCTION_ARGS);
+Datum gip4r_distance(PG_FUNCTION_ARGS);
 
 static bool gip4r_leaf_consistent(IP4R * key, IP4R * query, StrategyNumber strategy);
 static bool gip4r_internal_consistent(IP4R * key, IP4R * query, StrategyNumber strategy);
@@ -1371,9 +1423,7 @@ static bool gip4r_internal_consistent(IP4R * key, IP4R * query, StrategyNumber s
 ** the predicate x op query == false, where op is the oper
 ** corresponding to strategy in the pg_amop table.
 */
-PG_FUNCTION_INFO_V1(gip4r_consistent);
-Datum
-gip4r_consistent(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_consistent, IPR_STAT_GIST_CONSISTENT, IPR_STAT_IP4R, 1)
 {
 	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	IP4R *query = (IP4R *) PG_GETARG_POINTER(1);
@@ -1395,16 +1445,38 @@ gip4r_consistent(PG_FUNCTION_ARGS)
 	else
 		retval = gip4r_internal_consistent(key, query, strategy);
 
+	if (unlikely(ipr_track_gist_scans))
+		ipr_gist_scan_count(IPR_GIST_IP4R, strategy, GIST_LEAF(entry), entry->page,
+							retval, recheck && *recheck);
+
 	PG_RETURN_BOOL(retval);
 }
 
+/*
+** The GiST Distance method, for the <-> ordering operator only.
+** A leaf gets the exact distance. Any leaf under an internal entry that
+** contains the query contains it too, and so is no smaller than the
+** query; so the query's own size is the lower bound.
+*/
+PG_FUNCTION_INFO_V1(gip4r_distance);
+Datum
+gip4r_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	IP4R *query = (IP4R *) PG_GETARG_POINTER(1);
+	IP4R *key = (IP4R *) DatumGetPointer(entry->key);
+
+	if (!ip4r_contains_internal(key, query, true))
+		PG_RETURN_FLOAT8(HUGE_VAL);
+	PG_RETURN_FLOAT8(ip4r_metric(GIST_LEAF(entry) ? key : query));
+}
+
 /*
 ** The GiST Union method for IP ranges
 ** returns the minimal bounding IP4R that encloses all the entries in entryvec
 */
-PG_FUNCTION_INFO_V1(gip4r_union);
-Datum
-gip4r_union(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_union, IPR_STAT_GIST_UNION, IPR_STAT_IP4R,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	int *sizep = (int *) PG_GETARG_POINTER(1);
@@ -1426,10 +1498,7 @@ gip4r_union(PG_FUNCTION_ARGS)
 	for (i = 1; i < numranges; i++)
 	{
 		tmp = (IP4R *) DatumGetPointer(ent[i].key);
-		if (tmp->lower < out->lower)
-			out->lower = tmp->lower;
-		if (tmp->upper > out->upper)
-			out->upper = tmp->upper;
+		ip4r_union_internal(out, tmp, out);
 	}
 
 	PG_RETURN_IP4R_P(out);
@@ -1439,23 +1508,17 @@ gip4r_union(PG_FUNCTION_ARGS)
 ** GiST Compress and Decompress methods for IP ranges
 ** do not do anything.
 */
-PG_FUNCTION_INFO_V1(gip4r_compress);
-Datum
-gip4r_compress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_compress, IPR_STAT_GIST_COMPRESS, IPR_STAT_IP4R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
 
-PG_FUNCTION_INFO_V1(gip4r_decompress);
-Datum
-gip4r_decompress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_decompress, IPR_STAT_GIST_DECOMPRESS, IPR_STAT_IP4R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
 
-PG_FUNCTION_INFO_V1(gip4r_fetch);
-Datum
-gip4r_fetch(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_fetch, IPR_STAT_GIST_FETCH, IPR_STAT_IP4R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
@@ -1464,9 +1527,7 @@ gip4r_fetch(PG_FUNCTION_ARGS)
 ** The GiST Penalty method for IP ranges
 ** As in the R-tree paper, we use change in area as our penalty metric
 */
-PG_FUNCTION_INFO_V1(gip4r_penalty);
-Datum
-gip4r_penalty(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_penalty, IPR_STAT_GIST_PENALTY, IPR_STAT_IP4R, 1)
 {
 	GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
@@ -1521,9 +1582,8 @@ gip4r_sort_compare(const void *a, const void *b)
 ** based on the box functions in rtree_gist simplified to one
 ** dimension
 */
-PG_FUNCTION_INFO_V1(gip4r_picksplit);
-Datum
-gip4r_picksplit(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_picksplit, IPR_STAT_GIST_PICKSPLIT, IPR_STAT_IP4R,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
@@ -1656,9 +1716,7 @@ gip4r_picksplit(PG_FUNCTION_ARGS)
 /*
 ** Equality methods
 */
-PG_FUNCTION_INFO_V1(gip4r_same);
-Datum
-gip4r_same(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip4r_same, IPR_STAT_GIST_SAME, IPR_STAT_IP4R, 1)
 {
 	IP4R *v1 = (IP4R *) PG_GETARG_POINTER(0);
 	IP4R *v2 = (IP4R *) PG_GETARG_POINTER(1);
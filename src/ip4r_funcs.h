@@ -123,6 +123,67 @@ bool ip4r_split_cidr(IP4R *val, IP4R *res)
 	return false;
 }
 
+/*
+ * Split a range completely; an arbitrary range needs at most two CIDRs per
+ * prefix length other than /0 (e.g. 0.0.0.1-255.255.255.254).
+ */
+
+#define IP4R_MAX_CIDRS 62
+
+static inline
+int ip4r_split_cidrs(IP4R *val, IP4R *res)
+{
+	IP4R tmp = *val;
+	int n = 0;
+
+	while (!ip4r_split_cidr(&tmp, &res[n]))
+		++n;
+
+	return n + 1;
+}
+
+/* the lowest or highest address of the prefix of length PFXLEN containing IP */
+
+static inline
+IP4 ip4_net_lower_internal(IP4 ip, unsigned pfxlen)
+{
+	return ip & netmask(pfxlen);
+}
+
+static inline
+IP4 ip4_net_upper_internal(IP4 ip, unsigned pfxlen)
+{
+	return ip | hostmask(pfxlen);
+}
+
+/* arithmetic; these return false if the result would be out of range */
+
+static inline
+bool ip4_plus_int64(IP4 ip, int64 addend, IP4 *result)
+{
+	uint64 res = (uint64) ip + addend;
+
+	if (((addend < 0) != (res < ip))
+		|| res != (uint64)(IP4)res)
+		return false;
+
+	*result = (IP4) res;
+	return true;
+}
+
+static inline
+bool ip4_minus_int64(IP4 ip, int64 subtrahend, IP4 *result)
+{
+	uint64 res = (uint64) ip - subtrahend;
+
+	if (((subtrahend > 0) != (res < ip))
+		|| res != (uint64)(IP4)res)
+		return false;
+
+	*result = (IP4) res;
+	return true;
+}
+
 /* comparisons */
 
 static inline
@@ -131,6 +192,12 @@ bool ip4_equal(IP4 a, IP4 b)
 	return (a == b);
 }
 
+static inline
+int ip4_compare(IP4 a, IP4 b)
+{
+	return (a > b) - (a < b);
+}
+
 static inline
 bool ip4_lessthan(IP4 a, IP4 b)
 {
@@ -3,6 +3,36 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include "utils/guc.h"
+
+#include "ipr_internal.h"
+
 PG_MODULE_MAGIC;
 
+PGDLLEXPORT void _PG_init(void);
+
+int ipr_binary_format = IPR_BINARY_STANDARD;
+
+static const struct config_enum_entry ipr_binary_format_options[] = {
+	{ "standard", IPR_BINARY_STANDARD, false },
+	{ "compact", IPR_BINARY_COMPACT, false },
+	{ NULL, 0, false }
+};
+
+void
+_PG_init(void)
+{
+	DefineCustomEnumVariable("ip4r.binary_format",
+							 "Sets the binary output format of ipaddress and iprange.",
+							 "Input accepts either format.",
+							 &ipr_binary_format,
+							 IPR_BINARY_STANDARD,
+							 ipr_binary_format_options,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	ipr_stats_init();
+}
+
 /* end */
@@ -0,0 +1,2023 @@
+/* ip4set.c */
+
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/elog.h"
+#include "utils/memutils.h"
+#include "utils/palloc.h"
+
+#include "ipr_internal.h"
+#include "ip4r_funcs.h"
+
+/*
+ * ip4set is a set of IPv4 addresses, stored as a roaring bitmap: the
+ * address space is split into 65536 chunks on the high 16 bits of the
+ * address, and each nonempty chunk is stored as a container in whichever
+ * of three formats is smallest for its contents:
+ *
+ *   array:  sorted uint16 low halves of the addresses (at most 4096)
+ *   bitmap: 65536 bits
+ *   run:    sorted, non-adjacent (first,last) pairs of uint16
+ *
+ * The format of each container is a function of its contents only, and
+ * all padding is zeroed, so equal sets are bytewise equal.
+ *
+ * On disk, the varlena header is followed by the container count, then
+ * a descriptor per container in key order, then the container data, each
+ * piece padded to a multiple of 8 bytes so that bitmaps can be read as
+ * uint64 words (the type has double alignment, and we always fully detoast,
+ * which gets rid of any short header).
+ */
+
+#define IP4SET_ARRAY	1
+#define IP4SET_BITMAP	2
+#define IP4SET_RUN		3
+
+#define IP4SET_ARRAY_MAX	4096
+#define IP4SET_BITMAP_WORDS	1024
+#define IP4SET_BITMAP_BYTES	(IP4SET_BITMAP_WORDS * sizeof(uint64))
+#define IP4SET_MAX_RUNS		32768
+#define IP4SET_CHUNK_SIZE	65536
+
+typedef struct IP4SetContainer
+{
+	uint16		key;		/* high 16 bits of the addresses */
+	uint16		type;		/* IP4SET_ARRAY etc. */
+	uint32		card;		/* number of addresses, 1 .. 65536 */
+	uint32		n;			/* number of array entries or runs */
+	uint32		offset;		/* offset of data from start of data area */
+} IP4SetContainer;
+
+typedef struct IP4Set
+{
+	int32		vl_len_;
+	uint32		ncontainers;
+	/* IP4SetContainer containers[ncontainers] follows, then the data */
+} IP4Set;
+
+#define IP4SET_CONTAINERS(s_) ((IP4SetContainer *) ((char *)(s_) + sizeof(IP4Set)))
+#define IP4SET_DATA(s_) ((char *) (IP4SET_CONTAINERS(s_) + (s_)->ncontainers))
+
+#define DatumGetIP4SetP(X) ((IP4Set *) PG_DETOAST_DATUM(X))
+#define IP4SetPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_IP4SET_P(n) DatumGetIP4SetP(PG_GETARG_DATUM(n))
+#define PG_RETURN_IP4SET_P(x) return IP4SetPGetDatum(x)
+
+/* a container as seen by the code below */
+
+typedef struct IP4SetChunk
+{
+	uint32		key;
+	int			type;
+	uint32		card;
+	uint32		n;
+	const void *data;
+} IP4SetChunk;
+
+static inline
+void ip4set_get_chunk(IP4Set *s, int i, IP4SetChunk *c)
+{
+	IP4SetContainer *hdr = &IP4SET_CONTAINERS(s)[i];
+
+	c->key = hdr->key;
+	c->type = hdr->type;
+	c->card = hdr->card;
+	c->n = hdr->n;
+	c->data = IP4SET_DATA(s) + hdr->offset;
+}
+
+/* index of the first container with key >= KEY */
+
+static inline
+int ip4set_lower_bound(IP4Set *s, uint32 key)
+{
+	IP4SetContainer *hdrs = IP4SET_CONTAINERS(s);
+	int lo = 0;
+	int hi = s->ncontainers;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+
+		if (hdrs[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+/**************************************************************************/
+/* Bit twiddling
+ */
+
+/* W must be nonzero */
+
+static inline
+int ip4set_ctz64(uint64 w)
+{
+#ifdef HAVE__BUILTIN_CTZ
+	return __builtin_ctzll(w);
+#else
+	int n = 0;
+
+	while (!(w & 1))
+	{
+		w >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+/* mask of the bits in word W that lie in [LO,HI] */
+
+static inline
+uint64 ip4set_word_mask(uint32 w, uint32 lo, uint32 hi)
+{
+	uint64 mask = ~UINT64CONST(0);
+
+	if ((lo >> 6) == w)
+		mask &= ~UINT64CONST(0) << (lo & 63);
+	if ((hi >> 6) == w)
+		mask &= ~UINT64CONST(0) >> (63 - (hi & 63));
+	return mask;
+}
+
+static
+void ip4set_bitmap_set_range(uint64 *bits, uint32 lo, uint32 hi)
+{
+	uint32 w;
+
+	for (w = lo >> 6; w <= (hi >> 6); ++w)
+		bits[w] |= ip4set_word_mask(w, lo, hi);
+}
+
+/*
+ * Find the next run of set bits starting at or after *POS; sets *FIRST and
+ * *LAST to its bounds and advances *POS past it. Returns false if none.
+ */
+static
+bool ip4set_bitmap_next_run(const uint64 *bits, uint32 *pos, uint32 *first, uint32 *last)
+{
+	uint32 p = *pos;
+	uint32 w;
+	uint64 word;
+
+	if (p >= IP4SET_CHUNK_SIZE)
+		return false;
+
+	w = p >> 6;
+	word = bits[w] & (~UINT64CONST(0) << (p & 63));
+	while (word == 0)
+	{
+		if (++w == IP4SET_BITMAP_WORDS)
+			return false;
+		word = bits[w];
+	}
+	*first = p = w * 64 + ip4set_ctz64(word);
+
+	word = ~bits[w] & (~UINT64CONST(0) << (p & 63));
+	while (word == 0)
+	{
+		if (++w == IP4SET_BITMAP_WORDS)
+			break;
+		word = ~bits[w];
+	}
+	p = (w == IP4SET_BITMAP_WORDS) ? IP4SET_CHUNK_SIZE : w * 64 + ip4set_ctz64(word);
+
+	*last = p - 1;
+	*pos = p;
+	return true;
+}
+
+
+/**************************************************************************/
+/* Operations on single containers
+ */
+
+/* index of the first array entry >= V */
+
+static inline
+uint32 ip4set_array_lower_bound(const uint16 *vals, uint32 n, uint32 v)
+{
+	uint32 lo = 0;
+	uint32 hi = n;
+
+	while (lo < hi)
+	{
+		uint32 mid = (lo + hi) / 2;
+
+		if (vals[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* index of the first run whose last value is >= V */
+
+static inline
+uint32 ip4set_run_lower_bound(const uint16 *runs, uint32 n, uint32 v)
+{
+	uint32 lo = 0;
+	uint32 hi = n;
+
+	while (lo < hi)
+	{
+		uint32 mid = (lo + hi) / 2;
+
+		if (runs[2*mid+1] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static
+bool ip4set_chunk_contains(const IP4SetChunk *c, uint32 v)
+{
+	switch (c->type)
+	{
+		case IP4SET_ARRAY:
+			{
+				const uint16 *vals = c->data;
+				uint32 i = ip4set_array_lower_bound(vals, c->n, v);
+
+				return i < c->n && vals[i] == v;
+			}
+
+		case IP4SET_BITMAP:
+			{
+				const uint64 *bits = c->data;
+
+				return (bits[v >> 6] >> (v & 63)) & 1;
+			}
+
+		case IP4SET_RUN:
+			{
+				const uint16 *runs = c->data;
+				uint32 i = ip4set_run_lower_bound(runs, c->n, v);
+
+				return i < c->n && runs[2*i] <= v;
+			}
+	}
+
+	return false;
+}
+
+/* all of [LO,HI] present? */
+
+static
+bool ip4set_chunk_contains_range(const IP4SetChunk *c, uint32 lo, uint32 hi)
+{
+	switch (c->type)
+	{
+		case IP4SET_ARRAY:
+			{
+				/* the entries are unique, so the range must be consecutive */
+				const uint16 *vals = c->data;
+				uint32 i = ip4set_array_lower_bound(vals, c->n, lo);
+
+				return (i + (hi - lo) < c->n
+						&& vals[i] == lo
+						&& vals[i + (hi - lo)] == hi);
+			}
+
+		case IP4SET_BITMAP:
+			{
+				const uint64 *bits = c->data;
+				uint32 w;
+
+				for (w = lo >> 6; w <= (hi >> 6); ++w)
+				{
+					uint64 mask = ip4set_word_mask(w, lo, hi);
+
+					if ((bits[w] & mask) != mask)
+						return false;
+				}
+				return true;
+			}
+
+		case IP4SET_RUN:
+			{
+				const uint16 *runs = c->data;
+				uint32 i = ip4set_run_lower_bound(runs, c->n, lo);
+
+				return i < c->n && runs[2*i] <= lo && runs[2*i+1] >= hi;
+			}
+	}
+
+	return false;
+}
+
+/* any of [LO,HI] present? */
+
+static
+bool ip4set_chunk_overlaps_range(const IP4SetChunk *c, uint32 lo, uint32 hi)
+{
+	switch (c->type)
+	{
+		case IP4SET_ARRAY:
+			{
+				const uint16 *vals = c->data;
+				uint32 i = ip4set_array_lower_bound(vals, c->n, lo);
+
+				return i < c->n && vals[i] <= hi;
+			}
+
+		case IP4SET_BITMAP:
+			{
+				const uint64 *bits = c->data;
+				uint32 w;
+
+				for (w = lo >> 6; w <= (hi >> 6); ++w)
+					if (bits[w] & ip4set_word_mask(w, lo, hi))
+						return true;
+				return false;
+			}
+
+		case IP4SET_RUN:
+			{
+				const uint16 *runs = c->data;
+				uint32 i = ip4set_run_lower_bound(runs, c->n, lo);
+
+				return i < c->n && runs[2*i] <= hi;
+			}
+	}
+
+	return false;
+}
+
+static
+void ip4set_chunk_to_bitmap(const IP4SetChunk *c, uint64 *bits)
+{
+	uint32 i;
+
+	if (c->type == IP4SET_BITMAP)
+	{
+		memcpy(bits, c->data, IP4SET_BITMAP_BYTES);
+		return;
+	}
+
+	memset(bits, 0, IP4SET_BITMAP_BYTES);
+
+	if (c->type == IP4SET_ARRAY)
+	{
+		const uint16 *vals = c->data;
+
+		for (i = 0; i < c->n; ++i)
+			bits[vals[i] >> 6] |= UINT64CONST(1) << (vals[i] & 63);
+	}
+	else
+	{
+		const uint16 *runs = c->data;
+
+		for (i = 0; i < c->n; ++i)
+			ip4set_bitmap_set_range(bits, runs[2*i], runs[2*i+1]);
+	}
+}
+
+
+/**************************************************************************/
+/* Building sets
+ *
+ * The writer accumulates containers in key order; each put function takes
+ * the contents of one chunk in some convenient format and stores it in the
+ * canonical one.
+ */
+
+typedef struct IP4SetWriter
+{
+	IP4SetContainer *hdrs;
+	int			nhdrs;
+	int			maxhdrs;
+	char	   *data;
+	Size		datalen;
+	Size		maxdata;
+} IP4SetWriter;
+
+static
+void ip4set_writer_init(IP4SetWriter *w)
+{
+	w->maxhdrs = 16;
+	w->nhdrs = 0;
+	w->hdrs = palloc(w->maxhdrs * sizeof(IP4SetContainer));
+	w->maxdata = 1024;
+	w->datalen = 0;
+	w->data = palloc(w->maxdata);
+}
+
+/* add a container header and return the (zeroed) space for its data */
+
+static
+void *ip4set_writer_emit(IP4SetWriter *w, uint32 key, int type,
+						 uint32 card, uint32 n, Size len)
+{
+	IP4SetContainer *hdr;
+	Size padded = TYPEALIGN(sizeof(uint64), len);
+	char *ptr;
+
+	if (w->nhdrs >= w->maxhdrs)
+	{
+		w->maxhdrs *= 2;
+		w->hdrs = repalloc(w->hdrs, w->maxhdrs * sizeof(IP4SetContainer));
+	}
+	if (w->datalen + padded > w->maxdata)
+	{
+		while (w->datalen + padded > w->maxdata)
+			w->maxdata *= 2;
+		w->data = repalloc(w->data, w->maxdata);
+	}
+
+	hdr = &w->hdrs[w->nhdrs++];
+	hdr->key = (uint16) key;
+	hdr->type = (uint16) type;
+	hdr->card = card;
+	hdr->n = n;
+	hdr->offset = (uint32) w->datalen;
+
+	ptr = w->data + w->datalen;
+	memset(ptr, 0, padded);
+	w->datalen += padded;
+
+	return ptr;
+}
+
+static
+IP4Set *ip4set_writer_finish(IP4SetWriter *w)
+{
+	Size hdrlen = sizeof(IP4Set) + w->nhdrs * sizeof(IP4SetContainer);
+	IP4Set *res = palloc(hdrlen + w->datalen);
+
+	SET_VARSIZE(res, hdrlen + w->datalen);
+	res->ncontainers = w->nhdrs;
+	if (w->nhdrs > 0)
+		memcpy(IP4SET_CONTAINERS(res), w->hdrs, w->nhdrs * sizeof(IP4SetContainer));
+	if (w->datalen > 0)
+		memcpy(IP4SET_DATA(res), w->data, w->datalen);
+
+	pfree(w->hdrs);
+	pfree(w->data);
+
+	return res;
+}
+
+/*
+ * Runs take 4 bytes each, array entries 2 bytes, and a bitmap 8kB; use
+ * whichever is smallest, preferring array or bitmap on ties.
+ */
+static inline
+int ip4set_choose_type(uint32 card, uint32 nruns)
+{
+	Size runlen = nruns * 2 * sizeof(uint16);
+
+	if (card <= IP4SET_ARRAY_MAX)
+		return (runlen < card * sizeof(uint16)) ? IP4SET_RUN : IP4SET_ARRAY;
+	return (runlen < IP4SET_BITMAP_BYTES) ? IP4SET_RUN : IP4SET_BITMAP;
+}
+
+/* copy a container that is already in canonical form */
+
+static
+void ip4set_put_chunk(IP4SetWriter *w, const IP4SetChunk *c)
+{
+	Size len;
+	void *ptr;
+
+	switch (c->type)
+	{
+		case IP4SET_ARRAY: len = c->n * sizeof(uint16); break;
+		case IP4SET_RUN: len = c->n * 2 * sizeof(uint16); break;
+		default: len = IP4SET_BITMAP_BYTES; break;
+	}
+
+	ptr = ip4set_writer_emit(w, c->key, c->type, c->card, c->n, len);
+	memcpy(ptr, c->data, len);
+}
+
+/* RUNS are sorted, non-overlapping and non-adjacent */
+
+static
+void ip4set_put_runs(IP4SetWriter *w, uint32 key, const uint16 *runs, uint32 nruns)
+{
+	uint32 card = 0;
+	uint32 i;
+
+	for (i = 0; i < nruns; ++i)
+		card += (uint32) runs[2*i+1] - runs[2*i] + 1;
+
+	if (card == 0)
+		return;
+
+	switch (ip4set_choose_type(card, nruns))
+	{
+		case IP4SET_RUN:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_RUN, card, nruns,
+												 nruns * 2 * sizeof(uint16));
+				memcpy(out, runs, nruns * 2 * sizeof(uint16));
+			}
+			break;
+
+		case IP4SET_ARRAY:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_ARRAY, card, card,
+												 card * sizeof(uint16));
+				uint32 k = 0;
+
+				for (i = 0; i < nruns; ++i)
+				{
+					uint32 v;
+
+					for (v = runs[2*i]; v <= runs[2*i+1]; ++v)
+						out[k++] = (uint16) v;
+				}
+			}
+			break;
+
+		case IP4SET_BITMAP:
+			{
+				uint64 *out = ip4set_writer_emit(w, key, IP4SET_BITMAP, card,
+												 IP4SET_BITMAP_WORDS, IP4SET_BITMAP_BYTES);
+
+				for (i = 0; i < nruns; ++i)
+					ip4set_bitmap_set_range(out, runs[2*i], runs[2*i+1]);
+			}
+			break;
+	}
+}
+
+/* VALS are sorted and unique; there may be more than IP4SET_ARRAY_MAX */
+
+static
+void ip4set_put_array(IP4SetWriter *w, uint32 key, const uint16 *vals, uint32 n)
+{
+	uint32 nruns;
+	uint32 i;
+
+	if (n == 0)
+		return;
+
+	for (nruns = 1, i = 1; i < n; ++i)
+		if (vals[i] != vals[i-1] + 1)
+			++nruns;
+
+	switch (ip4set_choose_type(n, nruns))
+	{
+		case IP4SET_ARRAY:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_ARRAY, n, n,
+												 n * sizeof(uint16));
+				memcpy(out, vals, n * sizeof(uint16));
+			}
+			break;
+
+		case IP4SET_RUN:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_RUN, n, nruns,
+												 nruns * 2 * sizeof(uint16));
+				uint32 k = 0;
+
+				out[0] = vals[0];
+				for (i = 1; i < n; ++i)
+				{
+					if (vals[i] != vals[i-1] + 1)
+					{
+						out[2*k+1] = vals[i-1];
+						out[2*(++k)] = vals[i];
+					}
+				}
+				out[2*k+1] = vals[n-1];
+			}
+			break;
+
+		case IP4SET_BITMAP:
+			{
+				uint64 *out = ip4set_writer_emit(w, key, IP4SET_BITMAP, n,
+												 IP4SET_BITMAP_WORDS, IP4SET_BITMAP_BYTES);
+
+				for (i = 0; i < n; ++i)
+					out[vals[i] >> 6] |= UINT64CONST(1) << (vals[i] & 63);
+			}
+			break;
+	}
+}
+
+static
+void ip4set_put_bitmap(IP4SetWriter *w, uint32 key, const uint64 *bits)
+{
+	uint32 card = 0;
+	uint32 nruns = 0;
+	uint64 carry = 0;
+	uint32 i;
+
+	for (i = 0; i < IP4SET_BITMAP_WORDS; ++i)
+	{
+		card += pg_popcount64(bits[i]);
+		/* count bits that are set but whose predecessor is not */
+		nruns += pg_popcount64(bits[i] & ~((bits[i] << 1) | carry));
+		carry = bits[i] >> 63;
+	}
+
+	if (card == 0)
+		return;
+
+	switch (ip4set_choose_type(card, nruns))
+	{
+		case IP4SET_BITMAP:
+			{
+				uint64 *out = ip4set_writer_emit(w, key, IP4SET_BITMAP, card,
+												 IP4SET_BITMAP_WORDS, IP4SET_BITMAP_BYTES);
+				memcpy(out, bits, IP4SET_BITMAP_BYTES);
+			}
+			break;
+
+		case IP4SET_ARRAY:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_ARRAY, card, card,
+												 card * sizeof(uint16));
+				uint32 k = 0;
+
+				for (i = 0; i < IP4SET_BITMAP_WORDS; ++i)
+				{
+					uint64 word = bits[i];
+
+					while (word)
+					{
+						out[k++] = (uint16) (i * 64 + ip4set_ctz64(word));
+						word &= word - 1;
+					}
+				}
+			}
+			break;
+
+		case IP4SET_RUN:
+			{
+				uint16 *out = ip4set_writer_emit(w, key, IP4SET_RUN, card, nruns,
+												 nruns * 2 * sizeof(uint16));
+				uint32 pos = 0;
+				uint32 first;
+				uint32 last;
+				uint32 k = 0;
+
+				while (ip4set_bitmap_next_run(bits, &pos, &first, &last))
+				{
+					out[2*k] = (uint16) first;
+					out[2*k+1] = (uint16) last;
+					++k;
+				}
+			}
+			break;
+	}
+}
+
+/* sort and coalesce an array of ranges in place; returns the new length */
+
+static
+int ip4set_range_cmp(const void *a, const void *b)
+{
+	const IP4R *ra = a;
+	const IP4R *rb = b;
+
+	if (ra->lower != rb->lower)
+		return (ra->lower < rb->lower) ? -1 : 1;
+	if (ra->upper != rb->upper)
+		return (ra->upper < rb->upper) ? -1 : 1;
+	return 0;
+}
+
+static
+int ip4set_normalize_ranges(IP4R *ranges, int n)
+{
+	int out = 0;
+	int i;
+
+	if (n <= 1)
+		return n;
+
+	qsort(ranges, n, sizeof(IP4R), ip4set_range_cmp);
+
+	for (i = 1; i < n; ++i)
+	{
+		if (ranges[out].upper == ~(IP4)0
+			|| ranges[i].lower <= ranges[out].upper + 1)
+		{
+			if (ranges[i].upper > ranges[out].upper)
+				ranges[out].upper = ranges[i].upper;
+		}
+		else
+			ranges[++out] = ranges[i];
+	}
+
+	return out + 1;
+}
+
+/* RANGES must be normalized */
+
+static
+IP4Set *ip4set_from_ranges(IP4R *ranges, int n)
+{
+	IP4SetWriter w;
+	uint16 *runs = NULL;
+	uint32 nruns = 0;
+	uint32 curkey = 0;
+	int i;
+
+	ip4set_writer_init(&w);
+
+	if (n > 0)
+		runs = palloc(IP4SET_MAX_RUNS * 2 * sizeof(uint16));
+
+	for (i = 0; i < n; ++i)
+	{
+		uint32 lo = ranges[i].lower;
+		uint32 hi = ranges[i].upper;
+
+		for (;;)
+		{
+			uint32 key = lo >> 16;
+			uint32 chunkhi = (key == (hi >> 16)) ? hi : (lo | 0xFFFF);
+
+			if (nruns > 0 && key != curkey)
+			{
+				ip4set_put_runs(&w, curkey, runs, nruns);
+				nruns = 0;
+			}
+			curkey = key;
+			runs[2*nruns] = (uint16) lo;
+			runs[2*nruns+1] = (uint16) chunkhi;
+			++nruns;
+
+			if (chunkhi == hi)
+				break;
+			lo = chunkhi + 1;
+		}
+	}
+
+	if (nruns > 0)
+		ip4set_put_runs(&w, curkey, runs, nruns);
+
+	if (runs)
+		pfree(runs);
+
+	return ip4set_writer_finish(&w);
+}
+
+
+/**************************************************************************/
+/* Set operations
+ */
+
+typedef enum IP4SetOp
+{
+	IP4SET_OP_UNION,
+	IP4SET_OP_INTER,
+	IP4SET_OP_MINUS
+} IP4SetOp;
+
+/* scratch space for combining chunks, allocated on first use */
+
+typedef struct IP4SetScratch
+{
+	uint64	   *bits1;
+	uint64	   *bits2;
+	uint16	   *vals;
+} IP4SetScratch;
+
+static
+void ip4set_scratch_init(IP4SetScratch *scratch)
+{
+	if (!scratch->bits1)
+	{
+		scratch->bits1 = palloc(IP4SET_BITMAP_BYTES);
+		scratch->bits2 = palloc(IP4SET_BITMAP_BYTES);
+		/* the larger of two merged arrays or a full set of runs */
+		scratch->vals = palloc(IP4SET_MAX_RUNS * 2 * sizeof(uint16));
+	}
+}
+
+static
+void ip4set_scratch_free(IP4SetScratch *scratch)
+{
+	if (scratch->bits1)
+	{
+		pfree(scratch->bits1);
+		pfree(scratch->bits2);
+		pfree(scratch->vals);
+	}
+}
+
+/* merge two arrays */
+
+static
+uint32 ip4set_merge_arrays(const uint16 *a, uint32 na, const uint16 *b, uint32 nb,
+						   IP4SetOp op, uint16 *out)
+{
+	uint32 i = 0;
+	uint32 j = 0;
+	uint32 k = 0;
+
+	while (i < na && j < nb)
+	{
+		if (a[i] < b[j])
+		{
+			if (op != IP4SET_OP_INTER)
+				out[k++] = a[i];
+			++i;
+		}
+		else if (b[j] < a[i])
+		{
+			if (op == IP4SET_OP_UNION)
+				out[k++] = b[j];
+			++j;
+		}
+		else
+		{
+			if (op != IP4SET_OP_MINUS)
+				out[k++] = a[i];
+			++i;
+			++j;
+		}
+	}
+
+	if (op != IP4SET_OP_INTER)
+		while (i < na)
+			out[k++] = a[i++];
+	if (op == IP4SET_OP_UNION)
+		while (j < nb)
+			out[k++] = b[j++];
+
+	return k;
+}
+
+/* union of two run lists, coalescing as we go */
+
+static
+uint32 ip4set_union_runs(const uint16 *a, uint32 na, const uint16 *b, uint32 nb,
+						 uint16 *out)
+{
+	uint32 i = 0;
+	uint32 j = 0;
+	uint32 k = 0;
+
+	while (i < na || j < nb)
+	{
+		const uint16 *r;
+
+		if (j >= nb || (i < na && a[2*i] <= b[2*j]))
+			r = &a[2*(i++)];
+		else
+			r = &b[2*(j++)];
+
+		if (k > 0 && (uint32) r[0] <= (uint32) out[2*k-1] + 1)
+		{
+			if (r[1] > out[2*k-1])
+				out[2*k-1] = r[1];
+		}
+		else
+		{
+			out[2*k] = r[0];
+			out[2*k+1] = r[1];
+			++k;
+		}
+	}
+
+	return k;
+}
+
+/*
+ * keep the values of array chunk A that are (or are not) in chunk B; with
+ * OUT null, just count them
+ */
+
+static
+uint32 ip4set_filter_array(const IP4SetChunk *a, const IP4SetChunk *b,
+						   bool keep_present, uint16 *out)
+{
+	const uint16 *vals = a->data;
+	uint32 i;
+	uint32 k = 0;
+
+	for (i = 0; i < a->n; ++i)
+		if (ip4set_chunk_contains(b, vals[i]) == keep_present)
+		{
+			if (out)
+				out[k] = vals[i];
+			++k;
+		}
+
+	return k;
+}
+
+static
+void ip4set_combine_chunks(IP4SetWriter *w, const IP4SetChunk *a, const IP4SetChunk *b,
+						   IP4SetOp op, IP4SetScratch *scratch)
+{
+	uint32 i;
+	uint32 n;
+
+	/* full chunks are common with large ranges */
+	switch (op)
+	{
+		case IP4SET_OP_UNION:
+			if (a->card == IP4SET_CHUNK_SIZE || b->card == IP4SET_CHUNK_SIZE)
+			{
+				ip4set_put_chunk(w, (a->card == IP4SET_CHUNK_SIZE) ? a : b);
+				return;
+			}
+			break;
+		case IP4SET_OP_INTER:
+			if (a->card == IP4SET_CHUNK_SIZE || b->card == IP4SET_CHUNK_SIZE)
+			{
+				ip4set_put_chunk(w, (a->card == IP4SET_CHUNK_SIZE) ? b : a);
+				return;
+			}
+			break;
+		case IP4SET_OP_MINUS:
+			if (b->card == IP4SET_CHUNK_SIZE)
+				return;
+			break;
+	}
+
+	ip4set_scratch_init(scratch);
+
+	if (a->type == IP4SET_ARRAY && b->type == IP4SET_ARRAY)
+	{
+		n = ip4set_merge_arrays(a->data, a->n, b->data, b->n, op, scratch->vals);
+		ip4set_put_array(w, a->key, scratch->vals, n);
+		return;
+	}
+
+	if (a->type == IP4SET_ARRAY && op != IP4SET_OP_UNION)
+	{
+		n = ip4set_filter_array(a, b, (op == IP4SET_OP_INTER), scratch->vals);
+		ip4set_put_array(w, a->key, scratch->vals, n);
+		return;
+	}
+
+	if (b->type == IP4SET_ARRAY && op == IP4SET_OP_INTER)
+	{
+		n = ip4set_filter_array(b, a, true, scratch->vals);
+		ip4set_put_array(w, a->key, scratch->vals, n);
+		return;
+	}
+
+	if (a->type == IP4SET_RUN && b->type == IP4SET_RUN && op == IP4SET_OP_UNION)
+	{
+		n = ip4set_union_runs(a->data, a->n, b->data, b->n, scratch->vals);
+		ip4set_put_runs(w, a->key, scratch->vals, n);
+		return;
+	}
+
+	ip4set_chunk_to_bitmap(a, scratch->bits1);
+	ip4set_chunk_to_bitmap(b, scratch->bits2);
+
+	for (i = 0; i < IP4SET_BITMAP_WORDS; ++i)
+	{
+		switch (op)
+		{
+			case IP4SET_OP_UNION: scratch->bits1[i] |= scratch->bits2[i]; break;
+			case IP4SET_OP_INTER: scratch->bits1[i] &= scratch->bits2[i]; break;
+			case IP4SET_OP_MINUS: scratch->bits1[i] &= ~scratch->bits2[i]; break;
+		}
+	}
+
+	ip4set_put_bitmap(w, a->key, scratch->bits1);
+}
+
+static
+IP4Set *ip4set_combine(IP4Set *a, IP4Set *b, IP4SetOp op)
+{
+	IP4SetWriter w;
+	IP4SetScratch scratch = { NULL, NULL, NULL };
+	int na = a->ncontainers;
+	int nb = b->ncontainers;
+	int i = 0;
+	int j = 0;
+
+	ip4set_writer_init(&w);
+
+	while (i < na || j < nb)
+	{
+		IP4SetChunk ca;
+		IP4SetChunk cb;
+
+		if (i < na)
+			ip4set_get_chunk(a, i, &ca);
+		if (j < nb)
+			ip4set_get_chunk(b, j, &cb);
+
+		if (j >= nb || (i < na && ca.key < cb.key))
+		{
+			if (op != IP4SET_OP_INTER)
+				ip4set_put_chunk(&w, &ca);
+			++i;
+		}
+		else if (i >= na || cb.key < ca.key)
+		{
+			if (op == IP4SET_OP_UNION)
+				ip4set_put_chunk(&w, &cb);
+			++j;
+		}
+		else
+		{
+			ip4set_combine_chunks(&w, &ca, &cb, op, &scratch);
+			++i;
+			++j;
+		}
+	}
+
+	ip4set_scratch_free(&scratch);
+
+	return ip4set_writer_finish(&w);
+}
+
+
+/**************************************************************************/
+/* Predicates
+ */
+
+static
+bool ip4set_contains_internal(IP4Set *s, IP4 ip)
+{
+	int i = ip4set_lower_bound(s, ip >> 16);
+	IP4SetChunk c;
+
+	if (i >= s->ncontainers)
+		return false;
+	ip4set_get_chunk(s, i, &c);
+	if (c.key != (ip >> 16))
+		return false;
+	return ip4set_chunk_contains(&c, ip & 0xFFFF);
+}
+
+static
+bool ip4set_contains_range_internal(IP4Set *s, IP4 lo, IP4 hi)
+{
+	uint32 firstkey = lo >> 16;
+	uint32 lastkey = hi >> 16;
+	uint32 key;
+	int i = ip4set_lower_bound(s, firstkey);
+
+	/* every chunk in the range must be present, so they are consecutive */
+	if (s->ncontainers - i < (int) (lastkey - firstkey + 1))
+		return false;
+
+	for (key = firstkey; key <= lastkey; ++key, ++i)
+	{
+		IP4SetChunk c;
+
+		ip4set_get_chunk(s, i, &c);
+		if (c.key != key
+			|| !ip4set_chunk_contains_range(&c,
+											(key == firstkey) ? (lo & 0xFFFF) : 0,
+											(key == lastkey) ? (hi & 0xFFFF) : 0xFFFF))
+			return false;
+	}
+
+	return true;
+}
+
+static
+bool ip4set_overlaps_range_internal(IP4Set *s, IP4 lo, IP4 hi)
+{
+	uint32 firstkey = lo >> 16;
+	uint32 lastkey = hi >> 16;
+	int i;
+
+	for (i = ip4set_lower_bound(s, firstkey); i < s->ncontainers; ++i)
+	{
+		IP4SetChunk c;
+
+		ip4set_get_chunk(s, i, &c);
+		if (c.key > lastkey)
+			break;
+		if (ip4set_chunk_overlaps_range(&c,
+										(c.key == firstkey) ? (lo & 0xFFFF) : 0,
+										(c.key == lastkey) ? (hi & 0xFFFF) : 0xFFFF))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * A is a subset of B (if SUBSET), or A and B overlap (if not). Both are
+ * decided chunk by chunk over the keys of A.
+ */
+static
+bool ip4set_compare_internal(IP4Set *a, IP4Set *b, bool subset)
+{
+	IP4SetScratch scratch = { NULL, NULL, NULL };
+	bool result = subset;
+	int nb = b->ncontainers;
+	int i;
+	int j = 0;
+
+	for (i = 0; i < a->ncontainers; ++i)
+	{
+		IP4SetChunk ca;
+		IP4SetChunk cb;
+		bool found = false;
+
+		ip4set_get_chunk(a, i, &ca);
+
+		j = ip4set_lower_bound(b, ca.key);
+		if (j < nb)
+		{
+			ip4set_get_chunk(b, j, &cb);
+			found = (cb.key == ca.key);
+		}
+
+		if (!found)
+		{
+			if (subset)
+			{
+				result = false;
+				break;
+			}
+			continue;
+		}
+
+		if (subset)
+		{
+			if (ca.card > cb.card)
+				result = false;
+			else if (cb.card == IP4SET_CHUNK_SIZE)
+				continue;
+			else if (ca.type == IP4SET_ARRAY)
+				result = (ip4set_filter_array(&ca, &cb, false, NULL) == 0);
+			else
+			{
+				uint32 w;
+
+				ip4set_scratch_init(&scratch);
+				ip4set_chunk_to_bitmap(&ca, scratch.bits1);
+				ip4set_chunk_to_bitmap(&cb, scratch.bits2);
+				for (w = 0; w < IP4SET_BITMAP_WORDS && result; ++w)
+					if (scratch.bits1[w] & ~scratch.bits2[w])
+						result = false;
+			}
+
+			if (!result)
+				break;
+		}
+		else
+		{
+			if (ca.card == IP4SET_CHUNK_SIZE || cb.card == IP4SET_CHUNK_SIZE)
+				result = true;
+			else if (ca.type == IP4SET_ARRAY)
+				result = (ip4set_filter_array(&ca, &cb, true, NULL) > 0);
+			else if (cb.type == IP4SET_ARRAY)
+				result = (ip4set_filter_array(&cb, &ca, true, NULL) > 0);
+			else
+			{
+				uint32 w;
+
+				ip4set_scratch_init(&scratch);
+				ip4set_chunk_to_bitmap(&ca, scratch.bits1);
+				ip4set_chunk_to_bitmap(&cb, scratch.bits2);
+				for (w = 0; w < IP4SET_BITMAP_WORDS && !result; ++w)
+					if (scratch.bits1[w] & scratch.bits2[w])
+						result = true;
+			}
+
+			if (result)
+				break;
+		}
+	}
+
+	ip4set_scratch_free(&scratch);
+
+	return result;
+}
+
+
+/**************************************************************************/
+/* Iterating over the set as a list of maximal ranges
+ */
+
+typedef struct IP4SetIter
+{
+	IP4Set	   *set;
+	int			cont;		/* current container */
+	uint32		pos;		/* position within it */
+	bool		have_pending;
+	IP4R		pending;
+} IP4SetIter;
+
+static
+void ip4set_iter_init(IP4SetIter *it, IP4Set *s)
+{
+	it->set = s;
+	it->cont = 0;
+	it->pos = 0;
+	it->have_pending = false;
+}
+
+/* next maximal range within a single container */
+
+static
+bool ip4set_iter_next_raw(IP4SetIter *it, IP4R *out)
+{
+	while (it->cont < it->set->ncontainers)
+	{
+		IP4SetChunk c;
+		uint32 first;
+		uint32 last;
+
+		ip4set_get_chunk(it->set, it->cont, &c);
+
+		switch (c.type)
+		{
+			case IP4SET_ARRAY:
+				if (it->pos < c.n)
+				{
+					const uint16 *vals = c.data;
+
+					first = last = vals[it->pos++];
+					while (it->pos < c.n && vals[it->pos] == last + 1)
+						last = vals[it->pos++];
+					out->lower = (c.key << 16) | first;
+					out->upper = (c.key << 16) | last;
+					return true;
+				}
+				break;
+
+			case IP4SET_RUN:
+				if (it->pos < c.n)
+				{
+					const uint16 *runs = c.data;
+
+					out->lower = (c.key << 16) | runs[2*it->pos];
+					out->upper = (c.key << 16) | runs[2*it->pos+1];
+					++it->pos;
+					return true;
+				}
+				break;
+
+			case IP4SET_BITMAP:
+				if (ip4set_bitmap_next_run(c.data, &it->pos, &first, &last))
+				{
+					out->lower = (c.key << 16) | first;
+					out->upper = (c.key << 16) | last;
+					return true;
+				}
+				break;
+		}
+
+		++it->cont;
+		it->pos = 0;
+	}
+
+	return false;
+}
+
+/* next maximal range, joining ranges that continue into the next container */
+
+static
+bool ip4set_iter_next(IP4SetIter *it, IP4R *out)
+{
+	IP4R r;
+
+	if (!it->have_pending)
+	{
+		if (!ip4set_iter_next_raw(it, &it->pending))
+			return false;
+		it->have_pending = true;
+	}
+
+	for (;;)
+	{
+		if (!ip4set_iter_next_raw(it, &r))
+		{
+			*out = it->pending;
+			it->have_pending = false;
+			return true;
+		}
+
+		if (it->pending.upper != ~(IP4)0 && r.lower == it->pending.upper + 1)
+			it->pending.upper = r.upper;
+		else
+		{
+			*out = it->pending;
+			it->pending = r;
+			return true;
+		}
+	}
+}
+
+
+/**************************************************************************/
+/* Aggregate state
+ *
+ * Input ranges are buffered and merged into the set in bulk, which is far
+ * cheaper than adding them one at a time.
+ */
+
+#define IP4SET_AGG_INITIAL_PENDING 64
+#define IP4SET_AGG_MAX_PENDING (1 << 20)
+
+typedef struct IP4SetAggState
+{
+	IP4Set	   *set;		/* merged so far, or NULL */
+	IP4R	   *pending;
+	int			npending;
+	int			maxpending;
+} IP4SetAggState;
+
+static
+IP4SetAggState *ip4set_agg_state_new(void)
+{
+	IP4SetAggState *state = palloc(sizeof(IP4SetAggState));
+
+	state->set = NULL;
+	state->npending = 0;
+	state->maxpending = IP4SET_AGG_INITIAL_PENDING;
+	state->pending = palloc(state->maxpending * sizeof(IP4R));
+
+	return state;
+}
+
+static
+void ip4set_agg_merge_set(IP4SetAggState *state, IP4Set *s)
+{
+	if (!state->set)
+	{
+		state->set = palloc(VARSIZE(s));
+		memcpy(state->set, s, VARSIZE(s));
+	}
+	else
+	{
+		IP4Set *old = state->set;
+
+		state->set = ip4set_combine(old, s, IP4SET_OP_UNION);
+		pfree(old);
+	}
+}
+
+static
+void ip4set_agg_flush(IP4SetAggState *state)
+{
+	IP4Set *s;
+	int n;
+
+	if (state->npending == 0)
+		return;
+
+	n = ip4set_normalize_ranges(state->pending, state->npending);
+	s = ip4set_from_ranges(state->pending, n);
+	state->npending = 0;
+
+	ip4set_agg_merge_set(state, s);
+	pfree(s);
+}
+
+/*
+ * The set represented by STATE, without modifying it: either state->set
+ * itself, or a new value in the current memory context. NULL if empty.
+ */
+
+static
+IP4Set *ip4set_agg_current(IP4SetAggState *state)
+{
+	IP4R *ranges;
+	IP4Set *s;
+	IP4Set *res;
+	int n;
+
+	if (state->npending == 0)
+		return state->set;
+
+	ranges = palloc(state->npending * sizeof(IP4R));
+	memcpy(ranges, state->pending, state->npending * sizeof(IP4R));
+	n = ip4set_normalize_ranges(ranges, state->npending);
+	s = ip4set_from_ranges(ranges, n);
+	pfree(ranges);
+
+	if (!state->set)
+		return s;
+
+	res = ip4set_combine(state->set, s, IP4SET_OP_UNION);
+	pfree(s);
+	return res;
+}
+
+static
+void ip4set_agg_add_range(IP4SetAggState *state, IP4 lo, IP4 hi)
+{
+	if (state->npending >= state->maxpending)
+	{
+		if (state->maxpending < IP4SET_AGG_MAX_PENDING)
+		{
+			state->maxpending *= 2;
+			state->pending = repalloc(state->pending, state->maxpending * sizeof(IP4R));
+		}
+		else
+			ip4set_agg_flush(state);
+	}
+
+	state->pending[state->npending].lower = lo;
+	state->pending[state->npending].upper = hi;
+	++state->npending;
+}
+
+static
+IP4Set *ip4set_empty(void)
+{
+	IP4Set *res = palloc(sizeof(IP4Set));
+
+	SET_VARSIZE(res, sizeof(IP4Set));
+	res->ncontainers = 0;
+
+	return res;
+}
+
+
+/**************************************************************************/
+/* This part handles all aspects of postgres interfacing.
+ */
+
+static
+bool ip4set_parse(char *str, IP4R **rangesp, int *np)
+{
+	char buf[IP4R_STRING_MAX];
+	char *p = str;
+	int max = 16;
+	int n = 0;
+	IP4R *ranges = palloc(max * sizeof(IP4R));
+
+	while (isspace((unsigned char) *p))
+		++p;
+	if (*p++ != '{')
+		return false;
+	while (isspace((unsigned char) *p))
+		++p;
+
+	if (*p != '}')
+	{
+		for (;;)
+		{
+			int len;
+
+			while (isspace((unsigned char) *p))
+				++p;
+			len = strcspn(p, ",} \t\r\n");
+			if (len == 0 || len >= sizeof(buf))
+				return false;
+			memcpy(buf, p, len);
+			buf[len] = 0;
+			p += len;
+
+			if (n >= max)
+			{
+				max *= 2;
+				ranges = repalloc(ranges, max * sizeof(IP4R));
+			}
+			if (!ip4r_from_str(buf, &ranges[n++]))
+				return false;
+
+			while (isspace((unsigned char) *p))
+				++p;
+			if (*p == '}')
+				break;
+			if (*p++ != ',')
+				return false;
+		}
+	}
+
+	++p;
+	while (isspace((unsigned char) *p))
+		++p;
+	if (*p)
+		return false;
+
+	*rangesp = ranges;
+	*np = n;
+	return true;
+}
+
+PG_FUNCTION_INFO_V1(ip4set_in);
+Datum
+ip4set_in(PG_FUNCTION_ARGS)
+{
+	char *str = PG_GETARG_CSTRING(0);
+	IP4R *ranges;
+	int n;
+
+	if (ip4set_parse(str, &ranges, &n))
+	{
+		n = ip4set_normalize_ranges(ranges, n);
+		PG_RETURN_IP4SET_P(ip4set_from_ranges(ranges, n));
+	}
+
+	ereturn(fcinfo->context, (Datum)0,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid IP4SET value: \"%s\"", str)));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_out);
+Datum
+ip4set_out(PG_FUNCTION_ARGS)
+{
+	IP4Set *s = PG_GETARG_IP4SET_P(0);
+	StringInfoData str;
+	IP4SetIter it;
+	IP4R r;
+	bool first = true;
+
+	initStringInfo(&str);
+	appendStringInfoChar(&str, '{');
+
+	ip4set_iter_init(&it, s);
+	while (ip4set_iter_next(&it, &r))
+	{
+		char buf[IP4R_STRING_MAX];
+
+		if (!first)
+			appendStringInfoChar(&str, ',');
+		first = false;
+		ip4r_to_str(&r, buf, sizeof(buf));
+		appendStringInfoString(&str, buf);
+	}
+
+	appendStringInfoChar(&str, '}');
+
+	PG_RETURN_CSTRING(str.data);
+}
+
+/*
+ * The binary format is a count followed by (lower,upper) pairs; on input
+ * the ranges may overlap and be in any order.
+ */
+
+PG_FUNCTION_INFO_V1(ip4set_recv);
+Datum
+ip4set_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	uint32 n = (uint32) pq_getmsgint(buf, sizeof(uint32));
+	IP4R *ranges;
+	uint32 i;
+
+	if (n > (buf->len - buf->cursor) / (2 * sizeof(IP4)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid IP4SET value")));
+
+	ranges = palloc((n ? n : 1) * sizeof(IP4R));
+
+	for (i = 0; i < n; ++i)
+	{
+		IP4 lo = (IP4) pq_getmsgint(buf, sizeof(IP4));
+		IP4 hi = (IP4) pq_getmsgint(buf, sizeof(IP4));
+
+		ranges[i].lower = (lo <= hi) ? lo : hi;
+		ranges[i].upper = (lo <= hi) ? hi : lo;
+	}
+
+	n = ip4set_normalize_ranges(ranges, n);
+
+	PG_RETURN_IP4SET_P(ip4set_from_ranges(ranges, n));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_send);
+Datum
+ip4set_send(PG_FUNCTION_ARGS)
+{
+	IP4Set *s = PG_GETARG_IP4SET_P(0);
+	StringInfoData buf;
+	IP4SetIter it;
+	IP4R r;
+	uint32 n = 0;
+
+	ip4set_iter_init(&it, s);
+	while (ip4set_iter_next(&it, &r))
+		++n;
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, n, sizeof(uint32));
+
+	ip4set_iter_init(&it, s);
+	while (ip4set_iter_next(&it, &r))
+	{
+		pq_sendint(&buf, r.lower, sizeof(IP4));
+		pq_sendint(&buf, r.upper, sizeof(IP4));
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_from_ip4);
+Datum
+ip4set_from_ip4(PG_FUNCTION_ARGS)
+{
+	IP4R r;
+
+	r.lower = r.upper = PG_GETARG_IP4(0);
+
+	PG_RETURN_IP4SET_P(ip4set_from_ranges(&r, 1));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_from_ip4r);
+Datum
+ip4set_from_ip4r(PG_FUNCTION_ARGS)
+{
+	IP4R *r = PG_GETARG_IP4R_P(0);
+
+	PG_RETURN_IP4SET_P(ip4set_from_ranges(r, 1));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_cardinality);
+Datum
+ip4set_cardinality(PG_FUNCTION_ARGS)
+{
+	IP4Set *s = PG_GETARG_IP4SET_P(0);
+	IP4SetContainer *hdrs = IP4SET_CONTAINERS(s);
+	int64 card = 0;
+	int i;
+
+	for (i = 0; i < s->ncontainers; ++i)
+		card += hdrs[i].card;
+
+	PG_RETURN_INT64(card);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_ranges);
+Datum
+ip4set_ranges(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	IP4SetIter *it;
+	IP4R *res;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		it = palloc(sizeof(IP4SetIter));
+		ip4set_iter_init(it, PG_GETARG_IP4SET_P(0));
+		funcctx->user_fctx = it;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	it = funcctx->user_fctx;
+
+	res = palloc(sizeof(IP4R));
+	if (!ip4set_iter_next(it, res))
+		SRF_RETURN_DONE(funcctx);
+
+	SRF_RETURN_NEXT(funcctx, IP4RPGetDatum(res));
+}
+
+/*
+ * set operations
+ */
+
+PG_FUNCTION_INFO_V1(ip4set_union);
+Datum
+ip4set_union(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_IP4SET_P(ip4set_combine(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4SET_P(1),
+									  IP4SET_OP_UNION));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_inter);
+Datum
+ip4set_inter(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_IP4SET_P(ip4set_combine(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4SET_P(1),
+									  IP4SET_OP_INTER));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_minus);
+Datum
+ip4set_minus(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_IP4SET_P(ip4set_combine(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4SET_P(1),
+									  IP4SET_OP_MINUS));
+}
+
+/*
+ * comparisons and predicates
+ */
+
+PG_FUNCTION_INFO_V1(ip4set_eq);
+Datum
+ip4set_eq(PG_FUNCTION_ARGS)
+{
+	IP4Set *a = PG_GETARG_IP4SET_P(0);
+	IP4Set *b = PG_GETARG_IP4SET_P(1);
+
+	PG_RETURN_BOOL(VARSIZE(a) == VARSIZE(b) && memcmp(a, b, VARSIZE(a)) == 0);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_neq);
+Datum
+ip4set_neq(PG_FUNCTION_ARGS)
+{
+	IP4Set *a = PG_GETARG_IP4SET_P(0);
+	IP4Set *b = PG_GETARG_IP4SET_P(1);
+
+	PG_RETURN_BOOL(VARSIZE(a) != VARSIZE(b) || memcmp(a, b, VARSIZE(a)) != 0);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_contains_ip4);
+Datum
+ip4set_contains_ip4(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ip4set_contains_internal(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4(1)));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_ip4_contained_by);
+Datum
+ip4set_ip4_contained_by(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ip4set_contains_internal(PG_GETARG_IP4SET_P(1), PG_GETARG_IP4(0)));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_contains_ip4r);
+Datum
+ip4set_contains_ip4r(PG_FUNCTION_ARGS)
+{
+	IP4R *r = PG_GETARG_IP4R_P(1);
+
+	PG_RETURN_BOOL(ip4set_contains_range_internal(PG_GETARG_IP4SET_P(0), r->lower, r->upper));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_ip4r_contained_by);
+Datum
+ip4set_ip4r_contained_by(PG_FUNCTION_ARGS)
+{
+	IP4R *r = PG_GETARG_IP4R_P(0);
+
+	PG_RETURN_BOOL(ip4set_contains_range_internal(PG_GETARG_IP4SET_P(1), r->lower, r->upper));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_overlaps_ip4r);
+Datum
+ip4set_overlaps_ip4r(PG_FUNCTION_ARGS)
+{
+	IP4R *r = PG_GETARG_IP4R_P(1);
+
+	PG_RETURN_BOOL(ip4set_overlaps_range_internal(PG_GETARG_IP4SET_P(0), r->lower, r->upper));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_ip4r_overlaps);
+Datum
+ip4set_ip4r_overlaps(PG_FUNCTION_ARGS)
+{
+	IP4R *r = PG_GETARG_IP4R_P(0);
+
+	PG_RETURN_BOOL(ip4set_overlaps_range_internal(PG_GETARG_IP4SET_P(1), r->lower, r->upper));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_contains);
+Datum
+ip4set_contains(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ip4set_compare_internal(PG_GETARG_IP4SET_P(1), PG_GETARG_IP4SET_P(0), true));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_contained_by);
+Datum
+ip4set_contained_by(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ip4set_compare_internal(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4SET_P(1), true));
+}
+
+PG_FUNCTION_INFO_V1(ip4set_overlaps);
+Datum
+ip4set_overlaps(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ip4set_compare_internal(PG_GETARG_IP4SET_P(0), PG_GETARG_IP4SET_P(1), false));
+}
+
+/*
+ * aggregate support
+ *
+ * The transition functions are not strict, since the state type is
+ * internal; null inputs are ignored. The final, combine and serial
+ * functions leave their input states alone (bar the first state for
+ * combine), since the final function may be called more than once on the
+ * same state in window aggregation or when the state is shared.
+ */
+
+static
+IP4SetAggState *ip4set_agg_getstate(FunctionCallInfo fcinfo, MemoryContext *aggcontext)
+{
+	if (!AggCheckCallContext(fcinfo, aggcontext))
+		elog(ERROR, "ip4set aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(*aggcontext);
+		IP4SetAggState *state = ip4set_agg_state_new();
+
+		MemoryContextSwitchTo(oldcontext);
+		return state;
+	}
+
+	return (IP4SetAggState *) PG_GETARG_POINTER(0);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_trans_ip4);
+Datum
+ip4set_agg_trans_ip4(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IP4SetAggState *state = ip4set_agg_getstate(fcinfo, &aggcontext);
+
+	if (!PG_ARGISNULL(1))
+	{
+		IP4 ip = PG_GETARG_IP4(1);
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		ip4set_agg_add_range(state, ip, ip);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_trans_ip4r);
+Datum
+ip4set_agg_trans_ip4r(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IP4SetAggState *state = ip4set_agg_getstate(fcinfo, &aggcontext);
+
+	if (!PG_ARGISNULL(1))
+	{
+		IP4R *r = PG_GETARG_IP4R_P(1);
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		ip4set_agg_add_range(state, r->lower, r->upper);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_trans_ip4set);
+Datum
+ip4set_agg_trans_ip4set(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IP4SetAggState *state = ip4set_agg_getstate(fcinfo, &aggcontext);
+
+	if (!PG_ARGISNULL(1))
+	{
+		IP4Set *s = PG_GETARG_IP4SET_P(1);
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		ip4set_agg_merge_set(state, s);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_final);
+Datum
+ip4set_agg_final(PG_FUNCTION_ARGS)
+{
+	IP4SetAggState *state;
+	IP4Set *s;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "ip4set aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IP4SetAggState *) PG_GETARG_POINTER(0);
+	s = ip4set_agg_current(state);
+
+	if (!s)
+		PG_RETURN_IP4SET_P(ip4set_empty());
+	if (s == state->set)
+		PG_RETURN_DATUM(datumCopy(IP4SetPGetDatum(s), false, -1));
+
+	PG_RETURN_IP4SET_P(s);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_combine);
+Datum
+ip4set_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IP4SetAggState *state1;
+	IP4SetAggState *state2;
+	IP4Set *s2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ip4set aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	state2 = (IP4SetAggState *) PG_GETARG_POINTER(1);
+	s2 = ip4set_agg_current(state2);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+
+	if (PG_ARGISNULL(0))
+		state1 = ip4set_agg_state_new();
+	else
+		state1 = (IP4SetAggState *) PG_GETARG_POINTER(0);
+
+	if (s2)
+		ip4set_agg_merge_set(state1, s2);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/* the serialized state is just the merged set */
+
+PG_FUNCTION_INFO_V1(ip4set_agg_serial);
+Datum
+ip4set_agg_serial(PG_FUNCTION_ARGS)
+{
+	IP4SetAggState *state;
+	IP4Set *s;
+	bytea *res;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "ip4set aggregate function called in non-aggregate context");
+
+	state = (IP4SetAggState *) PG_GETARG_POINTER(0);
+	s = ip4set_agg_current(state);
+
+	if (!s)
+		PG_RETURN_BYTEA_P((bytea *) ip4set_empty());
+	if (s != state->set)
+		PG_RETURN_BYTEA_P((bytea *) s);
+
+	res = palloc(VARSIZE(s));
+	memcpy(res, s, VARSIZE(s));
+
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(ip4set_agg_deserial);
+Datum
+ip4set_agg_deserial(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	bytea *in = PG_GETARG_BYTEA_P(0);
+	IP4SetAggState *state;
+	IP4Set *s;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ip4set aggregate function called in non-aggregate context");
+
+	/*
+	 * IN need be no more than int-aligned, which is not enough for the
+	 * bitmap words, so copy it to an aligned set in the aggregate context
+	 * before looking inside it.
+	 */
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	state = ip4set_agg_state_new();
+	s = palloc(VARSIZE(in));
+	memcpy(s, in, VARSIZE(in));
+	if (s->ncontainers > 0)
+		state->set = s;
+	else
+		pfree(s);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state);
+}
+
+/* end */
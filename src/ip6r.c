@@ -23,7 +23,6 @@
 
 /* extract an IP range from text.
  */
-static
 bool ip6r_from_str(char *str, IP6R *ipr)
 {
 	char buf[IP6_STRING_MAX];
@@ -91,7 +90,6 @@ bool ip6r_from_str(char *str, IP6R *ipr)
 
 /* Output an ip range in text form
  */
-static
 int ip6r_to_str(IP6R *ipr, char *str, int slen)
 {
 	char buf1[IP6_STRING_MAX];
@@ -149,9 +147,7 @@ set_text_len(text *txt, int len)
 ** Input/Output routines
 */
 
-PG_FUNCTION_INFO_V1(ip6_in);
-Datum
-ip6_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6_in, IPR_STAT_PARSE, IPR_STAT_IP6, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IP6 *ip = palloc(sizeof(IP6));
@@ -163,9 +159,7 @@ ip6_in(PG_FUNCTION_ARGS)
 			 errmsg("invalid IP6 value: '%s'", str)));
 }
 
-PG_FUNCTION_INFO_V1(ip6_out);
-Datum
-ip6_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6_out, IPR_STAT_FORMAT, IPR_STAT_IP6, 1)
 {
 	IP6 *ip = PG_GETARG_IP6_P(0);
 	char *out = palloc(IP6_STRING_MAX);
@@ -199,23 +193,19 @@ ip6_send(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-PG_FUNCTION_INFO_V1(ip6hash);
-Datum
-ip6hash(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6hash, IPR_STAT_HASH, IPR_STAT_IP6, 1)
 {
 	IP6 *arg1 = PG_GETARG_IP6_P(0);
 
-	return hash_any((unsigned char *)arg1, sizeof(IP6));
+	PG_RETURN_UINT32(ipr_hash_words(arg1, 4));
 }
 
-PG_FUNCTION_INFO_V1(ip6_hash_extended);
-Datum
-ip6_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6_hash_extended, IPR_STAT_HASH, IPR_STAT_IP6, 1)
 {
 	IP6 *arg1 = PG_GETARG_IP6_P(0);
 	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
 
-	return hash_any_extended((unsigned char *)arg1, sizeof(IP6), seed);
+	PG_RETURN_INT64((int64) ipr_hash_words_extended(arg1, 4, seed));
 }
 
 PG_FUNCTION_INFO_V1(ip6_cast_to_text);
@@ -295,71 +285,31 @@ Datum
 ip6_cast_to_numeric(PG_FUNCTION_ARGS)
 {
 	IP6 *ip = PG_GETARG_IP6_P(0);
-	Datum res,tmp,mul;
-	static int64 mul_val = ((int64)1 << 56);
-	int64 tmp_val;
-
-	mul = DirectFunctionCall1(int8_numeric,Int64GetDatumFast(mul_val));
-	tmp_val = (ip->bits[0] >> 48);
-	res = DirectFunctionCall1(int8_numeric,Int64GetDatumFast(tmp_val));
-	tmp_val = ((ip->bits[0] & (uint64)(0xFFFFFFFFFFFFULL)) << 8) | (ip->bits[1] >> 56);
-	tmp = DirectFunctionCall1(int8_numeric,Int64GetDatumFast(tmp_val));
-	res = DirectFunctionCall2(numeric_mul,res,mul);
-	res = DirectFunctionCall2(numeric_add,res,tmp);
-	tmp_val = (ip->bits[1] & (uint64)(0xFFFFFFFFFFFFFFULL));
-	tmp = DirectFunctionCall1(int8_numeric,Int64GetDatumFast(tmp_val));
-	res = DirectFunctionCall2(numeric_mul,res,mul);
-	res = DirectFunctionCall2(numeric_add,res,tmp);
 
-	PG_RETURN_DATUM(res);
+	PG_RETURN_NUMERIC(ipr_make_numeric(ip->bits[0], ip->bits[1], 0, false));
 }
 
 PG_FUNCTION_INFO_V1(ip6_cast_from_numeric);
 Datum
 ip6_cast_from_numeric(PG_FUNCTION_ARGS)
 {
-	Datum val = NumericGetDatum(PG_GETARG_NUMERIC(0));
-	Datum rem,tmp,div,mul;
-	static int64 mul_val = ((int64)1 << 56);
-	uint64 tmp_val;
-	IP6 *res;
+	Numeric val = PG_GETARG_NUMERIC(0);
+	IP6 tmp;
+	bool is_negative = false;
+	int rc = ipr_decode_numeric(val, &tmp.bits[0], &tmp.bits[1], &is_negative);
 
-	tmp = DirectFunctionCall1(numeric_floor,DirectFunctionCall1(numeric_abs,val));
-
-	if (!DatumGetBool(DirectFunctionCall2(numeric_eq,tmp,val)))
+	if (rc == IPR_NUMERIC_INVALID || is_negative)
 	{
 		ereturn(fcinfo->context, (Datum)0,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("invalid numeric value for conversion to IP6")));
 	}
 
-	res = palloc(sizeof(IP6));
-
-	/* we use div/mul here rather than mod because numeric_mod is implemented as
-	 * a div/mul/subtract in any case, so we save a division step by doing the
-	 * mul/subtract ourselves
-	 */
-
-	mul = DirectFunctionCall1(int8_numeric,Int64GetDatumFast(mul_val));
-	div = DirectFunctionCall2(numeric_div_trunc,val,mul);
-	tmp = DirectFunctionCall2(numeric_mul,div,mul);
-	rem = DirectFunctionCall2(numeric_sub,val,tmp);
-	res->bits[1] = (uint64)DatumGetInt64(DirectFunctionCall1(numeric_int8,rem));
-	val = div;
-	div = DirectFunctionCall2(numeric_div_trunc,val,mul);
-	tmp = DirectFunctionCall2(numeric_mul,div,mul);
-	rem = DirectFunctionCall2(numeric_sub,val,tmp);
-	tmp_val = (uint64)DatumGetInt64(DirectFunctionCall1(numeric_int8,rem));
-	res->bits[1] |= ((tmp_val & 0xFF) << 56);
-	res->bits[0] = (tmp_val >> 8);
-	if (!DatumGetBool(DirectFunctionCall2(numeric_gt,div,mul)))
+	if (rc == IPR_NUMERIC_OK)
 	{
-		tmp_val = (uint64)DatumGetInt64(DirectFunctionCall1(numeric_int8,div));
-		if (tmp_val <= (uint64)0xFFFFU)
-		{
-			res->bits[0] |= (tmp_val << 48);
-			PG_RETURN_IP6_P(res);
-		}
+		IP6 *res = palloc(sizeof(IP6));
+		*res = tmp;
+		PG_RETURN_IP6_P(res);
 	}
 
 	ereturn(fcinfo->context, (Datum)0,
@@ -473,8 +423,7 @@ ip6_net_lower(PG_FUNCTION_ARGS)
 	}
 
 	res = palloc(sizeof(IP6));
-	res->bits[0] = ip->bits[0] & netmask6_hi(pfxlen);
-	res->bits[1] = ip->bits[1] & netmask6_lo(pfxlen);
+	ip6_net_lower_internal(ip, pfxlen, res);
 
 	PG_RETURN_IP6_P(res);
 }
@@ -495,8 +444,7 @@ ip6_net_upper(PG_FUNCTION_ARGS)
 	}
 
 	res = palloc(sizeof(IP6));
-	res->bits[0] = ip->bits[0] | hostmask6_hi(pfxlen);
-	res->bits[1] = ip->bits[1] | hostmask6_lo(pfxlen);
+	ip6_net_upper_internal(ip, pfxlen, res);
 
 	PG_RETURN_IP6_P(res);
 }
@@ -509,18 +457,7 @@ ip6_plus_int(PG_FUNCTION_ARGS)
 	int addend = PG_GETARG_INT32(1);
 	IP6 *result = palloc(sizeof(IP6));
 
-	if (addend >= 0)
-	{
-		result->bits[1] = ip->bits[1] + addend;
-		result->bits[0] = ip->bits[0] + (result->bits[1] < ip->bits[1]);
-	}
-	else
-	{
-		result->bits[1] = ip->bits[1] - (uint64)(-addend);
-		result->bits[0] = ip->bits[0] - (result->bits[1] > ip->bits[1]);
-	}
-
-	if ((addend < 0) != ip6_lessthan(result,ip))
+	if (!ip6_plus_int64(ip, addend, result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -538,18 +475,7 @@ ip6_plus_bigint(PG_FUNCTION_ARGS)
 	int64 addend = PG_GETARG_INT64(1);
 	IP6 *result = palloc(sizeof(IP6));
 
-	if (addend >= 0)
-	{
-		result->bits[1] = ip->bits[1] + addend;
-		result->bits[0] = ip->bits[0] + (result->bits[1] < ip->bits[1]);
-	}
-	else
-	{
-		result->bits[1] = ip->bits[1] - (uint64)(-addend);
-		result->bits[0] = ip->bits[0] - (result->bits[1] > ip->bits[1]);
-	}
-
-	if ((addend < 0) != ip6_lessthan(result,ip))
+	if (!ip6_plus_int64(ip, addend, result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -559,34 +485,47 @@ ip6_plus_bigint(PG_FUNCTION_ARGS)
 	PG_RETURN_IP6_P(result);
 }
 
+/* shared by the ip6 and ipaddress +/- numeric operators; the addend is
+ * decoded straight from the numeric without allocating. Returns false if
+ * the result is out of range (RESULT may alias IP).
+ */
+bool ip6_plus_numeric_internal(IP6 *ip, Numeric addend_num, bool negate, IP6 *result)
+{
+	IP6 addend;
+	bool is_negative = false;
+
+	switch (ipr_decode_numeric(addend_num, &addend.bits[0], &addend.bits[1], &is_negative))
+	{
+		case IPR_NUMERIC_OK:
+			break;
+
+		case IPR_NUMERIC_OVERFLOW:
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("numeric value too large for conversion to IP6")));
+
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid numeric value for conversion to IP6")));
+	}
+
+	/* zero is never negative, even when negated */
+	if (negate && (addend.bits[0] | addend.bits[1]) != 0)
+		is_negative = !is_negative;
+
+	return ip6_plus_ip6(ip, &addend, is_negative, result);
+}
+
 PG_FUNCTION_INFO_V1(ip6_plus_numeric);
 Datum
 ip6_plus_numeric(PG_FUNCTION_ARGS)
 {
 	IP6 *ip = PG_GETARG_IP6_P(0);
-	Datum addend_num = NumericGetDatum(PG_GETARG_NUMERIC(1));
-	Datum addend_abs;
-	IP6 *addend;
+	Numeric addend = PG_GETARG_NUMERIC(1);
 	IP6 *result = palloc(sizeof(IP6));
-	bool is_negative;
-
-	addend_abs = DirectFunctionCall1(numeric_abs,addend_num);
-	addend = DatumGetIP6P(DirectFunctionCall1(ip6_cast_from_numeric,addend_abs));
 
-	if (DatumGetBool(DirectFunctionCall2(numeric_eq,addend_num,addend_abs)))
-	{
-		is_negative = false;
-		result->bits[1] = ip->bits[1] + addend->bits[1];
-		result->bits[0] = ip->bits[0] + addend->bits[0] + (result->bits[1] < ip->bits[1]);
-	}
-	else
-	{
-		is_negative = true;
-		result->bits[1] = ip->bits[1] - addend->bits[1];
-		result->bits[0] = ip->bits[0] - addend->bits[0] - (result->bits[1] > ip->bits[1]);
-	}
-
-	if (is_negative != ip6_lessthan(result,ip))
+	if (!ip6_plus_numeric_internal(ip, addend, false, result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -604,9 +543,7 @@ ip6_minus_int(PG_FUNCTION_ARGS)
 	int subtrahend = PG_GETARG_INT32(1);
 	IP6 *result = palloc(sizeof(IP6));
 
-	ip6_sub_int(ip, subtrahend, result);
-
-	if ((subtrahend > 0) != ip6_lessthan(result,ip))
+	if (!ip6_minus_int64(ip, subtrahend, result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -624,18 +561,7 @@ ip6_minus_bigint(PG_FUNCTION_ARGS)
 	int64 subtrahend = PG_GETARG_INT64(1);
 	IP6 *result = palloc(sizeof(IP6));
 
-	if (subtrahend >= 0)
-	{
-		result->bits[1] = ip->bits[1] - (uint64)subtrahend;
-		result->bits[0] = ip->bits[0] - (result->bits[1] > ip->bits[1]);
-	}
-	else
-	{
-		result->bits[1] = ip->bits[1] + (uint64)(-subtrahend);
-		result->bits[0] = ip->bits[0] + (result->bits[1] < ip->bits[1]);
-	}
-
-	if ((subtrahend > 0) != ip6_lessthan(result,ip))
+	if (!ip6_minus_int64(ip, subtrahend, result))
 	{
 		ereport(ERROR,
 				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
@@ -649,26 +575,36 @@ PG_FUNCTION_INFO_V1(ip6_minus_numeric);
 Datum
 ip6_minus_numeric(PG_FUNCTION_ARGS)
 {
-	Datum ip = PG_GETARG_DATUM(0);
-	Datum subtrahend = PG_GETARG_DATUM(1);
+	IP6 *ip = PG_GETARG_IP6_P(0);
+	Numeric subtrahend = PG_GETARG_NUMERIC(1);
+	IP6 *result = palloc(sizeof(IP6));
+
+	if (!ip6_plus_numeric_internal(ip, subtrahend, true, result))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("ip address out of range")));
+	}
 
-	subtrahend = DirectFunctionCall1(numeric_uminus,subtrahend);
-	return DirectFunctionCall2(ip6_plus_numeric,ip,subtrahend);
+	PG_RETURN_IP6_P(result);
 }
 
 PG_FUNCTION_INFO_V1(ip6_minus_ip6);
 Datum
 ip6_minus_ip6(PG_FUNCTION_ARGS)
 {
-	Datum minuend = PG_GETARG_DATUM(0);
-	Datum subtrahend = PG_GETARG_DATUM(1);
-	Datum res;
+	IP6 *minuend = PG_GETARG_IP6_P(0);
+	IP6 *subtrahend = PG_GETARG_IP6_P(1);
+	IP6 diff;
 
-	res = DirectFunctionCall2(numeric_sub,
-							  DirectFunctionCall1(ip6_cast_to_numeric,minuend),
-							  DirectFunctionCall1(ip6_cast_to_numeric,subtrahend));
+	if (ip6_lessthan(minuend, subtrahend))
+	{
+		ip6_sub(subtrahend, minuend, &diff);
+		PG_RETURN_NUMERIC(ipr_make_numeric(diff.bits[0], diff.bits[1], 0, true));
+	}
 
-	PG_RETURN_DATUM(res);
+	ip6_sub(minuend, subtrahend, &diff);
+	PG_RETURN_NUMERIC(ipr_make_numeric(diff.bits[0], diff.bits[1], 0, false));
 }
 
 PG_FUNCTION_INFO_V1(ip6_and);
@@ -729,9 +665,7 @@ ip6_not(PG_FUNCTION_ARGS)
 
 /*---- ip6r ----*/
 
-PG_FUNCTION_INFO_V1(ip6r_in);
-Datum
-ip6r_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6r_in, IPR_STAT_PARSE, IPR_STAT_IP6R, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IP6R ipr;
@@ -748,9 +682,7 @@ ip6r_in(PG_FUNCTION_ARGS)
 			 errmsg("invalid IP6R value: \"%s\"", str)));
 }
 
-PG_FUNCTION_INFO_V1(ip6r_out);
-Datum
-ip6r_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6r_out, IPR_STAT_FORMAT, IPR_STAT_IP6R, 1)
 {
 	IP6R *ipr = PG_GETARG_IP6R_P(0);
 	char *out = palloc(IP6R_STRING_MAX);
@@ -795,23 +727,19 @@ ip6r_send(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-PG_FUNCTION_INFO_V1(ip6rhash);
-Datum
-ip6rhash(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6rhash, IPR_STAT_HASH, IPR_STAT_IP6R, 1)
 {
 	IP6R *arg1 = PG_GETARG_IP6R_P(0);
 
-	return hash_any((unsigned char *)arg1, sizeof(IP6R));
+	PG_RETURN_UINT32(ipr_hash_words(arg1, 8));
 }
 
-PG_FUNCTION_INFO_V1(ip6r_hash_extended);
-Datum
-ip6r_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6r_hash_extended, IPR_STAT_HASH, IPR_STAT_IP6R, 1)
 {
 	IP6R *arg1 = PG_GETARG_IP6R_P(0);
 	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
 
-	return hash_any_extended((unsigned char *)arg1, sizeof(IP6R), seed);
+	PG_RETURN_INT64((int64) ipr_hash_words_extended(arg1, 8, seed));
 }
 
 PG_FUNCTION_INFO_V1(ip6r_cast_to_text);
@@ -1073,30 +1001,32 @@ PG_FUNCTION_INFO_V1(ip6r_cidr_split);
 Datum
 ip6r_cidr_split(PG_FUNCTION_ARGS)
 {
-	FuncCallContext *funcctx;
-	IP6R *val;
-	IP6R *res;
+	IP6R *in = PG_GETARG_IP6R_P(0);
+	IP6R res[IP6R_MAX_CIDRS];
+	Datum values[IP6R_MAX_CIDRS];
+	int n = ip6r_split_cidrs(in, res);
+	int i;
 
-	if (SRF_IS_FIRSTCALL())
-	{
-		IP6R *in = PG_GETARG_IP6R_P(0);
-		funcctx = SRF_FIRSTCALL_INIT();
-		val = MemoryContextAlloc(funcctx->multi_call_memory_ctx,
-								 sizeof(IP6R));
-		*val = *in;
-		funcctx->user_fctx = val;
-	}
+	for (i = 0; i < n; ++i)
+		values[i] = IP6RPGetDatum(&res[i]);
 
-	funcctx = SRF_PERCALL_SETUP();
-	val = funcctx->user_fctx;
-	if (!val)
-		SRF_RETURN_DONE(funcctx);
+	return ipr_return_materialized(fcinfo, values, n);
+}
 
-	res = palloc(sizeof(IP6R));
-	if (ip6r_split_cidr(val, res))
-		funcctx->user_fctx = NULL;
+PG_FUNCTION_INFO_V1(ip6r_cidr_split_array);
+Datum
+ip6r_cidr_split_array(PG_FUNCTION_ARGS)
+{
+	IP6R *in = PG_GETARG_IP6R_P(0);
+	IP6R res[IP6R_MAX_CIDRS];
+	Datum values[IP6R_MAX_CIDRS];
+	int n = ip6r_split_cidrs(in, res);
+	int i;
 
-	SRF_RETURN_NEXT(funcctx, IP6RPGetDatum(res));
+	for (i = 0; i < n; ++i)
+		values[i] = IP6RPGetDatum(&res[i]);
+
+	return ipr_return_array(fcinfo, values, n);
 }
 
 /*
@@ -1254,6 +1184,63 @@ ip6r_union(PG_FUNCTION_ARGS)
 	PG_RETURN_IP6R_P(res);
 }
 
+/*
+ * bounding_range_agg support. The state is a plain ip6r, which is
+ * updated in place; the range version also serves as the combine function.
+ */
+
+PG_FUNCTION_INFO_V1(ip6r_bounds_trans);
+Datum
+ip6r_bounds_trans(PG_FUNCTION_ARGS)
+{
+	IP6R *state = PG_GETARG_IP6R_P(0);
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "bounding_range_agg called in non-aggregate context");
+
+	ip6r_union_internal(state, PG_GETARG_IP6R_P(1), state);
+
+	PG_RETURN_IP6R_P(state);
+}
+
+PG_FUNCTION_INFO_V1(ip6r_bounds_trans_ip6);
+Datum
+ip6r_bounds_trans_ip6(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	IP6R *state;
+	IP6 ip;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "bounding_range_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_IP6R_P(PG_GETARG_IP6R_P(0));
+	}
+
+	ip = *PG_GETARG_IP6_P(1);
+
+	if (PG_ARGISNULL(0))
+	{
+		state = MemoryContextAlloc(aggcontext, sizeof(IP6R));
+		state->lower = ip;
+		state->upper = ip;
+	}
+	else
+	{
+		state = PG_GETARG_IP6R_P(0);
+		if (ip6_lessthan(&ip, &state->lower))
+			state->lower = ip;
+		if (ip6_lessthan(&state->upper, &ip))
+			state->upper = ip;
+	}
+
+	PG_RETURN_IP6R_P(state);
+}
+
 PG_FUNCTION_INFO_V1(ip6r_inter);
 Datum
 ip6r_inter(PG_FUNCTION_ARGS)
@@ -1275,16 +1262,38 @@ ip6r_size(PG_FUNCTION_ARGS)
 	PG_RETURN_FLOAT8(size);
 }
 
+/*
+ * The ordering operator for longest-prefix match: the size of the left
+ * range if it contains the right one, otherwise infinity, so that
+ * ORDER BY r <-> x returns the ranges containing x most specific first.
+ */
+
+PG_FUNCTION_INFO_V1(ip6r_lpm_distance);
+Datum
+ip6r_lpm_distance(PG_FUNCTION_ARGS)
+{
+	IP6R *a = PG_GETARG_IP6R_P(0);
+	IP6R *b = PG_GETARG_IP6R_P(1);
+
+	if (!ip6r_contains_internal(a, b, true))
+		PG_RETURN_FLOAT8(HUGE_VAL);
+	PG_RETURN_FLOAT8(ip6r_metric(a));
+}
+
 PG_FUNCTION_INFO_V1(ip6r_size_exact);
 Datum
 ip6r_size_exact(PG_FUNCTION_ARGS)
 {
 	IP6R *ipr = PG_GETARG_IP6R_P(0);
-	Datum l = DirectFunctionCall1(ip6_cast_to_numeric, IP6PGetDatum(&ipr->lower));
-	Datum u = DirectFunctionCall1(ip6_cast_to_numeric, IP6PGetDatum(&ipr->upper));
-	Datum d = DirectFunctionCall2(numeric_sub, u, l);
-	Datum s = DirectFunctionCall1(numeric_inc, d);
-	PG_RETURN_DATUM(s);
+	IP6 diff;
+
+	/* size is upper - lower + 1, which can carry into bit 128 */
+	ip6_sub(&ipr->upper, &ipr->lower, &diff);
+	diff.bits[1] += 1;
+	diff.bits[0] += (diff.bits[1] == 0);
+
+	PG_RETURN_NUMERIC(ipr_make_numeric(diff.bits[0], diff.bits[1],
+									   (diff.bits[0] | diff.bits[1]) == 0, false));
 }
 
 PG_FUNCTION_INFO_V1(ip6r_prefixlen);
@@ -1303,9 +1312,7 @@ ip6r_prefixlen(PG_FUNCTION_ARGS)
  *												   Btree functions
  *****************************************************************************/
 
-PG_FUNCTION_INFO_V1(ip6r_cmp);
-Datum
-ip6r_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6r_cmp, IPR_STAT_COMPARE, IPR_STAT_IP6R, 1)
 {
 	IP6R *a = PG_GETARG_IP6R_P(0);
 	IP6R *b = PG_GETARG_IP6R_P(1);
@@ -1316,9 +1323,7 @@ ip6r_cmp(PG_FUNCTION_ARGS)
 	PG_RETURN_INT32(1);
 }
 
-PG_FUNCTION_INFO_V1(ip6_cmp);
-Datum
-ip6_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ip6_cmp, IPR_STAT_COMPARE, IPR_STAT_IP6, 1)
 {
 	IP6 *a = PG_GETARG_IP6_P(0);
 	IP6 *b = PG_GETARG_IP6_P(1);
@@ -1462,6 +1467,7 @@ Datum gip6r_picksplit(PG_FUNCTION_ARGS);
 Datum gip6r_union(PG_FUNCTION_ARGS);
 Datum gip6r_same(PG_FUNCTION_ARGS);
 Datum gip6r_fetch(PG_FUNCTION_ARGS);
+Datum gip6r_distance(PG_FUNCTION_ARGS);
 
 static bool gip6r_leaf_consistent(IP6R * key, IP6R * query, StrategyNumber strategy);
 static bool gip6r_internal_consistent(IP6R * key, IP6R * query, StrategyNumber strategy);
@@ -1472,9 +1478,7 @@ static bool gip6r_internal_consistent(IP6R * key, IP6R * query, StrategyNumber s
 ** the predicate x op query == false, where op is the oper
 ** corresponding to strategy in the pg_amop table.
 */
-PG_FUNCTION_INFO_V1(gip6r_consistent);
-Datum
-gip6r_consistent(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_consistent, IPR_STAT_GIST_CONSISTENT, IPR_STAT_IP6R, 1)
 {
 	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	IP6R *query = (IP6R *) PG_GETARG_POINTER(1);
@@ -1496,16 +1500,38 @@ gip6r_consistent(PG_FUNCTION_ARGS)
 	else
 		retval = gip6r_internal_consistent(key, query, strategy);
 
+	if (unlikely(ipr_track_gist_scans))
+		ipr_gist_scan_count(IPR_GIST_IP6R, strategy, GIST_LEAF(entry), entry->page,
+							retval, recheck && *recheck);
+
 	PG_RETURN_BOOL(retval);
 }
 
+/*
+** The GiST Distance method, for the <-> ordering operator only.
+** A leaf gets the exact distance. Any leaf under an internal entry that
+** contains the query contains it too, and so is no smaller than the
+** query; so the query's own size is the lower bound.
+*/
+PG_FUNCTION_INFO_V1(gip6r_distance);
+Datum
+gip6r_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	IP6R *query = (IP6R *) PG_GETARG_POINTER(1);
+	IP6R *key = (IP6R *) DatumGetPointer(entry->key);
+
+	if (!ip6r_contains_internal(key, query, true))
+		PG_RETURN_FLOAT8(HUGE_VAL);
+	PG_RETURN_FLOAT8(ip6r_metric(GIST_LEAF(entry) ? key : query));
+}
+
 /*
 ** The GiST Union method for IP ranges
 ** returns the minimal bounding IP4R that encloses all the entries in entryvec
 */
-PG_FUNCTION_INFO_V1(gip6r_union);
-Datum
-gip6r_union(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_union, IPR_STAT_GIST_UNION, IPR_STAT_IP6R,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	int *sizep = (int *) PG_GETARG_POINTER(1);
@@ -1527,10 +1553,7 @@ gip6r_union(PG_FUNCTION_ARGS)
 	for (i = 1; i < numranges; i++)
 	{
 		tmp = (IP6R *) DatumGetPointer(ent[i].key);
-		if (ip6_lessthan(&tmp->lower,&out->lower))
-			out->lower = tmp->lower;
-		if (ip6_lessthan(&out->upper,&tmp->upper))
-			out->upper = tmp->upper;
+		ip6r_union_internal(out, tmp, out);
 	}
 
 	PG_RETURN_IP6R_P(out);
@@ -1540,23 +1563,17 @@ gip6r_union(PG_FUNCTION_ARGS)
 ** GiST Compress and Decompress methods for IP ranges
 ** do not do anything.
 */
-PG_FUNCTION_INFO_V1(gip6r_compress);
-Datum
-gip6r_compress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_compress, IPR_STAT_GIST_COMPRESS, IPR_STAT_IP6R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
 
-PG_FUNCTION_INFO_V1(gip6r_decompress);
-Datum
-gip6r_decompress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_decompress, IPR_STAT_GIST_DECOMPRESS, IPR_STAT_IP6R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
 
-PG_FUNCTION_INFO_V1(gip6r_fetch);
-Datum
-gip6r_fetch(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_fetch, IPR_STAT_GIST_FETCH, IPR_STAT_IP6R, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
@@ -1565,49 +1582,16 @@ gip6r_fetch(PG_FUNCTION_ARGS)
 ** The GiST Penalty method for IP ranges
 ** As in the R-tree paper, we use change in area as our penalty metric
 */
-PG_FUNCTION_INFO_V1(gip6r_penalty);
-Datum
-gip6r_penalty(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_penalty, IPR_STAT_GIST_PENALTY, IPR_STAT_IP6R, 1)
 {
 	GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
 	float *result = (float *) PG_GETARG_POINTER(2);
 	IP6R *key = (IP6R *) DatumGetPointer(origentry->key);
 	IP6R *newkey = (IP6R *) DatumGetPointer(newentry->key);
-	IP6R ud;
-	double tmp = 0.0;
-
-	/* rather than subtract the sizes, which might lose due to rounding errors,
-	 * we calculate the actual number of addresses added to the range.
-	 */
-
-	if (ip6_lessthan(&newkey->lower,&key->lower))
-	{
-		ud.lower = newkey->lower;
-		ud.upper = key->lower;
-		ip6_sub_int(&ud.upper,1,&ud.upper);
-		tmp = ip6r_metric(&ud);
-	}
-	if (ip6_lessthan(&key->upper,&newkey->upper))
-	{
-		ud.lower = key->upper;
-		ud.upper = newkey->upper;
-		ip6_sub_int(&ud.upper,1,&ud.upper);
-		tmp += ip6r_metric(&ud);
-	}
 
-	/*
-	 * we want to scale the result a bit. For one thing, the gist code implicitly
-	 * assigns a penalty of 1e10 for a union of null and non-null values, and we
-	 * want to keep our values less than that. For another, the penalty is sometimes
-	 * summed across columns of a multi-column index, and we don't want our huge
-	 * metrics (>2^80) to completely swamp anything else.
-	 *
-	 * So, we scale as the fourth power of the log2 of the computed penalty, which
-	 * gives us a range 0 - 268435456.
-	 */
-
-	*result = (float) pow(log(tmp+1) / log(2), 4);
+	/* see ip6r_penalty for the scaling */
+	*result = ip6r_penalty(key, newkey);
 
 #ifdef GIST_DEBUG
 	fprintf(stderr, "penalty\n");
@@ -1642,9 +1626,8 @@ gip6r_sort_compare(const void *a, const void *b)
 ** based on the box functions in rtree_gist simplified to one
 ** dimension
 */
-PG_FUNCTION_INFO_V1(gip6r_picksplit);
-Datum
-gip6r_picksplit(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_picksplit, IPR_STAT_GIST_PICKSPLIT, IPR_STAT_IP6R,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
@@ -1787,9 +1770,7 @@ gip6r_picksplit(PG_FUNCTION_ARGS)
 /*
 ** Equality methods
 */
-PG_FUNCTION_INFO_V1(gip6r_same);
-Datum
-gip6r_same(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gip6r_same, IPR_STAT_GIST_SAME, IPR_STAT_IP6R, 1)
 {
 	IP6R *v1 = (IP6R *) PG_GETARG_POINTER(0);
 	IP6R *v2 = (IP6R *) PG_GETARG_POINTER(1);
@@ -6,6 +6,53 @@
  * implemented in terms of these functions.
  */
 
+/*
+ * If the compiler has a native 128-bit integer type, do the arithmetic and
+ * comparisons on IP6 values as single 128-bit operations; this lets the
+ * compiler generate branch-free compare/subtract-with-borrow sequences
+ * rather than the word-at-a-time logic of the fallback code. Define
+ * IP6R_NO_INT128 to force the fallback (the benchmark does this to compare
+ * the two).
+ */
+#if defined(HAVE_INT128) && !defined(IP6R_NO_INT128)
+#define IP6R_USE_INT128 1
+#endif
+
+#ifdef IP6R_USE_INT128
+
+static inline
+uint128 ip6_get128(const IP6 *ip)
+{
+	return ((uint128) ip->bits[0] << 64) | ip->bits[1];
+}
+
+static inline
+void ip6_set128(IP6 *ip, uint128 val)
+{
+	ip->bits[0] = (uint64) (val >> 64);
+	ip->bits[1] = (uint64) val;
+}
+
+static inline
+uint128 hostmask6(unsigned masklen)
+{
+	return (masklen >= 128) ? 0 : (~(uint128)0 >> masklen);
+}
+
+static inline
+uint64 hostmask6_hi(unsigned masklen)
+{
+	return (uint64) (hostmask6(masklen) >> 64);
+}
+
+static inline
+uint64 hostmask6_lo(unsigned masklen)
+{
+	return (uint64) hostmask6(masklen);
+}
+
+#else
+
 static inline
 uint64 hostmask6_hi(unsigned masklen)
 {
@@ -24,6 +71,8 @@ uint64 hostmask6_lo(unsigned masklen)
 	return (((uint64)(1U)) << (128-masklen)) - 1U;
 }
 
+#endif
+
 static inline
 uint64 netmask6_hi(unsigned masklen)
 {
@@ -80,6 +129,51 @@ unsigned masklen64(uint64 lo, uint64 hi, int offset)
 	return ~0;
 }
 
+/* position of the highest set bit of a nonzero value */
+
+static inline
+int ip6_highbit64(uint64 v)
+{
+#ifdef HAVE__BUILTIN_CLZ
+	return 63 - __builtin_clzll(v);
+#else
+	int n = 0;
+
+	if (v >> 32) { n += 32; v >>= 32; }
+	if (v >> 16) { n += 16; v >>= 16; }
+	if (v >> 8) { n += 8; v >>= 8; }
+	if (v >> 4) { n += 4; v >>= 4; }
+	if (v >> 2) { n += 2; v >>= 2; }
+	if (v >> 1) { n += 1; }
+	return n;
+#endif
+}
+
+#ifdef IP6R_USE_INT128
+
+static inline
+unsigned masklen6(IP6 *lo, IP6 *hi)
+{
+	uint128 l = ip6_get128(lo);
+	uint128 h = ip6_get128(hi);
+	uint128 d = l ^ h;
+
+	/* CIDR iff the differing bits are a run of low-order bits which are
+	 * all clear in LO and all set in HI
+	 */
+	if ((d & (d + 1)) != 0 || (l & d) != 0 || (h & d) != d)
+		return ~0U;
+
+	/* so d is 2^k-1, and the prefix length is 128-k */
+	if ((uint64) (d >> 64) != 0)
+		return 63 - ip6_highbit64((uint64) (d >> 64));
+	if ((uint64) d != 0)
+		return 127 - ip6_highbit64((uint64) d);
+	return 128;
+}
+
+#else
+
 static inline
 unsigned masklen6(IP6 *lo, IP6 *hi)
 {
@@ -95,6 +189,8 @@ unsigned masklen6(IP6 *lo, IP6 *hi)
 	}
 }
 
+#endif
+
 static inline
 bool ip6_valid_netmask(uint64 maskhi, uint64 masklo)
 {
@@ -170,9 +266,41 @@ void ip6_deserialize(const void *src, IP6 *ip)
 static inline
 bool ip6_equal(IP6 *a, IP6 *b)
 {
-	return (a->bits[0] == b->bits[0]) && (a->bits[1] == b->bits[1]);
+	return ((a->bits[0] ^ b->bits[0]) | (a->bits[1] ^ b->bits[1])) == 0;
+}
+
+#ifdef IP6R_USE_INT128
+
+static inline
+int ip6_compare(IP6 *a, IP6 *b)
+{
+	uint128 x = ip6_get128(a);
+	uint128 y = ip6_get128(b);
+
+	return (x > y) - (x < y);
+}
+
+static inline
+bool ip6_lessthan(IP6 *a, IP6 *b)
+{
+	return ip6_get128(a) < ip6_get128(b);
+}
+
+static inline
+void ip6_sub(IP6 *minuend, IP6 *subtrahend, IP6 *result)
+{
+	ip6_set128(result, ip6_get128(minuend) - ip6_get128(subtrahend));
+}
+
+static inline
+void ip6_sub_int(IP6 *minuend, int subtrahend, IP6 *result)
+{
+	/* sign-extend, so that negative values add */
+	ip6_set128(result, ip6_get128(minuend) - (uint128) (int128) subtrahend);
 }
 
+#else
+
 static inline
 int ip6_compare(IP6 *a, IP6 *b)
 {
@@ -216,6 +344,100 @@ void ip6_sub_int(IP6 *minuend, int subtrahend, IP6 *result)
 	result->bits[1] = res_lo;
 }
 
+#endif
+
+/* the lowest or highest address of the prefix of length PFXLEN containing
+ * IP. RESULT may alias IP.
+ */
+
+static inline
+void ip6_net_lower_internal(IP6 *ip, unsigned pfxlen, IP6 *result)
+{
+	result->bits[0] = ip->bits[0] & netmask6_hi(pfxlen);
+	result->bits[1] = ip->bits[1] & netmask6_lo(pfxlen);
+}
+
+static inline
+void ip6_net_upper_internal(IP6 *ip, unsigned pfxlen, IP6 *result)
+{
+	result->bits[0] = ip->bits[0] | hostmask6_hi(pfxlen);
+	result->bits[1] = ip->bits[1] | hostmask6_lo(pfxlen);
+}
+
+/* arithmetic; these return false if the result would be out of range.
+ * RESULT may alias IP.
+ */
+
+static inline
+bool ip6_plus_int64(IP6 *ip, int64 addend, IP6 *result)
+{
+	IP6 res;
+	bool ok;
+
+	if (addend >= 0)
+	{
+		res.bits[1] = ip->bits[1] + (uint64) addend;
+		res.bits[0] = ip->bits[0] + (res.bits[1] < ip->bits[1]);
+	}
+	else
+	{
+		res.bits[1] = ip->bits[1] - ((uint64) 0 - (uint64) addend);
+		res.bits[0] = ip->bits[0] - (res.bits[1] > ip->bits[1]);
+	}
+
+	ok = ((addend < 0) == ip6_lessthan(&res, ip));
+	*result = res;
+	return ok;
+}
+
+static inline
+bool ip6_minus_int64(IP6 *ip, int64 subtrahend, IP6 *result)
+{
+	IP6 res;
+	bool ok;
+
+	if (subtrahend >= 0)
+	{
+		res.bits[1] = ip->bits[1] - (uint64) subtrahend;
+		res.bits[0] = ip->bits[0] - (res.bits[1] > ip->bits[1]);
+	}
+	else
+	{
+		res.bits[1] = ip->bits[1] + ((uint64) 0 - (uint64) subtrahend);
+		res.bits[0] = ip->bits[0] + (res.bits[1] < ip->bits[1]);
+	}
+
+	ok = ((subtrahend > 0) == ip6_lessthan(&res, ip));
+	*result = res;
+	return ok;
+}
+
+/* add (or subtract, if NEGATIVE) an unsigned 128-bit quantity; a zero
+ * ADDEND must not be flagged as NEGATIVE.
+ */
+
+static inline
+bool ip6_plus_ip6(IP6 *ip, IP6 *addend, bool negative, IP6 *result)
+{
+	IP6 res;
+	bool ok;
+
+	if (!negative)
+	{
+		res.bits[1] = ip->bits[1] + addend->bits[1];
+		res.bits[0] = ip->bits[0] + addend->bits[0] + (res.bits[1] < ip->bits[1]);
+	}
+	else
+	{
+		res.bits[1] = ip->bits[1] - addend->bits[1];
+		res.bits[0] = ip->bits[0] - addend->bits[0] - (res.bits[1] > ip->bits[1]);
+	}
+
+	ok = (negative == ip6_lessthan(&res, ip));
+	*result = res;
+	return ok;
+}
+
 static inline
 bool ip6_in_range_internal(IP6 *val, IP6 *base, IP6 *offset, bool sub, bool less)
 {
@@ -356,6 +578,22 @@ bool ip6r_split_cidr(IP6R *val, IP6R *res)
 	return false;
 }
 
+/* as for ip4r_split_cidrs */
+
+#define IP6R_MAX_CIDRS 254
+
+static inline
+int ip6r_split_cidrs(IP6R *val, IP6R *res)
+{
+	IP6R tmp = *val;
+	int n = 0;
+
+	while (!ip6r_split_cidr(&tmp, &res[n]))
+		++n;
+
+	return n + 1;
+}
+
 /* helpers for union/intersection for indexing */
 
 /* note that this function has to handle the case where RESULT aliases
@@ -418,6 +656,81 @@ double ip6r_metric(IP6R *v)
 			 + (diff.bits[1] + 1.0) );
 }
 
+/*
+ * Approximate log2(v+1) for the 128-bit value hi:lo, without libm. The
+ * integer part is the position of the top bit of v+1, and the fraction is
+ * taken linearly from the 23 bits below it. This is exact at powers of 2,
+ * never more than 0.09 too small, and monotone, which is what matters.
+ */
+
+static inline
+float ip6_log2p1(uint64 hi, uint64 lo)
+{
+	int b;
+	uint64 m;
+
+	lo += 1;
+	hi += (lo == 0);
+
+	if (hi != 0)
+	{
+		int t = ip6_highbit64(hi);
+		b = 64 + t;
+		m = t ? ((hi << (64 - t)) | (lo >> t)) : lo;
+	}
+	else if (lo != 0)
+	{
+		b = ip6_highbit64(lo);
+		m = b ? (lo << (64 - b)) : 0;
+	}
+	else
+		return 128.0f;		/* v+1 wrapped to 2^128 */
+
+	return (float) b + (float) (m >> 41) * (1.0f / 8388608.0f);
+}
+
+/*
+ * GiST penalty for adding NEWKEY to KEY. Rather than subtract the sizes,
+ * which might lose due to rounding errors, we count the actual number of
+ * addresses added to the range.
+ *
+ * We then want to scale the result a bit. For one thing, the gist code
+ * implicitly assigns a penalty of 1e10 for a union of null and non-null
+ * values, and we want to keep our values less than that. For another, the
+ * penalty is sometimes summed across columns of a multi-column index, and we
+ * don't want our huge metrics (>2^80) to completely swamp anything else.
+ *
+ * So, we scale as the fourth power of the log2 of the computed penalty, which
+ * gives us a range 0 - 268435456. This used to be done with pow(log()), but
+ * penalty is called for every candidate on every insertion, so the log2 is
+ * now done in the integer domain.
+ */
+
+static inline
+float ip6r_penalty(IP6R *key, IP6R *newkey)
+{
+	uint64 hi = 0;
+	uint64 lo = 0;
+	IP6 d;
+	float l;
+
+	if (ip6_lessthan(&newkey->lower,&key->lower))
+	{
+		ip6_sub(&key->lower, &newkey->lower, &d);
+		hi = d.bits[0];
+		lo = d.bits[1];
+	}
+	if (ip6_lessthan(&key->upper,&newkey->upper))
+	{
+		ip6_sub(&newkey->upper, &key->upper, &d);
+		lo += d.bits[1];
+		hi += d.bits[0] + (lo < d.bits[1]);
+	}
+
+	l = ip6_log2p1(hi, lo);
+	return (l * l) * (l * l);
+}
+
 /* comparisons */
 
 static inline
@@ -429,7 +742,7 @@ bool ip6_less_eq(IP6 *a, IP6 *b)
 static inline
 bool ip6r_equal(IP6R *a, IP6R *b)
 {
-	return ip6_equal(&a->lower,&b->lower) && ip6_equal(&a->upper,&b->upper);
+	return ip6_equal(&a->lower,&b->lower) & ip6_equal(&a->upper,&b->upper);
 }
 
 static inline
@@ -449,24 +762,28 @@ bool ip6r_less_eq(IP6R *a, IP6R *b)
 	return !ip6r_lessthan(b,a);
 }
 
+/* these use & rather than && deliberately, since both sides are cheap
+ * and side-effect-free, and avoiding the branch is a win in index scans
+ */
+
 static inline
 bool ip6r_contains_internal(IP6R *left, IP6R *right, bool eqval)
 {
 	if (ip6r_equal(left,right))
 		return eqval;
-	return !ip6_lessthan(&right->lower,&left->lower) && !ip6_lessthan(&left->upper,&right->upper);
+	return !ip6_lessthan(&right->lower,&left->lower) & !ip6_lessthan(&left->upper,&right->upper);
 }
 
 static inline
 bool ip6r_overlaps_internal(IP6R *left, IP6R *right)
 {
-	return !ip6_lessthan(&left->upper,&right->lower) && !ip6_lessthan(&right->upper,&left->lower);
+	return !ip6_lessthan(&left->upper,&right->lower) & !ip6_lessthan(&right->upper,&left->lower);
 }
 
 static inline
 bool ip6_contains_internal(IP6R *left, IP6 *right)
 {
-	return !ip6_lessthan(right,&left->lower) && !ip6_lessthan(&left->upper,right);
+	return !ip6_lessthan(right,&left->lower) & !ip6_lessthan(&left->upper,right);
 }
 
 /* end */
@@ -61,52 +61,125 @@ ipaddr_transform_1d(Datum d, PGFunction ip4func, PGFunction ip6func)
 }
 
 
-/* func(IP) returns IP */
+/*
+ * The operators below don't go through the ip4 or ip6 functions at all;
+ * they unpack their arguments and apply the same inline kernels (from
+ * ip4r_funcs.h / ip6r_funcs.h) directly, so the only allocation is the
+ * packed result.
+ */
+
+static inline
+void
+ipaddr_out_of_range(void)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+			 errmsg("ip address out of range")));
+}
+
+/* func(IP, int64) returns IP, or false if out of range */
+
+typedef bool (*ip4_int64_kernel)(IP4 ip, int64 val, IP4 *result);
+typedef bool (*ip6_int64_kernel)(IP6 *ip, int64 val, IP6 *result);
 
 static inline
 IP_P
-ipaddr_transform_1(Datum d, PGFunction ip4func, PGFunction ip6func)
+ipaddr_arith_int64(Datum d, int64 val, ip4_int64_kernel ip4func, ip6_int64_kernel ip6func)
 {
 	IP_P ipp = DatumGetIP_P(d);
 	IP ip;
 	int af = ip_unpack(ipp, &ip);
+	bool ok;
 
 	switch (af)
 	{
 		case PGSQL_AF_INET:
-			ip.ip4 = DatumGetIP4(DirectFunctionCall1(ip4func, IP4GetDatum(ip.ip4)));
+			ok = ip4func(ip.ip4, val, &ip.ip4);
 			break;
 
 		case PGSQL_AF_INET6:
-			ip.ip6 = *(DatumGetIP6P(DirectFunctionCall1(ip6func, IP6PGetDatum(&ip.ip6))));
+			ok = ip6func(&ip.ip6, val, &ip.ip6);
 			break;
 
 		default:
 			ipaddr_internal_error();
 	}
 
+	if (!ok)
+		ipaddr_out_of_range();
+
 	return ip_pack(af, &ip);
 }
 
+/* IP +/- numeric */
+
+static inline
+IP_P
+ipaddr_arith_numeric(Datum d, Datum num, bool negate)
+{
+	IP_P ipp = DatumGetIP_P(d);
+	IP ip;
+	int af = ip_unpack(ipp, &ip);
+	bool ok;
+
+	switch (af)
+	{
+		case PGSQL_AF_INET:
+			{
+				int64 val = DatumGetInt64(DirectFunctionCall1(numeric_int8, num));
+
+				if (negate)
+					ok = ip4_minus_int64(ip.ip4, val, &ip.ip4);
+				else
+					ok = ip4_plus_int64(ip.ip4, val, &ip.ip4);
+			}
+			break;
+
+		case PGSQL_AF_INET6:
+			ok = ip6_plus_numeric_internal(&ip.ip6, DatumGetNumeric(num), negate, &ip.ip6);
+			break;
+
+		default:
+			ipaddr_internal_error();
+	}
 
-/* func(IP, Datum) returns IP */
+	if (!ok)
+		ipaddr_out_of_range();
+
+	return ip_pack(af, &ip);
+}
+
+/* lower or upper bound of the prefix of length PFXLEN containing IP */
 
 static inline
 IP_P
-ipaddr_transform_2d(Datum d1, Datum d2, PGFunction ip4func, PGFunction ip6func)
+ipaddr_net_bound(Datum d, int pfxlen, bool upper)
 {
-	IP_P ipp = DatumGetIP_P(d1);
+	IP_P ipp = DatumGetIP_P(d);
 	IP ip;
 	int af = ip_unpack(ipp, &ip);
 
+	if (pfxlen < 0 || pfxlen > ipr_af_maxbits(af))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("prefix length out of range")));
+	}
+
 	switch (af)
 	{
 		case PGSQL_AF_INET:
-			ip.ip4 = DatumGetIP4(DirectFunctionCall2(ip4func, IP4GetDatum(ip.ip4), d2));
+			if (upper)
+				ip.ip4 = ip4_net_upper_internal(ip.ip4, pfxlen);
+			else
+				ip.ip4 = ip4_net_lower_internal(ip.ip4, pfxlen);
 			break;
 
 		case PGSQL_AF_INET6:
-			ip.ip6 = *(DatumGetIP6P(DirectFunctionCall2(ip6func, IP6PGetDatum(&ip.ip6), d2)));
+			if (upper)
+				ip6_net_upper_internal(&ip.ip6, pfxlen, &ip.ip6);
+			else
+				ip6_net_lower_internal(&ip.ip6, pfxlen, &ip.ip6);
 			break;
 
 		default:
@@ -116,11 +189,38 @@ ipaddr_transform_2d(Datum d1, Datum d2, PGFunction ip4func, PGFunction ip6func)
 	return ip_pack(af, &ip);
 }
 
-/* func(IP,IP) returns IP; it's an error for the source IPs to be in different families */
+/*
+ * bitwise func(IP,IP) returns IP; it's an error for the source IPs to be in
+ * different families. The operation is applied a word at a time, an IP4
+ * being just a short word.
+ */
+
+typedef uint64 (*ip_word_kernel)(uint64 a, uint64 b);
+
+static inline
+uint64
+ip_word_and(uint64 a, uint64 b)
+{
+	return a & b;
+}
+
+static inline
+uint64
+ip_word_or(uint64 a, uint64 b)
+{
+	return a | b;
+}
+
+static inline
+uint64
+ip_word_xor(uint64 a, uint64 b)
+{
+	return a ^ b;
+}
 
 static inline
 IP_P
-ipaddr_transform_2(Datum d1, Datum d2, PGFunction ip4func, PGFunction ip6func)
+ipaddr_bitwise(Datum d1, Datum d2, ip_word_kernel func)
 {
 	IP_P ipp1 = DatumGetIP_P(d1);
 	IP_P ipp2 = DatumGetIP_P(d2);
@@ -138,11 +238,12 @@ ipaddr_transform_2(Datum d1, Datum d2, PGFunction ip4func, PGFunction ip6func)
 	switch (af1)
 	{
 		case PGSQL_AF_INET:
-			out.ip4 = DatumGetIP4(DirectFunctionCall2(ip4func, IP4GetDatum(ip1.ip4), IP4GetDatum(ip2.ip4)));
+			out.ip4 = (IP4) func(ip1.ip4, ip2.ip4);
 			break;
 
 		case PGSQL_AF_INET6:
-			out.ip6 = *(DatumGetIP6P(DirectFunctionCall2(ip6func, IP6PGetDatum(&ip1.ip6), IP6PGetDatum(&ip2.ip6))));
+			out.ip6.bits[0] = func(ip1.ip6.bits[0], ip2.ip6.bits[0]);
+			out.ip6.bits[1] = func(ip1.ip6.bits[1], ip2.ip6.bits[1]);
 			break;
 
 		default:
@@ -186,9 +287,7 @@ set_text_len(text *txt, int len)
 ** Input/Output routines
 */
 
-PG_FUNCTION_INFO_V1(ipaddr_in);
-Datum
-ipaddr_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ipaddr_in, IPR_STAT_PARSE, IPR_STAT_IPADDRESS, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IP ip;
@@ -209,9 +308,7 @@ ipaddr_in(PG_FUNCTION_ARGS)
 			 errmsg("invalid IP value: '%s'", str)));
 }
 
-PG_FUNCTION_INFO_V1(ipaddr_out);
-Datum
-ipaddr_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ipaddr_out, IPR_STAT_FORMAT, IPR_STAT_IPADDRESS, 1)
 {
 	IP_P ipp = PG_GETARG_IP_P(0);
 	char *out = palloc(IP6_STRING_MAX);
@@ -238,6 +335,22 @@ ipaddr_recv(PG_FUNCTION_ARGS)
 	IP ip;
 	int af, bits, nbytes;
 
+	/*
+	 * The compact format (see iprange_recv) is just the address, which
+	 * can't be confused with the 8 or 20 bytes of the standard one.
+	 */
+	switch (buf->len - buf->cursor)
+	{
+		case sizeof(IP4):
+			ip.ip4 = (IP4) pq_getmsgint(buf, sizeof(IP4));
+			PG_RETURN_IP_P(ip_pack(PGSQL_AF_INET, &ip));
+
+		case sizeof(IP6):
+			ip.ip6.bits[0] = pq_getmsgint64(buf);
+			ip.ip6.bits[1] = pq_getmsgint64(buf);
+			PG_RETURN_IP_P(ip_pack(PGSQL_AF_INET6, &ip));
+	}
+
 	/* we copy the external format used by inet/cidr, just because. */
 
 	af = pq_getmsgbyte(buf);
@@ -282,10 +395,14 @@ ipaddr_send(PG_FUNCTION_ARGS)
 	int af = ip_unpack(arg1, &ip);
 
 	pq_begintypsend(&buf);
-	pq_sendbyte(&buf, af);
-	pq_sendbyte(&buf, (int8) ipr_af_maxbits(af));
-	pq_sendbyte(&buf, 1);
-	pq_sendbyte(&buf, ip_sizeof(af));
+
+	if (ipr_binary_format != IPR_BINARY_COMPACT)
+	{
+		pq_sendbyte(&buf, af);
+		pq_sendbyte(&buf, (int8) ipr_af_maxbits(af));
+		pq_sendbyte(&buf, 1);
+		pq_sendbyte(&buf, ip_sizeof(af));
+	}
 
 	switch (af)
 	{
@@ -302,23 +419,45 @@ ipaddr_send(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-PG_FUNCTION_INFO_V1(ipaddr_hash);
-Datum
-ipaddr_hash(PG_FUNCTION_ARGS)
+/*
+ * These hash the unpacked value, which gives the same result as hashing the
+ * packed bytes (and hence as ip4hash/ip6hash) but avoids hash_any's
+ * unaligned path.
+ */
+
+IPR_STAT_FUNCTION(ipaddr_hash, IPR_STAT_HASH, IPR_STAT_IPADDRESS, 1)
 {
 	IP_P arg1 = PG_GETARG_IP_P(0);
+	IP ip;
+
+	switch (ip_unpack(arg1, &ip))
+	{
+		case PGSQL_AF_INET:
+			return hash_uint32(ip.ip4);
 
-	return hash_any((void*)(VARDATA_ANY(arg1)), VARSIZE_ANY_EXHDR(arg1));
+		case PGSQL_AF_INET6:
+			PG_RETURN_UINT32(ipr_hash_words(&ip.ip6, 4));
+	}
+
+	ipaddr_internal_error();
 }
 
-PG_FUNCTION_INFO_V1(ipaddr_hash_extended);
-Datum
-ipaddr_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ipaddr_hash_extended, IPR_STAT_HASH, IPR_STAT_IPADDRESS, 1)
 {
 	IP_P arg1 = PG_GETARG_IP_P(0);
 	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
+	IP ip;
 
-	return hash_any_extended((void*)(VARDATA_ANY(arg1)), VARSIZE_ANY_EXHDR(arg1), seed);
+	switch (ip_unpack(arg1, &ip))
+	{
+		case PGSQL_AF_INET:
+			return hash_uint32_extended(ip.ip4, seed);
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&ip.ip6, 4, seed));
+	}
+
+	ipaddr_internal_error();
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_cast_to_text);
@@ -533,6 +672,35 @@ ipaddr_cast_to_bytea(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(ipaddr_transform_1d(PG_GETARG_DATUM(0), ip4_cast_to_bytea, ip6_cast_to_bytea));
 }
 
+PG_FUNCTION_INFO_V1(ipaddr_sortkey);
+Datum
+ipaddr_sortkey(PG_FUNCTION_ARGS)
+{
+	IP_P ipp = PG_GETARG_IP_P(0);
+	IP ip;
+	int af = ip_unpack(ipp, &ip);
+	bytea *res = palloc(VARHDRSZ + IPR_SORTKEY_MAX);
+
+	SET_VARSIZE(res, VARHDRSZ + ip_sortkey_encode(af, &ip, (unsigned char *) VARDATA(res)));
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_from_sortkey);
+Datum
+ipaddr_from_sortkey(PG_FUNCTION_ARGS)
+{
+	bytea *val = PG_GETARG_BYTEA_PP(0);
+	IP ip;
+	int af = ip_sortkey_decode((unsigned char *) VARDATA_ANY(val), VARSIZE_ANY_EXHDR(val), &ip);
+
+	if (af < 0)
+		ereturn(fcinfo->context, (Datum)0,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid sort key value for conversion to IPADDRESS")));
+
+	PG_RETURN_IP_P(ip_pack(af, &ip));
+}
+
 
 PG_FUNCTION_INFO_V1(ipaddr_family);
 Datum
@@ -552,56 +720,56 @@ PG_FUNCTION_INFO_V1(ipaddr_net_lower);
 Datum
 ipaddr_net_lower(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_net_lower, ip6_net_lower));
+	PG_RETURN_IP_P(ipaddr_net_bound(PG_GETARG_DATUM(0), PG_GETARG_INT32(1), false));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_net_upper);
 Datum
 ipaddr_net_upper(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_net_upper, ip6_net_upper));
+	PG_RETURN_IP_P(ipaddr_net_bound(PG_GETARG_DATUM(0), PG_GETARG_INT32(1), true));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_plus_int);
 Datum
 ipaddr_plus_int(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_plus_int, ip6_plus_int));
+	PG_RETURN_IP_P(ipaddr_arith_int64(PG_GETARG_DATUM(0), PG_GETARG_INT32(1), ip4_plus_int64, ip6_plus_int64));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_plus_bigint);
 Datum
 ipaddr_plus_bigint(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_plus_bigint, ip6_plus_bigint));
+	PG_RETURN_IP_P(ipaddr_arith_int64(PG_GETARG_DATUM(0), PG_GETARG_INT64(1), ip4_plus_int64, ip6_plus_int64));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_plus_numeric);
 Datum
 ipaddr_plus_numeric(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_plus_numeric, ip6_plus_numeric));
+	PG_RETURN_IP_P(ipaddr_arith_numeric(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), false));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_minus_int);
 Datum
 ipaddr_minus_int(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_minus_int, ip6_minus_int));
+	PG_RETURN_IP_P(ipaddr_arith_int64(PG_GETARG_DATUM(0), PG_GETARG_INT32(1), ip4_minus_int64, ip6_minus_int64));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_minus_bigint);
 Datum
 ipaddr_minus_bigint(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_minus_bigint, ip6_minus_bigint));
+	PG_RETURN_IP_P(ipaddr_arith_int64(PG_GETARG_DATUM(0), PG_GETARG_INT64(1), ip4_minus_int64, ip6_minus_int64));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_minus_numeric);
 Datum
 ipaddr_minus_numeric(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2d(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_minus_numeric, ip6_minus_numeric));
+	PG_RETURN_IP_P(ipaddr_arith_numeric(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), true));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_minus_ipaddr);
@@ -624,15 +792,14 @@ ipaddr_minus_ipaddr(PG_FUNCTION_ARGS)
 	switch (af1)
 	{
 		case PGSQL_AF_INET:
-			res = DirectFunctionCall2(numeric_sub,
-									  DirectFunctionCall1(ip4_cast_to_numeric,IP4GetDatum(ip1.ip4)),
-									  DirectFunctionCall1(ip4_cast_to_numeric,IP4GetDatum(ip2.ip4)));
+			res = DirectFunctionCall1(int8_numeric,
+									  Int64GetDatumFast((int64)ip1.ip4 - (int64)ip2.ip4));
 			break;
 
 		case PGSQL_AF_INET6:
-			res = DirectFunctionCall2(numeric_sub,
-									  DirectFunctionCall1(ip6_cast_to_numeric,IP6PGetDatum(&ip1.ip6)),
-									  DirectFunctionCall1(ip6_cast_to_numeric,IP6PGetDatum(&ip2.ip6)));
+			res = DirectFunctionCall2(ip6_minus_ip6,
+									  IP6PGetDatum(&ip1.ip6),
+									  IP6PGetDatum(&ip2.ip6));
 			break;
 
 		default:
@@ -646,43 +813,58 @@ PG_FUNCTION_INFO_V1(ipaddr_and);
 Datum
 ipaddr_and(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_and, ip6_and));
+	PG_RETURN_IP_P(ipaddr_bitwise(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip_word_and));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_or);
 Datum
 ipaddr_or(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_or, ip6_or));
+	PG_RETURN_IP_P(ipaddr_bitwise(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip_word_or));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_xor);
 Datum
 ipaddr_xor(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_2(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip4_xor, ip6_xor));
+	PG_RETURN_IP_P(ipaddr_bitwise(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1), ip_word_xor));
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_not);
 Datum
 ipaddr_not(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_IP_P(ipaddr_transform_1(PG_GETARG_DATUM(0), ip4_not, ip6_not));
+	IP_P ipp = PG_GETARG_IP_P(0);
+	IP ip;
+	int af = ip_unpack(ipp, &ip);
+
+	switch (af)
+	{
+		case PGSQL_AF_INET:
+			ip.ip4 = ~ip.ip4;
+			break;
+
+		case PGSQL_AF_INET6:
+			ip.ip6.bits[0] = ~ip.ip6.bits[0];
+			ip.ip6.bits[1] = ~ip.ip6.bits[1];
+			break;
+
+		default:
+			ipaddr_internal_error();
+	}
+
+	PG_RETURN_IP_P(ip_pack(af, &ip));
 }
 
 
 /*
- * generic boolean comparison of two IPs. If in the same family, then the
- * passed-in comparison function is called; if in different families, then
- * the result is mismatch_af1 or _af2 according to which of the first or
- * second address is in the larger family.
+ * generic comparison of two IPs. If in different families, the IP in the
+ * larger family is the greater.
  */
 
 static inline
-bool
-ipaddr_comparison_bool(Datum d1, Datum d2,
-					   bool mismatch_af1, bool mismatch_af2,
-					   PGFunction ip4func, PGFunction ip6func)
+int
+ipaddr_cmp_internal(Datum d1, Datum d2)
 {
 	IP_P ipp1 = DatumGetIP_P(d1);
 	IP_P ipp2 = DatumGetIP_P(d2);
@@ -690,22 +872,22 @@ ipaddr_comparison_bool(Datum d1, Datum d2,
 	IP ip2;
 	int af1 = ip_unpack(ipp1, &ip1);
 	int af2 = ip_unpack(ipp2, &ip2);
-	bool retval;
+	int retval;
 
 	if (af1 != af2)
 	{
-		retval = (af1 > af2) ? mismatch_af1 : mismatch_af2;
+		retval = (af1 > af2) ? 1 : -1;
 	}
 	else
 	{
 		switch (af1)
 		{
 			case PGSQL_AF_INET:
-				retval = DatumGetBool(DirectFunctionCall2(ip4func, IP4GetDatum(ip1.ip4), IP4GetDatum(ip2.ip4)));
+				retval = ip4_compare(ip1.ip4, ip2.ip4);
 				break;
 
 			case PGSQL_AF_INET6:
-				retval = DatumGetBool(DirectFunctionCall2(ip6func, IP6PGetDatum(&ip1.ip6), IP6PGetDatum(&ip2.ip6)));
+				retval = ip6_compare(&ip1.ip6, &ip2.ip6);
 				break;
 
 			default:
@@ -725,60 +907,42 @@ PG_FUNCTION_INFO_V1(ipaddr_lt);
 Datum
 ipaddr_lt(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   false, true,
-							   ip4_lt, ip6_lt));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) < 0);
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_le);
 Datum
 ipaddr_le(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   false, true,
-							   ip4_le, ip6_le));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) <= 0);
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_gt);
 Datum
 ipaddr_gt(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   true, false,
-							   ip4_gt, ip6_gt));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) > 0);
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_ge);
 Datum
 ipaddr_ge(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   true, false,
-							   ip4_ge, ip6_ge));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) >= 0);
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_eq);
 Datum
 ipaddr_eq(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   false, false,
-							   ip4_eq, ip6_eq));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) == 0);
 }
 
 PG_FUNCTION_INFO_V1(ipaddr_neq);
 Datum
 ipaddr_neq(PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(
-		ipaddr_comparison_bool(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1),
-							   true, true,
-							   ip4_neq, ip6_neq));
+	PG_RETURN_BOOL(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) != 0);
 }
 
 
@@ -786,43 +950,9 @@ ipaddr_neq(PG_FUNCTION_ARGS)
  *												   Btree functions
  *****************************************************************************/
 
-PG_FUNCTION_INFO_V1(ipaddr_cmp);
-Datum
-ipaddr_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(ipaddr_cmp, IPR_STAT_COMPARE, IPR_STAT_IPADDRESS, 1)
 {
-	IP_P ipp1 = PG_GETARG_IP_P(0);
-	IP_P ipp2 = PG_GETARG_IP_P(1);
-	IP ip1;
-	IP ip2;
-	int af1 = ip_unpack(ipp1, &ip1);
-	int af2 = ip_unpack(ipp2, &ip2);
-	int32 retval;
-
-	if (af1 != af2)
-	{
-		retval = (af1 > af2) ? 1 : -1;
-	}
-	else
-	{
-		switch (af1)
-		{
-			case PGSQL_AF_INET:
-				retval = DatumGetInt32(DirectFunctionCall2(ip4_cmp, IP4GetDatum(ip1.ip4), IP4GetDatum(ip2.ip4)));
-				break;
-
-			case PGSQL_AF_INET6:
-				retval = DatumGetInt32(DirectFunctionCall2(ip6_cmp, IP6PGetDatum(&ip1.ip6), IP6PGetDatum(&ip2.ip6)));
-				break;
-
-			default:
-				ipaddr_internal_error();
-		}
-	}
-
-	PG_FREE_IF_COPY(ipp1,0);
-	PG_FREE_IF_COPY(ipp2,1);
-
-	PG_RETURN_INT32(retval);
+	PG_RETURN_INT32(ipaddr_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)));
 }
 
 /* end */
@@ -0,0 +1,357 @@
+/* iparray.c */
+
+#include "postgres.h"
+
+#include <sys/socket.h>
+
+#include "fmgr.h"
+
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/elog.h"
+#include "utils/palloc.h"
+
+#include "ipr_internal.h"
+
+/*
+ * Containment of whole arrays of addresses in one range, as counts, masks
+ * or filtered arrays, without a function call per element.
+ *
+ * The non-null elements of an array of a fixed-length type are stored
+ * contiguously whatever the null bitmap says, so for ip4[] and ip6[] the
+ * tests run over the array data as over a plain C array. The loops are
+ * free of branches (an ip4 x is in [lower,upper] iff x - lower <= upper -
+ * lower, unsigned), and this file is built with CFLAGS_VECTORIZE, so the
+ * compiler can turn them into SIMD code. ipaddress[] has variable-length
+ * elements, which are unpacked one at a time.
+ */
+
+typedef enum IPA_Op
+{
+	IPA_COUNT,
+	IPA_MASK,
+	IPA_FILTER
+} IPA_Op;
+
+/* the number of non-null elements */
+
+static int
+ipa_nonnull(ArrayType *arr, int nitems)
+{
+	bits8 *bitmap = ARR_NULLBITMAP(arr);
+	int n = 0;
+	int i;
+
+	if (!bitmap)
+		return nitems;
+
+	for (i = 0; i < nitems; ++i)
+		n += (bitmap[i / 8] >> (i % 8)) & 1;
+
+	return n;
+}
+
+/*
+ * Build a boolean array with the shape and nulls of ARR, given the values
+ * for its non-null elements.
+ */
+
+static ArrayType *
+ipa_mask_array(ArrayType *arr, int nitems, const bool *match, int n)
+{
+	int ndim = ARR_NDIM(arr);
+	int32 dataoffset = ARR_HASNULL(arr) ? ARR_OVERHEAD_WITHNULLS(ndim, nitems) : 0;
+	Size nbytes = (dataoffset ? dataoffset : ARR_OVERHEAD_NONULLS(ndim)) + n;
+	ArrayType *res = palloc0(nbytes);
+
+	SET_VARSIZE(res, nbytes);
+	res->ndim = ndim;
+	res->dataoffset = dataoffset;
+	res->elemtype = BOOLOID;
+	memcpy(ARR_DIMS(res), ARR_DIMS(arr), ndim * sizeof(int));
+	memcpy(ARR_LBOUND(res), ARR_LBOUND(arr), ndim * sizeof(int));
+	if (dataoffset)
+		memcpy(ARR_NULLBITMAP(res), ARR_NULLBITMAP(arr), (nitems + 7) / 8);
+	memcpy(ARR_DATA_PTR(res), match, n);
+
+	return res;
+}
+
+/* Build a one-dimensional array of N fixed-length elements from DATA. */
+
+static ArrayType *
+ipa_fixed_array(Oid elemtype, int elemlen, const void *data, int n)
+{
+	Size nbytes = ARR_OVERHEAD_NONULLS(1) + (Size) n * elemlen;
+	ArrayType *res;
+
+	if (n == 0)
+		return construct_empty_array(elemtype);
+
+	res = palloc0(nbytes);
+	SET_VARSIZE(res, nbytes);
+	res->ndim = 1;
+	res->dataoffset = 0;
+	res->elemtype = elemtype;
+	ARR_DIMS(res)[0] = n;
+	ARR_LBOUND(res)[0] = 1;
+	memcpy(ARR_DATA_PTR(res), data, (Size) n * elemlen);
+
+	return res;
+}
+
+/*
+ * The kernels. The count loops keep a separate 32-bit total, since arrays
+ * can't have more than MaxArraySize elements, so that the compiler can
+ * keep it in a vector register of the same width as the data.
+ */
+
+static int64
+ipa_count4(const IP4 *a, int n, IP4 lower, IP4 span)
+{
+	uint32 count = 0;
+	int i;
+
+	for (i = 0; i < n; ++i)
+		count += ((IP4) (a[i] - lower) <= span);
+
+	return count;
+}
+
+static void
+ipa_match4(const IP4 *a, int n, IP4 lower, IP4 span, bool *out)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		out[i] = ((IP4) (a[i] - lower) <= span);
+}
+
+static inline bool
+ipa_in6(const IP6 *x, const IP6 *lower, const IP6 *upper)
+{
+	uint64 hi = x->bits[0];
+	uint64 lo = x->bits[1];
+
+	return (((hi > lower->bits[0]) | ((hi == lower->bits[0]) & (lo >= lower->bits[1])))
+			& ((hi < upper->bits[0]) | ((hi == upper->bits[0]) & (lo <= upper->bits[1]))));
+}
+
+static int64
+ipa_count6(const IP6 *a, int n, const IP6 *lower, const IP6 *upper)
+{
+	uint32 count = 0;
+	int i;
+
+	for (i = 0; i < n; ++i)
+		count += ipa_in6(&a[i], lower, upper);
+
+	return count;
+}
+
+static void
+ipa_match6(const IP6 *a, int n, const IP6 *lower, const IP6 *upper, bool *out)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		out[i] = ipa_in6(&a[i], lower, upper);
+}
+
+static Datum
+ip4_array_contained(FunctionCallInfo fcinfo, IPA_Op op)
+{
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P(0);
+	IP4R *ipr = PG_GETARG_IP4R_P(1);
+	int nitems = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+	int n = ipa_nonnull(arr, nitems);
+	const IP4 *data = (const IP4 *) ARR_DATA_PTR(arr);
+	IP4 span = ipr->upper - ipr->lower;
+	bool *match;
+	IP4 *out;
+	int i, k;
+
+	if (op == IPA_COUNT)
+		PG_RETURN_INT64(ipa_count4(data, n, ipr->lower, span));
+
+	match = palloc(n + 1);
+	ipa_match4(data, n, ipr->lower, span, match);
+
+	if (op == IPA_MASK)
+		PG_RETURN_ARRAYTYPE_P(ipa_mask_array(arr, nitems, match, n));
+
+	out = palloc((n + 1) * sizeof(IP4));
+	for (i = k = 0; i < n; ++i)
+	{
+		out[k] = data[i];
+		k += match[i];
+	}
+
+	PG_RETURN_ARRAYTYPE_P(ipa_fixed_array(ARR_ELEMTYPE(arr), sizeof(IP4), out, k));
+}
+
+static Datum
+ip6_array_contained(FunctionCallInfo fcinfo, IPA_Op op)
+{
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P(0);
+	IP6R *ipr = PG_GETARG_IP6R_P(1);
+	int nitems = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+	int n = ipa_nonnull(arr, nitems);
+	const IP6 *data = (const IP6 *) ARR_DATA_PTR(arr);
+	bool *match;
+	IP6 *out;
+	int i, k;
+
+	if (op == IPA_COUNT)
+		PG_RETURN_INT64(ipa_count6(data, n, &ipr->lower, &ipr->upper));
+
+	match = palloc(n + 1);
+	ipa_match6(data, n, &ipr->lower, &ipr->upper, match);
+
+	if (op == IPA_MASK)
+		PG_RETURN_ARRAYTYPE_P(ipa_mask_array(arr, nitems, match, n));
+
+	out = palloc((n + 1) * sizeof(IP6));
+	for (i = k = 0; i < n; ++i)
+	{
+		out[k] = data[i];
+		k += match[i];
+	}
+
+	PG_RETURN_ARRAYTYPE_P(ipa_fixed_array(ARR_ELEMTYPE(arr), sizeof(IP6), out, k));
+}
+
+/*
+ * ipaddress elements are unpacked one at a time; the range '-' contains
+ * every address, and other ranges only addresses of their own family.
+ */
+
+static Datum
+ipaddr_array_contained(FunctionCallInfo fcinfo, IPA_Op op)
+{
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P(0);
+	IPR ipr;
+	int raf = ipr_unpack(PG_GETARG_IPR_P(1), &ipr);
+	IP4 span4 = (raf == PGSQL_AF_INET) ? ipr.ip4r.upper - ipr.ip4r.lower : 0;
+	Datum *elems;
+	bool *nulls;
+	bool *match;
+	int64 count = 0;
+	int nitems;
+	int i, k;
+
+	deconstruct_array(arr, ARR_ELEMTYPE(arr), -1, false, 'i',
+					  &elems, &nulls, &nitems);
+
+	match = palloc(nitems + 1);
+
+	for (i = 0; i < nitems; ++i)
+	{
+		IP ip;
+		int af;
+
+		match[i] = false;
+		if (nulls[i])
+			continue;
+
+		af = ip_unpack(DatumGetIP_P(elems[i]), &ip);
+
+		if (raf == 0)
+			match[i] = true;
+		else if (af != raf)
+			continue;
+		else if (af == PGSQL_AF_INET)
+			match[i] = ((IP4) (ip.ip4 - ipr.ip4r.lower) <= span4);
+		else
+			match[i] = ipa_in6(&ip.ip6, &ipr.ip6r.lower, &ipr.ip6r.upper);
+
+		count += match[i];
+	}
+
+	if (op == IPA_COUNT)
+		PG_RETURN_INT64(count);
+
+	if (op == IPA_MASK)
+	{
+		Datum *values = palloc((nitems + 1) * sizeof(Datum));
+
+		for (i = 0; i < nitems; ++i)
+			values[i] = BoolGetDatum(match[i]);
+		PG_RETURN_ARRAYTYPE_P(construct_md_array(values, nulls,
+												 ARR_NDIM(arr), ARR_DIMS(arr),
+												 ARR_LBOUND(arr),
+												 BOOLOID, 1, true, 'c'));
+	}
+
+	for (i = k = 0; i < nitems; ++i)
+		if (match[i])
+			elems[k++] = elems[i];
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, k, ARR_ELEMTYPE(arr),
+										  -1, false, 'i'));
+}
+
+PG_FUNCTION_INFO_V1(ip4_array_contained_count);
+Datum
+ip4_array_contained_count(PG_FUNCTION_ARGS)
+{
+	return ip4_array_contained(fcinfo, IPA_COUNT);
+}
+
+PG_FUNCTION_INFO_V1(ip4_array_contained_mask);
+Datum
+ip4_array_contained_mask(PG_FUNCTION_ARGS)
+{
+	return ip4_array_contained(fcinfo, IPA_MASK);
+}
+
+PG_FUNCTION_INFO_V1(ip4_array_contained_filter);
+Datum
+ip4_array_contained_filter(PG_FUNCTION_ARGS)
+{
+	return ip4_array_contained(fcinfo, IPA_FILTER);
+}
+
+PG_FUNCTION_INFO_V1(ip6_array_contained_count);
+Datum
+ip6_array_contained_count(PG_FUNCTION_ARGS)
+{
+	return ip6_array_contained(fcinfo, IPA_COUNT);
+}
+
+PG_FUNCTION_INFO_V1(ip6_array_contained_mask);
+Datum
+ip6_array_contained_mask(PG_FUNCTION_ARGS)
+{
+	return ip6_array_contained(fcinfo, IPA_MASK);
+}
+
+PG_FUNCTION_INFO_V1(ip6_array_contained_filter);
+Datum
+ip6_array_contained_filter(PG_FUNCTION_ARGS)
+{
+	return ip6_array_contained(fcinfo, IPA_FILTER);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_array_contained_count);
+Datum
+ipaddr_array_contained_count(PG_FUNCTION_ARGS)
+{
+	return ipaddr_array_contained(fcinfo, IPA_COUNT);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_array_contained_mask);
+Datum
+ipaddr_array_contained_mask(PG_FUNCTION_ARGS)
+{
+	return ipaddr_array_contained(fcinfo, IPA_MASK);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_array_contained_filter);
+Datum
+ipaddr_array_contained_filter(PG_FUNCTION_ARGS)
+{
+	return ipaddr_array_contained(fcinfo, IPA_FILTER);
+}
+
+/* end */
@@ -0,0 +1,266 @@
+/* ipextract.c */
+
+#include "postgres.h"
+
+#include <sys/socket.h>
+
+#include "fmgr.h"
+
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/palloc.h"
+
+#include "ipr_internal.h"
+
+/*
+ * Extract the IP addresses from arbitrary text, such as log lines.
+ *
+ * Every address has at least one '.' or ':', which are much rarer in
+ * typical text than the digits and hex letters, so the scan looks for those
+ * a word at a time, and only on finding one looks at the surrounding run of
+ * address characters (hex digits, '.' and ':'). The run is copied to a
+ * small buffer and validated with the ordinary input routines, so what is
+ * accepted is exactly what ipaddress input accepts; no allocation is needed
+ * except for the result values.
+ *
+ * A run that is joined to a word is ignored up to the first colon from
+ * that side, so "src:192.0.2.1" gives an address but "std::vector" and
+ * "host1.2.3.4" do not. Trailing dots (the end of a sentence) are dropped,
+ * as are trailing colons and a ":port" suffix on an IPv4 address; prefix
+ * lengths and zone ids are not part of the run, so "10.0.0.0/8" gives
+ * 10.0.0.0 and "fe80::1%eth0" gives fe80::1.
+ */
+
+#define IPX_DIGIT	0x01
+#define IPX_HEX		0x02
+#define IPX_DOT		0x04
+#define IPX_COLON	0x08
+#define IPX_WORD	0x10		/* letters and _ that can't be in an address */
+
+#define IPX_CAND	(IPX_DIGIT | IPX_HEX | IPX_DOT | IPX_COLON)
+
+static uint8 ipx_class[256];
+static bool ipx_class_done = false;
+
+static void
+ipx_init_class(void)
+{
+	int c;
+
+	for (c = 0; c < 256; ++c)
+	{
+		uint8 cl = 0;
+
+		if (c >= '0' && c <= '9')
+			cl = IPX_DIGIT;
+		else if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+			cl = IPX_HEX;
+		else if (c == '.')
+			cl = IPX_DOT;
+		else if (c == ':')
+			cl = IPX_COLON;
+		else if ((c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z') || c == '_')
+			cl = IPX_WORD;
+		ipx_class[c] = cl;
+	}
+
+	ipx_class_done = true;
+}
+
+/*
+ * Return the first '.' or ':' in [p,end), or end if none. Eight bytes at a
+ * time, using the usual test for a zero byte on the input xored with each
+ * of the two characters.
+ */
+
+#define IPX_ONES	UINT64CONST(0x0101010101010101)
+#define IPX_HIGHS	UINT64CONST(0x8080808080808080)
+#define IPX_HASZERO(v_) (((v_) - IPX_ONES) & ~(v_) & IPX_HIGHS)
+
+static inline const char *
+ipx_find_sep(const char *p, const char *end)
+{
+	while (end - p >= 8)
+	{
+		uint64 w;
+
+		memcpy(&w, p, sizeof(w));
+		if (IPX_HASZERO(w ^ (IPX_ONES * '.')) | IPX_HASZERO(w ^ (IPX_ONES * ':')))
+			break;
+		p += 8;
+	}
+
+	for (; p < end; ++p)
+		if (*p == '.' || *p == ':')
+			return p;
+
+	return end;
+}
+
+/*
+ * Validate a run of address characters, nul-terminated in buf, of length
+ * len. Returns the address family, or 0 if it's not an address.
+ */
+
+static int
+ipx_validate(char *buf, int len, bool has_colon, IP *ip)
+{
+	while (len > 0 && buf[len - 1] == '.')
+		buf[--len] = 0;
+
+	if (!has_colon)
+		return ip4_raw_input(buf, &ip->ip4) ? PGSQL_AF_INET : 0;
+
+	if (ip6_raw_input(buf, ip->ip6.bits))
+		return PGSQL_AF_INET6;
+
+	/* "2001:db8::1:" at the end of a field */
+	if (len > 0 && buf[len - 1] == ':' && (len < 2 || buf[len - 2] != ':'))
+	{
+		buf[len - 1] = 0;
+		if (ip6_raw_input(buf, ip->ip6.bits))
+			return PGSQL_AF_INET6;
+	}
+
+	/* "192.0.2.1:80" */
+	{
+		char *colon = strchr(buf, ':');
+
+		if (colon)
+			*colon = 0;
+		if (ip4_raw_input(buf, &ip->ip4))
+			return PGSQL_AF_INET;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the next address in [*pp,end), advancing *pp past it. Returns the
+ * address family, or 0 if there are no more.
+ */
+
+static int
+ipx_next(const char **pp, const char *start, const char *end, IP *ip)
+{
+	const unsigned char *ustart = (const unsigned char *) start;
+	const unsigned char *uend = (const unsigned char *) end;
+	const char *p = *pp;
+
+	if (!ipx_class_done)
+		ipx_init_class();
+
+	while ((p = ipx_find_sep(p, end)) < end)
+	{
+		const unsigned char *s = (const unsigned char *) p;
+		const unsigned char *e = (const unsigned char *) p;
+		char buf[IP6_STRING_MAX];
+		uint8 seen = 0;
+		int len;
+		int i;
+		int af;
+
+		while (s > ustart && (ipx_class[s[-1]] & IPX_CAND))
+			--s;
+		while (e < uend && (ipx_class[*e] & IPX_CAND))
+			++e;
+
+		p = (const char *) e;
+
+		/*
+		 * If the run is joined to a word, only the part past a colon can be
+		 * an address: "src:192.0.2.1" but not "std::" or "host1.2.3.4".
+		 */
+		if (s > ustart && (ipx_class[s[-1]] & IPX_WORD))
+		{
+			while (s < e && *s != ':')
+				++s;
+			if (s < e)
+				++s;
+		}
+		if (e < uend && (ipx_class[*e] & IPX_WORD))
+		{
+			while (e > s && e[-1] != ':')
+				--e;
+			if (e > s)
+				--e;
+		}
+
+		len = e - s;
+		if (len == 0 || len >= (int) sizeof(buf))
+			continue;
+
+		for (i = 0; i < len; ++i)
+		{
+			seen |= ipx_class[s[i]];
+			buf[i] = s[i];
+		}
+		buf[len] = 0;
+
+		if ((seen & (IPX_DIGIT | IPX_HEX)) == 0)
+			continue;
+
+		af = ipx_validate(buf, len, (seen & IPX_COLON) != 0, ip);
+		if (af)
+		{
+			*pp = p;
+			return af;
+		}
+	}
+
+	*pp = end;
+	return 0;
+}
+
+PG_FUNCTION_INFO_V1(ip_extract);
+Datum
+ip_extract(PG_FUNCTION_ARGS)
+{
+	text *txt = PG_GETARG_TEXT_PP(0);
+	const char *start = VARDATA_ANY(txt);
+	const char *end = start + VARSIZE_ANY_EXHDR(txt);
+	const char *p = start;
+	IP ip;
+	int af;
+
+	ipr_materialize_init(fcinfo);
+
+	while ((af = ipx_next(&p, start, end, &ip)) != 0)
+	{
+		IP_P ipp = ip_pack(af, &ip);
+
+		ipr_materialize_value(fcinfo, IP_PGetDatum(ipp));
+		pfree(ipp);
+	}
+
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(ip_extract_array);
+Datum
+ip_extract_array(PG_FUNCTION_ARGS)
+{
+	text *txt = PG_GETARG_TEXT_PP(0);
+	const char *start = VARDATA_ANY(txt);
+	const char *end = start + VARSIZE_ANY_EXHDR(txt);
+	const char *p = start;
+	int nalloc = 8;
+	int n = 0;
+	Datum *values = palloc(nalloc * sizeof(Datum));
+	IP ip;
+	int af;
+
+	while ((af = ipx_next(&p, start, end, &ip)) != 0)
+	{
+		if (n >= nalloc)
+		{
+			nalloc *= 2;
+			values = repalloc(values, nalloc * sizeof(Datum));
+		}
+		values[n++] = IP_PGetDatum(ip_pack(af, &ip));
+	}
+
+	return ipr_return_array(fcinfo, values, n);
+}
+
+/* end */
@@ -0,0 +1,612 @@
+/* ipfixed.c */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <sys/socket.h>
+
+#include "fmgr.h"
+
+#include "access/hash.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/palloc.h"
+
+#include "ipr_internal.h"
+
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+/*
+ * ipaddress_fixed and iprange_fixed hold the same values as ipaddress and
+ * iprange, with the same semantics, but as fixed-length double-aligned types
+ * (17 and 33 bytes), so that operators can use the stored value in place
+ * rather than detoasting and unpacking it. The price is space: every value
+ * takes the size of the largest IPv6 value.
+ *
+ * Everything other than I/O, casts, comparison, containment and hashing is
+ * left to the implicit casts to the packed types.
+ */
+
+static void ipfixed_internal_error(void) __attribute__((noreturn,noinline));
+
+static
+void ipfixed_internal_error(void)
+{
+	elog(ERROR,"Invalid fixed-length IP datum");
+
+	/* just to shut the compiler up */
+	abort();
+}
+
+/* the conversions from the packed forms take a detoasted value */
+
+static inline
+IPF *ipf_from_packed(IP_P ipp)
+{
+	IP ip;
+	int af = ip_unpack(ipp, &ip);
+
+	return ipf_make(af, &ip);
+}
+
+static inline
+IPRF *iprf_from_packed(IPR_P iprp)
+{
+	IPR ipr;
+	int af = ipr_unpack(iprp, &ipr);
+
+	return iprf_make(af, &ipr);
+}
+
+
+/*
+** Input/Output routines
+*/
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_in);
+Datum
+ipaddr_fixed_in(PG_FUNCTION_ARGS)
+{
+	Datum res = ipaddr_in(fcinfo);
+
+	if (SOFT_ERROR_OCCURRED(fcinfo->context))
+		PG_RETURN_DATUM(res);
+	PG_RETURN_IPF_P(ipf_from_packed(DatumGetIP_P(res)));
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_out);
+Datum
+ipaddr_fixed_out(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+	char *out = palloc(IP6_STRING_MAX);
+
+	switch (ipf->af)
+	{
+		case PGSQL_AF_INET:
+			ip4_raw_output(ipf->ip.ip4, out, IP6_STRING_MAX);
+			break;
+		case PGSQL_AF_INET6:
+			ip6_raw_output(ipf->ip.ip6.bits, out, IP6_STRING_MAX);
+			break;
+		default:
+			ipfixed_internal_error();
+	}
+
+	PG_RETURN_CSTRING(out);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_recv);
+Datum
+ipaddr_fixed_recv(PG_FUNCTION_ARGS)
+{
+	Datum res = ipaddr_recv(fcinfo);
+
+	if (SOFT_ERROR_OCCURRED(fcinfo->context))
+		PG_RETURN_DATUM(res);
+	PG_RETURN_IPF_P(ipf_from_packed(DatumGetIP_P(res)));
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_send);
+Datum
+ipaddr_fixed_send(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+
+	PG_RETURN_DATUM(DirectFunctionCall1(ipaddr_send,
+										IP_PGetDatum(ip_pack(ipf->af, &ipf->ip))));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_in);
+Datum
+iprange_fixed_in(PG_FUNCTION_ARGS)
+{
+	Datum res = iprange_in(fcinfo);
+
+	if (SOFT_ERROR_OCCURRED(fcinfo->context))
+		PG_RETURN_DATUM(res);
+	PG_RETURN_IPRF_P(iprf_from_packed(DatumGetIPR_P(res)));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_out);
+Datum
+iprange_fixed_out(PG_FUNCTION_ARGS)
+{
+	IPRF *iprf = PG_GETARG_IPRF_P(0);
+
+	switch (iprf->af)
+	{
+		case 0:
+		{
+			char *out = palloc(2);
+			strcpy(out,"-");
+			PG_RETURN_CSTRING(out);
+		}
+
+		case PGSQL_AF_INET:
+			PG_RETURN_DATUM(DirectFunctionCall1(ip4r_out,IP4RPGetDatum(&iprf->ipr.ip4r)));
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_DATUM(DirectFunctionCall1(ip6r_out,IP6RPGetDatum(&iprf->ipr.ip6r)));
+
+		default:
+			ipfixed_internal_error();
+	}
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_recv);
+Datum
+iprange_fixed_recv(PG_FUNCTION_ARGS)
+{
+	Datum res = iprange_recv(fcinfo);
+
+	if (SOFT_ERROR_OCCURRED(fcinfo->context))
+		PG_RETURN_DATUM(res);
+	PG_RETURN_IPRF_P(iprf_from_packed(DatumGetIPR_P(res)));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_send);
+Datum
+iprange_fixed_send(PG_FUNCTION_ARGS)
+{
+	IPRF *iprf = PG_GETARG_IPRF_P(0);
+
+	PG_RETURN_DATUM(DirectFunctionCall1(iprange_send,
+										IPR_PGetDatum(ipr_pack(iprf->af, &iprf->ipr))));
+}
+
+
+/*
+** Casts
+*/
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_cast_from_ipaddr);
+Datum
+ipaddr_fixed_cast_from_ipaddr(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_IPF_P(ipf_from_packed(PG_GETARG_IP_P(0)));
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_cast_to_ipaddr);
+Datum
+ipaddr_fixed_cast_to_ipaddr(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+
+	PG_RETURN_IP_P(ip_pack(ipf->af, &ipf->ip));
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_cast_from_ip4);
+Datum
+ipaddr_fixed_cast_from_ip4(PG_FUNCTION_ARGS)
+{
+	IP ip;
+
+	ip.ip4 = PG_GETARG_IP4(0);
+	PG_RETURN_IPF_P(ipf_make(PGSQL_AF_INET, &ip));
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_cast_from_ip6);
+Datum
+ipaddr_fixed_cast_from_ip6(PG_FUNCTION_ARGS)
+{
+	IP ip;
+
+	ip.ip6 = *PG_GETARG_IP6_P(0);
+	PG_RETURN_IPF_P(ipf_make(PGSQL_AF_INET6, &ip));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cast_from_iprange);
+Datum
+iprange_fixed_cast_from_iprange(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_IPRF_P(iprf_from_packed(PG_GETARG_IPR_P(0)));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cast_to_iprange);
+Datum
+iprange_fixed_cast_to_iprange(PG_FUNCTION_ARGS)
+{
+	IPRF *iprf = PG_GETARG_IPRF_P(0);
+
+	PG_RETURN_IPR_P(ipr_pack(iprf->af, &iprf->ipr));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cast_from_ip4r);
+Datum
+iprange_fixed_cast_from_ip4r(PG_FUNCTION_ARGS)
+{
+	IPR ipr;
+
+	ipr.ip4r = *PG_GETARG_IP4R_P(0);
+	PG_RETURN_IPRF_P(iprf_make(PGSQL_AF_INET, &ipr));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cast_from_ip6r);
+Datum
+iprange_fixed_cast_from_ip6r(PG_FUNCTION_ARGS)
+{
+	IPR ipr;
+
+	ipr.ip6r = *PG_GETARG_IP6R_P(0);
+	PG_RETURN_IPRF_P(iprf_make(PGSQL_AF_INET6, &ipr));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cast_from_ipaddr_fixed);
+Datum
+iprange_fixed_cast_from_ipaddr_fixed(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+	IPR ipr;
+
+	switch (ipf->af)
+	{
+		case PGSQL_AF_INET:
+			ipr.ip4r.lower = ipr.ip4r.upper = ipf->ip.ip4;
+			break;
+		case PGSQL_AF_INET6:
+			ipr.ip6r.lower = ipr.ip6r.upper = ipf->ip.ip6;
+			break;
+		default:
+			ipfixed_internal_error();
+	}
+
+	PG_RETURN_IPRF_P(iprf_make(ipf->af, &ipr));
+}
+
+/*
+ * iprange(ipaddress_fixed) would otherwise be ambiguous between the implicit
+ * casts to ipaddress and to iprange_fixed.
+ */
+
+PG_FUNCTION_INFO_V1(iprange_cast_from_ipaddr_fixed);
+Datum
+iprange_cast_from_ipaddr_fixed(PG_FUNCTION_ARGS)
+{
+	Datum res = iprange_fixed_cast_from_ipaddr_fixed(fcinfo);
+	IPRF *iprf = DatumGetIPRFP(res);
+
+	PG_RETURN_IPR_P(ipr_pack(iprf->af, &iprf->ipr));
+}
+
+
+/*
+** Hashing; these give the same values as ipaddr_hash and iprange_hash_new
+** (and the extended versions) for the same value.
+*/
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_hash);
+Datum
+ipaddr_fixed_hash(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+
+	switch (ipf->af)
+	{
+		case PGSQL_AF_INET:
+			return hash_uint32(ipf->ip.ip4);
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_UINT32(ipr_hash_words(&ipf->ip.ip6, 4));
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_hash_extended);
+Datum
+ipaddr_fixed_hash_extended(PG_FUNCTION_ARGS)
+{
+	IPF *ipf = PG_GETARG_IPF_P(0);
+	uint64 seed = DatumGetUInt64(PG_GETARG_DATUM(1));
+
+	switch (ipf->af)
+	{
+		case PGSQL_AF_INET:
+			return hash_uint32_extended(ipf->ip.ip4, seed);
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&ipf->ip.ip6, 4, seed));
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_hash);
+Datum
+iprange_fixed_hash(PG_FUNCTION_ARGS)
+{
+	IPRF *iprf = PG_GETARG_IPRF_P(0);
+
+	switch (iprf->af)
+	{
+		case 0:
+			return hash_any((void *) iprf, 0);
+
+		case PGSQL_AF_INET:
+			PG_RETURN_UINT32(ipr_hash_words(&iprf->ipr.ip4r, 2));
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_UINT32(ipr_hash_words(&iprf->ipr.ip6r, 8));
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_hash_extended);
+Datum
+iprange_fixed_hash_extended(PG_FUNCTION_ARGS)
+{
+	IPRF *iprf = PG_GETARG_IPRF_P(0);
+	uint32 seed = DatumGetUInt32(PG_GETARG_DATUM(1));
+
+	switch (iprf->af)
+	{
+		case 0:
+			return hash_any_extended((void *) iprf, 0, seed);
+
+		case PGSQL_AF_INET:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&iprf->ipr.ip4r, 2, seed));
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&iprf->ipr.ip6r, 8, seed));
+	}
+
+	ipfixed_internal_error();
+}
+
+
+/*
+ * comparisons; the ordering is the same as for ipaddress and iprange
+ */
+
+static inline
+int
+ipaddr_fixed_cmp_internal(IPF *a, IPF *b)
+{
+	if (a->af != b->af)
+		return (a->af > b->af) ? 1 : -1;
+
+	switch (a->af)
+	{
+		case PGSQL_AF_INET:
+			return ip4_compare(a->ip.ip4, b->ip.ip4);
+
+		case PGSQL_AF_INET6:
+			return ip6_compare(&a->ip.ip6, &b->ip.ip6);
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_lt);
+Datum
+ipaddr_fixed_lt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) < 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_le);
+Datum
+ipaddr_fixed_le(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_gt);
+Datum
+ipaddr_fixed_gt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) > 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_ge);
+Datum
+ipaddr_fixed_ge(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) >= 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_eq);
+Datum
+ipaddr_fixed_eq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) == 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_neq);
+Datum
+ipaddr_fixed_neq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)) != 0);
+}
+
+PG_FUNCTION_INFO_V1(ipaddr_fixed_cmp);
+Datum
+ipaddr_fixed_cmp(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT32(ipaddr_fixed_cmp_internal(PG_GETARG_IPF_P(0), PG_GETARG_IPF_P(1)));
+}
+
+static inline
+int
+iprange_fixed_cmp_internal(IPRF *a, IPRF *b)
+{
+	if (a->af != b->af)
+		return (a->af > b->af) ? 1 : -1;
+
+	switch (a->af)
+	{
+		case 0:
+			return 0;
+
+		case PGSQL_AF_INET:
+			if (ip4r_lessthan(&a->ipr.ip4r, &b->ipr.ip4r))
+				return -1;
+			return ip4r_equal(&a->ipr.ip4r, &b->ipr.ip4r) ? 0 : 1;
+
+		case PGSQL_AF_INET6:
+			if (ip6r_lessthan(&a->ipr.ip6r, &b->ipr.ip6r))
+				return -1;
+			return ip6r_equal(&a->ipr.ip6r, &b->ipr.ip6r) ? 0 : 1;
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_lt);
+Datum
+iprange_fixed_lt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) < 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_le);
+Datum
+iprange_fixed_le(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_gt);
+Datum
+iprange_fixed_gt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) > 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_ge);
+Datum
+iprange_fixed_ge(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) >= 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_eq);
+Datum
+iprange_fixed_eq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) == 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_neq);
+Datum
+iprange_fixed_neq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)) != 0);
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_cmp);
+Datum
+iprange_fixed_cmp(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT32(iprange_fixed_cmp_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)));
+}
+
+
+/*
+ * containment; as for iprange, the universal range contains everything and
+ * ranges of different families are otherwise disjoint.
+ */
+
+static inline
+bool
+iprange_fixed_overlaps_internal(IPRF *a, IPRF *b)
+{
+	if (a->af != b->af)
+		return (a->af == 0) || (b->af == 0);
+
+	switch (a->af)
+	{
+		case 0:
+			return true;
+
+		case PGSQL_AF_INET:
+			return ip4r_overlaps_internal(&a->ipr.ip4r, &b->ipr.ip4r);
+
+		case PGSQL_AF_INET6:
+			return ip6r_overlaps_internal(&a->ipr.ip6r, &b->ipr.ip6r);
+	}
+
+	ipfixed_internal_error();
+}
+
+static inline
+bool
+iprange_fixed_contains_internal(IPRF *a, IPRF *b, bool eqval)
+{
+	if (a->af != b->af)
+		return (a->af == 0);
+
+	switch (a->af)
+	{
+		case 0:
+			return eqval;
+
+		case PGSQL_AF_INET:
+			return ip4r_contains_internal(&a->ipr.ip4r, &b->ipr.ip4r, eqval);
+
+		case PGSQL_AF_INET6:
+			return ip6r_contains_internal(&a->ipr.ip6r, &b->ipr.ip6r, eqval);
+	}
+
+	ipfixed_internal_error();
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_overlaps);
+Datum
+iprange_fixed_overlaps(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_overlaps_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1)));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_contains);
+Datum
+iprange_fixed_contains(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_contains_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1), true));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_contains_strict);
+Datum
+iprange_fixed_contains_strict(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_contains_internal(PG_GETARG_IPRF_P(0), PG_GETARG_IPRF_P(1), false));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_contained_by);
+Datum
+iprange_fixed_contained_by(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_contains_internal(PG_GETARG_IPRF_P(1), PG_GETARG_IPRF_P(0), true));
+}
+
+PG_FUNCTION_INFO_V1(iprange_fixed_contained_by_strict);
+Datum
+iprange_fixed_contained_by_strict(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(iprange_fixed_contains_internal(PG_GETARG_IPRF_P(1), PG_GETARG_IPRF_P(0), false));
+}
+
+/* end */
@@ -0,0 +1,454 @@
+/* ipgiststats.c */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <sys/socket.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/genam.h"
+#include "access/gist_private.h"
+#include "access/itup.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "storage/bufmgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/lsyscache.h"
+#include "utils/palloc.h"
+#include "utils/rel.h"
+#include "utils/tuplestore.h"
+
+#include "ipr_internal.h"
+
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+/*
+ * ip_gist_stats(index) walks a gist index using one of our opclasses and
+ * reports, for each level from the root (level 0) down:
+ *
+ *  - the number of pages and tuples, and the fraction of page space used;
+ *
+ *  - the mean size of the stored keys and the number of keys per family,
+ *    and for iprange the number of keys in each packed format chosen by
+ *    ipr_pack (named by payload size: 0 for '-', 8 for IPv4, 9 and 17 for
+ *    IPv6 prefixes of up to and over 64 bits, 32 for other IPv6 ranges);
+ *
+ *  - the sibling overlap: the number of addresses common to each pair of
+ *    keys on the same page, summed over the level. On internal pages these
+ *    are the union keys of sibling subtrees, i.e. what picksplit tries to
+ *    keep apart;
+ *
+ *  - the expected number of pages of the level visited by a lookup of a
+ *    uniformly random address of each family. A page is visited exactly
+ *    when the address is in the downlink key pointing to it, so this is
+ *    the sum over the pages of the fraction of the address space covered
+ *    by their downlinks. The sum over all levels is the expected cost of a
+ *    point lookup.
+ *
+ * Only the first index column is examined. Pages are locked one at a time,
+ * so an index being modified concurrently is not seen consistently.
+ */
+
+#define IPGS_SPACE4 4294967296.0
+#define IPGS_SPACE6 ldexp(1.0, 128)
+
+typedef enum IPGS_KeyType {
+	IPGS_IP4R,
+	IPGS_IP6R,
+	IPGS_IPRANGE
+} IPGS_KeyType;
+
+/* the iprange packed formats, by payload size */
+#define IPGS_NFORMATS 5
+
+static const Size ipgs_format_size[IPGS_NFORMATS] = {
+	0, sizeof(IP4R), 1 + sizeof(uint64), 1 + sizeof(IP6), sizeof(IP6R)
+};
+
+typedef struct IPGS_Key {
+	int af;
+	IPR ipr;
+} IPGS_Key;
+
+/* a page to visit, with the probability of a random probe reaching it */
+typedef struct IPGS_PageRef {
+	BlockNumber blkno;
+	double p4;
+	double p6;
+} IPGS_PageRef;
+
+typedef struct IPGS_PageList {
+	IPGS_PageRef *refs;
+	int n;
+	int max;
+} IPGS_PageList;
+
+typedef struct IPGS_Level {
+	bool leaf;
+	int64 pages;
+	int64 tuples;
+	int64 keys;
+	int64 keys4;
+	int64 keys6;
+	int64 format_keys[IPGS_NFORMATS];
+	double used_bytes;
+	double key_bytes;
+	double overlap4;
+	double overlap6;
+	double probe4;
+	double probe6;
+} IPGS_Level;
+
+static IPGS_KeyType
+ipgs_keytype(Relation rel)
+{
+	PGFunction consistent;
+
+	if (rel->rd_rel->relkind != RELKIND_INDEX
+		|| rel->rd_rel->relam != GIST_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a GiST index",
+						RelationGetRelationName(rel))));
+
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary indexes of other sessions")));
+
+	/*
+	 * Identify the opclass by its consistent function, which is the one
+	 * support function that differs between all of them.
+	 */
+	consistent = index_getprocinfo(rel, 1, GIST_CONSISTENT_PROC)->fn_addr;
+
+	if (consistent == gip4r_consistent)
+		return IPGS_IP4R;
+	if (consistent == gip6r_consistent)
+		return IPGS_IP6R;
+	if (consistent == gipr_consistent || consistent == gipr_fixed_consistent)
+		return IPGS_IPRANGE;
+
+	ereport(ERROR,
+			(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+			 errmsg("index \"%s\" does not use an ip4r gist operator class",
+					RelationGetRelationName(rel))));
+	return IPGS_IPRANGE;		/* keep compiler quiet */
+}
+
+static int
+ipgs_key_cmp(const void *pa, const void *pb)
+{
+	const IPGS_Key *a = pa;
+	const IPGS_Key *b = pb;
+
+	if (a->af != b->af)
+		return (a->af > b->af) ? 1 : -1;
+
+	switch (a->af)
+	{
+		case PGSQL_AF_INET:
+			return ip4_compare(a->ipr.ip4r.lower, b->ipr.ip4r.lower);
+		case PGSQL_AF_INET6:
+			return ip6_compare((IP6 *) &a->ipr.ip6r.lower, (IP6 *) &b->ipr.ip6r.lower);
+	}
+	return 0;
+}
+
+/*
+ * Sum the pairwise overlaps of the keys of one page. With the keys sorted
+ * by lower bound, the scan for keys overlapping a given one can stop at the
+ * first that starts after it ends.
+ */
+static void
+ipgs_overlap(IPGS_Key *keys, int nkeys, double *overlap4, double *overlap6)
+{
+	double total4 = 0.0;
+	double total6 = 0.0;
+	int nuniv = 0;
+	int i, j;
+
+	qsort(keys, nkeys, sizeof(IPGS_Key), ipgs_key_cmp);
+
+	while (nuniv < nkeys && keys[nuniv].af == 0)
+		++nuniv;
+
+	for (i = nuniv; i < nkeys; ++i)
+	{
+		IPGS_Key *a = &keys[i];
+		IPR inter;
+
+		if (a->af == PGSQL_AF_INET)
+		{
+			total4 += ip4r_metric(&a->ipr.ip4r);
+			for (j = i + 1; j < nkeys && keys[j].af == PGSQL_AF_INET; ++j)
+			{
+				if (keys[j].ipr.ip4r.lower > a->ipr.ip4r.upper)
+					break;
+				*overlap4 += ip4r_metric(ip4r_inter_internal(&a->ipr.ip4r, &keys[j].ipr.ip4r,
+															 &inter.ip4r));
+			}
+		}
+		else
+		{
+			total6 += ip6r_metric(&a->ipr.ip6r);
+			for (j = i + 1; j < nkeys; ++j)
+			{
+				if (ip6_lessthan(&a->ipr.ip6r.upper, &keys[j].ipr.ip6r.lower))
+					break;
+				*overlap6 += ip6r_metric(ip6r_inter_internal(&a->ipr.ip6r, &keys[j].ipr.ip6r,
+															 &inter.ip6r));
+			}
+		}
+	}
+
+	/* a universal key overlaps everything else, other universal keys included */
+	if (nuniv > 0)
+	{
+		double npairs = nuniv * (nuniv - 1) / 2.0;
+
+		*overlap4 += nuniv * total4 + npairs * IPGS_SPACE4;
+		*overlap6 += nuniv * total6 + npairs * IPGS_SPACE6;
+	}
+}
+
+static void
+ipgs_add_page(IPGS_PageList *list, BlockNumber blkno, double p4, double p6)
+{
+	if (list->n == list->max)
+	{
+		list->max *= 2;
+		list->refs = repalloc(list->refs, list->max * sizeof(IPGS_PageRef));
+	}
+	list->refs[list->n].blkno = blkno;
+	list->refs[list->n].p4 = p4;
+	list->refs[list->n].p6 = p6;
+	list->n++;
+}
+
+/*
+ * Accumulate one page into its level's stats, and if it is an internal
+ * page, add its children to the list for the next level. KEYS is workspace
+ * for MaxIndexTuplesPerPage entries.
+ */
+static void
+ipgs_scan_page(Relation rel, IPGS_KeyType keytype, IPGS_PageRef *ref,
+			   IPGS_Level *lev, IPGS_PageList *children, IPGS_Key *keys)
+{
+	TupleDesc tupdesc = RelationGetDescr(rel);
+	Buffer buf = ReadBufferExtended(rel, MAIN_FORKNUM, ref->blkno, RBM_NORMAL, NULL);
+	Page page;
+	OffsetNumber off;
+	OffsetNumber maxoff;
+	bool leaf;
+	int nkeys = 0;
+
+	LockBuffer(buf, GIST_SHARE);
+	page = BufferGetPage(buf);
+
+	if (GistPageIsDeleted(page))
+	{
+		UnlockReleaseBuffer(buf);
+		return;
+	}
+
+	leaf = GistPageIsLeaf(page);
+
+	lev->leaf = leaf;
+	lev->pages++;
+	lev->used_bytes += PageGetPageSize(page) - PageGetExactFreeSpace(page);
+	lev->probe4 += ref->p4;
+	lev->probe6 += ref->p6;
+
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	for (off = FirstOffsetNumber; off <= maxoff; off = OffsetNumberNext(off))
+	{
+		ItemId iid = PageGetItemId(page, off);
+		IndexTuple itup;
+		IPGS_Key *k = &keys[nkeys];
+		double p4 = 0.0;
+		double p6 = 0.0;
+		Datum key;
+		bool isnull;
+
+		if (!ItemIdIsUsed(iid) || ItemIdIsDead(iid))
+			continue;
+
+		itup = (IndexTuple) PageGetItem(page, iid);
+		key = index_getattr(itup, 1, tupdesc, &isnull);
+
+		lev->tuples++;
+
+		/* a subtree of only nulls is never visited by a lookup */
+		if (!isnull)
+		{
+			switch (keytype)
+			{
+				case IPGS_IP4R:
+					k->af = PGSQL_AF_INET;
+					k->ipr.ip4r = *DatumGetIP4RP(key);
+					lev->key_bytes += sizeof(IP4R);
+					break;
+
+				case IPGS_IP6R:
+					k->af = PGSQL_AF_INET6;
+					k->ipr.ip6r = *DatumGetIP6RP(key);
+					lev->key_bytes += sizeof(IP6R);
+					break;
+
+				case IPGS_IPRANGE:
+				{
+					Size sz = VARSIZE_ANY_EXHDR(DatumGetPointer(key));
+					int fmt;
+
+					k->af = ipr_unpack((IPR_P) DatumGetPointer(key), &k->ipr);
+					lev->key_bytes += sz;
+					for (fmt = 0; fmt < IPGS_NFORMATS; ++fmt)
+						if (ipgs_format_size[fmt] == sz)
+							lev->format_keys[fmt]++;
+					break;
+				}
+			}
+
+			lev->keys++;
+
+			switch (k->af)
+			{
+				case 0:
+					p4 = p6 = 1.0;
+					break;
+
+				case PGSQL_AF_INET:
+					lev->keys4++;
+					p4 = ip4r_metric(&k->ipr.ip4r) / IPGS_SPACE4;
+					break;
+
+				case PGSQL_AF_INET6:
+					lev->keys6++;
+					p6 = ip6r_metric(&k->ipr.ip6r) / IPGS_SPACE6;
+					break;
+			}
+
+			++nkeys;
+		}
+
+		if (!leaf)
+			ipgs_add_page(children, ItemPointerGetBlockNumber(&itup->t_tid), p4, p6);
+	}
+
+	UnlockReleaseBuffer(buf);
+
+	ipgs_overlap(keys, nkeys, &lev->overlap4, &lev->overlap6);
+}
+
+PG_FUNCTION_INFO_V1(ip_gist_stats);
+Datum
+ip_gist_stats(PG_FUNCTION_ARGS)
+{
+	Oid indexoid = PG_GETARG_OID(0);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation rel;
+	IPGS_KeyType keytype;
+	IPGS_Key *keys;
+	IPGS_Level *levels;
+	IPGS_PageList cur;
+	IPGS_PageList next;
+	int nlevels = 0;
+	int maxlevels = 8;
+	int i;
+
+	ipr_materialize_init(fcinfo);
+
+	rel = index_open(indexoid, AccessShareLock);
+	keytype = ipgs_keytype(rel);
+
+	if (pg_class_aclcheck(rel->rd_index->indrelid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for table %s",
+						get_rel_name(rel->rd_index->indrelid))));
+
+	keys = palloc(MaxIndexTuplesPerPage * sizeof(IPGS_Key));
+	levels = palloc(maxlevels * sizeof(IPGS_Level));
+
+	cur.max = next.max = 64;
+	cur.refs = palloc(cur.max * sizeof(IPGS_PageRef));
+	next.refs = palloc(next.max * sizeof(IPGS_PageRef));
+	cur.n = next.n = 0;
+
+	ipgs_add_page(&cur, GIST_ROOT_BLKNO, 1.0, 1.0);
+
+	while (cur.n > 0)
+	{
+		IPGS_PageList tmp;
+
+		if (nlevels == maxlevels)
+		{
+			maxlevels *= 2;
+			levels = repalloc(levels, maxlevels * sizeof(IPGS_Level));
+		}
+		memset(&levels[nlevels], 0, sizeof(IPGS_Level));
+
+		next.n = 0;
+		for (i = 0; i < cur.n; ++i)
+		{
+			CHECK_FOR_INTERRUPTS();
+			ipgs_scan_page(rel, keytype, &cur.refs[i], &levels[nlevels], &next, keys);
+		}
+
+		++nlevels;
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	index_close(rel, AccessShareLock);
+
+	for (i = 0; i < nlevels; ++i)
+	{
+		IPGS_Level *lev = &levels[i];
+		Datum values[17];
+		bool nulls[17];
+		int fmt;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(i);
+		values[1] = BoolGetDatum(lev->leaf);
+		values[2] = Int64GetDatum(lev->pages);
+		values[3] = Int64GetDatum(lev->tuples);
+		values[4] = Float8GetDatum(lev->pages ? lev->used_bytes / (lev->pages * (double) BLCKSZ) : 0.0);
+		values[5] = Float8GetDatum(lev->keys ? lev->key_bytes / lev->keys : 0.0);
+		nulls[5] = (lev->keys == 0);
+		values[6] = Int64GetDatum(lev->keys4);
+		values[7] = Int64GetDatum(lev->keys6);
+		for (fmt = 0; fmt < IPGS_NFORMATS; ++fmt)
+		{
+			values[8 + fmt] = Int64GetDatum(lev->format_keys[fmt]);
+			nulls[8 + fmt] = (keytype != IPGS_IPRANGE);
+		}
+		values[13] = Float8GetDatum(lev->overlap4);
+		values[14] = Float8GetDatum(lev->overlap6);
+		values[15] = Float8GetDatum(lev->probe4);
+		values[16] = Float8GetDatum(lev->probe6);
+
+		/* the other family's columns mean nothing for ip4r and ip6r */
+		if (keytype == IPGS_IP4R)
+			nulls[7] = nulls[14] = nulls[16] = true;
+		else if (keytype == IPGS_IP6R)
+			nulls[6] = nulls[13] = nulls[15] = true;
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/* end */
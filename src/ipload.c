@@ -0,0 +1,533 @@
+/* ipload.c */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/palloc.h"
+#include "utils/tuplestore.h"
+
+#include "ipr_internal.h"
+
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+/*
+ * Bulk loading of range data (e.g. geolocation or ASN datasets) from a
+ * file on the server.
+ *
+ * iprange_load(filename, format, merge) reads the file and returns
+ * (range, data) rows. The formats are:
+ *
+ *   csv   one range per line, in any form accepted by iprange input, as
+ *         the first comma-separated field (optionally double-quoted); data
+ *         is the rest of the line after the comma, unparsed. A first line
+ *         that doesn't start with a range is taken as a header and
+ *         skipped, as is any empty line. This reads the "Blocks" files of
+ *         the MaxMind GeoLite2 CSV distribution as is.
+ *
+ *   ip4r  fixed-size binary records of two IPv4 addresses (lower, upper),
+ *         4 bytes each in network byte order; data is null.
+ *
+ *   ip6r  the same with IPv6 addresses, 16 bytes each.
+ *
+ * The file is read in large chunks with read(), as COPY FROM does, rather
+ * than mapped: a mapped file that is truncated while being read would get
+ * the backend a SIGBUS, and so restart the whole cluster. Ranges are parsed
+ * straight from the read buffer, and a line or record that spans two
+ * chunks is carried over to the next.
+ *
+ * With merge, the rows are returned in iprange order instead of file
+ * order, and overlapping or adjacent ranges with equal data are merged.
+ * Every range and its data are then held in memory until the end, rather
+ * than only the current chunk.
+ *
+ * The file is read with the server's permissions, so like pg_read_file
+ * the function is not executable by PUBLIC.
+ */
+
+typedef struct IPLoadEntry
+{
+	int			af;
+	IPR			ipr;
+	const char *data;			/* NULL if none */
+	int			datalen;
+} IPLoadEntry;
+
+typedef enum IPLoadFormat
+{
+	IPLOAD_CSV,
+	IPLOAD_IP4R,
+	IPLOAD_IP6R
+} IPLoadFormat;
+
+#define IPLOAD_CHUNK_SIZE	65536
+
+typedef struct IPLoadState
+{
+	FunctionCallInfo fcinfo;
+	const char *filename;
+	IPLoadFormat format;
+	bool		merge;
+	int64		lineno;			/* lines or records consumed so far */
+	IPLoadEntry *entries;
+	Size		nentries;
+	Size		maxentries;
+} IPLoadState;
+
+static void
+ipload_emit(IPLoadState *st, int af, IPR *ipr, const char *data, int datalen)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) st->fcinfo->resultinfo;
+	Datum values[2];
+	bool nulls[2] = { false, false };
+
+	values[0] = IPR_PGetDatum(ipr_pack(af, ipr));
+	if (data)
+		values[1] = PointerGetDatum(cstring_to_text_with_len(data, datalen));
+	else
+		nulls[1] = true;
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+
+	pfree(DatumGetPointer(values[0]));
+	if (data)
+		pfree(DatumGetPointer(values[1]));
+}
+
+static void
+ipload_add(IPLoadState *st, int af, IPR *ipr, const char *data, int datalen)
+{
+	IPLoadEntry *e;
+
+	if (!st->merge)
+	{
+		ipload_emit(st, af, ipr, data, datalen);
+		return;
+	}
+
+	if (st->nentries >= st->maxentries)
+	{
+		if (st->maxentries >= MaxAllocSize / sizeof(IPLoadEntry) / 2)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many ranges in file \"%s\" to merge", st->filename)));
+		st->maxentries *= 2;
+		st->entries = repalloc(st->entries, st->maxentries * sizeof(IPLoadEntry));
+	}
+
+	e = &st->entries[st->nentries++];
+	e->af = af;
+	e->ipr = *ipr;
+	e->data = NULL;
+	e->datalen = datalen;
+
+	/* DATA points into the read buffer, which will be reused */
+	if (data)
+	{
+		char *copy = palloc(datalen);
+
+		memcpy(copy, data, datalen);
+		e->data = copy;
+	}
+}
+
+static int
+ipload_data_cmp(const IPLoadEntry *a, const IPLoadEntry *b)
+{
+	int cmp;
+
+	if (!a->data || !b->data)
+		return (a->data != NULL) - (b->data != NULL);
+
+	cmp = memcmp(a->data, b->data, Min(a->datalen, b->datalen));
+	if (cmp == 0)
+		cmp = (a->datalen > b->datalen) - (a->datalen < b->datalen);
+	return cmp;
+}
+
+static int
+ipload_range_cmp(const IPLoadEntry *a, const IPLoadEntry *b)
+{
+	if (a->af != b->af)
+		return (a->af < b->af) ? -1 : 1;
+
+	switch (a->af)
+	{
+		case PGSQL_AF_INET:
+			if (ip4r_lessthan((IP4R *) &a->ipr.ip4r, (IP4R *) &b->ipr.ip4r))
+				return -1;
+			if (ip4r_lessthan((IP4R *) &b->ipr.ip4r, (IP4R *) &a->ipr.ip4r))
+				return 1;
+			break;
+
+		case PGSQL_AF_INET6:
+			if (ip6r_lessthan((IP6R *) &a->ipr.ip6r, (IP6R *) &b->ipr.ip6r))
+				return -1;
+			if (ip6r_lessthan((IP6R *) &b->ipr.ip6r, (IP6R *) &a->ipr.ip6r))
+				return 1;
+			break;
+	}
+
+	return 0;
+}
+
+/* iprange order, then data, so that equal ranges are grouped by data */
+
+static int
+ipload_cmp(const void *pa, const void *pb)
+{
+	int cmp = ipload_range_cmp(pa, pb);
+
+	return cmp ? cmp : ipload_data_cmp(pa, pb);
+}
+
+/* data, then iprange order, so that the ranges for each data are together */
+
+static int
+ipload_data_order_cmp(const void *pa, const void *pb)
+{
+	int cmp = ipload_data_cmp(pa, pb);
+
+	return cmp ? cmp : ipload_range_cmp(pa, pb);
+}
+
+/*
+ * Try to merge NEXT into CUR, which sorts before it. Only ranges with equal
+ * data are merged, so when ranges with different data overlap, both are
+ * kept.
+ */
+
+static bool
+ipload_merge(IPLoadEntry *cur, IPLoadEntry *next)
+{
+	if (cur->af != next->af || ipload_data_cmp(cur, next) != 0)
+		return false;
+
+	switch (cur->af)
+	{
+		case 0:
+			return true;
+
+		case PGSQL_AF_INET:
+		{
+			IP4R *c = &cur->ipr.ip4r;
+			IP4R *n = &next->ipr.ip4r;
+
+			if (c->upper != ~(IP4)0 && n->lower > c->upper + 1)
+				return false;
+			if (n->upper > c->upper)
+				c->upper = n->upper;
+			return true;
+		}
+
+		case PGSQL_AF_INET6:
+		{
+			IP6R *c = &cur->ipr.ip6r;
+			IP6R *n = &next->ipr.ip6r;
+			IP6 after;
+
+			if ((c->upper.bits[0] & c->upper.bits[1]) == ~(uint64)0)
+				after = c->upper;
+			else
+				ip6_sub_int(&c->upper, -1, &after);
+
+			if (!ip6_less_eq(&n->lower, &after))
+				return false;
+			if (ip6_lessthan(&c->upper, &n->upper))
+				c->upper = n->upper;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+ipload_finish(IPLoadState *st)
+{
+	Size i;
+	Size n;
+
+	if (!st->merge || st->nentries == 0)
+		return;
+
+	/*
+	 * Merge within the ranges for each data value, so that ranges with
+	 * different data sorting between two mergeable ones don't get in the
+	 * way; then put the result in iprange order.
+	 */
+	qsort(st->entries, st->nentries, sizeof(IPLoadEntry), ipload_data_order_cmp);
+
+	for (i = 1, n = 0; i < st->nentries; ++i)
+	{
+		if (!ipload_merge(&st->entries[n], &st->entries[i]))
+			st->entries[++n] = st->entries[i];
+	}
+
+	qsort(st->entries, n + 1, sizeof(IPLoadEntry), ipload_cmp);
+
+	for (i = 0; i <= n; ++i)
+	{
+		IPLoadEntry *e = &st->entries[i];
+
+		ipload_emit(st, e->af, &e->ipr, e->data, e->datalen);
+	}
+}
+
+static int
+ipload_parse_range(const char *p, int len, IPR *ipr)
+{
+	char buf[IP6R_STRING_MAX];
+
+	while (len > 0 && (*p == ' ' || *p == '\t'))
+		++p, --len;
+	while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+		--len;
+	if (len >= 2 && p[0] == '"' && p[len - 1] == '"')
+		++p, len -= 2;
+
+	if (len <= 0 || len >= sizeof(buf))
+		return -1;
+	memcpy(buf, p, len);
+	buf[len] = 0;
+
+	if (len == 1 && buf[0] == '-')
+		return 0;
+	if (memchr(buf, ':', len))
+		return ip6r_from_str(buf, &ipr->ip6r) ? PGSQL_AF_INET6 : -1;
+	return ip4r_from_str(buf, &ipr->ip4r) ? PGSQL_AF_INET : -1;
+}
+
+/*
+ * Process the complete lines in [p,end), and at EOF any final unterminated
+ * line too. Returns the number of bytes consumed.
+ */
+
+static Size
+ipload_csv(IPLoadState *st, const char *p, const char *end, bool eof)
+{
+	const char *start = p;
+
+	while (p < end)
+	{
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		const char *comma;
+		IPR ipr;
+		int af;
+
+		if (!eol)
+		{
+			if (!eof)
+				break;
+			eol = end;
+		}
+		if (eol > p && eol[-1] == '\r')
+			--eol;
+		++st->lineno;
+
+		if (eol == p)
+		{
+			p = next;
+			continue;
+		}
+
+		comma = memchr(p, ',', eol - p);
+
+		af = ipload_parse_range(p, (comma ? comma : eol) - p, &ipr);
+		if (af < 0)
+		{
+			if (st->lineno == 1)
+			{
+				p = next;
+				continue;
+			}
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid IP range on line " INT64_FORMAT " of file \"%s\"",
+							st->lineno, st->filename)));
+		}
+
+		if (comma)
+			ipload_add(st, af, &ipr, comma + 1, eol - (comma + 1));
+		else
+			ipload_add(st, af, &ipr, NULL, 0);
+
+		p = next;
+	}
+
+	return p - start;
+}
+
+/*
+ * Process the complete records in [p,end); at EOF, there must be no partial
+ * one left. Returns the number of bytes consumed.
+ */
+
+static Size
+ipload_binary(IPLoadState *st, const char *p, const char *end, bool eof)
+{
+	Size reclen = (st->format == IPLOAD_IP4R) ? 8 : 32;
+	Size nrecs = (end - p) / reclen;
+	Size i;
+
+	if (eof && (end - p) % reclen != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("size of file \"%s\" is not a multiple of %d bytes",
+						st->filename, (int) reclen)));
+
+	for (i = 0; i < nrecs; ++i, p += reclen)
+	{
+		const unsigned char *u = (const unsigned char *) p;
+		IPR ipr;
+		int af;
+		bool ok;
+
+		++st->lineno;
+
+		if (st->format == IPLOAD_IP4R)
+		{
+			ipr.ip4r.lower = ((uint32) u[0] << 24) | ((uint32) u[1] << 16) | ((uint32) u[2] << 8) | u[3];
+			ipr.ip4r.upper = ((uint32) u[4] << 24) | ((uint32) u[5] << 16) | ((uint32) u[6] << 8) | u[7];
+			ok = !ip4_lessthan(ipr.ip4r.upper, ipr.ip4r.lower);
+			af = PGSQL_AF_INET;
+		}
+		else
+		{
+			ip6_deserialize(u, &ipr.ip6r.lower);
+			ip6_deserialize(u + 16, &ipr.ip6r.upper);
+			ok = !ip6_lessthan(&ipr.ip6r.upper, &ipr.ip6r.lower);
+			af = PGSQL_AF_INET6;
+		}
+
+		if (!ok)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid IP range in record " INT64_FORMAT " of file \"%s\"",
+							st->lineno, st->filename)));
+
+		ipload_add(st, af, &ipr, NULL, 0);
+	}
+
+	return nrecs * reclen;
+}
+
+/*
+ * Read the file a chunk at a time, handing each to the parser for the
+ * format; whatever the parser leaves unconsumed (a partial line or record)
+ * is kept at the start of the buffer for the next read. The buffer grows
+ * only if a single line doesn't fit.
+ */
+
+static void
+ipload_read_file(IPLoadState *st)
+{
+	Size bufsize = IPLOAD_CHUNK_SIZE;
+	char *buf = palloc(bufsize);
+	Size len = 0;
+	bool eof = false;
+	int fd;
+
+#if PG_VERSION_NUM >= 110000
+	fd = OpenTransientFile(st->filename, O_RDONLY | PG_BINARY);
+#else
+	fd = OpenTransientFile((char *) st->filename, O_RDONLY | PG_BINARY, 0);
+#endif
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m", st->filename)));
+
+	while (!eof)
+	{
+		ssize_t r;
+		Size used;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (len == bufsize)
+		{
+			if (bufsize >= MaxAllocSize / 2)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("line " INT64_FORMAT " of file \"%s\" is too long",
+								st->lineno + 1, st->filename)));
+			bufsize *= 2;
+			buf = repalloc(buf, bufsize);
+		}
+
+		r = read(fd, buf + len, bufsize - len);
+		if (r < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", st->filename)));
+		eof = (r == 0);
+		len += r;
+
+		if (st->format == IPLOAD_CSV)
+			used = ipload_csv(st, buf, buf + len, eof);
+		else
+			used = ipload_binary(st, buf, buf + len, eof);
+
+		if (used > 0)
+		{
+			memmove(buf, buf + used, len - used);
+			len -= used;
+		}
+	}
+
+	CloseTransientFile(fd);
+	pfree(buf);
+}
+
+PG_FUNCTION_INFO_V1(iprange_load);
+Datum
+iprange_load(PG_FUNCTION_ARGS)
+{
+	char *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char *fmtname = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	IPLoadState st;
+	IPLoadFormat format;
+
+	if (pg_strcasecmp(fmtname, "csv") == 0)
+		format = IPLOAD_CSV;
+	else if (pg_strcasecmp(fmtname, "ip4r") == 0)
+		format = IPLOAD_IP4R;
+	else if (pg_strcasecmp(fmtname, "ip6r") == 0)
+		format = IPLOAD_IP6R;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized file format \"%s\"", fmtname),
+				 errhint("Valid formats are \"csv\", \"ip4r\" and \"ip6r\".")));
+
+	ipr_materialize_init(fcinfo);
+
+	st.fcinfo = fcinfo;
+	st.filename = filename;
+	st.format = format;
+	st.merge = PG_GETARG_BOOL(2);
+	st.lineno = 0;
+	st.nentries = 0;
+	st.maxentries = 1024;
+	st.entries = st.merge ? palloc(st.maxentries * sizeof(IPLoadEntry)) : NULL;
+
+	ipload_read_file(&st);
+	ipload_finish(&st);
+
+	return (Datum) 0;
+}
+
+/* end */
@@ -0,0 +1,971 @@
+/* ipmap.c */
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "fmgr.h"
+
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/memutils.h"
+#include "utils/palloc.h"
+
+#include "ipr_internal.h"
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+/*
+ * ipmap is a dictionary from disjoint IP ranges to bigint values, held in
+ * a single datum, for enrichment lookups (geolocation, ASN, etc.) that
+ * would otherwise cost an index probe and heap fetch per row.
+ *
+ * Each family is stored as parallel arrays of lower bounds, upper bounds
+ * and values, in Eytzinger (BFS) order: entry k has children 2k+1 and 2k+2.
+ * A lookup is a descent of this implicit tree, in which the first several
+ * levels share a handful of cache lines, and which needs no pointers, so
+ * the detoasted value is usable as-is.
+ *
+ * Layout after the header:
+ *
+ *   int64 value4[n4], value6[n6]
+ *   IP6   lower6[n6], upper6[n6]
+ *   IP4   lower4[n4], upper4[n4]
+ *
+ * which keeps everything aligned given double alignment of the whole.
+ */
+
+typedef struct IPMap
+{
+	int32		vl_len_;
+	uint32		n4;
+	uint32		n6;
+	uint32		pad_;		/* always zero */
+} IPMap;
+
+typedef struct IPMapView
+{
+	uint32		n4;
+	uint32		n6;
+	const int64 *value4;
+	const int64 *value6;
+	const IP6  *lower6;
+	const IP6  *upper6;
+	const IP4  *lower4;
+	const IP4  *upper4;
+} IPMapView;
+
+#define IPMAP_SIZE(n4_,n6_) \
+	(sizeof(IPMap) + (n4_) * (sizeof(int64) + 2*sizeof(IP4)) \
+	 + (n6_) * (sizeof(int64) + 2*sizeof(IP6)))
+
+#define DatumGetIPMapP(X) ((IPMap *) PG_DETOAST_DATUM(X))
+#define IPMapPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_IPMAP_P(n) DatumGetIPMapP(PG_GETARG_DATUM(n))
+#define PG_RETURN_IPMAP_P(x) return IPMapPGetDatum(x)
+
+static inline
+void ipmap_view(const IPMap *map, IPMapView *v)
+{
+	const char *p = (const char *) map + sizeof(IPMap);
+
+	v->n4 = map->n4;
+	v->n6 = map->n6;
+	v->value4 = (const int64 *) p;		p += v->n4 * sizeof(int64);
+	v->value6 = (const int64 *) p;		p += v->n6 * sizeof(int64);
+	v->lower6 = (const IP6 *) p;		p += v->n6 * sizeof(IP6);
+	v->upper6 = (const IP6 *) p;		p += v->n6 * sizeof(IP6);
+	v->lower4 = (const IP4 *) p;		p += v->n4 * sizeof(IP4);
+	v->upper4 = (const IP4 *) p;
+}
+
+/*
+ * Find the entry containing IP; returns its index, or -1. The descent
+ * remembers the last node whose lower bound was <= IP, which is the
+ * in-order predecessor of IP; the compiler turns that into a cmov.
+ */
+
+static inline
+int64 ipmap_find4(const IPMapView *v, IP4 ip)
+{
+	const IP4 *lower = v->lower4;
+	uint32 n = v->n4;
+	uint32 k = 0;
+	int64 cand = -1;
+
+	while (k < n)
+	{
+		bool le = (lower[k] <= ip);
+
+		cand = le ? (int64) k : cand;
+		k = 2*k + 1 + le;
+	}
+
+	if (cand >= 0 && ip <= v->upper4[cand])
+		return cand;
+	return -1;
+}
+
+static inline
+int64 ipmap_find6(const IPMapView *v, IP6 *ip)
+{
+	const IP6 *lower = v->lower6;
+	uint32 n = v->n6;
+	uint32 k = 0;
+	int64 cand = -1;
+
+	while (k < n)
+	{
+		bool le = !ip6_lessthan(ip, (IP6 *) &lower[k]);
+
+		cand = le ? (int64) k : cand;
+		k = 2*k + 1 + le;
+	}
+
+	if (cand >= 0 && !ip6_lessthan((IP6 *) &v->upper6[cand], ip))
+		return cand;
+	return -1;
+}
+
+/*
+ * PERM[i] is set to the Eytzinger position of the i'th entry in sorted
+ * order, by an in-order walk of the implicit tree.
+ */
+static
+uint32 ipmap_eytzinger_fill(uint32 *perm, uint32 n, uint32 k, uint32 i)
+{
+	if (k < n)
+	{
+		i = ipmap_eytzinger_fill(perm, n, 2*k + 1, i);
+		perm[i++] = k;
+		i = ipmap_eytzinger_fill(perm, n, 2*k + 2, i);
+	}
+	return i;
+}
+
+static
+uint32 *ipmap_eytzinger_perm(uint32 n)
+{
+	uint32 *perm = palloc((n ? n : 1) * sizeof(uint32));
+
+	ipmap_eytzinger_fill(perm, n, 0, 0);
+	return perm;
+}
+
+
+/**************************************************************************/
+/* Building maps
+ *
+ * Entries are collected per family, then sorted, checked for overlaps,
+ * and adjacent entries with equal values are merged.
+ */
+
+typedef struct IPMapEntry4
+{
+	IP4R		r;
+	int64		value;
+} IPMapEntry4;
+
+typedef struct IPMapEntry6
+{
+	IP6R		r;
+	int64		value;
+} IPMapEntry6;
+
+typedef struct IPMapBuild
+{
+	IPMapEntry4 *e4;
+	uint32		n4;
+	uint32		max4;
+	IPMapEntry6 *e6;
+	uint32		n6;
+	uint32		max6;
+} IPMapBuild;
+
+static
+void ipmap_build_init(IPMapBuild *b)
+{
+	b->max4 = b->max6 = 16;
+	b->n4 = b->n6 = 0;
+	b->e4 = palloc(b->max4 * sizeof(IPMapEntry4));
+	b->e6 = palloc(b->max6 * sizeof(IPMapEntry6));
+}
+
+static
+void ipmap_build_add4(IPMapBuild *b, IP4R *r, int64 value)
+{
+	if (b->n4 >= b->max4)
+	{
+		b->max4 *= 2;
+		b->e4 = repalloc(b->e4, b->max4 * sizeof(IPMapEntry4));
+	}
+	b->e4[b->n4].r = *r;
+	b->e4[b->n4].value = value;
+	++b->n4;
+}
+
+static
+void ipmap_build_add6(IPMapBuild *b, IP6R *r, int64 value)
+{
+	if (b->n6 >= b->max6)
+	{
+		b->max6 *= 2;
+		b->e6 = repalloc(b->e6, b->max6 * sizeof(IPMapEntry6));
+	}
+	b->e6[b->n6].r = *r;
+	b->e6[b->n6].value = value;
+	++b->n6;
+}
+
+/* add an unpacked iprange; af 0 is the universal range */
+
+static
+void ipmap_build_add(IPMapBuild *b, int af, IPR *ipr, int64 value)
+{
+	IP4R r4;
+	IP6R r6;
+
+	switch (af)
+	{
+		case 0:
+			r4.lower = 0;
+			r4.upper = ~(IP4)0;
+			r6.lower.bits[0] = r6.lower.bits[1] = 0;
+			r6.upper.bits[0] = r6.upper.bits[1] = ~(uint64)0;
+			ipmap_build_add4(b, &r4, value);
+			ipmap_build_add6(b, &r6, value);
+			break;
+
+		case PGSQL_AF_INET:
+			ipmap_build_add4(b, &ipr->ip4r, value);
+			break;
+
+		case PGSQL_AF_INET6:
+			ipmap_build_add6(b, &ipr->ip6r, value);
+			break;
+	}
+}
+
+static
+int ipmap_entry4_cmp(const void *a, const void *b)
+{
+	const IPMapEntry4 *ea = a;
+	const IPMapEntry4 *eb = b;
+
+	return (ea->r.lower > eb->r.lower) - (ea->r.lower < eb->r.lower);
+}
+
+static
+int ipmap_entry6_cmp(const void *a, const void *b)
+{
+	const IPMapEntry6 *ea = a;
+	const IPMapEntry6 *eb = b;
+
+	return ip6_compare((IP6 *) &ea->r.lower, (IP6 *) &eb->r.lower);
+}
+
+static
+char *ipmap_overlap_detail(const char *r1, const char *r2)
+{
+	StringInfoData str;
+
+	initStringInfo(&str);
+	appendStringInfo(&str, "Ranges %s and %s overlap.", r1, r2);
+	return str.data;
+}
+
+/*
+ * Sort and merge the entries. If two entries overlap, returns false with
+ * *DETAIL describing them.
+ */
+static
+bool ipmap_build_normalize(IPMapBuild *b, char **detail)
+{
+	uint32 out;
+	uint32 i;
+
+	if (b->n4 > 1)
+	{
+		qsort(b->e4, b->n4, sizeof(IPMapEntry4), ipmap_entry4_cmp);
+
+		for (out = 0, i = 1; i < b->n4; ++i)
+		{
+			IPMapEntry4 *prev = &b->e4[out];
+			IPMapEntry4 *cur = &b->e4[i];
+
+			if (cur->r.lower <= prev->r.upper)
+			{
+				char buf1[IP4R_STRING_MAX];
+				char buf2[IP4R_STRING_MAX];
+
+				ip4r_to_str(&prev->r, buf1, sizeof(buf1));
+				ip4r_to_str(&cur->r, buf2, sizeof(buf2));
+				*detail = ipmap_overlap_detail(buf1, buf2);
+				return false;
+			}
+
+			if (cur->value == prev->value && cur->r.lower - prev->r.upper == 1)
+				prev->r.upper = cur->r.upper;
+			else
+				b->e4[++out] = *cur;
+		}
+
+		b->n4 = out + 1;
+	}
+
+	if (b->n6 > 1)
+	{
+		qsort(b->e6, b->n6, sizeof(IPMapEntry6), ipmap_entry6_cmp);
+
+		for (out = 0, i = 1; i < b->n6; ++i)
+		{
+			IPMapEntry6 *prev = &b->e6[out];
+			IPMapEntry6 *cur = &b->e6[i];
+			IP6 diff;
+
+			if (!ip6_lessthan(&prev->r.upper, &cur->r.lower))
+			{
+				char buf1[IP6R_STRING_MAX];
+				char buf2[IP6R_STRING_MAX];
+
+				ip6r_to_str(&prev->r, buf1, sizeof(buf1));
+				ip6r_to_str(&cur->r, buf2, sizeof(buf2));
+				*detail = ipmap_overlap_detail(buf1, buf2);
+				return false;
+			}
+
+			ip6_sub(&cur->r.lower, &prev->r.upper, &diff);
+			if (cur->value == prev->value && diff.bits[0] == 0 && diff.bits[1] == 1)
+				prev->r.upper = cur->r.upper;
+			else
+				b->e6[++out] = *cur;
+		}
+
+		b->n6 = out + 1;
+	}
+
+	return true;
+}
+
+/* the entries must have been normalized */
+
+static
+IPMap *ipmap_build_finish(IPMapBuild *b)
+{
+	Size len = IPMAP_SIZE(b->n4, b->n6);
+	IPMap *map = palloc0(len);
+	IPMapView v;
+	uint32 *perm;
+	uint32 i;
+
+	SET_VARSIZE(map, len);
+	map->n4 = b->n4;
+	map->n6 = b->n6;
+	ipmap_view(map, &v);
+
+	perm = ipmap_eytzinger_perm(b->n4);
+	for (i = 0; i < b->n4; ++i)
+	{
+		uint32 k = perm[i];
+
+		((IP4 *) v.lower4)[k] = b->e4[i].r.lower;
+		((IP4 *) v.upper4)[k] = b->e4[i].r.upper;
+		((int64 *) v.value4)[k] = b->e4[i].value;
+	}
+	pfree(perm);
+
+	perm = ipmap_eytzinger_perm(b->n6);
+	for (i = 0; i < b->n6; ++i)
+	{
+		uint32 k = perm[i];
+
+		((IP6 *) v.lower6)[k] = b->e6[i].r.lower;
+		((IP6 *) v.upper6)[k] = b->e6[i].r.upper;
+		((int64 *) v.value6)[k] = b->e6[i].value;
+	}
+	pfree(perm);
+
+	return map;
+}
+
+
+/**************************************************************************/
+/* This part handles all aspects of postgres interfacing.
+ */
+
+/*
+ * Lookups detoast the map argument once per query rather than once per
+ * call: toasted values are identified by their raw (compressed or
+ * external) bytes, which for an out-of-line value is just the toast
+ * pointer. Values that are already plain need no caching at all, which
+ * covers maps computed in the query itself.
+ */
+
+typedef struct IPMapCache
+{
+	struct varlena *raw;	/* copy of the argument as passed */
+	IPMap	   *map;		/* detoasted value */
+} IPMapCache;
+
+static
+IPMap *ipmap_getarg_cached(FunctionCallInfo fcinfo, int argno)
+{
+	struct varlena *raw = (struct varlena *) DatumGetPointer(PG_GETARG_DATUM(argno));
+	IPMapCache *cache = fcinfo->flinfo->fn_extra;
+	MemoryContext oldcontext;
+	Size rawlen;
+
+	if (!VARATT_IS_EXTENDED(raw))
+		return (IPMap *) raw;
+
+	/* in-memory indirections don't have a stable identity */
+	if (VARATT_IS_EXTERNAL(raw) && !VARATT_IS_EXTERNAL_ONDISK(raw))
+		return (IPMap *) PG_DETOAST_DATUM(PointerGetDatum(raw));
+
+	rawlen = VARSIZE_ANY(raw);
+
+	if (cache && cache->raw
+		&& VARSIZE_ANY(cache->raw) == rawlen
+		&& memcmp(cache->raw, raw, rawlen) == 0)
+		return cache->map;
+
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	if (!cache)
+	{
+		cache = palloc0(sizeof(IPMapCache));
+		fcinfo->flinfo->fn_extra = cache;
+	}
+	else if (cache->raw)
+	{
+		pfree(cache->raw);
+		pfree(cache->map);
+		cache->raw = NULL;
+	}
+
+	cache->map = (IPMap *) PG_DETOAST_DATUM_COPY(PointerGetDatum(raw));
+	cache->raw = palloc(rawlen);
+	memcpy(cache->raw, raw, rawlen);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return cache->map;
+}
+
+PG_FUNCTION_INFO_V1(ipmap_lookup_ip4);
+Datum
+ipmap_lookup_ip4(PG_FUNCTION_ARGS)
+{
+	IPMap *map = ipmap_getarg_cached(fcinfo, 0);
+	IPMapView v;
+	int64 k;
+
+	ipmap_view(map, &v);
+	k = ipmap_find4(&v, PG_GETARG_IP4(1));
+	if (k < 0)
+		PG_RETURN_NULL();
+	PG_RETURN_INT64(v.value4[k]);
+}
+
+PG_FUNCTION_INFO_V1(ipmap_lookup_ip6);
+Datum
+ipmap_lookup_ip6(PG_FUNCTION_ARGS)
+{
+	IPMap *map = ipmap_getarg_cached(fcinfo, 0);
+	IPMapView v;
+	int64 k;
+
+	ipmap_view(map, &v);
+	k = ipmap_find6(&v, PG_GETARG_IP6_P(1));
+	if (k < 0)
+		PG_RETURN_NULL();
+	PG_RETURN_INT64(v.value6[k]);
+}
+
+PG_FUNCTION_INFO_V1(ipmap_lookup_ipaddr);
+Datum
+ipmap_lookup_ipaddr(PG_FUNCTION_ARGS)
+{
+	IPMap *map = ipmap_getarg_cached(fcinfo, 0);
+	IP_P ipp = PG_GETARG_IP_P(1);
+	IP ip;
+	IPMapView v;
+	int64 k;
+
+	ipmap_view(map, &v);
+
+	switch (ip_unpack(ipp, &ip))
+	{
+		case PGSQL_AF_INET:
+			k = ipmap_find4(&v, ip.ip4);
+			if (k < 0)
+				PG_RETURN_NULL();
+			PG_RETURN_INT64(v.value4[k]);
+
+		case PGSQL_AF_INET6:
+			k = ipmap_find6(&v, &ip.ip6);
+			if (k < 0)
+				PG_RETURN_NULL();
+			PG_RETURN_INT64(v.value6[k]);
+	}
+
+	ipaddr_internal_error();
+}
+
+/*
+ * Text format is {range=>value,...}, where range is anything accepted by
+ * iprange. Output is in address order, v4 first.
+ */
+
+static bool
+ipmap_parse(char *str, IPMapBuild *b)
+{
+	char buf[IP6R_STRING_MAX];
+	char *p = str;
+
+	while (isspace((unsigned char) *p))
+		++p;
+	if (*p++ != '{')
+		return false;
+	while (isspace((unsigned char) *p))
+		++p;
+
+	if (*p != '}')
+	{
+		for (;;)
+		{
+			IPR ipr;
+			int af;
+			int len;
+			long long value;
+			char *end;
+
+			while (isspace((unsigned char) *p))
+				++p;
+			len = strcspn(p, "=,} \t\r\n");
+			if (len == 0 || len >= sizeof(buf))
+				return false;
+			memcpy(buf, p, len);
+			buf[len] = 0;
+			p += len;
+
+			if (strcmp(buf, "-") == 0)
+				af = 0;
+			else if (strchr(buf, ':'))
+			{
+				if (!ip6r_from_str(buf, &ipr.ip6r))
+					return false;
+				af = PGSQL_AF_INET6;
+			}
+			else
+			{
+				if (!ip4r_from_str(buf, &ipr.ip4r))
+					return false;
+				af = PGSQL_AF_INET;
+			}
+
+			while (isspace((unsigned char) *p))
+				++p;
+			if (p[0] != '=' || p[1] != '>')
+				return false;
+			p += 2;
+			while (isspace((unsigned char) *p))
+				++p;
+
+			errno = 0;
+			value = strtoll(p, &end, 10);
+			if (end == p || errno != 0)
+				return false;
+			p = end;
+
+			ipmap_build_add(b, af, &ipr, (int64) value);
+
+			while (isspace((unsigned char) *p))
+				++p;
+			if (*p == '}')
+				break;
+			if (*p++ != ',')
+				return false;
+		}
+	}
+
+	++p;
+	while (isspace((unsigned char) *p))
+		++p;
+	return (*p == 0);
+}
+
+PG_FUNCTION_INFO_V1(ipmap_in);
+Datum
+ipmap_in(PG_FUNCTION_ARGS)
+{
+	char *str = PG_GETARG_CSTRING(0);
+	IPMapBuild b;
+	char *detail;
+
+	ipmap_build_init(&b);
+
+	if (!ipmap_parse(str, &b))
+		ereturn(fcinfo->context, (Datum)0,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid IPMAP value: \"%s\"", str)));
+
+	if (!ipmap_build_normalize(&b, &detail))
+		ereturn(fcinfo->context, (Datum)0,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid IPMAP value: \"%s\"", str),
+				 errdetail("%s", detail)));
+
+	PG_RETURN_IPMAP_P(ipmap_build_finish(&b));
+}
+
+PG_FUNCTION_INFO_V1(ipmap_out);
+Datum
+ipmap_out(PG_FUNCTION_ARGS)
+{
+	IPMap *map = PG_GETARG_IPMAP_P(0);
+	StringInfoData str;
+	IPMapView v;
+	uint32 *perm;
+	uint32 i;
+
+	ipmap_view(map, &v);
+	initStringInfo(&str);
+	appendStringInfoChar(&str, '{');
+
+	perm = ipmap_eytzinger_perm(v.n4);
+	for (i = 0; i < v.n4; ++i)
+	{
+		char buf[IP4R_STRING_MAX];
+		IP4R r;
+
+		r.lower = v.lower4[perm[i]];
+		r.upper = v.upper4[perm[i]];
+		ip4r_to_str(&r, buf, sizeof(buf));
+		appendStringInfo(&str, "%s%s=>" INT64_FORMAT,
+						 (i > 0) ? "," : "", buf, v.value4[perm[i]]);
+	}
+	pfree(perm);
+
+	perm = ipmap_eytzinger_perm(v.n6);
+	for (i = 0; i < v.n6; ++i)
+	{
+		char buf[IP6R_STRING_MAX];
+		IP6R r;
+
+		r.lower = v.lower6[perm[i]];
+		r.upper = v.upper6[perm[i]];
+		ip6r_to_str(&r, buf, sizeof(buf));
+		appendStringInfo(&str, "%s%s=>" INT64_FORMAT,
+						 (i > 0 || v.n4 > 0) ? "," : "", buf, v.value6[perm[i]]);
+	}
+	pfree(perm);
+
+	appendStringInfoChar(&str, '}');
+
+	PG_RETURN_CSTRING(str.data);
+}
+
+/*
+ * The binary format is the two entry counts, followed by the v4 and then
+ * the v6 entries as fixed-size (lower, upper, value) records in address
+ * order, so a dump of it can be binary-searched in place (e.g. after
+ * mapping it into memory) without decoding. Input need not be in order.
+ */
+
+PG_FUNCTION_INFO_V1(ipmap_recv);
+Datum
+ipmap_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	uint32 n4 = (uint32) pq_getmsgint(buf, sizeof(uint32));
+	uint32 n6 = (uint32) pq_getmsgint(buf, sizeof(uint32));
+	IPMapBuild b;
+	char *detail;
+	uint32 i;
+
+	if (n4 > (buf->len - buf->cursor) / (2*sizeof(IP4) + sizeof(int64))
+		|| n6 > (buf->len - buf->cursor) / (2*sizeof(IP6) + sizeof(int64)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid IPMAP value")));
+
+	ipmap_build_init(&b);
+
+	for (i = 0; i < n4; ++i)
+	{
+		IP4R r;
+		int64 value;
+
+		r.lower = (IP4) pq_getmsgint(buf, sizeof(IP4));
+		r.upper = (IP4) pq_getmsgint(buf, sizeof(IP4));
+		value = pq_getmsgint64(buf);
+		if (r.lower > r.upper)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid IPMAP value")));
+		ipmap_build_add4(&b, &r, value);
+	}
+
+	for (i = 0; i < n6; ++i)
+	{
+		IP6R r;
+		int64 value;
+
+		r.lower.bits[0] = pq_getmsgint64(buf);
+		r.lower.bits[1] = pq_getmsgint64(buf);
+		r.upper.bits[0] = pq_getmsgint64(buf);
+		r.upper.bits[1] = pq_getmsgint64(buf);
+		value = pq_getmsgint64(buf);
+		if (ip6_lessthan(&r.upper, &r.lower))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid IPMAP value")));
+		ipmap_build_add6(&b, &r, value);
+	}
+
+	if (!ipmap_build_normalize(&b, &detail))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid IPMAP value"),
+				 errdetail("%s", detail)));
+
+	PG_RETURN_IPMAP_P(ipmap_build_finish(&b));
+}
+
+PG_FUNCTION_INFO_V1(ipmap_send);
+Datum
+ipmap_send(PG_FUNCTION_ARGS)
+{
+	IPMap *map = PG_GETARG_IPMAP_P(0);
+	StringInfoData buf;
+	IPMapView v;
+	uint32 *perm;
+	uint32 i;
+
+	ipmap_view(map, &v);
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, v.n4, sizeof(uint32));
+	pq_sendint(&buf, v.n6, sizeof(uint32));
+
+	perm = ipmap_eytzinger_perm(v.n4);
+	for (i = 0; i < v.n4; ++i)
+	{
+		pq_sendint(&buf, v.lower4[perm[i]], sizeof(IP4));
+		pq_sendint(&buf, v.upper4[perm[i]], sizeof(IP4));
+		pq_sendint64(&buf, v.value4[perm[i]]);
+	}
+	pfree(perm);
+
+	perm = ipmap_eytzinger_perm(v.n6);
+	for (i = 0; i < v.n6; ++i)
+	{
+		pq_sendint64(&buf, v.lower6[perm[i]].bits[0]);
+		pq_sendint64(&buf, v.lower6[perm[i]].bits[1]);
+		pq_sendint64(&buf, v.upper6[perm[i]].bits[0]);
+		pq_sendint64(&buf, v.upper6[perm[i]].bits[1]);
+		pq_sendint64(&buf, v.value6[perm[i]]);
+	}
+	pfree(perm);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+PG_FUNCTION_INFO_V1(ipmap_size);
+Datum
+ipmap_size(PG_FUNCTION_ARGS)
+{
+	IPMap *map = PG_GETARG_IPMAP_P(0);
+
+	PG_RETURN_INT64((int64) map->n4 + map->n6);
+}
+
+/*
+ * aggregate support
+ *
+ * The state is the unsorted entry list; the final function sorts it and
+ * complains about overlaps. Rows with a null range or value are ignored.
+ */
+
+static
+IPMapBuild *ipmap_agg_state_new(MemoryContext aggcontext)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(aggcontext);
+	IPMapBuild *state = palloc(sizeof(IPMapBuild));
+
+	ipmap_build_init(state);
+	MemoryContextSwitchTo(oldcontext);
+
+	return state;
+}
+
+PG_FUNCTION_INFO_V1(ipmap_agg_trans);
+Datum
+ipmap_agg_trans(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IPMapBuild *state;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ipmap aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		state = ipmap_agg_state_new(aggcontext);
+	else
+		state = (IPMapBuild *) PG_GETARG_POINTER(0);
+
+	if (!PG_ARGISNULL(1) && !PG_ARGISNULL(2))
+	{
+		IPR_P iprp = PG_GETARG_IPR_P(1);
+		IPR ipr;
+		int af = ipr_unpack(iprp, &ipr);
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		ipmap_build_add(state, af, &ipr, PG_GETARG_INT64(2));
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(ipmap_agg_final);
+Datum
+ipmap_agg_final(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	IPMapBuild *state;
+	IPMapBuild b;
+	char *detail;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ipmap aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IPMapBuild *) PG_GETARG_POINTER(0);
+
+	/* work on a copy, since the final function must not change the state */
+	b.n4 = b.max4 = state->n4;
+	b.n6 = b.max6 = state->n6;
+	b.e4 = palloc((b.n4 ? b.n4 : 1) * sizeof(IPMapEntry4));
+	b.e6 = palloc((b.n6 ? b.n6 : 1) * sizeof(IPMapEntry6));
+	memcpy(b.e4, state->e4, b.n4 * sizeof(IPMapEntry4));
+	memcpy(b.e6, state->e6, b.n6 * sizeof(IPMapEntry6));
+
+	if (!ipmap_build_normalize(&b, &detail))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("overlapping ranges in ipmap_agg input"),
+				 errdetail("%s", detail)));
+
+	PG_RETURN_IPMAP_P(ipmap_build_finish(&b));
+}
+
+PG_FUNCTION_INFO_V1(ipmap_agg_combine);
+Datum
+ipmap_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IPMapBuild *state1;
+	IPMapBuild *state2;
+	uint32 i;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ipmap aggregate function called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	state2 = (IPMapBuild *) PG_GETARG_POINTER(1);
+
+	if (PG_ARGISNULL(0))
+		state1 = ipmap_agg_state_new(aggcontext);
+	else
+		state1 = (IPMapBuild *) PG_GETARG_POINTER(0);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	for (i = 0; i < state2->n4; ++i)
+		ipmap_build_add4(state1, &state2->e4[i].r, state2->e4[i].value);
+	for (i = 0; i < state2->n6; ++i)
+		ipmap_build_add6(state1, &state2->e6[i].r, state2->e6[i].value);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/* the serialized state is the two counts followed by the raw entries */
+
+PG_FUNCTION_INFO_V1(ipmap_agg_serial);
+Datum
+ipmap_agg_serial(PG_FUNCTION_ARGS)
+{
+	IPMapBuild *state;
+	Size len;
+	bytea *res;
+	char *p;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "ipmap aggregate function called in non-aggregate context");
+
+	state = (IPMapBuild *) PG_GETARG_POINTER(0);
+
+	len = VARHDRSZ + 2*sizeof(uint32)
+		+ state->n4 * sizeof(IPMapEntry4) + state->n6 * sizeof(IPMapEntry6);
+	res = palloc(len);
+	SET_VARSIZE(res, len);
+
+	p = VARDATA(res);
+	memcpy(p, &state->n4, sizeof(uint32));			p += sizeof(uint32);
+	memcpy(p, &state->n6, sizeof(uint32));			p += sizeof(uint32);
+	memcpy(p, state->e4, state->n4 * sizeof(IPMapEntry4));	p += state->n4 * sizeof(IPMapEntry4);
+	memcpy(p, state->e6, state->n6 * sizeof(IPMapEntry6));
+
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(ipmap_agg_deserial);
+Datum
+ipmap_agg_deserial(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	bytea *in = PG_GETARG_BYTEA_P(0);
+	const char *p = VARDATA(in);
+	IPMapBuild *state;
+	uint32 n4;
+	uint32 n6;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "ipmap aggregate function called in non-aggregate context");
+
+	memcpy(&n4, p, sizeof(uint32));		p += sizeof(uint32);
+	memcpy(&n6, p, sizeof(uint32));		p += sizeof(uint32);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	state = palloc(sizeof(IPMapBuild));
+	state->n4 = n4;
+	state->n6 = n6;
+	state->max4 = Max(n4, 16);
+	state->max6 = Max(n6, 16);
+	state->e4 = palloc(state->max4 * sizeof(IPMapEntry4));
+	state->e6 = palloc(state->max6 * sizeof(IPMapEntry6));
+	memcpy(state->e4, p, n4 * sizeof(IPMapEntry4));		p += n4 * sizeof(IPMapEntry4);
+	memcpy(state->e6, p, n6 * sizeof(IPMapEntry6));
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state);
+}
+
+/* end */
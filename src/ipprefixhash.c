@@ -0,0 +1,138 @@
+/* ipprefixhash.c */
+
+#include "postgres.h"
+
+#include <math.h>
+#include <sys/socket.h>
+
+#include "fmgr.h"
+
+#include "access/hash.h"
+#include "utils/elog.h"
+
+#include "ipr_internal.h"
+
+#include "ip4r_funcs.h"
+#include "ip6r_funcs.h"
+
+/*
+ * Hash functions for the hash_*_prefixN_ops opclasses, which hash only the
+ * leading N bits of the address. All addresses of one /N network therefore
+ * get the same hash, so hash partitioning (or any other hash-based
+ * sharding) on such an opclass keeps each network in a single partition.
+ * Within a hash index or hash join every address of the network would land
+ * in the same bucket, so these are not the default opclasses.
+ *
+ * The supported prefix lengths are fixed by the opclass, since hash support
+ * functions take no parameters; each variant is a pair of thin wrappers
+ * generated below. IPv6 prefixes are at most 64 bits, so only the high word
+ * is hashed.
+ */
+
+static void ipprefixhash_internal_error(void) __attribute__((noreturn,noinline));
+
+static
+void ipprefixhash_internal_error(void)
+{
+	elog(ERROR,"Invalid IP datum");
+
+	/* just to shut the compiler up */
+	abort();
+}
+
+static inline
+Datum ip4_prefix_hash(IP4 ip, unsigned len, bool extended, uint64 seed)
+{
+	ip &= netmask(len);
+
+	if (extended)
+		return hash_uint32_extended(ip, seed);
+	return hash_uint32(ip);
+}
+
+static inline
+Datum ip6_prefix_hash(IP6 *ip, unsigned len, bool extended, uint64 seed)
+{
+	uint64 hi = ip->bits[0] & netmask6_hi(len);
+
+	if (extended)
+		return Int64GetDatum((int64) ipr_hash_words_extended(&hi, 2, seed));
+	return UInt32GetDatum(ipr_hash_words(&hi, 2));
+}
+
+static inline
+Datum ipaddr_prefix_hash(IP_P ipp, unsigned len4, unsigned len6,
+						 bool extended, uint64 seed)
+{
+	IP ip;
+
+	switch (ip_unpack(ipp, &ip))
+	{
+		case PGSQL_AF_INET:
+			return ip4_prefix_hash(ip.ip4, len4, extended, seed);
+
+		case PGSQL_AF_INET6:
+			return ip6_prefix_hash(&ip.ip6, len6, extended, seed);
+	}
+
+	ipprefixhash_internal_error();
+}
+
+#define IP4_PREFIX_HASH(len_) \
+	PG_FUNCTION_INFO_V1(ip4_prefix##len_##_hash); \
+	Datum \
+	ip4_prefix##len_##_hash(PG_FUNCTION_ARGS) \
+	{ \
+		return ip4_prefix_hash(PG_GETARG_IP4(0), len_, false, 0); \
+	} \
+	PG_FUNCTION_INFO_V1(ip4_prefix##len_##_hash_extended); \
+	Datum \
+	ip4_prefix##len_##_hash_extended(PG_FUNCTION_ARGS) \
+	{ \
+		return ip4_prefix_hash(PG_GETARG_IP4(0), len_, \
+							   true, DatumGetUInt64(PG_GETARG_DATUM(1))); \
+	}
+
+#define IP6_PREFIX_HASH(len_) \
+	PG_FUNCTION_INFO_V1(ip6_prefix##len_##_hash); \
+	Datum \
+	ip6_prefix##len_##_hash(PG_FUNCTION_ARGS) \
+	{ \
+		return ip6_prefix_hash(PG_GETARG_IP6_P(0), len_, false, 0); \
+	} \
+	PG_FUNCTION_INFO_V1(ip6_prefix##len_##_hash_extended); \
+	Datum \
+	ip6_prefix##len_##_hash_extended(PG_FUNCTION_ARGS) \
+	{ \
+		return ip6_prefix_hash(PG_GETARG_IP6_P(0), len_, \
+							   true, DatumGetUInt64(PG_GETARG_DATUM(1))); \
+	}
+
+#define IPADDR_PREFIX_HASH(len4_,len6_) \
+	PG_FUNCTION_INFO_V1(ipaddr_prefix##len4_##_##len6_##_hash); \
+	Datum \
+	ipaddr_prefix##len4_##_##len6_##_hash(PG_FUNCTION_ARGS) \
+	{ \
+		return ipaddr_prefix_hash(PG_GETARG_IP_P(0), len4_, len6_, false, 0); \
+	} \
+	PG_FUNCTION_INFO_V1(ipaddr_prefix##len4_##_##len6_##_hash_extended); \
+	Datum \
+	ipaddr_prefix##len4_##_##len6_##_hash_extended(PG_FUNCTION_ARGS) \
+	{ \
+		return ipaddr_prefix_hash(PG_GETARG_IP_P(0), len4_, len6_, \
+								  true, DatumGetUInt64(PG_GETARG_DATUM(1))); \
+	}
+
+IP4_PREFIX_HASH(8)
+IP4_PREFIX_HASH(16)
+IP4_PREFIX_HASH(24)
+
+IP6_PREFIX_HASH(32)
+IP6_PREFIX_HASH(48)
+IP6_PREFIX_HASH(64)
+
+IPADDR_PREFIX_HASH(16,32)
+IPADDR_PREFIX_HASH(24,48)
+IPADDR_PREFIX_HASH(24,64)
+
+/* end */
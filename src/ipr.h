@@ -151,5 +151,58 @@ PGDLLEXPORT IPR_P ipr_pack(int af, IPR *val);
 #define PG_GETARG_IPR_P(n) DatumGetIPR_P(PG_GETARG_DATUM(n))
 #define PG_RETURN_IPR_P(x) return IPR_PGetDatum(x)
 
+/*
+ * IPF and IPRF are the fixed-length forms of ipaddress and iprange: the
+ * value itself, aligned, followed by one byte of address family (0 only for
+ * the universal range). Bytes not used by the value are always zero.
+ *
+ * Only the first IPF_SIZE or IPRF_SIZE bytes are part of the datum, so these
+ * must never be copied by structure assignment out of a datum.
+ */
+typedef struct IPF {
+	IP ip;
+	uint8 af;
+} IPF;
+
+#define IPF_SIZE (sizeof(IP) + 1)
+
+typedef struct IPRF {
+	IPR ipr;
+	uint8 af;
+} IPRF;
+
+#define IPRF_SIZE (sizeof(IPR) + 1)
+
+static inline
+IPF *ipf_make(int af, IP *val)
+{
+	IPF *out = palloc0(sizeof(IPF));
+
+	memcpy(&out->ip, val, ip_sizeof(af));
+	out->af = af;
+	return out;
+}
+
+static inline
+IPRF *iprf_make(int af, IPR *val)
+{
+	IPRF *out = palloc0(sizeof(IPRF));
+
+	if (af != 0)
+		memcpy(&out->ipr, val, ipr_sizeof(af));
+	out->af = af;
+	return out;
+}
+
+#define DatumGetIPFP(X) ((IPF *) DatumGetPointer(X))
+#define IPFPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_IPF_P(n) DatumGetIPFP(PG_GETARG_DATUM(n))
+#define PG_RETURN_IPF_P(x) return IPFPGetDatum(x)
+
+#define DatumGetIPRFP(X) ((IPRF *) DatumGetPointer(X))
+#define IPRFPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_IPRF_P(n) DatumGetIPRFP(PG_GETARG_DATUM(n))
+#define PG_RETURN_IPRF_P(x) return IPRFPGetDatum(x)
+
 #endif
 /* end */
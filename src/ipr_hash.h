@@ -0,0 +1,106 @@
+/* ipr_hash.h */
+#ifndef IPR_HASH_H
+#define IPR_HASH_H
+
+/*
+ * Fixed-width versions of hash_any / hash_any_extended for our types.
+ *
+ * These must return exactly what hash_any(k, nwords * 4) would, since the
+ * values are baked into existing hash indexes and hash partition bounds.
+ * But knowing the length and alignment in advance lets the compiler unroll
+ * everything, and lets callers hash an unpacked (aligned) copy rather than
+ * the possibly unaligned varlena bytes, which sends hash_any down its slow
+ * byte-at-a-time path.
+ *
+ * The algorithm is Bob Jenkins' lookup3, with the initialization constants
+ * used by postgres. Single uint32 values should use hash_uint32 instead,
+ * which is the same thing again.
+ *
+ * NWORDS must be a constant and not a multiple of 3 (the core code does not
+ * run "final" on an empty tail the same way lookup3 does); our types only
+ * need 2, 4 and 8.
+ */
+
+#define IPR_HASH_ROT(x_,k_) (((x_) << (k_)) | ((x_) >> (32 - (k_))))
+
+#define IPR_HASH_MIX(a_,b_,c_) \
+	do { \
+		a_ -= c_;  a_ ^= IPR_HASH_ROT(c_, 4);  c_ += b_; \
+		b_ -= a_;  b_ ^= IPR_HASH_ROT(a_, 6);  a_ += c_; \
+		c_ -= b_;  c_ ^= IPR_HASH_ROT(b_, 8);  b_ += a_; \
+		a_ -= c_;  a_ ^= IPR_HASH_ROT(c_,16);  c_ += b_; \
+		b_ -= a_;  b_ ^= IPR_HASH_ROT(a_,19);  a_ += c_; \
+		c_ -= b_;  c_ ^= IPR_HASH_ROT(b_, 4);  b_ += a_; \
+	} while (0)
+
+#define IPR_HASH_FINAL(a_,b_,c_) \
+	do { \
+		c_ ^= b_; c_ -= IPR_HASH_ROT(b_,14); \
+		a_ ^= c_; a_ -= IPR_HASH_ROT(c_,11); \
+		b_ ^= a_; b_ -= IPR_HASH_ROT(a_,25); \
+		c_ ^= b_; c_ -= IPR_HASH_ROT(b_,16); \
+		a_ ^= c_; a_ -= IPR_HASH_ROT(c_, 4); \
+		b_ ^= a_; b_ -= IPR_HASH_ROT(a_,14); \
+		c_ ^= b_; c_ -= IPR_HASH_ROT(b_,24); \
+	} while (0)
+
+static inline
+void ipr_hash_words_internal(const uint32 *k, int nwords, uint64 seed,
+							 uint32 *bp, uint32 *cp)
+{
+	uint32 a, b, c;
+
+	a = b = c = 0x9e3779b9 + (uint32) (nwords * sizeof(uint32)) + 3923095;
+
+	if (seed != 0)
+	{
+		a += (uint32) (seed >> 32);
+		b += (uint32) seed;
+		IPR_HASH_MIX(a, b, c);
+	}
+
+	while (nwords >= 3)
+	{
+		a += k[0];
+		b += k[1];
+		c += k[2];
+		IPR_HASH_MIX(a, b, c);
+		k += 3;
+		nwords -= 3;
+	}
+
+	switch (nwords)
+	{
+		case 2:
+			b += k[1];
+			/* FALLTHROUGH */
+		case 1:
+			a += k[0];
+	}
+
+	IPR_HASH_FINAL(a, b, c);
+
+	*bp = b;
+	*cp = c;
+}
+
+static inline
+uint32 ipr_hash_words(const void *k, int nwords)
+{
+	uint32 b, c;
+
+	ipr_hash_words_internal((const uint32 *) k, nwords, 0, &b, &c);
+	return c;
+}
+
+static inline
+uint64 ipr_hash_words_extended(const void *k, int nwords, uint64 seed)
+{
+	uint32 b, c;
+
+	ipr_hash_words_internal((const uint32 *) k, nwords, seed, &b, &c);
+	return ((uint64) b << 32) | c;
+}
+
+#endif
+/* end */
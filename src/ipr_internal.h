@@ -3,9 +3,14 @@
 #define IPR_INTERNAL_H
 
 #include "ipr.h"
+#include "ipr_hash.h"
+#include "ipr_sortkey.h"
+#include "ipr_stats.h"
 
-#define IP4R_VERSION_STR "2.4.2"
-#define IP4R_VERSION_NUM 20402
+#include "utils/numeric.h"
+
+#define IP4R_VERSION_STR "2.5.0"
+#define IP4R_VERSION_NUM 20500
 
 /* PG version dependencies */
 
@@ -38,6 +43,13 @@ Datum hash_any_extended(register const unsigned char *k,
 	PG_RETURN_INT64((int64)(uint32) DatumGetInt32(d));
 }
 
+static inline
+Datum hash_uint32_extended(uint32 k, uint64 seed)
+{
+	Datum d = hash_uint32(k);
+	PG_RETURN_INT64((int64)(uint32) DatumGetInt32(d));
+}
+
 #endif
 
 /* cope with variable-length fcinfo in pg12 */
@@ -53,6 +65,20 @@ Datum hash_any_extended(register const unsigned char *k,
 #define LFCI_ARGISNULL(fci_,n_) ((fci_)->args[n_].isnull)
 #endif
 
+/* pg_bitutils.h is new in pg12 */
+#if PG_VERSION_NUM >= 120000
+#include "port/pg_bitutils.h"
+#else
+static inline int
+pg_popcount64(uint64 w)
+{
+	w = w - ((w >> 1) & UINT64CONST(0x5555555555555555));
+	w = (w & UINT64CONST(0x3333333333333333)) + ((w >> 2) & UINT64CONST(0x3333333333333333));
+	w = (w + (w >> 4)) & UINT64CONST(0x0F0F0F0F0F0F0F0F);
+	return (int) ((w * UINT64CONST(0x0101010101010101)) >> 56);
+}
+#endif
+
 /* Soft-error handling is new in pg16 */
 #if PG_VERSION_NUM >= 160000
 #include "nodes/miscnodes.h"
@@ -62,6 +88,48 @@ Datum hash_any_extended(register const unsigned char *k,
 #define SOFT_ERROR_OCCURRED(escontext) false
 #endif
 
+/* VARATT_IS_EXTERNAL_ONDISK is new in 9.4; before that, all external
+ * values were on disk.
+ */
+#ifndef VARATT_IS_EXTERNAL_ONDISK
+#define VARATT_IS_EXTERNAL_ONDISK(p_) VARATT_IS_EXTERNAL(p_)
+#endif
+
+/* numeric_io.c */
+
+#define IPR_NUMERIC_OK 0
+#define IPR_NUMERIC_INVALID 1
+#define IPR_NUMERIC_OVERFLOW 2
+
+Numeric ipr_make_numeric(uint64 hi, uint64 lo, uint32 extra, bool negative);
+int ipr_decode_numeric(Numeric num, uint64 *hi, uint64 *lo, bool *negative);
+
+/* ip4r_module.c */
+
+/* values of ip4r.binary_format, used by ipaddr_send and iprange_send */
+#define IPR_BINARY_STANDARD 0
+#define IPR_BINARY_COMPACT 1
+
+extern int ipr_binary_format;
+
+/* iprange.c */
+
+void ipr_materialize_init(FunctionCallInfo fcinfo);
+void ipr_materialize_value(FunctionCallInfo fcinfo, Datum value);
+Datum ipr_return_materialized(FunctionCallInfo fcinfo, Datum *values, int nvalues);
+Datum ipr_return_array(FunctionCallInfo fcinfo, Datum *values, int nvalues);
+
+/* ip4r.c */
+
+bool ip4r_from_str(char *str, IP4R *ipr);
+int ip4r_to_str(IP4R *ipr, char *str, int slen);
+
+/* ip6r.c */
+
+bool ip6r_from_str(char *str, IP6R *ipr);
+int ip6r_to_str(IP6R *ipr, char *str, int slen);
+bool ip6_plus_numeric_internal(IP6 *ip, Numeric addend, bool negate, IP6 *result);
+
 /* funcs */
 
 Datum ip4_in(PG_FUNCTION_ARGS);
@@ -104,6 +172,9 @@ Datum ip4r_lower(PG_FUNCTION_ARGS);
 Datum ip4r_upper(PG_FUNCTION_ARGS);
 Datum ip4r_is_cidr(PG_FUNCTION_ARGS);
 Datum ip4r_cidr_split(PG_FUNCTION_ARGS);
+Datum ip4r_cidr_split_array(PG_FUNCTION_ARGS);
+Datum ip4r_bounds_trans(PG_FUNCTION_ARGS);
+Datum ip4r_bounds_trans_ip4(PG_FUNCTION_ARGS);
 Datum ip4_netmask(PG_FUNCTION_ARGS);
 Datum ip4_net_lower(PG_FUNCTION_ARGS);
 Datum ip4_net_upper(PG_FUNCTION_ARGS);
@@ -141,6 +212,7 @@ Datum ip4r_union(PG_FUNCTION_ARGS);
 Datum ip4r_inter(PG_FUNCTION_ARGS);
 Datum ip4r_size(PG_FUNCTION_ARGS);
 Datum ip4r_size_exact(PG_FUNCTION_ARGS);
+Datum ip4r_lpm_distance(PG_FUNCTION_ARGS);
 Datum ip4r_prefixlen(PG_FUNCTION_ARGS);
 Datum ip4r_cmp(PG_FUNCTION_ARGS);
 Datum ip4_cmp(PG_FUNCTION_ARGS);
@@ -185,6 +257,9 @@ Datum ip6r_lower(PG_FUNCTION_ARGS);
 Datum ip6r_upper(PG_FUNCTION_ARGS);
 Datum ip6r_is_cidr(PG_FUNCTION_ARGS);
 Datum ip6r_cidr_split(PG_FUNCTION_ARGS);
+Datum ip6r_cidr_split_array(PG_FUNCTION_ARGS);
+Datum ip6r_bounds_trans(PG_FUNCTION_ARGS);
+Datum ip6r_bounds_trans_ip6(PG_FUNCTION_ARGS);
 Datum ip6_netmask(PG_FUNCTION_ARGS);
 Datum ip6_net_lower(PG_FUNCTION_ARGS);
 Datum ip6_net_upper(PG_FUNCTION_ARGS);
@@ -222,6 +297,7 @@ Datum ip6r_union(PG_FUNCTION_ARGS);
 Datum ip6r_inter(PG_FUNCTION_ARGS);
 Datum ip6r_size(PG_FUNCTION_ARGS);
 Datum ip6r_size_exact(PG_FUNCTION_ARGS);
+Datum ip6r_lpm_distance(PG_FUNCTION_ARGS);
 Datum ip6r_prefixlen(PG_FUNCTION_ARGS);
 Datum ip6r_cmp(PG_FUNCTION_ARGS);
 Datum ip6_cmp(PG_FUNCTION_ARGS);
@@ -245,6 +321,8 @@ Datum ipaddr_cast_from_bit(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_to_bit(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_from_bytea(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_to_bytea(PG_FUNCTION_ARGS);
+Datum ipaddr_sortkey(PG_FUNCTION_ARGS);
+Datum ipaddr_from_sortkey(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_from_inet(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_to_cidr(PG_FUNCTION_ARGS);
 Datum ipaddr_cast_to_numeric(PG_FUNCTION_ARGS);
@@ -286,6 +364,8 @@ Datum iprange_cast_from_text(PG_FUNCTION_ARGS);
 Datum iprange_cast_from_cidr(PG_FUNCTION_ARGS);
 Datum iprange_cast_to_cidr(PG_FUNCTION_ARGS);
 Datum iprange_cast_to_bit(PG_FUNCTION_ARGS);
+Datum iprange_sortkey(PG_FUNCTION_ARGS);
+Datum iprange_from_sortkey(PG_FUNCTION_ARGS);
 Datum iprange_cast_from_ip4(PG_FUNCTION_ARGS);
 Datum iprange_cast_from_ip6(PG_FUNCTION_ARGS);
 Datum iprange_cast_from_ipaddr(PG_FUNCTION_ARGS);
@@ -307,6 +387,22 @@ Datum iprange_upper(PG_FUNCTION_ARGS);
 Datum iprange_is_cidr(PG_FUNCTION_ARGS);
 Datum iprange_family(PG_FUNCTION_ARGS);
 Datum iprange_cidr_split(PG_FUNCTION_ARGS);
+Datum iprange_cidr_split_array(PG_FUNCTION_ARGS);
+Datum iprange_cidr_agg_trans(PG_FUNCTION_ARGS);
+Datum iprange_cidr_agg_final(PG_FUNCTION_ARGS);
+Datum iprange_cidr_agg_combine(PG_FUNCTION_ARGS);
+Datum iprange_cidr_agg_serial(PG_FUNCTION_ARGS);
+Datum iprange_cidr_agg_deserial(PG_FUNCTION_ARGS);
+Datum iprange_union_size_final(PG_FUNCTION_ARGS);
+Datum iprange_disjoint_final(PG_FUNCTION_ARGS);
+Datum iprange_range_gaps(PG_FUNCTION_ARGS);
+Datum iprange_cidr_gaps(PG_FUNCTION_ARGS);
+Datum iprange_bounds_trans(PG_FUNCTION_ARGS);
+Datum iprange_bounds_trans_ip(PG_FUNCTION_ARGS);
+Datum iprange_bounds_final(PG_FUNCTION_ARGS);
+Datum iprange_bounds_combine(PG_FUNCTION_ARGS);
+Datum iprange_bounds_serial(PG_FUNCTION_ARGS);
+Datum iprange_bounds_deserial(PG_FUNCTION_ARGS);
 Datum iprange_lt(PG_FUNCTION_ARGS);
 Datum iprange_le(PG_FUNCTION_ARGS);
 Datum iprange_gt(PG_FUNCTION_ARGS);
@@ -327,8 +423,138 @@ Datum iprange_ip6_contained_by(PG_FUNCTION_ARGS);
 Datum iprange_union(PG_FUNCTION_ARGS);
 Datum iprange_inter(PG_FUNCTION_ARGS);
 Datum iprange_size(PG_FUNCTION_ARGS);
+Datum iprange_lpm_distance(PG_FUNCTION_ARGS);
 Datum iprange_size_exact(PG_FUNCTION_ARGS);
 Datum iprange_prefixlen(PG_FUNCTION_ARGS);
 Datum iprange_cmp(PG_FUNCTION_ARGS);
 
+Datum ip4set_in(PG_FUNCTION_ARGS);
+Datum ip4set_out(PG_FUNCTION_ARGS);
+Datum ip4set_recv(PG_FUNCTION_ARGS);
+Datum ip4set_send(PG_FUNCTION_ARGS);
+Datum ip4set_from_ip4(PG_FUNCTION_ARGS);
+Datum ip4set_from_ip4r(PG_FUNCTION_ARGS);
+Datum ip4set_cardinality(PG_FUNCTION_ARGS);
+Datum ip4set_ranges(PG_FUNCTION_ARGS);
+Datum ip4set_union(PG_FUNCTION_ARGS);
+Datum ip4set_inter(PG_FUNCTION_ARGS);
+Datum ip4set_minus(PG_FUNCTION_ARGS);
+Datum ip4set_eq(PG_FUNCTION_ARGS);
+Datum ip4set_neq(PG_FUNCTION_ARGS);
+Datum ip4set_contains_ip4(PG_FUNCTION_ARGS);
+Datum ip4set_ip4_contained_by(PG_FUNCTION_ARGS);
+Datum ip4set_contains_ip4r(PG_FUNCTION_ARGS);
+Datum ip4set_ip4r_contained_by(PG_FUNCTION_ARGS);
+Datum ip4set_overlaps_ip4r(PG_FUNCTION_ARGS);
+Datum ip4set_ip4r_overlaps(PG_FUNCTION_ARGS);
+Datum ip4set_contains(PG_FUNCTION_ARGS);
+Datum ip4set_contained_by(PG_FUNCTION_ARGS);
+Datum ip4set_overlaps(PG_FUNCTION_ARGS);
+Datum ip4set_agg_trans_ip4(PG_FUNCTION_ARGS);
+Datum ip4set_agg_trans_ip4r(PG_FUNCTION_ARGS);
+Datum ip4set_agg_trans_ip4set(PG_FUNCTION_ARGS);
+Datum ip4set_agg_final(PG_FUNCTION_ARGS);
+Datum ip4set_agg_combine(PG_FUNCTION_ARGS);
+Datum ip4set_agg_serial(PG_FUNCTION_ARGS);
+Datum ip4set_agg_deserial(PG_FUNCTION_ARGS);
+
+Datum ipmap_in(PG_FUNCTION_ARGS);
+Datum ipmap_out(PG_FUNCTION_ARGS);
+Datum ipmap_recv(PG_FUNCTION_ARGS);
+Datum ipmap_send(PG_FUNCTION_ARGS);
+Datum ipmap_size(PG_FUNCTION_ARGS);
+Datum ipmap_lookup_ip4(PG_FUNCTION_ARGS);
+Datum ipmap_lookup_ip6(PG_FUNCTION_ARGS);
+Datum ipmap_lookup_ipaddr(PG_FUNCTION_ARGS);
+Datum ipmap_agg_trans(PG_FUNCTION_ARGS);
+Datum ipmap_agg_final(PG_FUNCTION_ARGS);
+Datum ipmap_agg_combine(PG_FUNCTION_ARGS);
+Datum ipmap_agg_serial(PG_FUNCTION_ARGS);
+Datum ipmap_agg_deserial(PG_FUNCTION_ARGS);
+
+Datum ipaddr_fixed_in(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_out(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_recv(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_send(PG_FUNCTION_ARGS);
+Datum iprange_fixed_in(PG_FUNCTION_ARGS);
+Datum iprange_fixed_out(PG_FUNCTION_ARGS);
+Datum iprange_fixed_recv(PG_FUNCTION_ARGS);
+Datum iprange_fixed_send(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_cast_from_ipaddr(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_cast_to_ipaddr(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_cast_from_ip4(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_cast_from_ip6(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cast_from_iprange(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cast_to_iprange(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cast_from_ip4r(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cast_from_ip6r(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cast_from_ipaddr_fixed(PG_FUNCTION_ARGS);
+Datum iprange_cast_from_ipaddr_fixed(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_hash(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_hash_extended(PG_FUNCTION_ARGS);
+Datum iprange_fixed_hash(PG_FUNCTION_ARGS);
+Datum iprange_fixed_hash_extended(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_lt(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_le(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_gt(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_ge(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_eq(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_neq(PG_FUNCTION_ARGS);
+Datum ipaddr_fixed_cmp(PG_FUNCTION_ARGS);
+Datum iprange_fixed_lt(PG_FUNCTION_ARGS);
+Datum iprange_fixed_le(PG_FUNCTION_ARGS);
+Datum iprange_fixed_gt(PG_FUNCTION_ARGS);
+Datum iprange_fixed_ge(PG_FUNCTION_ARGS);
+Datum iprange_fixed_eq(PG_FUNCTION_ARGS);
+Datum iprange_fixed_neq(PG_FUNCTION_ARGS);
+Datum iprange_fixed_cmp(PG_FUNCTION_ARGS);
+Datum iprange_fixed_overlaps(PG_FUNCTION_ARGS);
+Datum iprange_fixed_contains(PG_FUNCTION_ARGS);
+Datum iprange_fixed_contains_strict(PG_FUNCTION_ARGS);
+Datum iprange_fixed_contained_by(PG_FUNCTION_ARGS);
+Datum iprange_fixed_contained_by_strict(PG_FUNCTION_ARGS);
+
+/* the gist consistent functions identify our opclasses to ip_gist_stats */
+Datum gip4r_consistent(PG_FUNCTION_ARGS);
+Datum gip6r_consistent(PG_FUNCTION_ARGS);
+Datum gipr_consistent(PG_FUNCTION_ARGS);
+Datum gipr_fixed_consistent(PG_FUNCTION_ARGS);
+Datum ip_gist_stats(PG_FUNCTION_ARGS);
+Datum ip4_prefix8_hash(PG_FUNCTION_ARGS);
+Datum ip4_prefix8_hash_extended(PG_FUNCTION_ARGS);
+Datum ip4_prefix16_hash(PG_FUNCTION_ARGS);
+Datum ip4_prefix16_hash_extended(PG_FUNCTION_ARGS);
+Datum ip4_prefix24_hash(PG_FUNCTION_ARGS);
+Datum ip4_prefix24_hash_extended(PG_FUNCTION_ARGS);
+Datum ip6_prefix32_hash(PG_FUNCTION_ARGS);
+Datum ip6_prefix32_hash_extended(PG_FUNCTION_ARGS);
+Datum ip6_prefix48_hash(PG_FUNCTION_ARGS);
+Datum ip6_prefix48_hash_extended(PG_FUNCTION_ARGS);
+Datum ip6_prefix64_hash(PG_FUNCTION_ARGS);
+Datum ip6_prefix64_hash_extended(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix16_32_hash(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix16_32_hash_extended(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix24_48_hash(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix24_48_hash_extended(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix24_64_hash(PG_FUNCTION_ARGS);
+Datum ipaddr_prefix24_64_hash_extended(PG_FUNCTION_ARGS);
+
+Datum ip4r_stat(PG_FUNCTION_ARGS);
+Datum ip4r_stat_reset(PG_FUNCTION_ARGS);
+Datum ip_gist_scan_stats(PG_FUNCTION_ARGS);
+Datum ip_gist_scan_stats_reset(PG_FUNCTION_ARGS);
+Datum ip_extract(PG_FUNCTION_ARGS);
+Datum ip_extract_array(PG_FUNCTION_ARGS);
+Datum iprange_load(PG_FUNCTION_ARGS);
+
+Datum ip4_array_contained_count(PG_FUNCTION_ARGS);
+Datum ip4_array_contained_mask(PG_FUNCTION_ARGS);
+Datum ip4_array_contained_filter(PG_FUNCTION_ARGS);
+Datum ip6_array_contained_count(PG_FUNCTION_ARGS);
+Datum ip6_array_contained_mask(PG_FUNCTION_ARGS);
+Datum ip6_array_contained_filter(PG_FUNCTION_ARGS);
+Datum ipaddr_array_contained_count(PG_FUNCTION_ARGS);
+Datum ipaddr_array_contained_mask(PG_FUNCTION_ARGS);
+Datum ipaddr_array_contained_filter(PG_FUNCTION_ARGS);
+
 #endif
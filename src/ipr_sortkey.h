@@ -0,0 +1,139 @@
+/* ipr_sortkey.h */
+#ifndef IPR_SORTKEY_H
+#define IPR_SORTKEY_H
+
+/*
+ * Byte-comparable encodings of ipaddress and iprange values.
+ *
+ * A key is one family byte (0 for the universal range, otherwise 4 or 6)
+ * followed by the address, or by the lower and then the upper bound of the
+ * range, each in big-endian order. Keys of the same family have the same
+ * length, so comparing two keys by memcmp (and then by length, as bytea
+ * does) gives exactly the ordering of the ipaddress and iprange btree
+ * opclasses. Stored as bytea, keys therefore get memcmp comparisons,
+ * abbreviated keys in sorts and btree deduplication from the core code.
+ *
+ * The key format is stored in indexes and must not change.
+ */
+
+#define IPR_SORTKEY_MAX (1 + sizeof(IP6R))
+
+static inline
+void ipr_sortkey_put32(unsigned char *p, uint32 v)
+{
+	p[0] = (unsigned char) (v >> 24);
+	p[1] = (unsigned char) (v >> 16);
+	p[2] = (unsigned char) (v >> 8);
+	p[3] = (unsigned char) v;
+}
+
+static inline
+void ipr_sortkey_put64(unsigned char *p, uint64 v)
+{
+	ipr_sortkey_put32(p, (uint32) (v >> 32));
+	ipr_sortkey_put32(p + 4, (uint32) v);
+}
+
+static inline
+uint32 ipr_sortkey_get32(const unsigned char *p)
+{
+	return ((uint32) p[0] << 24) | ((uint32) p[1] << 16) | ((uint32) p[2] << 8) | p[3];
+}
+
+static inline
+uint64 ipr_sortkey_get64(const unsigned char *p)
+{
+	return ((uint64) ipr_sortkey_get32(p) << 32) | ipr_sortkey_get32(p + 4);
+}
+
+/* these return the key length; OUT must have room for IPR_SORTKEY_MAX */
+
+static inline
+int ip_sortkey_encode(int af, IP *ip, unsigned char *out)
+{
+	if (af == PGSQL_AF_INET)
+	{
+		out[0] = 4;
+		ipr_sortkey_put32(out + 1, ip->ip4);
+		return 1 + sizeof(IP4);
+	}
+
+	out[0] = 6;
+	ipr_sortkey_put64(out + 1, ip->ip6.bits[0]);
+	ipr_sortkey_put64(out + 9, ip->ip6.bits[1]);
+	return 1 + sizeof(IP6);
+}
+
+static inline
+int ipr_sortkey_encode(int af, IPR *ipr, unsigned char *out)
+{
+	switch (af)
+	{
+		case PGSQL_AF_INET:
+			out[0] = 4;
+			ipr_sortkey_put32(out + 1, ipr->ip4r.lower);
+			ipr_sortkey_put32(out + 5, ipr->ip4r.upper);
+			return 1 + sizeof(IP4R);
+
+		case PGSQL_AF_INET6:
+			out[0] = 6;
+			ipr_sortkey_put64(out + 1, ipr->ip6r.lower.bits[0]);
+			ipr_sortkey_put64(out + 9, ipr->ip6r.lower.bits[1]);
+			ipr_sortkey_put64(out + 17, ipr->ip6r.upper.bits[0]);
+			ipr_sortkey_put64(out + 25, ipr->ip6r.upper.bits[1]);
+			return 1 + sizeof(IP6R);
+
+		default:
+			out[0] = 0;
+			return 1;
+	}
+}
+
+/* these return the address family, or -1 if the key is invalid */
+
+static inline
+int ip_sortkey_decode(const unsigned char *p, int len, IP *out)
+{
+	if (len == 1 + sizeof(IP4) && p[0] == 4)
+	{
+		out->ip4 = ipr_sortkey_get32(p + 1);
+		return PGSQL_AF_INET;
+	}
+	if (len == 1 + sizeof(IP6) && p[0] == 6)
+	{
+		out->ip6.bits[0] = ipr_sortkey_get64(p + 1);
+		out->ip6.bits[1] = ipr_sortkey_get64(p + 9);
+		return PGSQL_AF_INET6;
+	}
+	return -1;
+}
+
+static inline
+int ipr_sortkey_decode(const unsigned char *p, int len, IPR *out)
+{
+	if (len == 1 && p[0] == 0)
+		return 0;
+	if (len == 1 + sizeof(IP4R) && p[0] == 4)
+	{
+		out->ip4r.lower = ipr_sortkey_get32(p + 1);
+		out->ip4r.upper = ipr_sortkey_get32(p + 5);
+		if (out->ip4r.lower > out->ip4r.upper)
+			return -1;
+		return PGSQL_AF_INET;
+	}
+	if (len == 1 + sizeof(IP6R) && p[0] == 6)
+	{
+		out->ip6r.lower.bits[0] = ipr_sortkey_get64(p + 1);
+		out->ip6r.lower.bits[1] = ipr_sortkey_get64(p + 9);
+		out->ip6r.upper.bits[0] = ipr_sortkey_get64(p + 17);
+		out->ip6r.upper.bits[1] = ipr_sortkey_get64(p + 25);
+		/* the encoding is big-endian, so memcmp orders the bounds */
+		if (memcmp(p + 1, p + 17, sizeof(IP6)) > 0)
+			return -1;
+		return PGSQL_AF_INET6;
+	}
+	return -1;
+}
+
+#endif
+/* end */
@@ -0,0 +1,97 @@
+/* ipr_stats.h */
+#ifndef IPR_STATS_H
+#define IPR_STATS_H
+
+/*
+ * Call counters for the ip4r_stat view (ipstats.c).
+ *
+ * Instrumented functions are defined with IPR_STAT_FUNCTION in place of
+ * the usual PG_FUNCTION_INFO_V1 header. The exported function checks
+ * ipr_track_stats and, when it is off, just calls the body; the only cost
+ * is then one test of a global. When it is on, the call goes through
+ * ipr_stat_call, which counts it (and ROWS, which may use fcinfo) in
+ * backend-local counters that are added to shared memory in batches.
+ */
+
+typedef enum IPR_StatOp
+{
+	IPR_STAT_PARSE,
+	IPR_STAT_FORMAT,
+	IPR_STAT_COMPARE,
+	IPR_STAT_HASH,
+	/* the gist methods only exist for the range types */
+	IPR_STAT_GIST_CONSISTENT,
+	IPR_STAT_GIST_UNION,
+	IPR_STAT_GIST_COMPRESS,
+	IPR_STAT_GIST_DECOMPRESS,
+	IPR_STAT_GIST_PENALTY,
+	IPR_STAT_GIST_PICKSPLIT,
+	IPR_STAT_GIST_SAME,
+	IPR_STAT_GIST_FETCH,
+	IPR_STAT_NOPS
+} IPR_StatOp;
+
+typedef enum IPR_StatType
+{
+	IPR_STAT_IP4,
+	IPR_STAT_IP4R,
+	IPR_STAT_IP6,
+	IPR_STAT_IP6R,
+	IPR_STAT_IPADDRESS,
+	IPR_STAT_IPRANGE,
+	IPR_STAT_NTYPES
+} IPR_StatType;
+
+extern bool ipr_track_stats;
+
+Datum ipr_stat_call(PGFunction fn, FunctionCallInfo fcinfo,
+					IPR_StatOp op, IPR_StatType type, int64 rows);
+
+void ipr_stats_init(void);
+
+/*
+ * Session-local counts of gist consistent calls, for ip_gist_scan_stats.
+ * The consistent functions report each call when ip4r.track_gist_scans is
+ * set; PAGE is the page holding the entry, used to count pages visited.
+ */
+
+typedef enum IPR_GistOpclass
+{
+	IPR_GIST_IP4R,
+	IPR_GIST_IP6R,
+	IPR_GIST_IPRANGE,
+	IPR_GIST_IPRANGE_FIXED,
+	IPR_GIST_NOPCLASSES
+} IPR_GistOpclass;
+
+/* strategies 1..6 are >>=, <<=, >>, <<, &&, = in every opclass */
+#define IPR_GIST_NSTRATEGIES 6
+
+extern bool ipr_track_gist_scans;
+
+void ipr_gist_scan_count(IPR_GistOpclass opclass, uint16 strategy,
+						 bool leaf, const void *page,
+						 bool match, bool recheck);
+
+#ifndef likely
+#define likely(x_) (x_)
+#endif
+#ifndef unlikely
+#define unlikely(x_) (x_)
+#endif
+
+#define IPR_STAT_FUNCTION(name_, op_, type_, rows_) \
+	static Datum name_##_body(FunctionCallInfo fcinfo); \
+	PG_FUNCTION_INFO_V1(name_); \
+	Datum \
+	name_(PG_FUNCTION_ARGS) \
+	{ \
+		if (likely(!ipr_track_stats)) \
+			return name_##_body(fcinfo); \
+		return ipr_stat_call(name_##_body, fcinfo, op_, type_, (rows_)); \
+	} \
+	static Datum \
+	name_##_body(FunctionCallInfo fcinfo)
+
+#endif
+/* end */
@@ -7,15 +7,19 @@
 
 #include "fmgr.h"
 #include "funcapi.h"
+#include "miscadmin.h"
 
 #include "access/gist.h"
 #include "access/hash.h"
 #include "access/skey.h"
 #include "libpq/pqformat.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
+#include "utils/lsyscache.h"
 #include "utils/numeric.h"
 #include "utils/palloc.h"
+#include "utils/tuplestore.h"
 #include "utils/varbit.h"
 
 #include "ipr_internal.h"
@@ -168,9 +172,7 @@ IPR_P ipr_pack(int af, IPR *val)
 
 /*---- ipr ----*/
 
-PG_FUNCTION_INFO_V1(iprange_in);
-Datum
-iprange_in(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(iprange_in, IPR_STAT_PARSE, IPR_STAT_IPRANGE, 1)
 {
 	char *str = PG_GETARG_CSTRING(0);
 	IPR ipr;
@@ -197,9 +199,7 @@ iprange_in(PG_FUNCTION_ARGS)
 	}
 }
 
-PG_FUNCTION_INFO_V1(iprange_out);
-Datum
-iprange_out(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(iprange_out, IPR_STAT_FORMAT, IPR_STAT_IPRANGE, 1)
 {
 	IPR_P *iprp = PG_GETARG_IPR_P(0);
 	IPR ipr;
@@ -225,6 +225,154 @@ iprange_out(PG_FUNCTION_ARGS)
 	}
 }
 
+/*
+ * The compact binary format, sent when ip4r.binary_format is "compact",
+ * drops the inet-style header in favour of a single byte that is the
+ * prefix length of a CIDR range or 255 otherwise, followed by as much of
+ * the address as the packed form stores, in network byte order:
+ *
+ *	1 byte					 - special 'match all' range (tag 0)
+ *	1 + 4 bytes				 - IPv4 cidr range
+ *	1 + 8 bytes				 - IPv4 range (tag 255), or IPv6 cidr /64 or shorter
+ *	1 + 16 bytes			 - IPv6 cidr range /65 or longer
+ *	1 + 32 bytes			 - arbitrary IPv6 range (tag 255)
+ *
+ * Compact values are always of odd length and standard ones of a multiple
+ * of 4 bytes, so input accepts either format without being told which.
+ */
+
+static Datum
+iprange_recv_compact(FunctionCallInfo fcinfo, StringInfo buf, int nbytes)
+{
+	IPR ipr;
+	unsigned bits = pq_getmsgbyte(buf);
+
+	switch (nbytes)
+	{
+		case 1:
+			if (bits == 0)
+				PG_RETURN_IPR_P(ipr_pack(0,NULL));
+			break;
+
+		case 1+sizeof(IP4):
+			if (bits <= ipr_af_maxbits(PGSQL_AF_INET))
+			{
+				ipr.ip4r.lower = (IP4) pq_getmsgint(buf, sizeof(IP4));
+				ipr.ip4r.upper = ipr.ip4r.lower | hostmask(bits);
+				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET,&ipr));
+			}
+			break;
+
+		case 1+sizeof(IP4R):	/* also 1+sizeof(uint64) */
+			if (bits == 255)
+			{
+				ipr.ip4r.lower = (IP4) pq_getmsgint(buf, sizeof(IP4));
+				ipr.ip4r.upper = (IP4) pq_getmsgint(buf, sizeof(IP4));
+				if (ipr.ip4r.upper < ipr.ip4r.lower)
+				{
+					IP4 t = ipr.ip4r.upper;
+					ipr.ip4r.upper = ipr.ip4r.lower;
+					ipr.ip4r.lower = t;
+				}
+				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET,&ipr));
+			}
+			else if (bits <= 64)
+			{
+				ipr.ip6r.lower.bits[0] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.lower.bits[1] = 0;
+				ipr.ip6r.upper.bits[0] = ipr.ip6r.lower.bits[0] | hostmask6_hi(bits);
+				ipr.ip6r.upper.bits[1] = ~(uint64)0;
+				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET6,&ipr));
+			}
+			break;
+
+		case 1+sizeof(IP6):
+			if (bits <= ipr_af_maxbits(PGSQL_AF_INET6))
+			{
+				ipr.ip6r.lower.bits[0] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.lower.bits[1] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.upper.bits[0] = ipr.ip6r.lower.bits[0] | hostmask6_hi(bits);
+				ipr.ip6r.upper.bits[1] = ipr.ip6r.lower.bits[1] | hostmask6_lo(bits);
+				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET6,&ipr));
+			}
+			break;
+
+		case 1+sizeof(IP6R):
+			if (bits == 255)
+			{
+				ipr.ip6r.lower.bits[0] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.lower.bits[1] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.upper.bits[0] = (uint64) pq_getmsgint64(buf);
+				ipr.ip6r.upper.bits[1] = (uint64) pq_getmsgint64(buf);
+				if (ip6_lessthan(&ipr.ip6r.upper, &ipr.ip6r.lower))
+				{
+					IP6 t = ipr.ip6r.upper;
+					ipr.ip6r.upper = ipr.ip6r.lower;
+					ipr.ip6r.lower = t;
+				}
+				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET6,&ipr));
+			}
+			break;
+	}
+
+	ereturn(fcinfo->context, (Datum)0,
+			(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+			 errmsg("invalid compact external IPR value")));
+}
+
+static Datum
+iprange_send_compact(int af, IPR *ipr, unsigned bits)
+{
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+
+	switch (af)
+	{
+		case 0:
+			pq_sendbyte(&buf, 0);
+			break;
+
+		case PGSQL_AF_INET:
+			if (bits <= ipr_af_maxbits(PGSQL_AF_INET))
+			{
+				pq_sendbyte(&buf, bits);
+				pq_sendint(&buf, ipr->ip4r.lower, sizeof(IP4));
+			}
+			else
+			{
+				pq_sendbyte(&buf, 255);
+				pq_sendint(&buf, ipr->ip4r.lower, sizeof(IP4));
+				pq_sendint(&buf, ipr->ip4r.upper, sizeof(IP4));
+			}
+			break;
+
+		case PGSQL_AF_INET6:
+			if (bits <= 64)
+			{
+				pq_sendbyte(&buf, bits);
+				pq_sendint64(&buf, ipr->ip6r.lower.bits[0]);
+			}
+			else if (bits <= ipr_af_maxbits(PGSQL_AF_INET6))
+			{
+				pq_sendbyte(&buf, bits);
+				pq_sendint64(&buf, ipr->ip6r.lower.bits[0]);
+				pq_sendint64(&buf, ipr->ip6r.lower.bits[1]);
+			}
+			else
+			{
+				pq_sendbyte(&buf, 255);
+				pq_sendint64(&buf, ipr->ip6r.lower.bits[0]);
+				pq_sendint64(&buf, ipr->ip6r.lower.bits[1]);
+				pq_sendint64(&buf, ipr->ip6r.upper.bits[0]);
+				pq_sendint64(&buf, ipr->ip6r.upper.bits[1]);
+			}
+			break;
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
 PG_FUNCTION_INFO_V1(iprange_recv);
 Datum
 iprange_recv(PG_FUNCTION_ARGS)
@@ -233,6 +381,9 @@ iprange_recv(PG_FUNCTION_ARGS)
 	IPR ipr;
 	unsigned af, bits, nbytes;
 
+	if ((buf->len - buf->cursor) % 2 != 0)
+		return iprange_recv_compact(fcinfo, buf, buf->len - buf->cursor);
+
 	/*
 	 * This isn't quite the same format as inet/cidr but we keep reasonably
 	 * close for no very good reason.
@@ -344,6 +495,9 @@ iprange_send(PG_FUNCTION_ARGS)
 			break;
 	}
 
+	if (ipr_binary_format == IPR_BINARY_COMPACT)
+		return iprange_send_compact(af, &ipr, bits);
+
 	pq_begintypsend(&buf);
 	pq_sendbyte(&buf, af);
 	pq_sendbyte(&buf, (int8) bits);
@@ -419,39 +573,52 @@ iprange_hash(PG_FUNCTION_ARGS)
 /* below are the fixed hash functions
  */
 
-PG_FUNCTION_INFO_V1(iprange_hash_new);
-Datum
-iprange_hash_new(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(iprange_hash_new, IPR_STAT_HASH, IPR_STAT_IPRANGE, 1)
 {
 	IPR_P arg1 = PG_GETARG_IPR_P(0);
 	IPR tmp;
 	uint32 vsize = VARSIZE_ANY_EXHDR(arg1);
 
-	if (vsize <= sizeof(IP4R) || vsize == sizeof(IP6R))
-		return hash_any((void *) VARDATA_ANY(arg1), vsize);
+	/*
+	 * The unpacked value is bytewise the same as the packed one except for
+	 * ipv6 cidr ranges, which were always hashed unpacked; so hashing the
+	 * aligned copy changes no hash values.
+	 */
+	switch (ipr_unpack(arg1,&tmp))
+	{
+		case 0:
+			return hash_any((void *) VARDATA_ANY(arg1), vsize);
 
-	if (ipr_unpack(arg1,&tmp) != PGSQL_AF_INET6)
-		iprange_internal_error();
+		case PGSQL_AF_INET:
+			PG_RETURN_UINT32(ipr_hash_words(&tmp.ip4r, 2));
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_UINT32(ipr_hash_words(&tmp.ip6r, 8));
+	}
 
-	return hash_any((void *) &tmp, sizeof(IP6R));
+	iprange_internal_error();
 }
 
-PG_FUNCTION_INFO_V1(iprange_hash_extended);
-Datum
-iprange_hash_extended(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(iprange_hash_extended, IPR_STAT_HASH, IPR_STAT_IPRANGE, 1)
 {
 	IPR_P arg1 = PG_GETARG_IPR_P(0);
 	IPR tmp;
 	uint32 vsize = VARSIZE_ANY_EXHDR(arg1);
 	uint32 seed = DatumGetUInt32(PG_GETARG_DATUM(1));
 
-	if (vsize <= sizeof(IP4R) || vsize == sizeof(IP6R))
-		return hash_any_extended((void *) VARDATA_ANY(arg1), vsize, seed);
+	switch (ipr_unpack(arg1,&tmp))
+	{
+		case 0:
+			return hash_any_extended((void *) VARDATA_ANY(arg1), vsize, seed);
 
-	if (ipr_unpack(arg1,&tmp) != PGSQL_AF_INET6)
-		iprange_internal_error();
+		case PGSQL_AF_INET:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&tmp.ip4r, 2, seed));
+
+		case PGSQL_AF_INET6:
+			PG_RETURN_INT64((int64) ipr_hash_words_extended(&tmp.ip6r, 8, seed));
+	}
 
-	return hash_any_extended((void *) &tmp, sizeof(IP6R), seed);
+	iprange_internal_error();
 }
 
 PG_FUNCTION_INFO_V1(iprange_cast_to_text);
@@ -814,6 +981,35 @@ iprange_cast_to_bit(PG_FUNCTION_ARGS)
 	PG_RETURN_VARBIT_P(res);
 }
 
+PG_FUNCTION_INFO_V1(iprange_sortkey);
+Datum
+iprange_sortkey(PG_FUNCTION_ARGS)
+{
+	IPR_P iprp = PG_GETARG_IPR_P(0);
+	IPR ipr;
+	int af = ipr_unpack(iprp, &ipr);
+	bytea *res = palloc(VARHDRSZ + IPR_SORTKEY_MAX);
+
+	SET_VARSIZE(res, VARHDRSZ + ipr_sortkey_encode(af, &ipr, (unsigned char *) VARDATA(res)));
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(iprange_from_sortkey);
+Datum
+iprange_from_sortkey(PG_FUNCTION_ARGS)
+{
+	bytea *val = PG_GETARG_BYTEA_PP(0);
+	IPR ipr;
+	int af = ipr_sortkey_decode((unsigned char *) VARDATA_ANY(val), VARSIZE_ANY_EXHDR(val), &ipr);
+
+	if (af < 0)
+		ereturn(fcinfo->context, (Datum)0,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid sort key value for conversion to IPRANGE")));
+
+	PG_RETURN_IPR_P(ipr_pack(af, &ipr));
+}
+
 
 static
 Datum
@@ -1113,84 +1309,852 @@ iprange_family(PG_FUNCTION_ARGS)
 	}
 }
 
+/*
+ * Result helpers for functions that produce all their output in one go;
+ * these are shared with ip4r.c and ip6r.c.
+ *
+ * Set-returning functions use materialize mode, which avoids a round trip
+ * through the executor for every row: ipr_materialize_init sets up the
+ * result tuplestore, and ipr_materialize_value adds a row to it. Values
+ * are copied, so they need not outlive the call. ipr_return_materialized
+ * does the whole thing for a result that's already in an array.
+ */
+
+void
+ipr_materialize_init(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+
+	if (!rsinfo || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize) || !rsinfo->expectedDesc)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setDesc = CreateTupleDescCopy(rsinfo->expectedDesc);
+	rsinfo->setResult = tuplestore_begin_heap((rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+											  false, work_mem);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+void
+ipr_materialize_value(FunctionCallInfo fcinfo, Datum value)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	bool isnull = false;
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, &value, &isnull);
+}
+
+Datum
+ipr_return_materialized(FunctionCallInfo fcinfo, Datum *values, int nvalues)
+{
+	int i;
+
+	ipr_materialize_init(fcinfo);
+
+	for (i = 0; i < nvalues; ++i)
+		ipr_materialize_value(fcinfo, values[i]);
+
+	return (Datum) 0;
+}
+
+/*
+ * ipr_return_array returns the values as an array of the function's
+ * declared result type. The element type details are cached in fn_extra.
+ */
+
+typedef struct IPR_ArrayElemType {
+	Oid elemtype;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+} IPR_ArrayElemType;
+
+Datum
+ipr_return_array(FunctionCallInfo fcinfo, Datum *values, int nvalues)
+{
+	IPR_ArrayElemType *et = fcinfo->flinfo->fn_extra;
+
+	if (!et)
+	{
+		Oid elemtype = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+
+		if (!OidIsValid(elemtype))
+			elog(ERROR, "could not determine array element type");
+
+		et = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(IPR_ArrayElemType));
+		et->elemtype = elemtype;
+		get_typlenbyvalalign(elemtype, &et->typlen, &et->typbyval, &et->typalign);
+		fcinfo->flinfo->fn_extra = et;
+	}
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(values, nvalues, et->elemtype,
+										  et->typlen, et->typbyval, et->typalign));
+}
+
 /*
  * Decompose an arbitrary range into CIDRs
+ *
+ * The universal range '-' splits into '0.0.0.0/0' and '::/0'.
  */
+
+static
+int iprange_split_cidrs(IPR_P in, Datum *values)
+{
+	IPR ipr;
+	int af = ipr_unpack(in, &ipr);
+	int n = 0;
+	int i;
+
+	switch (af)
+	{
+		case 0:
+			ipr.ip4r.lower = netmask(0);
+			ipr.ip4r.upper = hostmask(0);
+			values[n++] = IPR_PGetDatum(ipr_pack(PGSQL_AF_INET, &ipr));
+			ipr.ip6r.lower.bits[0] = netmask6_hi(0);
+			ipr.ip6r.lower.bits[1] = netmask6_lo(0);
+			ipr.ip6r.upper.bits[0] = hostmask6_hi(0);
+			ipr.ip6r.upper.bits[1] = hostmask6_lo(0);
+			values[n++] = IPR_PGetDatum(ipr_pack(PGSQL_AF_INET6, &ipr));
+			break;
+
+		case PGSQL_AF_INET:
+			{
+				IP4R res[IP4R_MAX_CIDRS];
+
+				n = ip4r_split_cidrs(&ipr.ip4r, res);
+				for (i = 0; i < n; ++i)
+				{
+					ipr.ip4r = res[i];
+					values[i] = IPR_PGetDatum(ipr_pack(af, &ipr));
+				}
+			}
+			break;
+
+		case PGSQL_AF_INET6:
+			{
+				IP6R res[IP6R_MAX_CIDRS];
+
+				n = ip6r_split_cidrs(&ipr.ip6r, res);
+				for (i = 0; i < n; ++i)
+				{
+					ipr.ip6r = res[i];
+					values[i] = IPR_PGetDatum(ipr_pack(af, &ipr));
+				}
+			}
+			break;
+
+		default:
+			iprange_internal_error();
+	}
+
+	return n;
+}
+
 PG_FUNCTION_INFO_V1(iprange_cidr_split);
 Datum
 iprange_cidr_split(PG_FUNCTION_ARGS)
 {
-	FuncCallContext *funcctx;
-	IPR *val;
-	IPR res;
+	Datum values[IP6R_MAX_CIDRS];
+	int n = iprange_split_cidrs(PG_GETARG_IPR_P(0), values);
+
+	return ipr_return_materialized(fcinfo, values, n);
+}
+
+PG_FUNCTION_INFO_V1(iprange_cidr_split_array);
+Datum
+iprange_cidr_split_array(PG_FUNCTION_ARGS)
+{
+	Datum values[IP6R_MAX_CIDRS];
+	int n = iprange_split_cidrs(PG_GETARG_IPR_P(0), values);
+
+	return ipr_return_array(fcinfo, values, n);
+}
+
+/*
+ * cidr_split_agg: reduce a set of ranges, which may overlap, to the minimal
+ * list of CIDRs covering their union, returned as an array in address order
+ * (v4 first).
+ *
+ * The state is a list of ranges per family. When a list fills up, it is
+ * sorted and merged in place before growing it, so memory use is bounded by
+ * the size of the union rather than by the number of input rows. Merging
+ * notes whether any two inputs actually overlapped, for disjoint_agg.
+ */
+
+typedef struct IPR_CidrAggState {
+	uint32 n4;
+	uint32 max4;
+	uint32 n6;
+	uint32 max6;
+	IP4R *r4;
+	IP6R *r6;
+	bool overlap;
+} IPR_CidrAggState;
+
+static int
+iprange_cidr_agg_cmp4(const void *a, const void *b)
+{
+	return ip4_compare(((const IP4R *) a)->lower, ((const IP4R *) b)->lower);
+}
+
+static int
+iprange_cidr_agg_cmp6(const void *a, const void *b)
+{
+	return ip6_compare(&((IP6R *) a)->lower, &((IP6R *) b)->lower);
+}
+
+/* sort and merge overlapping or adjacent ranges */
+
+static
+void iprange_cidr_agg_compact(IPR_CidrAggState *state)
+{
+	uint32 i;
+	uint32 n;
+
+	if (state->n4 > 1)
+	{
+		IP4R *r = state->r4;
+
+		qsort(r, state->n4, sizeof(IP4R), iprange_cidr_agg_cmp4);
+		for (i = 1, n = 0; i < state->n4; ++i)
+		{
+			if (r[n].upper == ~(IP4)0 || r[i].lower <= r[n].upper + 1)
+			{
+				if (r[i].lower <= r[n].upper)
+					state->overlap = true;
+				if (r[i].upper > r[n].upper)
+					r[n].upper = r[i].upper;
+			}
+			else
+				r[++n] = r[i];
+		}
+		state->n4 = n + 1;
+	}
+
+	if (state->n6 > 1)
+	{
+		IP6R *r = state->r6;
+
+		qsort(r, state->n6, sizeof(IP6R), iprange_cidr_agg_cmp6);
+		for (i = 1, n = 0; i < state->n6; ++i)
+		{
+			IP6 next;
+
+			if ((r[n].upper.bits[0] & r[n].upper.bits[1]) == ~(uint64)0)
+				next = r[n].upper;
+			else
+				ip6_sub_int(&r[n].upper, -1, &next);
+
+			if (ip6_less_eq(&r[i].lower, &next))
+			{
+				if (ip6_less_eq(&r[i].lower, &r[n].upper))
+					state->overlap = true;
+				if (ip6_lessthan(&r[n].upper, &r[i].upper))
+					r[n].upper = r[i].upper;
+			}
+			else
+				r[++n] = r[i];
+		}
+		state->n6 = n + 1;
+	}
+}
+
+static
+IPR_CidrAggState *iprange_cidr_agg_state_new(MemoryContext aggcontext,
+											 uint32 max4, uint32 max6)
+{
+	IPR_CidrAggState *state = MemoryContextAlloc(aggcontext, sizeof(IPR_CidrAggState));
+
+	state->n4 = 0;
+	state->n6 = 0;
+	state->overlap = false;
+	state->max4 = Max(max4, 16);
+	state->max6 = Max(max6, 16);
+	state->r4 = MemoryContextAlloc(aggcontext, state->max4 * sizeof(IP4R));
+	state->r6 = MemoryContextAlloc(aggcontext, state->max6 * sizeof(IP6R));
+
+	return state;
+}
+
+/*
+ * Make room for one more entry; compact first, and grow only if that didn't
+ * free up at least a quarter of the space.
+ */
+
+static
+void iprange_cidr_agg_add4(IPR_CidrAggState *state, IP4R *val)
+{
+	if (state->n4 >= state->max4)
+	{
+		iprange_cidr_agg_compact(state);
+		if (state->n4 >= state->max4 - state->max4 / 4)
+		{
+			state->max4 *= 2;
+			state->r4 = repalloc(state->r4, state->max4 * sizeof(IP4R));
+		}
+	}
+	state->r4[state->n4++] = *val;
+}
+
+static
+void iprange_cidr_agg_add6(IPR_CidrAggState *state, IP6R *val)
+{
+	if (state->n6 >= state->max6)
+	{
+		iprange_cidr_agg_compact(state);
+		if (state->n6 >= state->max6 - state->max6 / 4)
+		{
+			state->max6 *= 2;
+			state->r6 = repalloc(state->r6, state->max6 * sizeof(IP6R));
+		}
+	}
+	state->r6[state->n6++] = *val;
+}
+
+PG_FUNCTION_INFO_V1(iprange_cidr_agg_trans);
+Datum
+iprange_cidr_agg_trans(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IPR_CidrAggState *state;
+	IPR ipr;
 	int af;
 
-	if (SRF_IS_FIRSTCALL())
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "cidr_split_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		state = iprange_cidr_agg_state_new(aggcontext, 0, 0);
+	else
+		state = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	af = ipr_unpack(PG_GETARG_IPR_P(1), &ipr);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+
+	switch (af)
 	{
-		IPR_P *in = PG_GETARG_IPR_P(0);
+		case 0:
+			ipr.ip4r.lower = netmask(0);
+			ipr.ip4r.upper = hostmask(0);
+			iprange_cidr_agg_add4(state, &ipr.ip4r);
+			ipr.ip6r.lower.bits[0] = netmask6_hi(0);
+			ipr.ip6r.lower.bits[1] = netmask6_lo(0);
+			ipr.ip6r.upper.bits[0] = hostmask6_hi(0);
+			ipr.ip6r.upper.bits[1] = hostmask6_lo(0);
+			iprange_cidr_agg_add6(state, &ipr.ip6r);
+			break;
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		val = MemoryContextAlloc(funcctx->multi_call_memory_ctx,
-								 sizeof(IPR));
-		af = ipr_unpack(in, val);
-		funcctx->user_fctx = val;
-		/*
-		 * We abuse max_calls, which is ignored by the api and only exists as
-		 * a convenience variable, to store the current address family. But
-		 * out of sheer aesthetics (and for debugging purposes) we store a
-		 * value that does actually represent a (loose) upper bound on the row
-		 * count.
-		 */
-		funcctx->max_calls = af ? 2*ipr_af_maxbits(af) : 2;
+		case PGSQL_AF_INET:
+			iprange_cidr_agg_add4(state, &ipr.ip4r);
+			break;
+
+		case PGSQL_AF_INET6:
+			iprange_cidr_agg_add6(state, &ipr.ip6r);
+			break;
+
+		default:
+			iprange_internal_error();
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(iprange_cidr_agg_final);
+Datum
+iprange_cidr_agg_final(PG_FUNCTION_ARGS)
+{
+	IPR_CidrAggState *state;
+	IPR ipr;
+	Datum *values;
+	uint32 nvalues = 0;
+	uint32 maxvalues;
+	uint32 i;
+	int j;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "cidr_split_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+
+	/*
+	 * Compacting again is harmless, since the result is the same however
+	 * many times it's done.
+	 */
+	iprange_cidr_agg_compact(state);
+
+	maxvalues = Max(state->n4 + state->n6, 16);
+	values = palloc(maxvalues * sizeof(Datum));
+
+	for (i = 0; i < state->n4; ++i)
+	{
+		IP4R res[IP4R_MAX_CIDRS];
+		int n = ip4r_split_cidrs(&state->r4[i], res);
+
+		if (nvalues + n > maxvalues)
+		{
+			maxvalues = 2 * maxvalues + n;
+			values = repalloc(values, maxvalues * sizeof(Datum));
+		}
+		for (j = 0; j < n; ++j)
+		{
+			ipr.ip4r = res[j];
+			values[nvalues++] = IPR_PGetDatum(ipr_pack(PGSQL_AF_INET, &ipr));
+		}
+	}
+
+	for (i = 0; i < state->n6; ++i)
+	{
+		IP6R res[IP6R_MAX_CIDRS];
+		int n = ip6r_split_cidrs(&state->r6[i], res);
+
+		if (nvalues + n > maxvalues)
+		{
+			maxvalues = 2 * maxvalues + n;
+			values = repalloc(values, maxvalues * sizeof(Datum));
+		}
+		for (j = 0; j < n; ++j)
+		{
+			ipr.ip6r = res[j];
+			values[nvalues++] = IPR_PGetDatum(ipr_pack(PGSQL_AF_INET6, &ipr));
+		}
+	}
+
+	return ipr_return_array(fcinfo, values, nvalues);
+}
+
+PG_FUNCTION_INFO_V1(iprange_cidr_agg_combine);
+Datum
+iprange_cidr_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	IPR_CidrAggState *state1;
+	IPR_CidrAggState *state2;
+	uint32 i;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "cidr_split_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	state2 = (IPR_CidrAggState *) PG_GETARG_POINTER(1);
+
+	if (PG_ARGISNULL(0))
+		state1 = iprange_cidr_agg_state_new(aggcontext, state2->n4, state2->n6);
+	else
+		state1 = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+
+	state1->overlap |= state2->overlap;
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	for (i = 0; i < state2->n4; ++i)
+		iprange_cidr_agg_add4(state1, &state2->r4[i]);
+	for (i = 0; i < state2->n6; ++i)
+		iprange_cidr_agg_add6(state1, &state2->r6[i]);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * the serialized state is the two counts and the overlap flag followed by
+ * the compacted ranges
+ */
+
+PG_FUNCTION_INFO_V1(iprange_cidr_agg_serial);
+Datum
+iprange_cidr_agg_serial(PG_FUNCTION_ARGS)
+{
+	IPR_CidrAggState *state;
+	uint32 overlap;
+	Size len;
+	bytea *res;
+	char *p;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "cidr_split_agg called in non-aggregate context");
+
+	state = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+	iprange_cidr_agg_compact(state);
+
+	len = VARHDRSZ + 3*sizeof(uint32)
+		+ state->n4 * sizeof(IP4R) + state->n6 * sizeof(IP6R);
+	res = palloc(len);
+	SET_VARSIZE(res, len);
+
+	overlap = state->overlap;
+	p = VARDATA(res);
+	memcpy(p, &state->n4, sizeof(uint32));			p += sizeof(uint32);
+	memcpy(p, &state->n6, sizeof(uint32));			p += sizeof(uint32);
+	memcpy(p, &overlap, sizeof(uint32));			p += sizeof(uint32);
+	memcpy(p, state->r4, state->n4 * sizeof(IP4R));	p += state->n4 * sizeof(IP4R);
+	memcpy(p, state->r6, state->n6 * sizeof(IP6R));
+
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(iprange_cidr_agg_deserial);
+Datum
+iprange_cidr_agg_deserial(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	bytea *in = PG_GETARG_BYTEA_P(0);
+	const char *p = VARDATA(in);
+	IPR_CidrAggState *state;
+	uint32 n4;
+	uint32 n6;
+	uint32 overlap;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "cidr_split_agg called in non-aggregate context");
+
+	memcpy(&n4, p, sizeof(uint32));		p += sizeof(uint32);
+	memcpy(&n6, p, sizeof(uint32));		p += sizeof(uint32);
+	memcpy(&overlap, p, sizeof(uint32));	p += sizeof(uint32);
+
+	state = iprange_cidr_agg_state_new(aggcontext, n4, n6);
+	state->n4 = n4;
+	state->n6 = n6;
+	state->overlap = (overlap != 0);
+	memcpy(state->r4, p, n4 * sizeof(IP4R));	p += n4 * sizeof(IP4R);
+	memcpy(state->r6, p, n6 * sizeof(IP6R));
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * union_size_agg: the number of distinct addresses covered by a set of
+ * ranges, which may overlap. This uses the same state as cidr_split_agg,
+ * and adds up the sizes of the merged ranges.
+ *
+ * The merged IPv6 ranges total at most 2^128 and the IPv4 ones at most
+ * 2^32, so a 128-bit sum plus one carry bit is enough.
+ */
+
+static inline
+void iprange_add129(uint32 *carry, uint64 *hi, uint64 *lo, uint64 add_hi, uint64 add_lo)
+{
+	uint64 c;
+
+	*lo += add_lo;
+	c = (*lo < add_lo);
+	*hi += c;
+	*carry += (*hi < c);
+	*hi += add_hi;
+	*carry += (*hi < add_hi);
+}
+
+PG_FUNCTION_INFO_V1(iprange_union_size_final);
+Datum
+iprange_union_size_final(PG_FUNCTION_ARGS)
+{
+	IPR_CidrAggState *state;
+	uint64 hi = 0;
+	uint64 lo = 0;
+	uint32 carry = 0;
+	uint32 i;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "union_size_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+	iprange_cidr_agg_compact(state);
+
+	for (i = 0; i < state->n4; ++i)
+		lo += (uint64) state->r4[i].upper - state->r4[i].lower + 1;
+
+	for (i = 0; i < state->n6; ++i)
+	{
+		IP6 diff;
+
+		ip6_sub(&state->r6[i].upper, &state->r6[i].lower, &diff);
+		iprange_add129(&carry, &hi, &lo, diff.bits[0], diff.bits[1]);
+		iprange_add129(&carry, &hi, &lo, 0, 1);
+	}
+
+	PG_RETURN_NUMERIC(ipr_make_numeric(hi, lo, carry, false));
+}
+
+/*
+ * disjoint_agg: whether no two of a set of ranges overlap (adjacent ranges
+ * are fine). This is the same sort-and-merge as cidr_split_agg, which
+ * records any overlap it sees; so checking a whole table costs one sort
+ * of its ranges, or less when adjacent ranges merge, rather than an index
+ * probe per row as an exclusion constraint does.
+ */
+
+PG_FUNCTION_INFO_V1(iprange_disjoint_final);
+Datum
+iprange_disjoint_final(PG_FUNCTION_ARGS)
+{
+	IPR_CidrAggState *state;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "disjoint_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IPR_CidrAggState *) PG_GETARG_POINTER(0);
+	iprange_cidr_agg_compact(state);
+
+	PG_RETURN_BOOL(!state->overlap);
+}
+
+/*
+ * range_gaps / cidr_gaps: the parts of a containing range not covered by
+ * any of an array of ranges, as maximal ranges or as CIDRs of at least a
+ * given size (i.e. prefix length no more than the one given; smaller free
+ * blocks are omitted). Ranges of the wrong family or outside the container
+ * are ignored; if the container is '-', both families are done.
+ *
+ * This reuses the cidr_split_agg state: the ranges are clipped to the
+ * container, sorted and merged, and a single sweep finds the gaps.
+ */
+
+static
+void iprange_gaps_emit4(FunctionCallInfo fcinfo, IP4 lo, IP4 hi, int maxlen)
+{
+	IPR ipr;
+
+	if (maxlen < 0)
+	{
+		ipr.ip4r.lower = lo;
+		ipr.ip4r.upper = hi;
+		ipr_materialize_value(fcinfo, IPR_PGetDatum(ipr_pack(PGSQL_AF_INET, &ipr)));
+	}
+	else
+	{
+		IP4R gap;
+		IP4R res[IP4R_MAX_CIDRS];
+		int n;
+		int i;
+
+		gap.lower = lo;
+		gap.upper = hi;
+		n = ip4r_split_cidrs(&gap, res);
+		for (i = 0; i < n; ++i)
+		{
+			if (masklen(res[i].lower, res[i].upper) > (unsigned) maxlen)
+				continue;
+			ipr.ip4r = res[i];
+			ipr_materialize_value(fcinfo, IPR_PGetDatum(ipr_pack(PGSQL_AF_INET, &ipr)));
+		}
+	}
+}
+
+static
+void iprange_gaps_emit6(FunctionCallInfo fcinfo, IP6 *lo, IP6 *hi, int maxlen)
+{
+	IPR ipr;
+
+	if (maxlen < 0)
+	{
+		ipr.ip6r.lower = *lo;
+		ipr.ip6r.upper = *hi;
+		ipr_materialize_value(fcinfo, IPR_PGetDatum(ipr_pack(PGSQL_AF_INET6, &ipr)));
+	}
+	else
+	{
+		IP6R gap;
+		IP6R res[IP6R_MAX_CIDRS];
+		int n;
+		int i;
+
+		gap.lower = *lo;
+		gap.upper = *hi;
+		n = ip6r_split_cidrs(&gap, res);
+		for (i = 0; i < n; ++i)
+		{
+			if (masklen6(&res[i].lower, &res[i].upper) > (unsigned) maxlen)
+				continue;
+			ipr.ip6r = res[i];
+			ipr_materialize_value(fcinfo, IPR_PGetDatum(ipr_pack(PGSQL_AF_INET6, &ipr)));
+		}
+	}
+}
+
+static
+void iprange_gaps4(FunctionCallInfo fcinfo, IP4R *container,
+				   IPR_CidrAggState *state, int maxlen)
+{
+	IP4 next = container->lower;
+	uint32 i;
+
+	for (i = 0; i < state->n4; ++i)
+	{
+		IP4R *r = &state->r4[i];
+
+		if (next < r->lower)
+			iprange_gaps_emit4(fcinfo, next, r->lower - 1, maxlen);
+		if (r->upper == container->upper)
+			return;
+		next = r->upper + 1;
+	}
+
+	iprange_gaps_emit4(fcinfo, next, container->upper, maxlen);
+}
+
+static
+void iprange_gaps6(FunctionCallInfo fcinfo, IP6R *container,
+				   IPR_CidrAggState *state, int maxlen)
+{
+	IP6 next = container->lower;
+	uint32 i;
+
+	for (i = 0; i < state->n6; ++i)
+	{
+		IP6R *r = &state->r6[i];
+
+		if (ip6_lessthan(&next, &r->lower))
+		{
+			IP6 prev;
+
+			ip6_sub_int(&r->lower, 1, &prev);
+			iprange_gaps_emit6(fcinfo, &next, &prev, maxlen);
+		}
+		if (ip6_equal(&r->upper, &container->upper))
+			return;
+		ip6_sub_int(&r->upper, -1, &next);
+	}
+
+	iprange_gaps_emit6(fcinfo, &next, &container->upper, maxlen);
+}
+
+static
+Datum iprange_gaps_internal(FunctionCallInfo fcinfo, int maxlen)
+{
+	IPR container;
+	int caf = ipr_unpack(PG_GETARG_IPR_P(0), &container);
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P(1);
+	IPR_CidrAggState *state;
+	IP4R c4;
+	IP6R c6;
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	int i;
+
+	switch (caf)
+	{
+		case 0:
+			c4.lower = netmask(0);
+			c4.upper = hostmask(0);
+			c6.lower.bits[0] = netmask6_hi(0);
+			c6.lower.bits[1] = netmask6_lo(0);
+			c6.upper.bits[0] = hostmask6_hi(0);
+			c6.upper.bits[1] = hostmask6_lo(0);
+			break;
+		case PGSQL_AF_INET:
+			c4 = container.ip4r;
+			break;
+		case PGSQL_AF_INET6:
+			c6 = container.ip6r;
+			break;
+		default:
+			iprange_internal_error();
+	}
+
+	deconstruct_array(arr, ARR_ELEMTYPE(arr), -1, false, 'i',
+					  &elems, &nulls, &nelems);
+
+	state = iprange_cidr_agg_state_new(CurrentMemoryContext, nelems, nelems);
+
+	for (i = 0; i < nelems; ++i)
+	{
+		IPR ipr;
+		int af;
+
+		if (nulls[i])
+			continue;
+
+		af = ipr_unpack(DatumGetIPR_P(elems[i]), &ipr);
+
+		if ((af == 0 || af == PGSQL_AF_INET)
+			&& (caf == 0 || caf == PGSQL_AF_INET))
+		{
+			IP4R r;
+
+			if (af == 0)
+				r = c4;
+			else if (!ip4r_inter_internal(&ipr.ip4r, &c4, &r))
+				continue;
+			iprange_cidr_agg_add4(state, &r);
+		}
+
+		if ((af == 0 || af == PGSQL_AF_INET6)
+			&& (caf == 0 || caf == PGSQL_AF_INET6))
+		{
+			IP6R r;
+
+			if (af == 0)
+				r = c6;
+			else if (!ip6r_inter_internal(&ipr.ip6r, &c6, &r))
+				continue;
+			iprange_cidr_agg_add6(state, &r);
+		}
 	}
 
-	funcctx = SRF_PERCALL_SETUP();
+	iprange_cidr_agg_compact(state);
 
-	val = funcctx->user_fctx;
-	if (!val)
-		SRF_RETURN_DONE(funcctx);
-	Assert(funcctx->call_cntr < funcctx->max_calls);
+	ipr_materialize_init(fcinfo);
 
-	switch (funcctx->max_calls)
-	{
-		case 2:
-			/*
-			 * We're splitting '-' into '0.0.0.0/0' and '::/0'.
-			 */
-			if (funcctx->call_cntr == 0)
-			{
-				res.ip4r.lower = netmask(0);
-				res.ip4r.upper = hostmask(0);
-				af = PGSQL_AF_INET;
-			}
-			else
-			{
-				funcctx->user_fctx = NULL;	/* this is the last row */
-				res.ip6r.lower.bits[0] = netmask6_hi(0);
-				res.ip6r.lower.bits[1] = netmask6_lo(0);
-				res.ip6r.upper.bits[0] = hostmask6_hi(0);
-				res.ip6r.upper.bits[1] = hostmask6_lo(0);
-				af = PGSQL_AF_INET6;
-			}
-			break;
+	if (caf == 0 || caf == PGSQL_AF_INET)
+		iprange_gaps4(fcinfo, &c4, state, maxlen);
+	if (caf == 0 || caf == PGSQL_AF_INET6)
+		iprange_gaps6(fcinfo, &c6, state, maxlen);
 
-		case 2*ipr_af_maxbits(PGSQL_AF_INET):
-			if (ip4r_split_cidr(&val->ip4r, &res.ip4r))
-				funcctx->user_fctx = NULL;
-			af = PGSQL_AF_INET;
-			break;
+	return (Datum) 0;
+}
 
-		case 2*ipr_af_maxbits(PGSQL_AF_INET6):
-			if (ip6r_split_cidr(&val->ip6r, &res.ip6r))
-				funcctx->user_fctx = NULL;
-			af = PGSQL_AF_INET6;
-			break;
+PG_FUNCTION_INFO_V1(iprange_range_gaps);
+Datum
+iprange_range_gaps(PG_FUNCTION_ARGS)
+{
+	return iprange_gaps_internal(fcinfo, -1);
+}
 
-		default:
-			iprange_internal_error();
-	}
+PG_FUNCTION_INFO_V1(iprange_cidr_gaps);
+Datum
+iprange_cidr_gaps(PG_FUNCTION_ARGS)
+{
+	int32 maxlen = PG_GETARG_INT32(2);
+
+	if (maxlen < 0 || maxlen > 128)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("prefix length out of range")));
 
-	SRF_RETURN_NEXT(funcctx, IPR_PGetDatum(ipr_pack(af, &res)));
+	return iprange_gaps_internal(fcinfo, maxlen);
 }
 
 /*
@@ -1511,6 +2475,38 @@ iprange_ip_contained_by(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(retval);
 }
 
+/*
+ * Bounding range of two ranges, which is '-' if the families differ.
+ * RESULT may alias A or B. This is shared by iprange_union, the GiST union
+ * method and bounding_range_agg.
+ */
+
+static inline
+int ipr_union_internal(int af1, IPR *a, int af2, IPR *b, IPR *result)
+{
+	if (af1 != af2)
+		return 0;
+
+	switch (af1)
+	{
+		case 0:
+			break;
+
+		case PGSQL_AF_INET:
+			ip4r_union_internal(&a->ip4r, &b->ip4r, &result->ip4r);
+			break;
+
+		case PGSQL_AF_INET6:
+			ip6r_union_internal(&a->ip6r, &b->ip6r, &result->ip6r);
+			break;
+
+		default:
+			iprange_internal_error();
+	}
+
+	return af1;
+}
+
 PG_FUNCTION_INFO_V1(iprange_union);
 Datum
 iprange_union(PG_FUNCTION_ARGS)
@@ -1522,28 +2518,158 @@ iprange_union(PG_FUNCTION_ARGS)
 	int af1 = ipr_unpack(ipp1, &ipr1);
 	int af2 = ipr_unpack(ipp2, &ipr2);
 	IPR res;
+	int af = ipr_union_internal(af1, &ipr1, af2, &ipr2, &res);
 
-	if (af1 == af2)
-	{
-		switch (af1)
-		{
-			case 0:
-				PG_RETURN_IPR_P(ipr_pack(0,NULL));
+	PG_RETURN_IPR_P(ipr_pack(af, &res));
+}
 
-			case PGSQL_AF_INET:
-				ip4r_union_internal(&ipr1.ip4r,&ipr2.ip4r,&res.ip4r);
-				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET,&res));
+/*
+ * bounding_range_agg for iprange and ipaddress. The state is an unpacked
+ * range and its family; rows of differing families give '-'.
+ */
 
-			case PGSQL_AF_INET6:
-				ip6r_union_internal(&ipr1.ip6r,&ipr2.ip6r,&res.ip6r);
-				PG_RETURN_IPR_P(ipr_pack(PGSQL_AF_INET6,&res));
+typedef struct IPR_BoundsState {
+	int32 af;
+	IPR ipr;
+} IPR_BoundsState;
 
-			default:
-				iprange_internal_error();
-		}
+static
+Datum iprange_bounds_add(FunctionCallInfo fcinfo, int af, IPR *ipr)
+{
+	MemoryContext aggcontext;
+	IPR_BoundsState *state;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "bounding_range_agg called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+	{
+		state = MemoryContextAlloc(aggcontext, sizeof(IPR_BoundsState));
+		state->af = af;
+		state->ipr = *ipr;
 	}
 	else
-		PG_RETURN_IPR_P(ipr_pack(0,NULL));
+	{
+		state = (IPR_BoundsState *) PG_GETARG_POINTER(0);
+		state->af = ipr_union_internal(state->af, &state->ipr, af, ipr, &state->ipr);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(iprange_bounds_trans);
+Datum
+iprange_bounds_trans(PG_FUNCTION_ARGS)
+{
+	IPR ipr;
+	int af;
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	af = ipr_unpack(PG_GETARG_IPR_P(1), &ipr);
+
+	return iprange_bounds_add(fcinfo, af, &ipr);
+}
+
+PG_FUNCTION_INFO_V1(iprange_bounds_trans_ip);
+Datum
+iprange_bounds_trans_ip(PG_FUNCTION_ARGS)
+{
+	IP ip;
+	IPR ipr;
+	int af;
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	af = ip_unpack(PG_GETARG_IP_P(1), &ip);
+
+	switch (af)
+	{
+		case PGSQL_AF_INET:
+			ipr.ip4r.lower = ipr.ip4r.upper = ip.ip4;
+			break;
+
+		case PGSQL_AF_INET6:
+			ipr.ip6r.lower = ipr.ip6r.upper = ip.ip6;
+			break;
+
+		default:
+			iprange_internal_error();
+	}
+
+	return iprange_bounds_add(fcinfo, af, &ipr);
+}
+
+PG_FUNCTION_INFO_V1(iprange_bounds_final);
+Datum
+iprange_bounds_final(PG_FUNCTION_ARGS)
+{
+	IPR_BoundsState *state;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (IPR_BoundsState *) PG_GETARG_POINTER(0);
+
+	PG_RETURN_IPR_P(ipr_pack(state->af, &state->ipr));
+}
+
+PG_FUNCTION_INFO_V1(iprange_bounds_combine);
+Datum
+iprange_bounds_combine(PG_FUNCTION_ARGS)
+{
+	IPR_BoundsState *state2;
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	state2 = (IPR_BoundsState *) PG_GETARG_POINTER(1);
+
+	return iprange_bounds_add(fcinfo, state2->af, &state2->ipr);
+}
+
+/* the serialized state is just the state struct */
+
+PG_FUNCTION_INFO_V1(iprange_bounds_serial);
+Datum
+iprange_bounds_serial(PG_FUNCTION_ARGS)
+{
+	IPR_BoundsState *state = (IPR_BoundsState *) PG_GETARG_POINTER(0);
+	bytea *res = palloc(VARHDRSZ + sizeof(IPR_BoundsState));
+
+	SET_VARSIZE(res, VARHDRSZ + sizeof(IPR_BoundsState));
+	memcpy(VARDATA(res), state, sizeof(IPR_BoundsState));
+
+	PG_RETURN_BYTEA_P(res);
+}
+
+PG_FUNCTION_INFO_V1(iprange_bounds_deserial);
+Datum
+iprange_bounds_deserial(PG_FUNCTION_ARGS)
+{
+	bytea *in = PG_GETARG_BYTEA_P(0);
+	IPR_BoundsState *state = palloc(sizeof(IPR_BoundsState));
+
+	if (VARSIZE(in) != VARHDRSZ + sizeof(IPR_BoundsState))
+		elog(ERROR, "invalid bounding_range_agg state");
+
+	memcpy(state, VARDATA(in), sizeof(IPR_BoundsState));
+
+	PG_RETURN_POINTER(state);
 }
 
 PG_FUNCTION_INFO_V1(iprange_inter);
@@ -1611,6 +2737,37 @@ iprange_size(PG_FUNCTION_ARGS)
 	}
 }
 
+/*
+ * As for ip4r and ip6r; '-' contains everything, and its size is 2^129
+ * as for @.
+ */
+
+static double
+iprange_lpm_distance_internal(int af_a, IPR *a, int af_b, IPR *b)
+{
+	if (af_a == 0)
+		return ldexp(1.0, 129);
+	if (af_a != af_b)
+		return HUGE_VAL;
+	if (af_a == PGSQL_AF_INET)
+		return ip4r_contains_internal(&a->ip4r, &b->ip4r, true)
+			? ip4r_metric(&a->ip4r) : HUGE_VAL;
+	return ip6r_contains_internal(&a->ip6r, &b->ip6r, true)
+		? ip6r_metric(&a->ip6r) : HUGE_VAL;
+}
+
+PG_FUNCTION_INFO_V1(iprange_lpm_distance);
+Datum
+iprange_lpm_distance(PG_FUNCTION_ARGS)
+{
+	IPR a;
+	IPR b;
+	int af_a = ipr_unpack(PG_GETARG_IPR_P(0), &a);
+	int af_b = ipr_unpack(PG_GETARG_IPR_P(1), &b);
+
+	PG_RETURN_FLOAT8(iprange_lpm_distance_internal(af_a, &a, af_b, &b));
+}
+
 PG_FUNCTION_INFO_V1(iprange_size_exact);
 Datum
 iprange_size_exact(PG_FUNCTION_ARGS)
@@ -1618,31 +2775,28 @@ iprange_size_exact(PG_FUNCTION_ARGS)
 	IPR_P ipp = PG_GETARG_IPR_P(0);
 	IPR ipr;
 	int af = ipr_unpack(ipp, &ipr);
-	Datum u,l,d,s;
+	IP6 diff;
 
 	switch (af)
 	{
 		case 0:
-			s = DirectFunctionCall3(numeric_in, CStringGetDatum("680564733841876926926749214863536422912"), 0, Int32GetDatum(-1));
-			PG_RETURN_DATUM(s);
+			/* 2^129 */
+			PG_RETURN_NUMERIC(ipr_make_numeric(0, 0, 2, false));
 
 		case PGSQL_AF_INET:
-			l = DirectFunctionCall1(ip4_cast_to_numeric, IP4GetDatum(ipr.ip4r.lower));
-			u = DirectFunctionCall1(ip4_cast_to_numeric, IP4GetDatum(ipr.ip4r.upper));
-			break;
+			PG_RETURN_NUMERIC(ipr_make_numeric(0, (uint64)ipr.ip4r.upper - ipr.ip4r.lower + 1,
+											   0, false));
 
 		case PGSQL_AF_INET6:
-			l = DirectFunctionCall1(ip6_cast_to_numeric, IP6PGetDatum(&ipr.ip6r.lower));
-			u = DirectFunctionCall1(ip6_cast_to_numeric, IP6PGetDatum(&ipr.ip6r.upper));
-			break;
+			ip6_sub(&ipr.ip6r.upper, &ipr.ip6r.lower, &diff);
+			diff.bits[1] += 1;
+			diff.bits[0] += (diff.bits[1] == 0);
+			PG_RETURN_NUMERIC(ipr_make_numeric(diff.bits[0], diff.bits[1],
+											   (diff.bits[0] | diff.bits[1]) == 0, false));
 
 		default:
 			iprange_internal_error();
 	}
-
-	d = DirectFunctionCall2(numeric_sub, u, l);
-	s = DirectFunctionCall1(numeric_inc, d);
-	PG_RETURN_DATUM(s);
 }
 
 PG_FUNCTION_INFO_V1(iprange_prefixlen);
@@ -1671,9 +2825,7 @@ iprange_prefixlen(PG_FUNCTION_ARGS)
  *												   Btree functions
  *****************************************************************************/
 
-PG_FUNCTION_INFO_V1(iprange_cmp);
-Datum
-iprange_cmp(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(iprange_cmp, IPR_STAT_COMPARE, IPR_STAT_IPRANGE, 1)
 {
 	PG_RETURN_INT32( iprange_cmp_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)) );
 }
@@ -1695,6 +2847,10 @@ Datum gipr_picksplit(PG_FUNCTION_ARGS);
 Datum gipr_union(PG_FUNCTION_ARGS);
 Datum gipr_same(PG_FUNCTION_ARGS);
 Datum gipr_fetch(PG_FUNCTION_ARGS);
+Datum gipr_fixed_consistent(PG_FUNCTION_ARGS);
+Datum gipr_fixed_compress(PG_FUNCTION_ARGS);
+Datum gipr_fixed_fetch(PG_FUNCTION_ARGS);
+Datum gipr_distance(PG_FUNCTION_ARGS);
 
 typedef struct {
 	int32 vl_len_;
@@ -1702,8 +2858,8 @@ typedef struct {
 	IPR ipr;
 } IPR_KEY;
 
-static bool gipr_leaf_consistent(IPR_KEY *key, IPR_P query, StrategyNumber strategy);
-static bool gipr_internal_consistent(IPR_KEY *key, IPR_P query, StrategyNumber strategy);
+static bool gipr_leaf_consistent(IPR_KEY *key, int af, IPR *query, StrategyNumber strategy);
+static bool gipr_internal_consistent(IPR_KEY *key, int af, IPR *query, StrategyNumber strategy);
 
 
 /*
@@ -1713,9 +2869,7 @@ static bool gipr_internal_consistent(IPR_KEY *key, IPR_P query, StrategyNumber s
  * it came from outside GiST (via insert or bulkinsert).
  */
 
-PG_FUNCTION_INFO_V1(gipr_compress);
-Datum
-gipr_compress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_compress, IPR_STAT_GIST_COMPRESS, IPR_STAT_IPRANGE, 1)
 {
 	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	GISTENTRY *retval = entry;
@@ -1737,9 +2891,7 @@ gipr_compress(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(retval);
 }
 
-PG_FUNCTION_INFO_V1(gipr_decompress);
-Datum
-gipr_decompress(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_decompress, IPR_STAT_GIST_DECOMPRESS, IPR_STAT_IPRANGE, 1)
 {
 	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	GISTENTRY *retval = palloc(sizeof(GISTENTRY));
@@ -1755,9 +2907,7 @@ gipr_decompress(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(retval);
 }
 
-PG_FUNCTION_INFO_V1(gipr_fetch);
-Datum
-gipr_fetch(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_fetch, IPR_STAT_GIST_FETCH, IPR_STAT_IPRANGE, 1)
 {
 	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
 }
@@ -1770,15 +2920,15 @@ gipr_fetch(PG_FUNCTION_ARGS)
 ** corresponding to strategy in the pg_amop table.
 */
 
-PG_FUNCTION_INFO_V1(gipr_consistent);
-Datum
-gipr_consistent(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_consistent, IPR_STAT_GIST_CONSISTENT, IPR_STAT_IPRANGE, 1)
 {
 	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
-	IPR_P query = (IPR_P) PG_GETARG_POINTER(1);
+	IPR_P queryp = (IPR_P) PG_GETARG_POINTER(1);
 	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
 	bool *recheck = (bool *) PG_GETARG_POINTER(4);
 	IPR_KEY *key = (IPR_KEY *) DatumGetPointer(entry->key);
+	IPR query;
+	int af = ipr_unpack(queryp, &query);
 	bool retval;
 
 	/* recheck is never needed with this type */
@@ -1791,9 +2941,109 @@ gipr_consistent(PG_FUNCTION_ARGS)
 	 */
 
 	if (GIST_LEAF(entry))
-		retval = gipr_leaf_consistent(key, query, strategy);
+		retval = gipr_leaf_consistent(key, af, &query, strategy);
+	else
+		retval = gipr_internal_consistent(key, af, &query, strategy);
+
+	if (unlikely(ipr_track_gist_scans))
+		ipr_gist_scan_count(IPR_GIST_IPRANGE, strategy, GIST_LEAF(entry), entry->page,
+							retval, recheck && *recheck);
+
+	PG_RETURN_BOOL(retval);
+}
+
+/*
+ * The GiST Distance method, for the <-> ordering operator only; see
+ * gip4r_distance. An internal key of family 0 may hold either family, or
+ * '-' itself, which is the only range that contains '-'.
+ */
+
+PG_FUNCTION_INFO_V1(gipr_distance);
+Datum
+gipr_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	IPR_P queryp = (IPR_P) PG_GETARG_POINTER(1);
+	IPR_KEY *key = (IPR_KEY *) DatumGetPointer(entry->key);
+	IPR query;
+	int af = ipr_unpack(queryp, &query);
+
+	if (GIST_LEAF(entry))
+		PG_RETURN_FLOAT8(iprange_lpm_distance_internal(key->af, &key->ipr, af, &query));
+
+	if (af == 0)
+		PG_RETURN_FLOAT8(key->af == 0 ? ldexp(1.0, 129) : HUGE_VAL);
+	if (key->af != 0
+		&& iprange_lpm_distance_internal(key->af, &key->ipr, af, &query) == HUGE_VAL)
+		PG_RETURN_FLOAT8(HUGE_VAL);
+	PG_RETURN_FLOAT8(af == PGSQL_AF_INET ? ip4r_metric(&query.ip4r) : ip6r_metric(&query.ip6r));
+}
+
+/*
+ * The opclass for iprange_fixed stores the same packed keys as for iprange,
+ * so only compress, fetch and consistent (which sees the query in the
+ * indexed type) differ.
+ */
+
+PG_FUNCTION_INFO_V1(gipr_fixed_compress);
+Datum
+gipr_fixed_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY *retval;
+	IPRF *iprf;
+
+	if (!entry->leafkey)
+		return gipr_compress(fcinfo);
+
+	iprf = DatumGetIPRFP(entry->key);
+	retval = palloc(sizeof(GISTENTRY));
+
+	gistentryinit(*retval, PointerGetDatum(ipr_pack(iprf->af, &iprf->ipr)),
+				  entry->rel, entry->page,
+				  entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+PG_FUNCTION_INFO_V1(gipr_fixed_fetch);
+Datum
+gipr_fixed_fetch(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY *retval = palloc(sizeof(GISTENTRY));
+	IPR ipr;
+	int af = ipr_unpack((IPR_P) DatumGetPointer(entry->key), &ipr);
+
+	gistentryinit(*retval, IPRFPGetDatum(iprf_make(af, &ipr)),
+				  entry->rel, entry->page,
+				  entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+PG_FUNCTION_INFO_V1(gipr_fixed_consistent);
+Datum
+gipr_fixed_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	IPRF *query = PG_GETARG_IPRF_P(1);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	IPR_KEY *key = (IPR_KEY *) DatumGetPointer(entry->key);
+	bool retval;
+
+	if (recheck)
+		*recheck = false;
+
+	if (GIST_LEAF(entry))
+		retval = gipr_leaf_consistent(key, query->af, &query->ipr, strategy);
 	else
-		retval = gipr_internal_consistent(key, query, strategy);
+		retval = gipr_internal_consistent(key, query->af, &query->ipr, strategy);
+
+	if (unlikely(ipr_track_gist_scans))
+		ipr_gist_scan_count(IPR_GIST_IPRANGE_FIXED, strategy, GIST_LEAF(entry), entry->page,
+							retval, recheck && *recheck);
 
 	PG_RETURN_BOOL(retval);
 }
@@ -1806,35 +3056,7 @@ gipr_consistent(PG_FUNCTION_ARGS)
 static void
 gipr_union_internal_1(IPR_KEY *out, IPR_KEY *tmp)
 {
-	if (out->af != tmp->af)
-		out->af = 0;
-
-	switch (out->af)
-	{
-		case 0:
-			break;
-
-		case PGSQL_AF_INET:
-		{
-			if (ip4_lessthan(tmp->ipr.ip4r.lower,out->ipr.ip4r.lower))
-				out->ipr.ip4r.lower = tmp->ipr.ip4r.lower;
-			if (ip4_lessthan(out->ipr.ip4r.upper,tmp->ipr.ip4r.upper))
-				out->ipr.ip4r.upper = tmp->ipr.ip4r.upper;
-			break;
-		}
-
-		case PGSQL_AF_INET6:
-		{
-			if (ip6_lessthan(&tmp->ipr.ip6r.lower,&out->ipr.ip6r.lower))
-				out->ipr.ip6r.lower = tmp->ipr.ip6r.lower;
-			if (ip6_lessthan(&out->ipr.ip6r.upper,&tmp->ipr.ip6r.upper))
-				out->ipr.ip6r.upper = tmp->ipr.ip6r.upper;
-			break;
-		}
-
-		default:
-			iprange_internal_error();
-	}
+	out->af = ipr_union_internal(out->af, &out->ipr, tmp->af, &tmp->ipr, &out->ipr);
 }
 
 static void
@@ -1876,10 +3098,7 @@ gipr_union_internal(IPR_KEY *out, bool *allequalp, bool *afequalp,
 				if (allequal && !ip4r_equal(&tmp->ipr.ip4r, &out->ipr.ip4r))
 					allequal = false;
 
-				if (ip4_lessthan(tmp->ipr.ip4r.lower,out->ipr.ip4r.lower))
-					out->ipr.ip4r.lower = tmp->ipr.ip4r.lower;
-				if (ip4_lessthan(out->ipr.ip4r.upper,tmp->ipr.ip4r.upper))
-					out->ipr.ip4r.upper = tmp->ipr.ip4r.upper;
+				ip4r_union_internal(&out->ipr.ip4r, &tmp->ipr.ip4r, &out->ipr.ip4r);
 			}
 			break;
 		}
@@ -1896,10 +3115,7 @@ gipr_union_internal(IPR_KEY *out, bool *allequalp, bool *afequalp,
 				if (allequal && !ip6r_equal(&tmp->ipr.ip6r, &out->ipr.ip6r))
 					allequal = false;
 
-				if (ip6_lessthan(&tmp->ipr.ip6r.lower,&out->ipr.ip6r.lower))
-					out->ipr.ip6r.lower = tmp->ipr.ip6r.lower;
-				if (ip6_lessthan(&out->ipr.ip6r.upper,&tmp->ipr.ip6r.upper))
-					out->ipr.ip6r.upper = tmp->ipr.ip6r.upper;
+				ip6r_union_internal(&out->ipr.ip6r, &tmp->ipr.ip6r, &out->ipr.ip6r);
 			}
 			break;
 		}
@@ -1915,9 +3131,8 @@ gipr_union_internal(IPR_KEY *out, bool *allequalp, bool *afequalp,
 }
 
 
-PG_FUNCTION_INFO_V1(gipr_union);
-Datum
-gipr_union(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_union, IPR_STAT_GIST_UNION, IPR_STAT_IPRANGE,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	int *sizep = (int *) PG_GETARG_POINTER(1);
@@ -1943,9 +3158,7 @@ gipr_union(PG_FUNCTION_ARGS)
 ** The GiST Penalty method for IP ranges
 ** As in the R-tree paper, we use change in area as our penalty metric
 */
-PG_FUNCTION_INFO_V1(gipr_penalty);
-Datum
-gipr_penalty(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_penalty, IPR_STAT_GIST_PENALTY, IPR_STAT_IPRANGE, 1)
 {
 	GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
 	GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
@@ -1953,7 +3166,6 @@ gipr_penalty(PG_FUNCTION_ARGS)
 	IPR_KEY *key = (IPR_KEY *) DatumGetPointer(origentry->key);
 	IPR_KEY *newkey = (IPR_KEY *) DatumGetPointer(newentry->key);
 	IP4R ud4;
-	IP6R ud6;
 	double tmp = 0.0;
 
 	if (key->af != newkey->af)
@@ -1990,33 +3202,8 @@ gipr_penalty(PG_FUNCTION_ARGS)
 				break;
 
 			case PGSQL_AF_INET6:
-				if (ip6_lessthan(&newkey->ipr.ip6r.lower,&key->ipr.ip6r.lower))
-				{
-					ud6.lower = newkey->ipr.ip6r.lower;
-					ud6.upper = key->ipr.ip6r.lower;
-					ip6_sub_int(&ud6.upper,1,&ud6.upper);
-					tmp = ip6r_metric(&ud6);
-				}
-				if (ip6_lessthan(&key->ipr.ip6r.upper,&newkey->ipr.ip6r.upper))
-				{
-					ud6.lower = key->ipr.ip6r.upper;
-					ud6.upper = newkey->ipr.ip6r.upper;
-					ip6_sub_int(&ud6.upper,1,&ud6.upper);
-					tmp += ip6r_metric(&ud6);
-				}
-
-				/*
-				 * we want to scale the result a bit. For one thing, the gist code implicitly
-				 * assigns a penalty of 1e10 for a union of null and non-null values, and we
-				 * want to keep our values less than that. For another, the penalty is sometimes
-				 * summed across columns of a multi-column index, and we don't want our huge
-				 * metrics (>2^80) to completely swamp anything else.
-				 *
-				 * So, we scale as the fourth power of the log2 of the computed penalty, which
-				 * gives us a range 0 - 268435456.
-				 */
-
-				tmp = pow(log(tmp+1) / log(2), 4);
+				/* see ip6r_penalty for the scaling */
+				tmp = ip6r_penalty(&key->ipr.ip6r, &newkey->ipr.ip6r);
 				break;
 
 			default:
@@ -2072,9 +3259,8 @@ gipr_sort_compare_v6(const void *av, const void *bv)
 ** based on the box functions in rtree_gist simplified to one
 ** dimension
 */
-PG_FUNCTION_INFO_V1(gipr_picksplit);
-Datum
-gipr_picksplit(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_picksplit, IPR_STAT_GIST_PICKSPLIT, IPR_STAT_IPRANGE,
+				  GISTENTRYCOUNT((GistEntryVector *) PG_GETARG_POINTER(0)))
 {
 	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
 	GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
@@ -2259,9 +3445,7 @@ gipr_picksplit(PG_FUNCTION_ARGS)
 /*
 ** Equality methods
 */
-PG_FUNCTION_INFO_V1(gipr_same);
-Datum
-gipr_same(PG_FUNCTION_ARGS)
+IPR_STAT_FUNCTION(gipr_same, IPR_STAT_GIST_SAME, IPR_STAT_IPRANGE, 1)
 {
 	IPR_KEY *v1 = (IPR_KEY *) PG_GETARG_POINTER(0);
 	IPR_KEY *v2 = (IPR_KEY *) PG_GETARG_POINTER(1);
@@ -2313,12 +3497,10 @@ gipr_same(PG_FUNCTION_ARGS)
 
 static bool
 gipr_leaf_consistent(IPR_KEY *key,
-					 IPR_P queryp,
+					 int af,
+					 IPR *query,
 					 StrategyNumber strategy)
 {
-	IPR query;
-	int af = ipr_unpack(queryp, &query);
-
 #ifdef GIST_QUERY_DEBUG
 	fprintf(stderr, "leaf_consistent, %d\n", strategy);
 #endif
@@ -2366,17 +3548,17 @@ gipr_leaf_consistent(IPR_KEY *key,
 		switch (strategy)
 		{
 			case 1:	  /* left contains right nonstrict */
-				return ip4r_contains_internal(&key->ipr.ip4r, &query.ip4r, true);
+				return ip4r_contains_internal(&key->ipr.ip4r, &query->ip4r, true);
 			case 2:	  /* left contained in right nonstrict */
-				return ip4r_contains_internal(&query.ip4r, &key->ipr.ip4r, true);
+				return ip4r_contains_internal(&query->ip4r, &key->ipr.ip4r, true);
 			case 3:	  /* left contains right strict */
-				return ip4r_contains_internal(&key->ipr.ip4r, &query.ip4r, false);
+				return ip4r_contains_internal(&key->ipr.ip4r, &query->ip4r, false);
 			case 4:	  /* left contained in right strict */
-				return ip4r_contains_internal(&query.ip4r, &key->ipr.ip4r, false);
+				return ip4r_contains_internal(&query->ip4r, &key->ipr.ip4r, false);
 			case 5:	  /* left overlaps right */
-				return ip4r_overlaps_internal(&key->ipr.ip4r, &query.ip4r);
+				return ip4r_overlaps_internal(&key->ipr.ip4r, &query->ip4r);
 			case 6:	  /* left equal right */
-				return ip4r_equal(&key->ipr.ip4r, &query.ip4r);
+				return ip4r_equal(&key->ipr.ip4r, &query->ip4r);
 		}
 	}
 	else if (af == PGSQL_AF_INET6)
@@ -2384,17 +3566,17 @@ gipr_leaf_consistent(IPR_KEY *key,
 		switch (strategy)
 		{
 			case 1:	  /* left contains right nonstrict */
-				return ip6r_contains_internal(&key->ipr.ip6r, &query.ip6r, true);
+				return ip6r_contains_internal(&key->ipr.ip6r, &query->ip6r, true);
 			case 2:	  /* left contained in right nonstrict */
-				return ip6r_contains_internal(&query.ip6r, &key->ipr.ip6r, true);
+				return ip6r_contains_internal(&query->ip6r, &key->ipr.ip6r, true);
 			case 3:	  /* left contains right strict */
-				return ip6r_contains_internal(&key->ipr.ip6r, &query.ip6r, false);
+				return ip6r_contains_internal(&key->ipr.ip6r, &query->ip6r, false);
 			case 4:	  /* left contained in right strict */
-				return ip6r_contains_internal(&query.ip6r, &key->ipr.ip6r, false);
+				return ip6r_contains_internal(&query->ip6r, &key->ipr.ip6r, false);
 			case 5:	  /* left overlaps right */
-				return ip6r_overlaps_internal(&key->ipr.ip6r, &query.ip6r);
+				return ip6r_overlaps_internal(&key->ipr.ip6r, &query->ip6r);
 			case 6:	  /* left equal right */
-				return ip6r_equal(&key->ipr.ip6r, &query.ip6r);
+				return ip6r_equal(&key->ipr.ip6r, &query->ip6r);
 		}
 	}
 	return false;
@@ -2414,12 +3596,10 @@ gipr_leaf_consistent(IPR_KEY *key,
 
 static bool
 gipr_internal_consistent(IPR_KEY *key,
-						 IPR_P queryp,
+						 int af,
+						 IPR *query,
 						 StrategyNumber strategy)
 {
-	IPR query;
-	int af = ipr_unpack(queryp, &query);
-
 #ifdef GIST_QUERY_DEBUG
 	fprintf(stderr, "leaf_consistent, %d\n", strategy);
 #endif
@@ -2437,12 +3617,12 @@ gipr_internal_consistent(IPR_KEY *key,
 			case 2:	  /* left contained in right nonstrict */
 			case 4:	  /* left contained in right strict */
 			case 5:	  /* left overlaps right */
-				return ip4r_overlaps_internal(&key->ipr.ip4r, &query.ip4r);
+				return ip4r_overlaps_internal(&key->ipr.ip4r, &query->ip4r);
 			case 3:	  /* left contains right strict */
-				return ip4r_contains_internal(&key->ipr.ip4r, &query.ip4r, false);
+				return ip4r_contains_internal(&key->ipr.ip4r, &query->ip4r, false);
 			case 1:	  /* left contains right nonstrict */
 			case 6:	  /* left equal right */
-				return ip4r_contains_internal(&key->ipr.ip4r, &query.ip4r, true);
+				return ip4r_contains_internal(&key->ipr.ip4r, &query->ip4r, true);
 		}
 	}
 	else if (af == PGSQL_AF_INET6)
@@ -2452,12 +3632,12 @@ gipr_internal_consistent(IPR_KEY *key,
 			case 2:	  /* left contained in right nonstrict */
 			case 4:	  /* left contained in right strict */
 			case 5:	  /* left overlaps right */
-				return ip6r_overlaps_internal(&key->ipr.ip6r, &query.ip6r);
+				return ip6r_overlaps_internal(&key->ipr.ip6r, &query->ip6r);
 			case 3:	  /* left contains right strict */
-				return ip6r_contains_internal(&key->ipr.ip6r, &query.ip6r, false);
+				return ip6r_contains_internal(&key->ipr.ip6r, &query->ip6r, false);
 			case 1:	  /* left contains right nonstrict */
 			case 6:	  /* left equal right */
-				return ip6r_contains_internal(&key->ipr.ip6r, &query.ip6r, true);
+				return ip6r_contains_internal(&key->ipr.ip6r, &query->ip6r, true);
 		}
 	}
 	return false;
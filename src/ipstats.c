@@ -0,0 +1,429 @@
+/* ipstats.c */
+
+#include "postgres.h"
+
+#include <limits.h>
+#include <sys/socket.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/guc.h"
+#include "utils/tuplestore.h"
+
+#include "ipr_internal.h"
+
+/*
+ * Per-operation call statistics, shown by the ip4r_stat view.
+ *
+ * Counting is off unless ip4r.track_stats is set, and needs the library to
+ * be in shared_preload_libraries, since that is the only time we can ask
+ * for shared memory. Each backend counts in local memory and adds its
+ * counts to the shared totals every IPR_STATS_FLUSH_CALLS calls and at
+ * the end of each transaction, so the spinlock is taken rarely even for
+ * operations, like compare and gist consistent, that run millions of times
+ * a second.
+ *
+ * Reading the clock costs more than most of the functions being counted,
+ * so only one call in ip4r.stats_timing_sample is timed; timed_calls says
+ * how many, so the mean time per call is timed_ms / timed_calls.
+ */
+
+#define IPR_STATS_FLUSH_CALLS 1024
+
+typedef struct IPR_StatCounters
+{
+	int64		calls;
+	int64		rows;
+	int64		timed_calls;
+	double		timed_secs;
+} IPR_StatCounters;
+
+typedef struct IPR_StatShared
+{
+	slock_t		mutex;
+	IPR_StatCounters counters[IPR_STAT_NOPS][IPR_STAT_NTYPES];
+} IPR_StatShared;
+
+bool ipr_track_stats = false;
+static int ipr_stats_timing_sample = 100;
+
+static IPR_StatShared *ipr_stats_shared = NULL;
+static IPR_StatCounters ipr_stats_local[IPR_STAT_NOPS][IPR_STAT_NTYPES];
+static int ipr_stats_pending = 0;
+static int ipr_stats_timing_count = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static const char *const ipr_stat_op_names[IPR_STAT_NOPS] = {
+	"parse",
+	"format",
+	"compare",
+	"hash",
+	"gist_consistent",
+	"gist_union",
+	"gist_compress",
+	"gist_decompress",
+	"gist_penalty",
+	"gist_picksplit",
+	"gist_same",
+	"gist_fetch"
+};
+
+static const char *const ipr_stat_type_names[IPR_STAT_NTYPES] = {
+	"ip4",
+	"ip4r",
+	"ip6",
+	"ip6r",
+	"ipaddress",
+	"iprange"
+};
+
+static void
+ipr_stats_flush(void)
+{
+	int i, j;
+
+	if (ipr_stats_pending == 0 || !ipr_stats_shared)
+		return;
+
+	SpinLockAcquire(&ipr_stats_shared->mutex);
+	for (i = 0; i < IPR_STAT_NOPS; ++i)
+		for (j = 0; j < IPR_STAT_NTYPES; ++j)
+		{
+			IPR_StatCounters *src = &ipr_stats_local[i][j];
+			IPR_StatCounters *dst = &ipr_stats_shared->counters[i][j];
+
+			if (src->calls == 0)
+				continue;
+			dst->calls += src->calls;
+			dst->rows += src->rows;
+			dst->timed_calls += src->timed_calls;
+			dst->timed_secs += src->timed_secs;
+		}
+	SpinLockRelease(&ipr_stats_shared->mutex);
+
+	memset(ipr_stats_local, 0, sizeof(ipr_stats_local));
+	ipr_stats_pending = 0;
+}
+
+Datum
+ipr_stat_call(PGFunction fn, FunctionCallInfo fcinfo,
+			  IPR_StatOp op, IPR_StatType type, int64 rows)
+{
+	IPR_StatCounters *c = &ipr_stats_local[op][type];
+	Datum result;
+
+	if (!ipr_stats_shared)
+		return fn(fcinfo);
+
+	if (ipr_stats_timing_sample > 0
+		&& ++ipr_stats_timing_count >= ipr_stats_timing_sample)
+	{
+		instr_time start;
+		instr_time duration;
+
+		ipr_stats_timing_count = 0;
+		INSTR_TIME_SET_CURRENT(start);
+		result = fn(fcinfo);
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+		c->timed_calls++;
+		c->timed_secs += INSTR_TIME_GET_DOUBLE(duration);
+	}
+	else
+		result = fn(fcinfo);
+
+	c->calls++;
+	c->rows += rows;
+
+	if (++ipr_stats_pending >= IPR_STATS_FLUSH_CALLS)
+		ipr_stats_flush();
+
+	return result;
+}
+
+static void
+ipr_stats_xact_callback(XactEvent event, void *arg)
+{
+	ipr_stats_flush();
+}
+
+static void
+ipr_stats_check_loaded(void)
+{
+	if (!ipr_stats_shared)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("ip4r must be loaded via shared_preload_libraries to collect statistics")));
+}
+
+PG_FUNCTION_INFO_V1(ip4r_stat);
+Datum
+ip4r_stat(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	IPR_StatCounters snap[IPR_STAT_NOPS][IPR_STAT_NTYPES];
+	int i, j;
+
+	ipr_stats_check_loaded();
+	ipr_materialize_init(fcinfo);
+
+	ipr_stats_flush();
+
+	SpinLockAcquire(&ipr_stats_shared->mutex);
+	memcpy(snap, ipr_stats_shared->counters, sizeof(snap));
+	SpinLockRelease(&ipr_stats_shared->mutex);
+
+	for (j = 0; j < IPR_STAT_NTYPES; ++j)
+		for (i = 0; i < IPR_STAT_NOPS; ++i)
+		{
+			Datum values[6];
+			bool nulls[6] = { false, false, false, false, false, false };
+
+			if (i >= IPR_STAT_GIST_CONSISTENT
+				&& j != IPR_STAT_IP4R && j != IPR_STAT_IP6R && j != IPR_STAT_IPRANGE)
+				continue;
+
+			values[0] = CStringGetTextDatum(ipr_stat_type_names[j]);
+			values[1] = CStringGetTextDatum(ipr_stat_op_names[i]);
+			values[2] = Int64GetDatum(snap[i][j].calls);
+			values[3] = Int64GetDatum(snap[i][j].rows);
+			values[4] = Int64GetDatum(snap[i][j].timed_calls);
+			values[5] = Float8GetDatum(snap[i][j].timed_secs * 1000.0);
+
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+		}
+
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(ip4r_stat_reset);
+Datum
+ip4r_stat_reset(PG_FUNCTION_ARGS)
+{
+	ipr_stats_check_loaded();
+
+	memset(ipr_stats_local, 0, sizeof(ipr_stats_local));
+	ipr_stats_pending = 0;
+
+	SpinLockAcquire(&ipr_stats_shared->mutex);
+	memset(ipr_stats_shared->counters, 0, sizeof(ipr_stats_shared->counters));
+	SpinLockRelease(&ipr_stats_shared->mutex);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * GiST scan counts.
+ *
+ * These are per-session and need no shared memory: set
+ * ip4r.track_gist_scans, run the queries of interest, then look at
+ * ip_gist_scan_stats(). Each consistent call is counted by opclass,
+ * strategy and level (leaf or internal), along with whether the entry
+ * matched and, if so, whether it was marked for recheck.
+ *
+ * A page is counted as visited when a consistent call sees an entry on a
+ * different page from the previous call, since the scan tests all the
+ * entries of a page together. With several conditions on the indexed
+ * column, the page is counted under the strategy tested first.
+ */
+
+typedef struct IPR_GistScanCounters
+{
+	int64		pages;
+	int64		calls;
+	int64		matches;
+	int64		rechecks;
+} IPR_GistScanCounters;
+
+bool ipr_track_gist_scans = false;
+
+static IPR_GistScanCounters ipr_gist_scans[IPR_GIST_NOPCLASSES][IPR_GIST_NSTRATEGIES][2];
+static const void *ipr_gist_scan_last_page = NULL;
+
+static const char *const ipr_gist_opclass_names[IPR_GIST_NOPCLASSES] = {
+	"gist_ip4r_ops",
+	"gist_ip6r_ops",
+	"gist_iprange_ops",
+	"gist_iprange_fixed_ops"
+};
+
+static const char *const ipr_gist_strategy_names[IPR_GIST_NSTRATEGIES] = {
+	">>=", "<<=", ">>", "<<", "&&", "="
+};
+
+void
+ipr_gist_scan_count(IPR_GistOpclass opclass, uint16 strategy,
+					bool leaf, const void *page,
+					bool match, bool recheck)
+{
+	IPR_GistScanCounters *c;
+
+	if (strategy < 1 || strategy > IPR_GIST_NSTRATEGIES)
+		return;
+
+	c = &ipr_gist_scans[opclass][strategy - 1][leaf ? 1 : 0];
+
+	if (page != ipr_gist_scan_last_page)
+	{
+		ipr_gist_scan_last_page = page;
+		c->pages++;
+	}
+
+	c->calls++;
+	if (match)
+	{
+		c->matches++;
+		if (recheck)
+			c->rechecks++;
+	}
+}
+
+PG_FUNCTION_INFO_V1(ip_gist_scan_stats);
+Datum
+ip_gist_scan_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	int i, j, k;
+
+	ipr_materialize_init(fcinfo);
+
+	for (i = 0; i < IPR_GIST_NOPCLASSES; ++i)
+		for (j = 0; j < IPR_GIST_NSTRATEGIES; ++j)
+			for (k = 0; k < 2; ++k)
+			{
+				IPR_GistScanCounters *c = &ipr_gist_scans[i][j][k];
+				Datum values[8];
+				bool nulls[8] = { false, false, false, false, false, false, false, false };
+
+				if (c->calls == 0)
+					continue;
+
+				values[0] = CStringGetTextDatum(ipr_gist_opclass_names[i]);
+				values[1] = Int16GetDatum(j + 1);
+				values[2] = CStringGetTextDatum(ipr_gist_strategy_names[j]);
+				values[3] = BoolGetDatum(k != 0);
+				values[4] = Int64GetDatum(c->pages);
+				values[5] = Int64GetDatum(c->calls);
+				values[6] = Int64GetDatum(c->matches);
+				values[7] = Int64GetDatum(c->rechecks);
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+			}
+
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(ip_gist_scan_stats_reset);
+Datum
+ip_gist_scan_stats_reset(PG_FUNCTION_ARGS)
+{
+	memset(ipr_gist_scans, 0, sizeof(ipr_gist_scans));
+	ipr_gist_scan_last_page = NULL;
+
+	PG_RETURN_VOID();
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+ipr_stats_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(IPR_StatShared)));
+}
+#endif
+
+static void
+ipr_stats_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ipr_stats_shared = ShmemInitStruct("ip4r stats", sizeof(IPR_StatShared), &found);
+	if (!found)
+	{
+		memset(ipr_stats_shared->counters, 0, sizeof(ipr_stats_shared->counters));
+		SpinLockInit(&ipr_stats_shared->mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Called from _PG_init. The settings are defined however the library is
+ * loaded, so they can be set in postgresql.conf either way, but the call
+ * counts are only kept when there is shared memory to keep them in.
+ */
+void
+ipr_stats_init(void)
+{
+	DefineCustomBoolVariable("ip4r.track_stats",
+							 "Collects call statistics for ip4r functions.",
+							 "Requires ip4r in shared_preload_libraries.",
+							 &ipr_track_stats,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ip4r.stats_timing_sample",
+							"Times one in this many counted calls.",
+							"Zero disables timing.",
+							&ipr_stats_timing_sample,
+							100,
+							0, INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("ip4r.track_gist_scans",
+							 "Counts gist consistent calls in this session.",
+							 "See ip_gist_scan_stats().",
+							 &ipr_track_gist_scans,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("ip4r");
+#else
+	EmitWarningsOnPlaceholders("ip4r");
+#endif
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = ipr_stats_shmem_request;
+#else
+	RequestAddinShmemSpace(MAXALIGN(sizeof(IPR_StatShared)));
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ipr_stats_shmem_startup;
+
+	RegisterXactCallback(ipr_stats_xact_callback, NULL);
+}
+
+/* end */
@@ -0,0 +1,169 @@
+/* numeric_io.c */
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "utils/numeric.h"
+
+#include "ipr_internal.h"
+
+/*
+ * Conversions between numeric and 128-bit (or slightly wider) unsigned
+ * integers, building or decoding the numeric digit array directly rather
+ * than going through numeric arithmetic, which allocates a new value for
+ * every intermediate step.
+ *
+ * The layout used here is the on-disk format of numeric, which is not
+ * exposed by numeric.h but which can't change without breaking
+ * pg_upgrade, so it's safe to rely on. Values are base-10000 digits (int16)
+ * preceded by either a 2-byte "short" header (which is what we always
+ * produce, since it's what the core code produces for any value we could
+ * generate) or a 4-byte "long" header (sign+dscale, weight).
+ */
+
+#define IPR_NBASE 10000
+
+#define IPR_NUMERIC_SIGN_MASK	0xC000
+#define IPR_NUMERIC_NEG			0x4000
+#define IPR_NUMERIC_SHORT		0x8000
+#define IPR_NUMERIC_SPECIAL		0xC000
+
+#define IPR_NUMERIC_SHORT_SIGN_MASK			0x2000
+#define IPR_NUMERIC_SHORT_WEIGHT_SIGN_MASK	0x0040
+#define IPR_NUMERIC_SHORT_WEIGHT_MASK		0x003F
+
+/* 2^130 < 10000^10, which is plenty */
+#define IPR_NUMERIC_MAX_DIGITS 10
+
+/*
+ * Value is extra * 2^128 + hi * 2^64 + lo. The only caller needing "extra"
+ * is the size of the universal iprange, which is 2^129.
+ */
+Numeric
+ipr_make_numeric(uint64 hi, uint64 lo, uint32 extra, bool negative)
+{
+	uint32 w[5];
+	int16 digits[IPR_NUMERIC_MAX_DIGITS];
+	int ndigits = 0;
+	int weight;
+	int nz;
+	int i;
+	Numeric res;
+	uint16 *p;
+
+	w[0] = extra;
+	w[1] = (uint32)(hi >> 32);
+	w[2] = (uint32)hi;
+	w[3] = (uint32)(lo >> 32);
+	w[4] = (uint32)lo;
+
+	/* extract base-NBASE digits, least significant first */
+	for (nz = 0; nz < 5 && w[nz] == 0; ++nz)
+		;
+	while (nz < 5)
+	{
+		uint64 rem = 0;
+
+		for (i = nz; i < 5; ++i)
+		{
+			uint64 cur = (rem << 32) | w[i];
+			w[i] = (uint32)(cur / IPR_NBASE);
+			rem = cur % IPR_NBASE;
+		}
+		digits[ndigits++] = (int16) rem;
+		while (nz < 5 && w[nz] == 0)
+			++nz;
+	}
+
+	/* the core code never stores trailing zero digits, so neither do we */
+	weight = ndigits - 1;
+	for (nz = 0; nz < ndigits && digits[nz] == 0; ++nz)
+		;
+
+	res = palloc(VARHDRSZ + sizeof(uint16) + (ndigits - nz) * sizeof(int16));
+	SET_VARSIZE(res, VARHDRSZ + sizeof(uint16) + (ndigits - nz) * sizeof(int16));
+
+	p = (uint16 *) VARDATA(res);
+	if (ndigits == 0)
+		*p++ = IPR_NUMERIC_SHORT;
+	else
+		*p++ = (IPR_NUMERIC_SHORT
+				| (negative ? IPR_NUMERIC_SHORT_SIGN_MASK : 0)
+				| (weight & IPR_NUMERIC_SHORT_WEIGHT_MASK));
+
+	for (i = ndigits - 1; i >= nz; --i)
+		*p++ = (uint16) digits[i];
+
+	return res;
+}
+
+/*
+ * Decode a numeric value as a 128-bit unsigned magnitude and a sign.
+ * Returns IPR_NUMERIC_INVALID for NaN, infinities and non-integers (leaving
+ * *negative untouched), and IPR_NUMERIC_OVERFLOW if the magnitude doesn't
+ * fit (but *negative is still set). Zero is never reported as negative.
+ */
+int
+ipr_decode_numeric(Numeric num, uint64 *hi, uint64 *lo, bool *negative)
+{
+	uint16 *p = (uint16 *) VARDATA(num);
+	uint16 header = *p;
+	int16 *digits;
+	int ndigits;
+	int weight;
+	bool neg;
+	uint32 w[4] = { 0, 0, 0, 0 };
+	int i;
+
+	if ((header & IPR_NUMERIC_SIGN_MASK) == IPR_NUMERIC_SPECIAL)
+		return IPR_NUMERIC_INVALID;
+
+	if (header & IPR_NUMERIC_SHORT)
+	{
+		neg = (header & IPR_NUMERIC_SHORT_SIGN_MASK) != 0;
+		weight = (header & IPR_NUMERIC_SHORT_WEIGHT_MASK);
+		if (header & IPR_NUMERIC_SHORT_WEIGHT_SIGN_MASK)
+			weight |= ~IPR_NUMERIC_SHORT_WEIGHT_MASK;
+		digits = (int16 *) (p + 1);
+		ndigits = (VARSIZE(num) - VARHDRSZ - sizeof(uint16)) / sizeof(int16);
+	}
+	else
+	{
+		neg = (header & IPR_NUMERIC_SIGN_MASK) == IPR_NUMERIC_NEG;
+		weight = ((int16 *) p)[1];
+		digits = (int16 *) (p + 2);
+		ndigits = (VARSIZE(num) - VARHDRSZ - 2*sizeof(uint16)) / sizeof(int16);
+	}
+
+	/* any nonzero digit past the decimal point makes it a non-integer */
+	for (i = (weight < -1) ? 0 : weight + 1; i < ndigits; ++i)
+		if (digits[i] != 0)
+			return IPR_NUMERIC_INVALID;
+
+	/* accumulate the integer part, including any implied trailing zeros */
+	for (i = 0; i <= weight; ++i)
+	{
+		uint64 carry = (i < ndigits) ? (uint64) digits[i] : 0;
+		int j;
+
+		for (j = 3; j >= 0; --j)
+		{
+			uint64 cur = (uint64) w[j] * IPR_NBASE + carry;
+			w[j] = (uint32) cur;
+			carry = cur >> 32;
+		}
+		if (carry)
+		{
+			*negative = neg;
+			return IPR_NUMERIC_OVERFLOW;
+		}
+	}
+
+	*hi = ((uint64) w[0] << 32) | w[1];
+	*lo = ((uint64) w[2] << 32) | w[3];
+	*negative = neg && (*hi | *lo) != 0;
+
+	return IPR_NUMERIC_OK;
+}
+
+/* end */